@@ -0,0 +1,140 @@
+#include "dataio.hpp"
+#include "simulation_funshield.hpp"
+
+#include "../benchmark.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+
+namespace {
+	/**
+	 * Temporary file removed when the benchmark ends.
+	 */
+	class TemporaryFile
+	{
+	private:
+		std::string mPath;
+
+	public:
+		TemporaryFile(const std::string& name)
+			: mPath((std::filesystem::temp_directory_path() / ("moccarduino_benchmark_" + name)).string()) {}
+
+		~TemporaryFile()
+		{
+			std::remove(mPath.c_str());
+		}
+
+		const std::string& path() const
+		{
+			return mPath;
+		}
+	};
+
+	/**
+	 * Fill the LEDs and 7-seg columns with given number of events (in total).
+	 */
+	void fillLog(LogWriter& log, std::size_t size)
+	{
+		auto& leds = log.addSink<BitArray<4>>("leds");
+		auto& seg = log.addSink<BitArray<32>>("7seg");
+		for (std::size_t i = 0; i < size; ++i) {
+			logtime_t time = (logtime_t)i * 1000;
+			if (i % 3 == 0) {
+				BitArray<4> state;
+				state.set<std::uint8_t>((std::uint8_t)i, 0, 4);
+				leds.addEvent(time, state);
+			}
+			else {
+				BitArray<32> state;
+				state.set<std::uint32_t>((std::uint32_t)(i * 2654435761u));
+				seg.addEvent(time, state);
+			}
+		}
+		log.finish();
+	}
+}
+
+
+/**
+ * Writing the simulation log as CSV (the size is the number of logged events).
+ */
+class LogWriterCsvBenchmark : public MoccarduinoBenchmark
+{
+public:
+	LogWriterCsvBenchmark() : MoccarduinoBenchmark("dataio/log-writer-csv", { 10000, 100000, 1000000 }) {}
+
+	virtual void run(std::size_t size, BenchmarkTimer& timer) const
+	{
+		std::ostringstream sout;
+		timer.measure([&]() {
+			LogWriter log(sout);
+			fillLog(log, size);
+		});
+		doNotOptimize(sout.tellp());
+	}
+};
+
+
+/**
+ * Writing the simulation log in the binary format (the size is the number of logged events).
+ */
+class LogWriterBinaryBenchmark : public MoccarduinoBenchmark
+{
+public:
+	LogWriterBinaryBenchmark() : MoccarduinoBenchmark("dataio/log-writer-binary", { 10000, 100000, 1000000 }) {}
+
+	virtual void run(std::size_t size, BenchmarkTimer& timer) const
+	{
+		TemporaryFile file("log.bin");
+		timer.measure([&]() {
+			LogWriter log(file.path(), LogWriter::Format::BINARY);
+			fillLog(log, size);
+		});
+	}
+};
+
+
+/**
+ * Parsing of the input file with button clicks and serial data (the size is the number of lines).
+ */
+class InputLoaderBenchmark : public MoccarduinoBenchmark
+{
+public:
+	InputLoaderBenchmark() : MoccarduinoBenchmark("dataio/input-loader", { 10000, 100000, 1000000 }) {}
+
+	virtual void run(std::size_t size, BenchmarkTimer& timer) const
+	{
+		TemporaryFile file("input.in");
+		{
+			std::ofstream input(file.path(), std::ios::binary);
+			for (std::size_t i = 0; i < size; ++i) {
+				logtime_t time = (logtime_t)(i + 1) * 1000;
+				if (i % 10 == 9) {
+					input << time << " S value " << i << "\n";
+				}
+				else {
+					input << time << " " << (i / 2) % 3 + 1 << " " << ((i & 1) ? 'u' : 'd') << "\n";
+				}
+			}
+			input << (logtime_t)(size + 1) * 1000 << "\n";
+		}
+
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		FunshieldSimulationController funshield(simulation);
+
+		timer.measure([&]() {
+			InputEventsLoader loader(file.path(), funshield, {}, nullptr);
+			loader.loadEventsUntil((logtime_t)(size + 1) * 1000);
+			doNotOptimize(loader.getEndTime());
+		});
+	}
+};
+
+
+LogWriterCsvBenchmark _logWriterCsvBenchmark;
+LogWriterBinaryBenchmark _logWriterBinaryBenchmark;
+InputLoaderBenchmark _inputLoaderBenchmark;
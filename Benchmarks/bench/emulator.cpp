@@ -0,0 +1,61 @@
+#include "simulation.hpp"
+#include "simulation_funshield.hpp"
+#include "funshield.h"
+
+#include "../benchmark.hpp"
+
+#include <cstdint>
+
+class DigitalWriteBenchmark : public MoccarduinoBenchmark
+{
+public:
+	DigitalWriteBenchmark() : MoccarduinoBenchmark("emulator/digital-write", { 100000, 1000000, 10000000 }) {}
+
+	virtual void run(std::size_t size, BenchmarkTimer& timer) const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		simulation.registerPin(led1_pin, OUTPUT);
+		emulator.pinMode(led1_pin, OUTPUT);
+
+		timer.measure([&]() {
+			for (std::size_t i = 0; i < size; ++i) {
+				emulator.digitalWrite(led1_pin, (i & 1) ? HIGH : LOW);
+			}
+		});
+	}
+};
+
+
+/**
+ * One refresh of one digit of the 7-seg display (as funshield solutions do it), the size is the number of refreshes.
+ */
+class ShiftOutSegDisplayBenchmark : public MoccarduinoBenchmark
+{
+public:
+	ShiftOutSegDisplayBenchmark() : MoccarduinoBenchmark("emulator/shift-out-seg-display", { 10000, 100000, 1000000 }) {}
+
+	virtual void run(std::size_t size, BenchmarkTimer& timer) const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		FunshieldSimulationController funshield(simulation);
+		emulator.pinMode(latch_pin, OUTPUT);
+		emulator.pinMode(clock_pin, OUTPUT);
+		emulator.pinMode(data_pin, OUTPUT);
+
+		constexpr std::uint8_t glyphs[] = { 0xC0, 0xF9, 0xA4, 0xB0, 0x99, 0x92, 0x82, 0xF8, 0x80, 0x90 };
+		timer.measure([&]() {
+			for (std::size_t i = 0; i < size; ++i) {
+				emulator.digitalWrite(latch_pin, LOW);
+				emulator.shiftOut(data_pin, clock_pin, MSBFIRST, glyphs[i % 10]);
+				emulator.shiftOut(data_pin, clock_pin, MSBFIRST, (std::uint8_t)(1 << (i % 4)));
+				emulator.digitalWrite(latch_pin, HIGH);
+			}
+		});
+	}
+};
+
+
+DigitalWriteBenchmark _digitalWriteBenchmark;
+ShiftOutSegDisplayBenchmark _shiftOutSegDisplayBenchmark;
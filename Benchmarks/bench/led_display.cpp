@@ -0,0 +1,48 @@
+#include "led_display.hpp"
+#include "time_series.hpp"
+
+#include "../benchmark.hpp"
+
+#include <cstdint>
+
+/**
+ * Smoothing of 7-seg display events (multiplexed digits) by demultiplexer and aggregator, the size is the number of events.
+ */
+class DemuxerAggregatorBenchmark : public MoccarduinoBenchmark
+{
+public:
+	DemuxerAggregatorBenchmark() : MoccarduinoBenchmark("led-display/demuxer-aggregator", { 10000, 100000, 1000000 }) {}
+
+	virtual void run(std::size_t size, BenchmarkTimer& timer) const
+	{
+		// prepare multiplexed states, the displayed number changes every 1000 refreshes
+		std::vector<BitArray<32>> states;
+		for (std::size_t number = 0; number < 10; ++number) {
+			for (std::size_t digit = 0; digit < 4; ++digit) {
+				BitArray<32> state(true);
+				state.set<std::uint8_t>((std::uint8_t)~(1 << ((number + digit) % 8)), digit * 8);
+				states.push_back(state);
+			}
+		}
+
+		LedsEventsDemultiplexer<32> demuxer(10000);
+		LedsEventsAggregator<32> aggregator(50000);
+		TimeSeries<BitArray<32>> events;
+		demuxer.attachNextConsumer(aggregator);
+		aggregator.attachNextConsumer(events);
+
+		timer.measure([&]() {
+			logtime_t time = 0;
+			for (std::size_t i = 0; i < size; ++i) {
+				std::size_t number = (i / 1000) % 10;
+				demuxer.addEvent(time, states[number * 4 + i % 4]);
+				time += 300;
+			}
+			demuxer.advanceTime(time + 1000000);
+		});
+		doNotOptimize(events.size());
+	}
+};
+
+
+DemuxerAggregatorBenchmark _demuxerAggregatorBenchmark;
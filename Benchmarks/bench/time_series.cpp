@@ -0,0 +1,74 @@
+#include "time_series.hpp"
+#include "helpers.hpp"
+
+#include "../benchmark.hpp"
+
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * Insertion of future events in slightly shuffled order (like button bouncing) while the time advances.
+ */
+class FutureInsertionBenchmark : public MoccarduinoBenchmark
+{
+public:
+	FutureInsertionBenchmark() : MoccarduinoBenchmark("time-series/future-insertion", { 10000, 100000, 1000000 }) {}
+
+	virtual void run(std::size_t size, BenchmarkTimer& timer) const
+	{
+		std::mt19937 gen(42);
+		std::vector<logtime_t> times;
+		for (std::size_t i = 0; i < size; ++i) {
+			times.push_back((logtime_t)i * 1000 + gen() % 5000);
+		}
+
+		FutureTimeSeries<bool> series(false);
+		TimeSeries<bool> consumed;
+		series.attachNextConsumer(consumed);
+
+		timer.measure([&]() {
+			for (std::size_t i = 0; i < size; ++i) {
+				series.addFutureEvent(times[i], (i & 1) != 0);
+				if (i % 16 == 15) {
+					series.advanceTime((logtime_t)(i - 15) * 1000);
+				}
+			}
+			series.advanceTime((logtime_t)size * 1000 + 5000);
+		});
+		doNotOptimize(consumed.size());
+	}
+};
+
+
+FutureInsertionBenchmark _futureInsertionBenchmark;
+
+
+/**
+ * Recording of display states (the whole history is kept) with given storage of the series.
+ */
+template<typename STORAGE>
+class AppendBenchmark : public MoccarduinoBenchmark
+{
+public:
+	AppendBenchmark(const std::string& name) : MoccarduinoBenchmark(name, { 100000, 1000000, 10000000 }) {}
+
+	virtual void run(std::size_t size, BenchmarkTimer& timer) const
+	{
+		TimeSeries<BitArray<32>, logtime_t, STORAGE> series;
+		BitArray<32> state;
+
+		timer.measure([&]() {
+			for (std::size_t i = 0; i < size; ++i) {
+				state.setWord(0, (std::uint32_t)i);
+				series.addEvent((logtime_t)i * 100, state);
+			}
+		});
+		doNotOptimize(series.memoryUsage());
+	}
+};
+
+
+AppendBenchmark<VectorEventStorage<BitArray<32>>> _vectorAppendBenchmark("time-series/append-vector");
+AppendBenchmark<ChunkedEventStorage<BitArray<32>>> _chunkedAppendBenchmark("time-series/append-chunked");
+AppendBenchmark<ChunkedEventStorage<BitArray<32>, logtime_t, true>> _splitAppendBenchmark("time-series/append-split");
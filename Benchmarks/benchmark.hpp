@@ -0,0 +1,129 @@
+#ifndef MOCCARDUINO_BENCHMARKS_BENCHMARK_HPP
+#define MOCCARDUINO_BENCHMARKS_BENCHMARK_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+#include <cstdint>
+
+/**
+ * Measures the host time of the benchmarked section (preparation of the data is excluded).
+ */
+class BenchmarkTimer
+{
+private:
+	std::chrono::steady_clock::duration mElapsed;
+	bool mMeasured;
+
+public:
+	BenchmarkTimer() : mElapsed(0), mMeasured(false) {}
+
+	/**
+	 * Invoke the measured operation. It should be called exactly once per benchmark run.
+	 */
+	template<typename F>
+	void measure(F&& fnc)
+	{
+		auto start = std::chrono::steady_clock::now();
+		fnc();
+		mElapsed += std::chrono::steady_clock::now() - start;
+		mMeasured = true;
+	}
+
+	bool measured() const
+	{
+		return mMeasured;
+	}
+
+	/**
+	 * Measured time in nanoseconds.
+	 */
+	std::uint64_t elapsed() const
+	{
+		return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(mElapsed).count();
+	}
+};
+
+
+/**
+ * Prevent the compiler from optimizing away a computed value.
+ */
+template<typename T>
+inline void doNotOptimize(const T& value)
+{
+#ifdef __GNUC__
+	asm volatile("" : : "g"(&value) : "memory");
+#else
+	volatile T sink = value;
+	(void)sink;
+#endif
+}
+
+
+/**
+ * Base class for all benchmarks. Like the unit tests, benchmarks are registered by name in a global registry.
+ * Each benchmark is executed for all its sizes (number of processed items, e.g., pin writes or events).
+ */
+class MoccarduinoBenchmark
+{
+private:
+	typedef std::map<std::string, const MoccarduinoBenchmark*> registry_t;
+
+	/**
+	 * Global benchmark registry declared as static singleton.
+	 */
+	static registry_t& _getBenchmarks()
+	{
+		static registry_t benchmarks;
+		return benchmarks;
+	}
+
+protected:
+	/**
+	 * Name of the benchmark (should reflect the file and the local name like names of the unit tests).
+	 */
+	std::string mName;
+
+	/**
+	 * Realistic sizes (number of items) for which the benchmark is measured.
+	 */
+	std::vector<std::size_t> mSizes;
+
+public:
+	MoccarduinoBenchmark(const std::string& name, std::vector<std::size_t> sizes) : mName(name), mSizes(std::move(sizes))
+	{
+		registry_t& benchmarks = _getBenchmarks();
+		if (benchmarks.find(mName) != benchmarks.end())
+			throw std::runtime_error("Moccarduino benchmark named '" + name + "' is already registered!");
+
+		benchmarks[mName] = this;
+	}
+
+	virtual ~MoccarduinoBenchmark()
+	{
+		_getBenchmarks().erase(mName);
+	}
+
+	const std::vector<std::size_t>& getSizes() const
+	{
+		return mSizes;
+	}
+
+	/**
+	 * Prepare the data and process given number of items inside timer.measure().
+	 */
+	virtual void run(std::size_t size, BenchmarkTimer& timer) const = 0;
+
+	/**
+	 * A way to access (read-only) the list of registered benchmarks.
+	 */
+	static const std::map<std::string, const MoccarduinoBenchmark*>& getBenchmarks()
+	{
+		return _getBenchmarks();
+	}
+};
+
+
+#endif
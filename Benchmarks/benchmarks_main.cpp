@@ -0,0 +1,105 @@
+#include "benchmark.hpp"
+#include "args.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using benchmarks_t = const std::map<std::string, const MoccarduinoBenchmark*>;
+
+/**
+ * Check that given benchmark name matches one of the filters (substrings), empty list accepts everything.
+ */
+bool onList(const std::string& name, const bpp::ProgramArguments& args)
+{
+	if (args.namelessCount() == 0) return true;
+	for (std::size_t i = 0; i < args.namelessCount(); ++i) {
+		if (name.find(args[i]) != std::string::npos) return true;
+	}
+	return false;
+}
+
+/**
+ * Run one benchmark for given size repeatedly and write the result as a JSON object.
+ */
+void runBenchmark(const std::string& name, const MoccarduinoBenchmark& benchmark, std::size_t size, std::size_t repetitions, std::ostream& out)
+{
+	std::vector<std::uint64_t> times;
+	for (std::size_t r = 0; r < repetitions; ++r) {
+		BenchmarkTimer timer;
+		benchmark.run(size, timer);
+		if (!timer.measured()) {
+			throw std::runtime_error("Benchmark " + name + " did not measure anything.");
+		}
+		times.push_back(timer.elapsed());
+	}
+
+	std::sort(times.begin(), times.end());
+	std::uint64_t total = 0;
+	for (auto t : times) {
+		total += t;
+	}
+	std::uint64_t median = times[times.size() / 2];
+	double itemsPerSecond = median > 0 ? (double)size * 1e9 / (double)median : 0.0;
+
+	out << "{\"name\":\"" << name << "\",\"size\":" << size << ",\"repetitions\":" << repetitions
+		<< ",\"min_ns\":" << times.front() << ",\"median_ns\":" << median << ",\"mean_ns\":" << total / times.size()
+		<< ",\"max_ns\":" << times.back() << ",\"items_per_second\":" << (std::uint64_t)itemsPerSecond << "}";
+}
+
+int main(int argc, char* argv[])
+{
+	bpp::ProgramArguments args;
+
+	try {
+		args.setNamelessCaption(0, "Filters, only benchmarks whose names contain one of the given substrings are executed.");
+		args.registerArg<bpp::ProgramArguments::ArgInt>("repetitions", "How many times each benchmark is repeated (the median time is reported).", false, 5, 1);
+		args.registerArg<bpp::ProgramArguments::ArgInt>("scale", "Divisor of the benchmark sizes (for quick runs).", false, 1, 1);
+		args.registerArg<bpp::ProgramArguments::ArgString>("output", "Path to the JSON file with results (stdout is used by default).", false, "");
+		args.process(argc, argv);
+	}
+	catch (bpp::ArgumentException& e) {
+		std::cout << "Invalid arguments: " << e.what() << std::endl << std::endl;
+		args.printUsage(std::cout);
+		return 100;
+	}
+
+	try {
+		std::ofstream file;
+		if (args.getArgString("output").isPresent()) {
+			file.open(args.getArgString("output").getValue());
+			if (!file.is_open()) {
+				throw std::runtime_error("Unable to open output file " + args.getArgString("output").getValue());
+			}
+		}
+		std::ostream& out = file.is_open() ? file : std::cout;
+
+		auto repetitions = (std::size_t)args.getArgInt("repetitions").getValue();
+		auto scale = (std::size_t)args.getArgInt("scale").getValue();
+
+		out << "{\"benchmarks\":[";
+		bool first = true;
+		benchmarks_t& benchmarks = MoccarduinoBenchmark::getBenchmarks();
+		for (auto const& [name, benchmark] : benchmarks) {
+			if (!onList(name, args)) continue;
+
+			for (std::size_t size : benchmark->getSizes()) {
+				size = std::max<std::size_t>(size / scale, 1);
+				std::cerr << "BENCHMARK: " << name << " (" << size << ") ..." << std::endl;
+				out << (first ? "\n" : ",\n");
+				runBenchmark(name, *benchmark, size, repetitions, out);
+				first = false;
+			}
+		}
+		out << "\n]}" << std::endl;
+	}
+	catch (std::exception& e) {
+		std::cerr << "Uncaught exception: " << e.what() << std::endl;
+		return 2;
+	}
+
+	return 0;
+}
@@ -1,166 +1,405 @@
 #include "dataio.hpp"
 
+#include <algorithm>
+#include <charconv>
+#include <cctype>
 #include <limits>
+#include <queue>
+#include <vector>
+#include <functional>
+#include <cstdio>
 
 
-logtime_t loadInputData(std::istream& sin, FunshieldSimulationController& funshield,
-    std::vector<std::shared_ptr<TimeSeries<bool>>>& buttonEvents, std::shared_ptr<TimeSeries<std::string>> serialEvents)
+InputEventsLoader::InputEventsLoader(const std::string& fileName, FunshieldSimulationController& funshield,
+    std::vector<EventConsumer<bool>*> buttonEvents, EventConsumer<std::string>* serialEvents, std::size_t chunkSize)
+    : mInput(fileName == "-" ? std::cin : mFile), mBuffer(std::max<std::size_t>(chunkSize, 1)), mBufferBegin(0), mBufferEnd(0),
+    mLineCount(0), mFunshield(funshield), mButtonEvents(std::move(buttonEvents)), mSerialEvents(serialEvents),
+    mStartTime(funshield.getArduino().getCurrentTime()), mLastTime(0), mButtonStates{ false, false, false },
+    mHasNext(false), mHasEndTime(false), mEndTime(0)
 {
-    std::string line;
-    std::size_t lineCount = 0;
-    logtime_t lastTime = 0;
-    bool buttonStates[] = { false, false, false };
+    if (fileName != "-") {
+        mFile.open(fileName, std::ios::binary);
+        if (!mFile.is_open()) {
+            throw std::runtime_error("Failed to open input file " + fileName);
+        }
+    }
 
-    while (std::getline(sin, line)) {
-        ++lineCount;
-        if (line.empty()) continue;
+    parseNext();
+    advanceEventLogs();
+}
+
+bool InputEventsLoader::nextLine(std::string_view& line)
+{
+    while (true) {
+        const char* begin = mBuffer.data() + mBufferBegin;
+        const char* end = mBuffer.data() + mBufferEnd;
+        const char* newline = std::find(begin, end, '\n');
+        if (newline != end) {
+            line = std::string_view(begin, newline - begin);
+            mBufferBegin += line.size() + 1;
+            return true;
+        }
+
+        if (!mInput) {
+            // the input is depleted, the rest of the buffer is the last line (without newline)
+            line = std::string_view(begin, end - begin);
+            mBufferBegin = mBufferEnd;
+            return !line.empty();
+        }
+
+        // move the incomplete line to the front and load another chunk after it
+        std::copy(begin, end, mBuffer.data());
+        mBufferEnd -= mBufferBegin;
+        mBufferBegin = 0;
+        if (mBufferEnd == mBuffer.size()) {
+            mBuffer.resize(mBuffer.size() * 2); // the line does not fit
+        }
+        mInput.read(mBuffer.data() + mBufferEnd, mBuffer.size() - mBufferEnd);
+        mBufferEnd += (std::size_t)mInput.gcount();
+    }
+}
+
+void InputEventsLoader::parseNext()
+{
+    mHasNext = false;
+    std::string_view line;
+    while (!mHasEndTime && nextLine(line)) {
+        ++mLineCount;
+
+        const char* pos = line.data();
+        const char* end = pos + line.size();
+        auto skipSpaces = [&]() {
+            while (pos < end && std::isspace((unsigned char)*pos)) ++pos;
+        };
+
+        skipSpaces();
+        if (pos == end) continue;
 
         // parse the line
         logtime_t time = 0;
-        char actionType = '\0';
-        char newState = '\0';
-        std::stringstream ss(line);
-        ss >> time >> actionType >> newState;
+        auto [ptr, ec] = std::from_chars(pos, end, time);
+        if (ec != std::errc()) {
+            throw std::runtime_error("Invalid timestamp found at line " + std::to_string(mLineCount));
+        }
+        pos = ptr;
+        skipSpaces();
+        char actionType = pos < end ? *pos++ : '\0';
+        skipSpaces();
+        const char* statePos = pos;
+        char newState = pos < end ? *pos++ : '\0';
 
-        if (time < lastTime) {
-            throw std::runtime_error("Timestamps are not ordered on line " + std::to_string(lineCount)
-                + ". Timestamp " + std::to_string(time) + " is lower than the previous " + std::to_string(lastTime) + ".");
+        if (time < mLastTime) {
+            throw std::runtime_error("Timestamps are not ordered on line " + std::to_string(mLineCount)
+                + ". Timestamp " + std::to_string(time) + " is lower than the previous " + std::to_string(mLastTime) + ".");
         }
-        lastTime = time;
+        mLastTime = time;
 
         if (actionType == '\0') {
-            return lastTime; // the timestamp had no additional arguments, it must have been the last marker
+            // the timestamp had no additional arguments, it must have been the last marker
+            mHasEndTime = true;
+            mEndTime = mLastTime;
+            return;
         }
 
+        if (time < mStartTime) {
+            throw std::runtime_error("Event on line " + std::to_string(mLineCount) + " at " + std::to_string(time)
+                + " precedes the current simulation time " + std::to_string(mStartTime) + " (input is loaded after setup).");
+        }
 
         if (actionType == 'S') {
-            // serial input
-            std::string serialInput;
-            if (newState != '\0') {
-                std::getline(ss, serialInput, '\0');
-                serialInput = newState + serialInput;
-
-                // trim whitespace at the end (may be \r or extra trailing spaces)
-                serialInput.erase(std::find_if(serialInput.rbegin(), serialInput.rend(), [](unsigned char ch) {
-                    return !std::isspace(ch);
-                }).base(), serialInput.end());
-            }
+            // serial input (the rest of the line with trailing whitespace trimmed, it may be \r or extra spaces)
+            while (end > statePos && std::isspace((unsigned char)end[-1])) --end;
+            mNext.time = time;
+            mNext.button = -1;
+            mNext.serialInput.assign(statePos, end);
+            mHasNext = true;
+            return;
+        }
 
-            funshield.getArduino().enqueueSerialInputEvent(serialInput, time);
+        /*
+         * Handle button actions.
+         */
 
-            if (serialEvents) {
-                serialEvents->addEvent(time, serialInput);
-            }
+        if (actionType < '1' || actionType > '3' || (newState != 'u' && newState != 'd')) {
+            throw std::runtime_error("Invalid operation (button #" + std::to_string(actionType) + " action " + newState
+                + ") found at line " + std::to_string(mLineCount));
         }
-        else {
-            /*
-             * Handle button actions.
-             */
+        int button = (int)actionType - (int)'1'; // normalize to 0-based int
 
-            if (actionType < '1' || actionType > '3' || (newState != 'u' && newState != 'd')) {
-                throw std::runtime_error("Invalid operation (button #" + std::to_string(actionType) + " action " + newState
-                    + ") found at line " + std::to_string(lineCount));
-            }
-            int button = (int)actionType - (int)'1'; // normalize to 0-based int
+        bool newButtonState = newState == 'd'; // down = true
+        if (mButtonStates[button] == newButtonState) {
+            continue; // no change in state
+        }
+        mButtonStates[button] = newButtonState;
 
-            bool newButtonState = newState == 'd'; // down = true
-            if (buttonStates[button] == newButtonState) {
-                continue; // no change in state
-            }
-            buttonStates[button] = newButtonState;
+        mNext.time = time;
+        mNext.button = button;
+        mNext.down = newButtonState;
+        mHasNext = true;
+        return;
+    }
+
+    if (!mHasEndTime) {
+        mHasEndTime = true;
+        mEndTime = mLastTime + 100000; // add 100ms after last button event
+    }
+}
+
+void InputEventsLoader::advanceEventLogs()
+{
+    logtime_t time = nextEventTime();
+    for (auto events : mButtonEvents) {
+        events->advanceTime(time);
+    }
+    if (mSerialEvents) {
+        mSerialEvents->advanceTime(time);
+    }
+}
+
+logtime_t InputEventsLoader::nextEventTime() const
+{
+    return mHasNext ? mNext.time : EventConsumer<bool>::NO_DEADLINE;
+}
 
+void InputEventsLoader::loadEventsUntil(logtime_t time)
+{
+    while (mHasNext && mNext.time <= time) {
+        if (mNext.button < 0) {
+            mFunshield.getArduino().enqueueSerialInputEventAt(mNext.serialInput, mNext.time);
+            if (mSerialEvents) {
+                mSerialEvents->addEvent(mNext.time, mNext.serialInput);
+            }
+        }
+        else {
             // enqueue the event into funshield emulator
-            if (newButtonState) {
-                funshield.buttonDown(button, time);
+            if (mNext.down) {
+                mFunshield.buttonDownAt(mNext.button, mNext.time);
             }
             else {
-                funshield.buttonUp(button, time);
+                mFunshield.buttonUpAt(mNext.button, mNext.time);
             }
 
             // record it for the output events
-            if (button < (int)buttonEvents.size()) {
-                buttonEvents[button]->addEvent(time, newButtonState);
+            if (mNext.button < (int)mButtonEvents.size()) {
+                mButtonEvents[mNext.button]->addEvent(mNext.time, mNext.down);
             }
-
         }
+        parseNext();
+    }
+    advanceEventLogs();
+}
 
+RandomInputGenerator::RandomInputGenerator(FunshieldSimulationController& funshield, std::uint64_t seed, logtime_t endTime, const Config& config)
+    : mFunshield(funshield), mConfig(config), mEndTime(endTime), mRandom(seed),
+    mBusyUntil(funshield.getButtonsCount(), funshield.getArduino().getCurrentTime()), mPatternsCount(0)
+{
+    if (mConfig.minClick > mConfig.maxClick || mConfig.minHold > mConfig.maxHold) {
+        throw std::runtime_error("Invalid durations of the generated button patterns.");
+    }
+    if (mConfig.bouncingDelay * 10 > mConfig.minClick) {
+        throw std::runtime_error("Bouncing delay is too long for the shortest click (all bounces must fit in it).");
     }
+    planNext(funshield.getArduino().getCurrentTime());
+}
 
-    return lastTime + 100000; // add 100ms after last button event
+void RandomInputGenerator::planNext(logtime_t after)
+{
+    logtime_t start = after + uniform(1, std::max<logtime_t>(mConfig.maxGap, 1));
+    mNextStart = start < mEndTime ? start : EventConsumer<bool>::NO_DEADLINE;
 }
 
-/**
- * Helper structure that holds series of events with current index to the first unprocessed event and its timestamp.
- */
-struct SeriesWrapper
+void RandomInputGenerator::generatePattern()
 {
-	std::size_t index;
-	logtime_t time;
-	std::shared_ptr<TimeSeriesBase<>> events;
+    // a busy button is not pressed again until its previous pattern ends
+    std::size_t button = (std::size_t)uniform(0, mBusyUntil.size() - 1);
+    logtime_t start = std::max(mNextStart, mBusyUntil[button]);
+
+    auto pattern = (Pattern)uniform(0, mConfig.bouncingDelay > 0 ? 2 : 1);
+    logtime_t duration = pattern == Pattern::HOLD
+        ? uniform(mConfig.minHold, mConfig.maxHold) : uniform(mConfig.minClick, mConfig.maxClick);
+    bool bouncing = pattern == Pattern::BOUNCE;
 
-	SeriesWrapper(std::shared_ptr<TimeSeriesBase<>> _events)
-		: index(0), time(_events->empty() ? std::numeric_limits<logtime_t>::max() : _events->getEventTime(0)), events(_events)
-	{}
+    logtime_t funshieldBouncingDelay = mFunshield.getButtonBouncingDelay();
+    mFunshield.setButtonBouncingDelay(mConfig.bouncingDelay);
+    mFunshield.buttonDownAt(button, start, bouncing);
+    mFunshield.buttonUpAt(button, start + duration, bouncing);
+    mFunshield.setButtonBouncingDelay(funshieldBouncingDelay);
 
-	void advanceIndex()
-	{
-		++index;
-		if (index < events->size()) {
-			time = events->getEventTime(index);
-		}
-		else {
-			time = std::numeric_limits<logtime_t>::max();
-		}
-	}
+    mBusyUntil[button] = start + duration + (bouncing ? 6 * mConfig.bouncingDelay : 0) + 1;
+    ++mPatternsCount;
+    planNext(start);
+}
 
-	bool isDone() const
-	{
-        return index >= events->size();
-	}
-};
+logtime_t RandomInputGenerator::nextEventTime() const
+{
+    return mNextStart;
+}
 
+void RandomInputGenerator::loadEventsUntil(logtime_t time)
+{
+    while (mNextStart <= time) {
+        generatePattern();
+    }
+}
 
-bool allDone(const std::vector<SeriesWrapper>& series)
+LogWriter::LogWriter(const std::string& fileName, Format format, char delimiter)
+    : mFile(fileName, std::ios::binary), mFileName(fileName), mOutput(mFile), mFormat(format), mDelimiter(delimiter),
+    mStreaming(format == Format::CSV), mHeaderWritten(false), mFinished(false), mPendingEvents(0), mFlushThreshold(4096), mWatermarkPeriod(100000),
+    mPeakMemoryUsage(0)
 {
-    for (auto& s : series) {
-        if (!s.isDone()) return false;
+    if (!mFile.is_open()) {
+        throw std::runtime_error("Unable to open output file " + fileName);
     }
-    return true;
 }
 
+LogWriter::LogWriter(std::ostream& sout, char delimiter)
+    : mOutput(sout), mFormat(Format::CSV), mDelimiter(delimiter), mStreaming(false),
+    mHeaderWritten(false), mFinished(false), mPendingEvents(0), mFlushThreshold(4096), mWatermarkPeriod(100000),
+    mPeakMemoryUsage(0)
+{}
 
-logtime_t getMinTimestamp(const std::vector<SeriesWrapper>& series)
+LogWriter::~LogWriter()
 {
-    logtime_t t = std::numeric_limits<logtime_t>::max();
-    for (auto& s : series) {
-        t = std::min(t, s.time);
+    if (mFile.is_open() && !mFinished) {
+        // incomplete log (the simulation has failed) is removed
+        mFile.close();
+        std::remove(mFileName.c_str());
     }
-    return t;
 }
 
+void LogWriter::addColumn(const std::string& name, std::unique_ptr<Column>&& column)
+{
+    if (mHeaderWritten) {
+        throw std::runtime_error("Column " + name + " cannot be added after the log writing has started.");
+    }
+    if (mColumns.find(name) != mColumns.end()) {
+        throw std::runtime_error("Column " + name + " is already present in the log.");
+    }
+    mColumns[name] = std::move(column);
+}
+
+void LogWriter::updatePeakMemoryUsage()
+{
+    mPeakMemoryUsage = std::max(mPeakMemoryUsage, memoryUsage());
+}
 
-void printEvents(std::ostream& sout, const std::map<std::string, std::shared_ptr<TimeSeriesBase<>>>& events, char delimiter)
+void LogWriter::writeHeader()
 {
-    // print header and prepare series wrappers
-	std::vector<SeriesWrapper> series;
-    sout << "timestamp";
-    for (auto const& it : events) {
-        sout << delimiter << it.first;
-        series.emplace_back(it.second);
+    if (mHeaderWritten) return;
+
+    mOutput << "timestamp";
+    for (auto const& it : mColumns) {
+        mOutput << mDelimiter << it.first;
+    }
+    mOutput << "\n";
+    mHeaderWritten = true;
+}
+
+void LogWriter::writeRows(logtime_t limit)
+{
+    std::vector<Column*> columns;
+    for (auto const& it : mColumns) {
+        columns.push_back(it.second.get());
+    }
+
+    // heap of columns with pending events ordered by the timestamp of their first event
+    using head_t = std::pair<logtime_t, std::size_t>;
+    std::priority_queue<head_t, std::vector<head_t>, std::greater<head_t>> heads;
+    for (std::size_t i = 0; i < columns.size(); ++i) {
+        if (!columns[i]->empty()) {
+            heads.emplace(columns[i]->headTime(), i);
+        }
     }
-    sout << "\n";
 
-    // process the time series one timestamp at a time
-    while (!allDone(series)) {
-        logtime_t ts = getMinTimestamp(series);
-        sout << ts;
-        for (auto& s : series) {
-            sout << delimiter;
-            if (!s.isDone() && s.time == ts) {
-                sout << s.events->getEventAsString(s.index);
-                s.advanceIndex();
+    // process the columns one timestamp at a time (each column contributes at most one event per row)
+    std::vector<bool> selected(columns.size(), false);
+    while (!heads.empty() && heads.top().first < limit) {
+        logtime_t ts = heads.top().first;
+        while (!heads.empty() && heads.top().first == ts) {
+            selected[heads.top().second] = true;
+            heads.pop();
+        }
+
+        mOutput << ts;
+        for (std::size_t i = 0; i < columns.size(); ++i) {
+            mOutput << mDelimiter;
+            if (selected[i]) {
+                selected[i] = false;
+                columns[i]->writeHead(mOutput);
+                if (!columns[i]->empty()) {
+                    heads.emplace(columns[i]->headTime(), i);
+                }
             }
         }
-        sout << "\n";
+        mOutput << "\n";
+    }
+}
+
+void LogWriter::writeBinary()
+{
+    constexpr std::size_t nameLength = 16;
+    constexpr std::uint64_t headerSize = 16;
+    constexpr std::uint64_t descriptorSize = nameLength + 32;
+
+    mOutput.write("MOCCBLOG", 8);
+    writeLittleEndian(mOutput, 1, 4); // version
+    writeLittleEndian(mOutput, mColumns.size(), 4);
+
+    // column descriptors (data are stored in the same order right after the descriptors)
+    std::uint64_t offset = headerSize + descriptorSize * mColumns.size();
+    for (auto const& it : mColumns) {
+        if (it.first.size() > nameLength) {
+            throw std::runtime_error("Column name " + it.first + " is too long for the binary log.");
+        }
+        char name[nameLength] = {};
+        it.first.copy(name, nameLength);
+        mOutput.write(name, nameLength);
+
+        it.second->writeBinaryDescriptor(mOutput, offset);
+        offset += it.second->binaryDataSize();
+    }
+
+    for (auto const& it : mColumns) {
+        it.second->writeBinaryData(mOutput);
+    }
+}
+
+std::size_t LogWriter::memoryUsage() const
+{
+    std::size_t res = 0;
+    for (auto const& it : mColumns) {
+        res += it.second->memoryUsage();
+    }
+    return res;
+}
+
+void LogWriter::flush()
+{
+    mPendingEvents = 0;
+    if (!mStreaming || mFinished) return;
+
+    updatePeakMemoryUsage();
+    logtime_t limit = std::numeric_limits<logtime_t>::max();
+    for (auto const& it : mColumns) {
+        limit = std::min(limit, it.second->watermark());
+    }
+
+    writeHeader();
+    writeRows(limit);
+}
+
+void LogWriter::finish()
+{
+    if (mFinished) return;
+
+    updatePeakMemoryUsage();
+    if (mFormat == Format::BINARY) {
+        writeBinary();
+    }
+    else {
+        writeHeader();
+        writeRows(std::numeric_limits<logtime_t>::max());
     }
+    mOutput.flush();
+    mFinished = true;
 }
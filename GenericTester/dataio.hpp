@@ -1,33 +1,671 @@
-#ifndef MOCCARDUINO_GENERIC_TESTER_OUTPUT_HPP
-#define MOCCARDUINO_GENERIC_TESTER_OUTPUT_HPP
-
-#include "time_series.hpp"
-#include "simulation_funshield.hpp"
-
-#include <iostream>
-#include <map>
-#include <string>
-#include <memory>
-
-/**
- * Load input text file (stream) with button events. Fill them into funshield emulator and record them in output time series.
- * @param sin input stream (the opened text file)
- * @param funshield the emulator being pre-loaded with button events
- * @param buttonEvents a vector of time series (one for each button), if the vector is empty, no events are recorded
- * @param serialEvents a time series holding input events for serial link (data transferred from host to Arduino)
- * @return duration of the emulation as loaded from the input stream
- */
-logtime_t loadInputData(std::istream& sin, FunshieldSimulationController& funshield,
-	std::vector<std::shared_ptr<TimeSeries<bool>>>& buttonEvents, std::shared_ptr<TimeSeries<std::string>> serialEvents);
-
-/**
- * Print out formatted CSV composed of multiple time series (collecting events).
- * First col of the CSV is always the `timestamp`
- * @param sout where the CSV is outputted
- * @param events map of time series, key in the map denotes name of the column
- * @param delimiter used for CSV separation
- */
-void printEvents(std::ostream& sout, const std::map<std::string, std::shared_ptr<TimeSeriesBase<>>>& events, char delimiter = ',');
-
-
-#endif
+#ifndef MOCCARDUINO_GENERIC_TESTER_OUTPUT_HPP
+#define MOCCARDUINO_GENERIC_TESTER_OUTPUT_HPP
+
+#include "time_series.hpp"
+#include "simulation_funshield.hpp"
+#include "helpers.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <deque>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <limits>
+#include <random>
+#include <cstdint>
+
+/**
+ * Streaming loader of the input text file with button and serial events. The file is read in fixed-size chunks
+ * and the events are parsed only when the simulation time approaches them, so the memory footprint does not
+ * depend on the length of the input. Each line holds '<timestamp> <action> [<state>|<serial data>]',
+ * the last line may hold only the timestamp (the end of the simulation).
+ * Timestamps in the file are absolute, so none of them may precede the simulation time when the loader is created.
+ */
+class InputEventsLoader : public InputEventsSource
+{
+private:
+	/**
+	 * One parsed event waiting to be loaded into the simulation.
+	 */
+	struct Event
+	{
+		logtime_t time = 0;
+		int button = -1;		///< zero-based button index, -1 for serial input
+		bool down = false;		///< new state of the button
+		std::string serialInput;
+	};
+
+	std::ifstream mFile;
+	std::istream& mInput;
+	std::vector<char> mBuffer;
+	std::size_t mBufferBegin;	///< position of the first unprocessed char in the buffer
+	std::size_t mBufferEnd;		///< end of the valid data in the buffer
+	std::size_t mLineCount;
+
+	FunshieldSimulationController& mFunshield;
+	std::vector<EventConsumer<bool>*> mButtonEvents;
+	EventConsumer<std::string>* mSerialEvents;
+
+	logtime_t mStartTime;
+	logtime_t mLastTime;
+	bool mButtonStates[3];
+
+	Event mNext;
+	bool mHasNext;
+	bool mHasEndTime;
+	logtime_t mEndTime;
+
+	/**
+	 * Get next line from the input (without the newline). The view is valid only until the next call.
+	 * @return false if the input was depleted
+	 */
+	bool nextLine(std::string_view& line);
+
+	/**
+	 * Parse the lines until the next event (or the end of the input) is found.
+	 */
+	void parseNext();
+
+	/**
+	 * Move the log series of the input events forward, so the log writer knows no older events will arrive.
+	 */
+	void advanceEventLogs();
+
+public:
+	/**
+	 * @param fileName path to the input file ("-" for stdin)
+	 * @param funshield the emulator being fed with button events
+	 * @param buttonEvents consumers recording button events (one for each button), if empty, no events are recorded
+	 * @param serialEvents consumer recording input events for serial link (data transferred from host to Arduino), may be null
+	 * @param chunkSize size of the input buffer (grows only if a single line does not fit)
+	 */
+	InputEventsLoader(const std::string& fileName, FunshieldSimulationController& funshield,
+		std::vector<EventConsumer<bool>*> buttonEvents, EventConsumer<std::string>* serialEvents,
+		std::size_t chunkSize = 64 * 1024);
+
+	logtime_t nextEventTime() const override;
+	void loadEventsUntil(logtime_t time) override;
+
+	/**
+	 * True if all events were loaded and the end of the simulation is known.
+	 */
+	bool hasEndTime() const
+	{
+		return mHasEndTime;
+	}
+
+	/**
+	 * Duration of the emulation as loaded from the input (the end marker, or 100ms after the last event).
+	 */
+	logtime_t getEndTime() const
+	{
+		return mEndTime;
+	}
+};
+
+
+/**
+ * Seeded generator of random button input (used by the fuzz mode instead of input files). The input is a sequence
+ * of patterns (clicks, long holds, and clicks with bouncing) of random buttons separated by random gaps. The patterns
+ * are generated lazily, as the simulation time approaches them, and enqueued directly into the funshield input buffers.
+ * The same seed always yields the same input (on all platforms), so a failing seed can be simulated again.
+ */
+class RandomInputGenerator : public InputEventsSource
+{
+public:
+	enum class Pattern { CLICK, HOLD, BOUNCE };
+
+	/**
+	 * Parameters of the generated input (all times in us).
+	 */
+	struct Config
+	{
+		logtime_t maxGap = 500000;			///< max. delay between the beginnings of two subsequent patterns
+		logtime_t minClick = 30000;			///< min. duration of a click
+		logtime_t maxClick = 300000;		///< max. duration of a click
+		logtime_t minHold = 1000000;		///< min. duration of a long hold
+		logtime_t maxHold = 3000000;		///< max. duration of a long hold
+		logtime_t bouncingDelay = 1000;		///< delay between two bounces (0 disables the bouncing patterns)
+	};
+
+private:
+	FunshieldSimulationController& mFunshield;
+	Config mConfig;
+	logtime_t mEndTime;
+
+	/**
+	 * Random engine with a standardized sequence (distributions of std library are implementation-defined).
+	 */
+	std::mt19937_64 mRandom;
+
+	logtime_t mNextStart;					///< time of the next pattern (NO_DEADLINE if there is none)
+	std::vector<logtime_t> mBusyUntil;		///< time when the last pattern of each button ends (including bounces)
+	std::size_t mPatternsCount;
+
+	/**
+	 * Random number from given closed interval.
+	 */
+	logtime_t uniform(logtime_t from, logtime_t to)
+	{
+		return from + (logtime_t)(mRandom() % (to - from + 1));
+	}
+
+	/**
+	 * Choose the beginning of the next pattern.
+	 */
+	void planNext(logtime_t after);
+
+	/**
+	 * Generate one pattern starting at mNextStart and enqueue its events.
+	 */
+	void generatePattern();
+
+public:
+	/**
+	 * @param funshield the emulator being fed with button events (the patterns start at its current time)
+	 * @param seed seed of the random engine
+	 * @param endTime no pattern starts at or after this time
+	 * @param config parameters of the generated patterns
+	 */
+	RandomInputGenerator(FunshieldSimulationController& funshield, std::uint64_t seed, logtime_t endTime, const Config& config);
+
+	logtime_t nextEventTime() const override;
+	void loadEventsUntil(logtime_t time) override;
+
+	/**
+	 * Number of patterns enqueued so far.
+	 */
+	std::size_t getPatternsCount() const
+	{
+		return mPatternsCount;
+	}
+};
+
+/**
+ * Write an unsigned value as little-endian sequence of given number of bytes.
+ */
+inline void writeLittleEndian(std::ostream& sout, std::uint64_t value, std::size_t bytes)
+{
+	char buffer[8];
+	for (std::size_t i = 0; i < bytes; ++i) {
+		buffer[i] = (char)(value & 0xff);
+		value >>= 8;
+	}
+	sout.write(buffer, bytes);
+}
+
+
+/**
+ * Type identifiers of the binary log columns.
+ */
+enum class LogValueType : std::uint32_t
+{
+	BOOL = 1,	///< one byte per value (0 or 1)
+	BITS = 2,	///< raw words of a bit array (little-endian, unused bits are zero)
+	STRING = 3,	///< u64 end offset of each string in the string blob that follows the values
+};
+
+
+/**
+ * Traits that define how values of given type are written into the log (CSV or binary).
+ */
+template<typename T>
+struct LogValueTraits;
+
+template<>
+struct LogValueTraits<bool>
+{
+	static constexpr LogValueType TYPE = LogValueType::BOOL;
+	static constexpr std::size_t SIZE = 1;
+	static constexpr std::size_t BITS = 0;
+
+	static void writeCsv(std::ostream& sout, bool value)
+	{
+		sout << (value ? '1' : '0');
+	}
+
+	static void writeBinary(std::ostream& sout, bool value)
+	{
+		sout.put(value ? 1 : 0);
+	}
+};
+
+template<int N>
+struct LogValueTraits<BitArray<N>>
+{
+	static constexpr LogValueType TYPE = LogValueType::BITS;
+	static constexpr std::size_t SIZE = sizeof(typename BitArray<N>::word_t) * BitArray<N>::WORDS;
+	static constexpr std::size_t BITS = N;
+
+	static void writeCsv(std::ostream& sout, const BitArray<N>& value)
+	{
+		char buffer[BitArray<N>::HEX_DIGITS];
+		value.writeHex(buffer);
+		sout.write(buffer, BitArray<N>::HEX_DIGITS);
+	}
+
+	static void writeBinary(std::ostream& sout, const BitArray<N>& value)
+	{
+		for (std::size_t i = 0; i < BitArray<N>::WORDS; ++i) {
+			writeLittleEndian(sout, value.getWord(i), sizeof(typename BitArray<N>::word_t));
+		}
+	}
+};
+
+template<>
+struct LogValueTraits<std::string>
+{
+	static constexpr LogValueType TYPE = LogValueType::STRING;
+	static constexpr std::size_t SIZE = 8;
+	static constexpr std::size_t BITS = 0;
+
+	static void writeCsv(std::ostream& sout, const std::string& value)
+	{
+		sout << '"';
+		for (char c : value) {
+			if (c == '"') sout << '"'; // prefix double quote with another (RFC 4180)
+			sout << c;
+		}
+		sout << '"';
+	}
+};
+
+
+/**
+ * Writer of the simulation log that merges multiple event columns.
+ * A column is either a complete time series (e.g., loaded input events) or a sink consumer attached
+ * at the end of an event chain.
+ *
+ * The CSV format merges the columns into rows ordered by timestamps. First col of the CSV is always
+ * the `timestamp`, the other columns are ordered by their names. When streaming into a file, rows are
+ * written as soon as all sinks have advanced past their timestamps, so the events are not kept
+ * in memory for the whole simulation.
+ *
+ * The binary format is columnar (see README), each column is stored as an array of u64 timestamps
+ * followed by an array of fixed-width values, so it can be memory-mapped by the reader.
+ */
+class LogWriter
+{
+public:
+	enum class Format { CSV, BINARY };
+
+	/**
+	 * Base class for all columns of the log (a queue of not yet written events).
+	 */
+	class Column
+	{
+	public:
+		virtual ~Column() = default;
+
+		/**
+		 * True if there are no pending events.
+		 */
+		virtual bool empty() const = 0;
+
+		/**
+		 * Timestamp of the first pending event.
+		 */
+		virtual logtime_t headTime() const = 0;
+
+		/**
+		 * Write the value of the first pending event (as CSV cell) and remove it.
+		 */
+		virtual void writeHead(std::ostream& sout) = 0;
+
+		/**
+		 * No more events earlier than this time will be added to the column.
+		 */
+		virtual logtime_t watermark() const = 0;
+
+		/**
+		 * Write the binary column descriptor (except for the name).
+		 * @param offset file offset where the column data will be written
+		 */
+		virtual void writeBinaryDescriptor(std::ostream& sout, std::uint64_t offset) const = 0;
+
+		/**
+		 * Size of the column data in binary format (including padding to 8B).
+		 */
+		virtual std::uint64_t binaryDataSize() const = 0;
+
+		/**
+		 * Write all pending events in binary format and remove them.
+		 */
+		virtual void writeBinaryData(std::ostream& sout) = 0;
+
+		/**
+		 * Bytes allocated for the events of the column (memory owned by string values is not included).
+		 */
+		virtual std::size_t memoryUsage() const = 0;
+	};
+
+	/**
+	 * Implementation of column operations for given value type.
+	 * Derived classes provide access to the pending events.
+	 */
+	template<typename VALUE>
+	class TypedColumn : public Column
+	{
+	private:
+		using traits_t = LogValueTraits<VALUE>;
+
+		std::uint64_t stringBlobSize() const
+		{
+			std::uint64_t size = 0;
+			if constexpr (traits_t::TYPE == LogValueType::STRING) {
+				for (std::size_t i = 0; i < pendingCount(); ++i) {
+					size += pendingValue(i).size();
+				}
+			}
+			return size;
+		}
+
+	protected:
+		virtual std::size_t pendingCount() const = 0;
+		virtual logtime_t pendingTime(std::size_t idx) const = 0;
+		virtual const VALUE& pendingValue(std::size_t idx) const = 0;
+		virtual void popPending(std::size_t count) = 0;
+
+	public:
+		bool empty() const override
+		{
+			return pendingCount() == 0;
+		}
+
+		logtime_t headTime() const override
+		{
+			return pendingTime(0);
+		}
+
+		void writeHead(std::ostream& sout) override
+		{
+			traits_t::writeCsv(sout, pendingValue(0));
+			popPending(1);
+		}
+
+		void writeBinaryDescriptor(std::ostream& sout, std::uint64_t offset) const override
+		{
+			writeLittleEndian(sout, (std::uint32_t)traits_t::TYPE, 4);
+			writeLittleEndian(sout, traits_t::SIZE, 4);
+			writeLittleEndian(sout, traits_t::BITS, 4);
+			writeLittleEndian(sout, 0, 4); // reserved
+			writeLittleEndian(sout, pendingCount(), 8);
+			writeLittleEndian(sout, offset, 8);
+		}
+
+		std::uint64_t binaryDataSize() const override
+		{
+			std::uint64_t size = (std::uint64_t)pendingCount() * (8 + traits_t::SIZE) + stringBlobSize();
+			return (size + 7) & ~(std::uint64_t)7;
+		}
+
+		void writeBinaryData(std::ostream& sout) override
+		{
+			std::size_t count = pendingCount();
+			for (std::size_t i = 0; i < count; ++i) {
+				writeLittleEndian(sout, pendingTime(i), 8);
+			}
+
+			if constexpr (traits_t::TYPE == LogValueType::STRING) {
+				std::uint64_t end = 0;
+				for (std::size_t i = 0; i < count; ++i) {
+					end += pendingValue(i).size();
+					writeLittleEndian(sout, end, 8);
+				}
+				for (std::size_t i = 0; i < count; ++i) {
+					sout.write(pendingValue(i).data(), pendingValue(i).size());
+				}
+			}
+			else {
+				for (std::size_t i = 0; i < count; ++i) {
+					traits_t::writeBinary(sout, pendingValue(i));
+				}
+			}
+
+			// padding
+			std::uint64_t size = (std::uint64_t)count * (8 + traits_t::SIZE) + stringBlobSize();
+			for (; (size & 7) != 0; ++size) {
+				sout.put(0);
+			}
+			popPending(count);
+		}
+	};
+
+	/**
+	 * Column holding a complete time series (all events are known in advance, the series must not be modified).
+	 */
+	template<typename VALUE>
+	class SeriesColumn : public TypedColumn<VALUE>
+	{
+	private:
+		std::shared_ptr<TimeSeries<VALUE>> mEvents;
+		std::size_t mIndex;
+
+	protected:
+		std::size_t pendingCount() const override
+		{
+			return mEvents->size() - mIndex;
+		}
+
+		logtime_t pendingTime(std::size_t idx) const override
+		{
+			return (*mEvents)[mIndex + idx].time;
+		}
+
+		const VALUE& pendingValue(std::size_t idx) const override
+		{
+			return (*mEvents)[mIndex + idx].value;
+		}
+
+		void popPending(std::size_t count) override
+		{
+			mIndex += count;
+		}
+
+	public:
+		SeriesColumn(std::shared_ptr<TimeSeries<VALUE>> events) : mEvents(std::move(events)), mIndex(0) {}
+
+		logtime_t watermark() const override
+		{
+			return std::numeric_limits<logtime_t>::max(); // no more events will come
+		}
+
+		std::size_t memoryUsage() const override
+		{
+			return mEvents->memoryUsage();
+		}
+	};
+
+	/**
+	 * Column that is fed by an event chain. Pending events are kept in chunks with times and values split
+	 * (the chunks of written events are reused), so the memory does not grow when the log is streamed.
+	 */
+	template<typename VALUE>
+	class Sink : public TypedColumn<VALUE>, public EventConsumer<VALUE>
+	{
+	private:
+		LogWriter& mWriter;
+		ChunkedEventStorage<VALUE, logtime_t, true> mEvents;
+
+	protected:
+		std::size_t pendingCount() const override
+		{
+			return mEvents.size();
+		}
+
+		logtime_t pendingTime(std::size_t idx) const override
+		{
+			return mEvents.time(idx);
+		}
+
+		const VALUE& pendingValue(std::size_t idx) const override
+		{
+			return mEvents.value(idx);
+		}
+
+		void popPending(std::size_t count) override
+		{
+			mEvents.eraseFront(count);
+		}
+
+		void doAddEvent(logtime_t time, VALUE value) override
+		{
+			mEvents.emplace_back(time, value);
+			EventConsumer<VALUE>::doAddEvent(time, value);
+			mWriter.eventAdded();
+		}
+
+		void doClear() override
+		{
+			mEvents.clear();
+			EventConsumer<VALUE>::doClear();
+		}
+
+		logtime_t doGetDeadline() const override
+		{
+			// periodic time advances keep the watermark moving, so the pending rows can be written
+			logtime_t deadline = mWriter.isStreaming() ? this->mLastTime + mWriter.getWatermarkPeriod() : EventConsumer<VALUE>::NO_DEADLINE;
+			return std::min(deadline, EventConsumer<VALUE>::doGetDeadline());
+		}
+
+	public:
+		Sink(LogWriter& writer) : mWriter(writer) {}
+
+		logtime_t watermark() const override
+		{
+			return this->mLastTime; // events at the very same time may still arrive
+		}
+
+		std::size_t memoryUsage() const override
+		{
+			return mEvents.memoryUsage();
+		}
+
+		/**
+		 * Preallocate space for given number of events.
+		 */
+		void reserve(std::size_t capacity)
+		{
+			mEvents.reserve(capacity);
+		}
+	};
+
+private:
+	std::ofstream mFile;
+	std::string mFileName;
+	std::ostream& mOutput;
+	Format mFormat;
+	char mDelimiter;
+	bool mStreaming;
+	bool mHeaderWritten;
+	bool mFinished;
+
+	std::map<std::string, std::unique_ptr<Column>> mColumns;
+
+	std::size_t mPendingEvents;		///< number of events added to sinks since the last flush
+	std::size_t mFlushThreshold;	///< how many events are accumulated before a flush is attempted
+	logtime_t mWatermarkPeriod;		///< how often (in logical time) are sinks advanced in the streaming mode
+	std::size_t mPeakMemoryUsage;	///< the largest memory usage observed before rows were written
+
+	void eventAdded()
+	{
+		if (mStreaming && ++mPendingEvents >= mFlushThreshold) {
+			flush();
+		}
+	}
+
+	void addColumn(const std::string& name, std::unique_ptr<Column>&& column);
+	void updatePeakMemoryUsage();
+	void writeHeader();
+	void writeRows(logtime_t limit);
+	void writeBinary();
+
+public:
+	/**
+	 * Create a writer that saves the log into a file. CSV logs are streamed (rows are written during the simulation),
+	 * binary logs are written when the simulation ends. If the writer is destroyed before finish() is called
+	 * (e.g., the simulation failed), the file is removed.
+	 */
+	LogWriter(const std::string& fileName, Format format = Format::CSV, char delimiter = ',');
+
+	/**
+	 * Create a writer that prints the whole CSV log into given stream when finish() is called.
+	 */
+	LogWriter(std::ostream& sout, char delimiter = ',');
+
+	~LogWriter();
+
+	bool isStreaming() const
+	{
+		return mStreaming;
+	}
+
+	logtime_t getWatermarkPeriod() const
+	{
+		return mWatermarkPeriod;
+	}
+
+	/**
+	 * True if no columns were added.
+	 */
+	bool empty() const
+	{
+		return mColumns.empty();
+	}
+
+	/**
+	 * Add a column holding complete series of events (it must not be modified afterwards).
+	 */
+	template<typename VALUE>
+	void addSeries(const std::string& name, std::shared_ptr<TimeSeries<VALUE>> events)
+	{
+		addColumn(name, std::make_unique<SeriesColumn<VALUE>>(std::move(events)));
+	}
+
+	/**
+	 * Add a column fed by an event consumer chain.
+	 * @param capacityHint expected number of events (e.g., derived from the length of the simulation), the space
+	 *                     is preallocated only if the log is not streamed (otherwise the events do not accumulate)
+	 * @return the sink consumer which should be attached at the end of the chain
+	 */
+	template<typename VALUE>
+	Sink<VALUE>& addSink(const std::string& name, std::size_t capacityHint = 0)
+	{
+		auto sink = std::make_unique<Sink<VALUE>>(*this);
+		if (!mStreaming) {
+			sink->reserve(capacityHint);
+		}
+		auto& res = *sink;
+		addColumn(name, std::move(sink));
+		return res;
+	}
+
+	/**
+	 * Bytes currently allocated for the events held by all columns.
+	 */
+	std::size_t memoryUsage() const;
+
+	/**
+	 * The largest memory usage of the columns observed so far (it is sampled whenever the rows are written).
+	 */
+	std::size_t peakMemoryUsage() const
+	{
+		return mPeakMemoryUsage;
+	}
+
+	/**
+	 * Write all rows that cannot be affected by future events (does nothing unless streaming).
+	 */
+	void flush();
+
+	/**
+	 * Write all remaining data (the simulation has ended).
+	 */
+	void finish();
+};
+
+
+#endif
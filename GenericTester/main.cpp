@@ -8,11 +8,23 @@
 #include "helpers.hpp"
 
 #include <map>
+#include <deque>
 #include <string>
 #include <vector>
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <functional>
+#include <cctype>
+
+#ifdef __unix__
+#include <cstdio>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <signal.h>
+#define FORK_SUPPORTED
+#endif
 
 #ifdef RECODEX
 #define CERR std::cout // only stdout is collected in ReCodEx
@@ -34,117 +46,606 @@ ArduinoEmulator& get_arduino_emulator_instance();
 
 using leds_state_t = FunshieldSimulationController::leds_display_t::state_t;
 using display_state_t = FunshieldSimulationController::seg_display_t::state_t;
-using output_events_t = std::map<std::string, std::shared_ptr<TimeSeriesBase<>>>;
+
+/**
+ * Smoothing of LED display events (demultiplexer followed by aggregator).
+ */
+template<int LEDS>
+using Smoothing = Pipeline<LedsEventsDemultiplexer<LEDS>, LedsEventsAggregator<LEDS>>;
 
 
 /**
- * Load button events from input file (or stdin), feed them to funshield, and prepare output events series for logging.
+ * Open the input file (or stdin) with button events, attach its loader to funshield, and add input events series into the log.
+ * The events are loaded lazily, as the simulation time approaches them.
+ * @param inputFile path to the input file, "-" for stdin, empty string if no input is loaded
+ * @return the loader (which must outlive the simulation), null if no input is loaded
  */
-logtime_t processInput(bpp::ProgramArguments &args, FunshieldSimulationController &funshield, output_events_t &outputEvents)
+std::unique_ptr<InputEventsLoader> processInput(bpp::ProgramArguments &args, const std::string& inputFile,
+    FunshieldSimulationController &funshield, LogWriter &log)
 {
-    std::vector<std::shared_ptr<TimeSeries<bool>>> buttonEvents;
+    std::vector<EventConsumer<bool>*> buttonEvents;
     if (args.getArgBool("log-buttons").getValue()) {
-        buttonEvents.emplace_back(std::make_shared<TimeSeries<bool>>());
-        buttonEvents.emplace_back(std::make_shared<TimeSeries<bool>>());
-        buttonEvents.emplace_back(std::make_shared<TimeSeries<bool>>());
+        buttonEvents.push_back(&log.addSink<bool>("b1"));
+        buttonEvents.push_back(&log.addSink<bool>("b2"));
+        buttonEvents.push_back(&log.addSink<bool>("b3"));
     }
-    std::shared_ptr<TimeSeries<std::string>> serialEvents;
+    EventConsumer<std::string>* serialEvents = nullptr;
     if (args.getArgBool("log-serial").getValue()) {
-        serialEvents = std::make_shared<TimeSeries<std::string>>();
+        serialEvents = &log.addSink<std::string>("serial");
     }
 
-    logtime_t simulationTime = 0;
+    if (inputFile.empty()) {
+        if (!args.getArgInt("simulation-length").isPresent()) {
+            throw std::runtime_error("Argument '--simulation-length' is required when no input file is given.");
+        }
+        return nullptr;
+    }
 
-    if (args.namelessCount() > 0) {
-        if (args[0] != "-") {
-            // load events from a file
-            std::ifstream sin(args[0], std::ios::binary);
-            if (!sin.is_open()) {
-                throw std::runtime_error("Failed to open input file " + args[0]);
-            }
-            simulationTime = loadInputData(sin, funshield, buttonEvents, serialEvents);
+    auto loader = std::make_unique<InputEventsLoader>(inputFile, funshield, buttonEvents, serialEvents);
+    funshield.getArduino().attachInputSource(loader.get());
+    return loader;
+}
+
+
+/**
+ * Estimate the number of events of a smoothed display log, so the memory may be reserved in advance.
+ * The aggregator emits at most one event per its window (plus the initial one).
+ * @param simulationLength length of the simulation [ms] (0 if not known)
+ * @param aggregatorWindow window of the aggregator [ms]
+ * @return 0 if the number is not known
+ */
+std::size_t displayLogCapacityHint(logtime_t simulationLength, logtime_t aggregatorWindow)
+{
+    constexpr std::size_t maxHint = 1 << 20; // the hint must not allocate excessive memory for unexpected inputs
+    if (simulationLength == 0 || aggregatorWindow == 0) {
+        return 0;
+    }
+    return std::min<std::size_t>(simulationLength / aggregatorWindow + 1, maxHint);
+}
+
+
+/**
+ * Add a log column fed by the broadcast of LED display states (either raw events or smoothed events).
+ * @param simulationLength length of the simulation [ms] (0 if not known), used as a capacity hint
+ * @param demuxerWindow window of the demultiplexer [ms]
+ * @param aggregatorWindow window of the aggregator [ms]
+ * @param brightness brightness of the LEDs used by the demultiplexer (may be null)
+ */
+template<int LEDS>
+void addDisplayLog(LogWriter& log, const std::string& column, BroadcastConsumer<BitArray<LEDS>>& broadcast,
+    std::deque<Smoothing<LEDS>>& smoothings, logtime_t simulationLength, bool raw, logtime_t demuxerWindow,
+    logtime_t aggregatorWindow, const typename LedsEventsDemultiplexer<LEDS>::brightness_t* brightness)
+{
+    auto& events = log.addSink<BitArray<LEDS>>(column, raw ? 0 : displayLogCapacityHint(simulationLength, aggregatorWindow));
+    if (raw) {
+        broadcast.subscribe(events);
+        return;
+    }
+
+    auto& smoothing = smoothings.emplace_back(LedsEventsDemultiplexer<LEDS>(demuxerWindow * 1000),
+        LedsEventsAggregator<LEDS>(aggregatorWindow * 1000));
+    if (brightness != nullptr) {
+        smoothing.front().setBrightnessSource(brightness);
+    }
+    smoothing.back().attachNextConsumer(events);
+    broadcast.subscribe(smoothing.front());
+}
+
+
+/**
+ * Add all log columns of a LED display (LEDs or 7seg) requested by the arguments. The main column is controlled
+ * by '--log-<name>' and '--raw-<name>', additional columns by '--<name>-extra-logs', so raw and differently smoothed
+ * events may be logged from one simulation.
+ */
+template<int LEDS>
+void setupDisplayLogs(bpp::ProgramArguments& args, const std::string& name, LogWriter& log,
+    ForkedEventConsumer<ArduinoPinState, BitArray<LEDS>>& display, BroadcastConsumer<BitArray<LEDS>>& broadcast,
+    std::deque<Smoothing<LEDS>>& smoothings, const typename LedsEventsDemultiplexer<LEDS>::brightness_t* brightness = nullptr)
+{
+    logtime_t length = args.getArgInt("simulation-length").isPresent() ? args.getArgInt("simulation-length").getValue() : 0;
+    if (args.getArgBool("log-" + name).getValue()) {
+        addDisplayLog(log, name, broadcast, smoothings, length, args.getArgBool("raw-" + name).getValue(),
+            args.getArgInt(name + "-demuxer-window").getValue(), args.getArgInt(name + "-aggregator-window").getValue(), brightness);
+    }
+
+    std::stringstream extraLogs(args.getArgString(name + "-extra-logs").getValue());
+    std::string spec;
+    while (std::getline(extraLogs, spec, ',')) {
+        if (spec == "raw") {
+            addDisplayLog(log, name + "-raw", broadcast, smoothings, length, true, 0, 0, brightness);
+            continue;
         }
-        else {
-            // load events from stdin
-            simulationTime = loadInputData(std::cin, funshield, buttonEvents, serialEvents);
+
+        std::size_t demuxerWindow = 0, aggregatorWindow = 0;
+        char colon = 0, rest = 0;
+        std::stringstream specStream(spec);
+        if (!(specStream >> demuxerWindow >> colon >> aggregatorWindow) || colon != ':' || specStream >> rest) {
+            throw std::runtime_error("Invalid specification '" + spec + "' of additional " + name + " log (raw or <demuxer>:<aggregator> expected).");
         }
+        addDisplayLog(log, name + "-" + std::to_string(demuxerWindow) + "-" + std::to_string(aggregatorWindow),
+            broadcast, smoothings, length, false, demuxerWindow, aggregatorWindow, brightness);
+    }
+
+    if (broadcast.subscribersCount() > 0) {
+        display.attachSproutConsumer(broadcast);
+    }
+}
+
+
+/**
+ * Enable the time warp if requested. The skipped periods of idle loops are recorded in the log (as their durations).
+ * @return the log sink of the skipped periods (null if the time warp is disabled)
+ */
+LogWriter::Sink<std::string>* setupTimeWarp(bpp::ProgramArguments& args, ArduinoSimulationController& arduino, LogWriter& log)
+{
+    if (args.getArgInt("time-warp").getValue() == 0) {
+        return nullptr;
+    }
+
+    auto warpEvents = &log.addSink<std::string>("warp");
+    arduino.setTimeWarp((logtime_t)args.getArgInt("time-warp").getValue(), [warpEvents](logtime_t from, logtime_t to) {
+        warpEvents->addEvent(from, std::to_string(to - from));
+    });
+    return warpEvents;
+}
+
+
+/**
+ * Write the rest of the output log when the simulation ended successfully.
+ */
+void finishLog(bpp::ProgramArguments& args, LogWriter& log)
+{
+    // make sure 
+    if (log.empty()) {
+        std::cout << "Simulation ended successfully, but no event logging was selected." << std::endl;
     }
     else {
-        if (!args.getArgInt("simulation-length").isPresent()) {
-            throw std::runtime_error("Argument '--simulation-length' is required when no input file is given.");
-        }
+        log.finish();
+    }
+
+    if (args.getArgBool("memory-usage").getValue()) {
+        std::cerr << "log memory: peak " << log.peakMemoryUsage() << " B" << std::endl;
     }
+}
+
 
+/**
+ * Run the loops of the simulation (the setup has to be already done) and print the output log.
+ * @param warpEvents log sink of the time warp (its time is advanced with the loops), may be null
+ * @return exit code of the application
+ */
+int runLoops(bpp::ProgramArguments& args, ArduinoSimulationController& arduino, FunshieldSimulationController& funshield,
+    LogWriter& log, const InputEventsLoader* loader, LogWriter::Sink<std::string>* warpEvents)
+{
+    // the end of the simulation is either given explicitly or it becomes known when the whole input is loaded
+    logtime_t startTime = arduino.getCurrentTime();
+    logtime_t simulationTime = EventConsumer<bool>::NO_DEADLINE;
     if (args.getArgInt("simulation-length").isPresent()) {
-        // possibly override simulation time
         simulationTime = (logtime_t)args.getArgInt("simulation-length").getValue() * 1000;
     }
-    
-    if (args.getArgBool("log-buttons").getValue()) {
-        outputEvents["b1"] = buttonEvents[0];
-        outputEvents["b2"] = buttonEvents[1];
-        outputEvents["b3"] = buttonEvents[2];
+    auto finished = [&](logtime_t time) {
+        if (simulationTime == EventConsumer<bool>::NO_DEADLINE && loader->hasEndTime()) {
+            simulationTime = loader->getEndTime();
+        }
+        return time - startTime >= simulationTime;
+    };
+
+    // This analysis is performed to ensure that in one loop is only one display change (latch activation)
+    std::size_t loopsCount = 0;
+    std::size_t violatedLoopsCount = 0;
+    std::size_t lastLoopLatchActivations = 0;
+    bool lastLatchState = true;
+    EventAnalyzer<ArduinoPinState> displayLatchAnalyzer([&](logtime_t time, ArduinoPinState state)
+        {
+            if (state.pin == latch_pin) {
+                bool pinValue = state.value == HIGH ? true : false;
+                if (!lastLatchState && pinValue) { // LOW -> HIGH edge
+                    ++lastLoopLatchActivations;
+                }
+                lastLatchState = pinValue;
+            }
+        },
+        []() {},
+        false // only events are analyzed, time advances may be skipped
+    );
+    funshield.getSegDisplay().attachNextConsumer(displayLatchAnalyzer);
+
+    logtime_t loopDelay = args.getArgInt("loop-delay").getValue();
+    if (!finished(startTime)) {
+        arduino.runLoopsForPeriod(EventConsumer<bool>::NO_DEADLINE - startTime, loopDelay, [&](logtime_t time)
+            {
+                if (lastLoopLatchActivations > 1) {
+                    ++violatedLoopsCount;
+                }
+                lastLoopLatchActivations = 0; // reset for the next loop
+                ++loopsCount;
+                if (warpEvents != nullptr) {
+                    warpEvents->advanceTime(time);
+                }
+                return !finished(time);
+            }
+        );
     }
 
-    if (args.getArgBool("log-serial").getValue()) {
-        outputEvents["serial"] = serialEvents;
+#ifdef MOCCARDUINO_STATS
+    if (args.getArgString("stats").isPresent()) {
+        if (args.getArgString("stats").getValue() == "json") {
+            arduino.getStats().writeJson(std::cerr);
+        }
+        else {
+            arduino.getStats().writeHistogram(std::cerr);
+        }
+    }
+#endif
+
+    // the input of the scenario was not delivered completely, so the log would not correspond to the scenario
+    if (arduino.getSerialOverflow() > 0) {
+        PRINT_ERROR_HEADER
+        CERR << "Serial input overflow: " << arduino.getSerialOverflow() << " bytes were dropped, since the serial buffer ("
+            << ArduinoEmulator::SERIAL_BUFFER_CAPACITY << " bytes) was full. The data were sent faster than they were read." << std::endl;
+        return error_res;
     }
 
-    return simulationTime;
+    if (args.getArgBool("one-latch-loop").getValue() && violatedLoopsCount > 0) {
+        PRINT_ERROR_HEADER
+        CERR << "The single-latch-activation rule was violated in " << violatedLoopsCount << " loop() invocations." << std::endl;
+        return error_res;
+    }
+
+    finishLog(args, log);
+    return 0;
 }
 
 
 /**
- * Merge all output series together and format them in CSV.
+ * Replay the emulator trace into the displays (and the log), the tested code is not executed at all.
+ * @return exit code of the application
  */
-void processOutput(bpp::ProgramArguments& args, output_events_t& outputEvents)
+int replayTrace(bpp::ProgramArguments& args, ArduinoSimulationController& arduino, LogWriter& log)
 {
-    if (args.getArgString("save").isPresent()) {
-        std::ofstream sout(args.getArgString("save").getValue(), std::ios::binary);
-        printEvents(sout, outputEvents);
-    }
-    else {
-        printEvents(std::cout, outputEvents);
+    auto fileName = args.getArgString("replay-trace").getValue();
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to open emulator trace " + fileName);
     }
+
+    EmulatorTraceReader trace(file);
+    arduino.replayTrace(trace);
+    finishLog(args, log);
+    return 0;
 }
 
-int main(int argc, char* argv[])
+
+/**
+ * Configure the watchdog of the emulator (and arm the hard-stop alarm) from the arguments.
+ */
+void setupWatchdog(bpp::ProgramArguments& args, ArduinoSimulationController& arduino)
 {
-    bpp::ProgramArguments args(0, 1);
-    args.setNamelessCaption(0, "Input file with button events.");
+    arduino.setWatchdogLoopLimit((logtime_t)args.getArgInt("loop-time-limit").getValue() * 1000);
+
+    auto budget = args.getArgInt("host-time-limit").getValue();
+    arduino.setWatchdogHostBudget(std::chrono::milliseconds(budget));
+
+#ifdef FORK_SUPPORTED
+    // code that spins without calling any API function is never seen by the emulator watchdog,
+    // so the process is terminated by an alarm shortly after the budget expires
+    if (budget > 0) {
+        signal(SIGALRM, [](int) {
+#ifdef RECODEX
+            const char msg[] = "ERROR\nWatchdog: The simulation exceeded its host time budget (no API function was called).\n";
+            ssize_t res = write(STDOUT_FILENO, msg, sizeof(msg) - 1);
+#else
+            const char msg[] = "Watchdog: The simulation exceeded its host time budget (no API function was called).\n";
+            ssize_t res = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+#endif
+            (void)res;
+            _exit(error_res);
+        });
+
+        constexpr std::int64_t graceMs = 50; // the emulator watchdog has the chance to report the error first
+        itimerval timer = {};
+        timer.it_value.tv_sec = (budget + graceMs) / 1000;
+        timer.it_value.tv_usec = ((budget + graceMs) % 1000) * 1000;
+        setitimer(ITIMER_REAL, &timer, nullptr);
+    }
+#endif
+}
+
 
+/**
+ * Invoke given part of the simulation and translate exceptions into error messages.
+ * @return exit code of the application
+ */
+int runGuarded(const std::function<int()>& fnc)
+{
     try {
-        args.registerArg<bpp::ProgramArguments::ArgString>("save", "Path to a file to which the simulation log (as CSV) is saved (stdout is used, if no file is given).", false);
+        return fnc();
+    }
+    catch (ArduinoWatchdogException& e) {
+        PRINT_ERROR_HEADER
+        CERR << "Watchdog: " << e.what() << std::endl;
+        return error_res;
+    }
+    catch (ArduinoEmulatorException& e) {
+        PRINT_ERROR_HEADER
+        CERR << "Arduino Emulator Exception: " << e.what() << std::endl;
+        return error_res;
+    }
+    catch (std::exception& e) {
+        PRINT_INTERNAL_ERROR_HEAD
+        CERR << "Exception: " << e.what() << std::endl;
+        return error_internal;
+    }
+}
 
-        args.registerArg<bpp::ProgramArguments::ArgInt>("simulation-length", "Length of the simulation in ms (overrides value from input file, required if no input file is provided).", false, 0, 0);
-        args.registerArg<bpp::ProgramArguments::ArgInt>("loop-delay", "Delay between two loop invocations [us].", false, 100, 1);
-        args.registerArg<bpp::ProgramArguments::ArgBool>("log-buttons", "Add button events into output log.");
-        args.registerArg<bpp::ProgramArguments::ArgBool>("log-serial", "Add serial-link input events into output log.");
-        args.registerArg<bpp::ProgramArguments::ArgBool>("log-leds", "Add LED events into output log.");
-        args.registerArg<bpp::ProgramArguments::ArgBool>("log-7seg", "Add events of the 7-segment display into output log.");
 
-        args.registerArg<bpp::ProgramArguments::ArgBool>("raw-leds", "Deactivate LEDs event smoothing by demultiplexer and aggregator.");
-        args.registerArg<bpp::ProgramArguments::ArgInt>("leds-demuxer-window", "Size of the LEDs demultiplexing window [ms].", false, 10, 0);
-        args.registerArg<bpp::ProgramArguments::ArgInt>("leds-aggregator-window", "Size of the LEDs demultiplexing window [ms].", false, 50, 0);
+#ifdef FORK_SUPPORTED
+/**
+ * Run all scenarios (input files) from the post-setup state. Every scenario is simulated in a forked process,
+ * which inherits the complete state of the emulator (and the tested code) as it was after the setup.
+ * The output of a scenario is saved next to its input file (with .csv suffix appended).
+ * @return exit code of the application (the worst code of all scenarios)
+ */
+int runForkedScenarios(bpp::ProgramArguments& args, ArduinoSimulationController& arduino, FunshieldSimulationController& funshield,
+    LogWriter& log, LogWriter::Sink<std::string>* warpEvents)
+{
+    // only the setup is guarded in the parent process, every scenario has its own watchdog budget
+    arduino.setWatchdogHostBudget(std::chrono::steady_clock::duration::zero());
+    itimerval noTimer = {};
+    setitimer(ITIMER_REAL, &noTimer, nullptr);
+
+    int res = 0;
+    for (std::size_t i = 0; i < args.namelessCount(); ++i) {
+        std::string inputFile = args[i];
+        std::cout.flush();
+        CERR.flush();
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            throw std::runtime_error("Unable to fork the simulation for input file " + inputFile);
+        }
 
-        args.registerArg<bpp::ProgramArguments::ArgBool>("raw-7seg", "Deactivate 7-seg display event smoothing by demultiplexer and aggregator.");
-        args.registerArg<bpp::ProgramArguments::ArgInt>("7seg-demuxer-window", "Size of the LEDs demultiplexing window [ms].", false, 15, 0);
-        args.registerArg<bpp::ProgramArguments::ArgInt>("7seg-aggregator-window", "Size of the LEDs demultiplexing window [ms].", false, 30, 0);
+        if (pid == 0) {
+            // the child simulates the scenario, all its standard output goes to the log file
+            int childRes = runGuarded([&]() {
+                std::string outputFile = inputFile + ".csv";
+                if (std::freopen(outputFile.c_str(), "w", stdout) == nullptr) {
+                    throw std::runtime_error("Unable to write output file " + outputFile);
+                }
+                setupWatchdog(args, arduino); // each scenario has its own budget
+                auto loader = processInput(args, inputFile, funshield, log);
+                return runLoops(args, arduino, funshield, log, loader.get(), warpEvents);
+            });
+            std::cout.flush();
+            std::fflush(stdout);
+            _exit(childRes);
+        }
 
-        args.registerArg<bpp::ProgramArguments::ArgBool>("enable-delay", "If set, builtin functions delay() and delayMicroseconds() are enabled.");
-        args.registerArg<bpp::ProgramArguments::ArgBool>("one-latch-loop", "Limit only one 7seg latch activation in each loop.");
+        int status = 0;
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+            CERR << "Simulation of " << inputFile << " terminated abnormally." << std::endl;
+            res = std::max(res, error_internal);
+        }
+        else {
+            res = std::max(res, WEXITSTATUS(status));
+        }
+    }
+    return res;
+}
 
-        // Process the arguments ...
-        args.process(argc, argv);
+
+/**
+ * Simulate random button inputs (RandomInputGenerator) of many seeds from the post-setup state.
+ * Like the forked scenarios, every seed is simulated in a process forked from this checkpoint (global variables
+ * of the tested code cannot be restored otherwise), up to --workers processes run concurrently.
+ * The logs are discarded, only the failing seeds are reported (with the error messages of their simulations).
+ * @return exit code of the application (the worst code of all seeds)
+ */
+int runFuzz(bpp::ProgramArguments& args, ArduinoSimulationController& arduino, FunshieldSimulationController& funshield,
+    LogWriter& log, LogWriter::Sink<std::string>* warpEvents)
+{
+    arduino.setWatchdogHostBudget(std::chrono::steady_clock::duration::zero());
+    itimerval noTimer = {};
+    setitimer(ITIMER_REAL, &noTimer, nullptr);
+
+    RandomInputGenerator::Config config;
+    config.maxGap = (logtime_t)args.getArgInt("fuzz-max-gap").getValue() * 1000;
+    config.bouncingDelay = (logtime_t)args.getArgInt("fuzz-bouncing").getValue();
+    logtime_t endTime = arduino.getCurrentTime() + (logtime_t)args.getArgInt("simulation-length").getValue() * 1000;
+
+    auto firstSeed = (std::uint64_t)args.getArgInt("fuzz-seed").getValue();
+    auto seeds = (std::uint64_t)args.getArgInt("fuzz").getValue();
+    std::size_t workers = args.getArgInt("workers").getAsSize();
+
+    struct Worker
+    {
+        std::uint64_t seed;
+        std::FILE* errors; ///< stderr of the worker (read when the seed fails)
+    };
+    std::map<pid_t, Worker> running;
+    std::map<std::uint64_t, std::string> failures; // seed -> report
+    int res = 0;
+
+    std::uint64_t next = 0;
+    while (next < seeds || !running.empty()) {
+        if (next < seeds && running.size() < workers) {
+            std::uint64_t seed = firstSeed + next++;
+            std::FILE* errors = std::tmpfile();
+            if (errors == nullptr) {
+                throw std::runtime_error("Unable to create a temporary file for the errors of a fuzz worker.");
+            }
+
+            std::cout.flush();
+            CERR.flush();
+            pid_t pid = fork();
+            if (pid < 0) {
+                throw std::runtime_error("Unable to fork a worker for seed " + std::to_string(seed));
+            }
+
+            if (pid == 0) {
+                int childRes = runGuarded([&]() {
+                    if (std::freopen("/dev/null", "w", stdout) == nullptr || dup2(fileno(errors), STDERR_FILENO) < 0) {
+                        throw std::runtime_error("Unable to redirect the output of a fuzz worker.");
+                    }
+                    setupWatchdog(args, arduino);
+                    RandomInputGenerator generator(funshield, seed, endTime, config);
+                    arduino.attachInputSource(&generator);
+                    return runLoops(args, arduino, funshield, log, nullptr, warpEvents);
+                });
+                std::cout.flush();
+                std::fflush(stdout);
+                CERR.flush();
+                _exit(childRes);
+            }
+
+            running[pid] = Worker{ seed, errors };
+            continue;
+        }
+
+        int status = 0;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            throw std::runtime_error("Waiting for fuzz workers failed.");
+        }
+
+        auto it = running.find(pid);
+        if (it == running.end()) continue;
+        auto worker = it->second;
+        running.erase(it);
+
+        int workerRes = WIFEXITED(status) ? WEXITSTATUS(status) : error_internal;
+        if (workerRes != 0 || !WIFEXITED(status)) {
+            std::string report = WIFEXITED(status) ? "exit code " + std::to_string(workerRes) : "terminated abnormally";
+            std::string message;
+            char buffer[4096];
+            std::rewind(worker.errors);
+            std::size_t length;
+            while ((length = std::fread(buffer, 1, sizeof(buffer), worker.errors)) > 0) {
+                message.append(buffer, length);
+            }
+            while (!message.empty() && std::isspace((unsigned char)message.back())) {
+                message.pop_back();
+            }
+            failures[worker.seed] = message.empty() ? report : report + ", " + message;
+            res = std::max(res, workerRes);
+        }
+        std::fclose(worker.errors);
     }
-    catch (bpp::ArgumentException& e) {
-        std::cout << "Invalid arguments: " << e.what() << std::endl << std::endl;
-        args.printUsage(std::cout);
-        return 100;
+
+    for (auto&& [seed, report] : failures) {
+        std::cout << "seed " << seed << ": FAILED (" << report << ")" << std::endl;
+    }
+    std::cout << "Total " << failures.size() << " / " << seeds << " seeds failed." << std::endl;
+    return res;
+}
+#endif
+
+
+/**
+ * Register all arguments of the tester.
+ */
+void registerArguments(bpp::ProgramArguments& args)
+{
+    args.setNamelessCaption(0, "Input file with button events (more files may be given with --fork-scenarios).");
+
+    args.registerArg<bpp::ProgramArguments::ArgString>("save", "Path to a file to which the simulation log (as CSV) is saved (stdout is used, if no file is given).", false);
+    args.registerArg<bpp::ProgramArguments::ArgEnum>("save-format", "Format of the saved log (csv or columnar binary).", false, false, "csv", std::initializer_list<std::string>{ "csv", "binary" });
+    args.getArg("save-format").requiresAlso("save");
+
+    args.registerArg<bpp::ProgramArguments::ArgInt>("simulation-length", "Length of the simulation in ms (overrides value from input file, required if no input file is provided).", false, 0, 0);
+    args.registerArg<bpp::ProgramArguments::ArgInt>("loop-delay", "Delay between two loop invocations [us].", false, 100, 1);
+    args.registerArg<bpp::ProgramArguments::ArgInt>("time-warp", "Fast-forward idle loops (no pin changes and serial transfers) by at most given granularity [us], skipped periods are logged in 'warp' column (0 = disabled).", false, 0, 0);
+    args.registerArg<bpp::ProgramArguments::ArgBool>("log-buttons", "Add button events into output log.");
+    args.registerArg<bpp::ProgramArguments::ArgBool>("log-serial", "Add serial-link input events into output log.");
+    args.registerArg<bpp::ProgramArguments::ArgBool>("log-serial-out", "Enable the Serial interface and add its output (coalesced per loop) into output log.");
+    args.registerArg<bpp::ProgramArguments::ArgBool>("log-leds", "Add LED events into output log.");
+    args.registerArg<bpp::ProgramArguments::ArgBool>("log-7seg", "Add events of the 7-segment display into output log.");
+
+    args.registerArg<bpp::ProgramArguments::ArgBool>("raw-leds", "Deactivate LEDs event smoothing by demultiplexer and aggregator.");
+    args.registerArg<bpp::ProgramArguments::ArgInt>("leds-demuxer-window", "Size of the LEDs demultiplexing window [ms].", false, 10, 0);
+    args.registerArg<bpp::ProgramArguments::ArgInt>("leds-aggregator-window", "Size of the LEDs demultiplexing window [ms].", false, 50, 0);
+    args.registerArg<bpp::ProgramArguments::ArgString>("leds-extra-logs", "Comma-separated list of additional LED columns logged in the same simulation ('raw' or '<demuxer>:<aggregator>' windows in ms).", false, "");
+
+    args.registerArg<bpp::ProgramArguments::ArgBool>("raw-7seg", "Deactivate 7-seg display event smoothing by demultiplexer and aggregator.");
+    args.registerArg<bpp::ProgramArguments::ArgInt>("7seg-demuxer-window", "Size of the LEDs demultiplexing window [ms].", false, 15, 0);
+    args.registerArg<bpp::ProgramArguments::ArgInt>("7seg-aggregator-window", "Size of the LEDs demultiplexing window [ms].", false, 30, 0);
+    args.registerArg<bpp::ProgramArguments::ArgString>("7seg-extra-logs", "Comma-separated list of additional 7-seg display columns logged in the same simulation ('raw' or '<demuxer>:<aggregator>' windows in ms).", false, "");
+
+    args.registerArg<bpp::ProgramArguments::ArgBool>("enable-delay", "If set, builtin functions delay() and delayMicroseconds() are enabled.");
+    args.registerArg<bpp::ProgramArguments::ArgBool>("one-latch-loop", "Limit only one 7seg latch activation in each loop.");
+    args.registerArg<bpp::ProgramArguments::ArgInt>("host-time-limit", "Host (wall clock) time budget of the simulation [ms], the simulation is terminated when it is exceeded (0 = unlimited).", false, 0, 0);
+    args.registerArg<bpp::ProgramArguments::ArgInt>("loop-time-limit", "Maximal logical time that may elapse within one loop() invocation [ms] (0 = unlimited).", false, 0, 0);
+    args.registerArg<bpp::ProgramArguments::ArgBool>("memory-usage", "Print the peak memory allocated for the events held by the output log to stderr when the simulation ends.");
+    args.registerArg<bpp::ProgramArguments::ArgString>("record-trace", "Path to a file to which a binary trace of all pin events is recorded (it may be replayed by --replay-trace).", false);
+    args.registerArg<bpp::ProgramArguments::ArgString>("replay-trace", "Path to a recorded trace which is replayed into the LED displays instead of running the tested code.", false);
+    args.getArg("replay-trace").conflictsWith("record-trace").conflictsWith("log-buttons").conflictsWith("log-serial")
+        .conflictsWith("log-serial-out").conflictsWith("time-warp").conflictsWith("one-latch-loop");
+    args.registerArg<bpp::ProgramArguments::ArgEnum>("stats", "Print profiling statistics of the loops and API calls to stderr when the simulation ends (histogram or json, requires build with STATS=1).", false, false, "histogram", std::initializer_list<std::string>{ "histogram", "json" });
+#ifdef FORK_SUPPORTED
+    args.registerArg<bpp::ProgramArguments::ArgBool>("fork-scenarios", "Run setup() only once and simulate every input file in a process forked from the post-setup state (logs are saved as <input>.csv).");
+    args.getArg("fork-scenarios").conflictsWith("save").conflictsWith("record-trace").conflictsWith("replay-trace");
+    args.registerArg<bpp::ProgramArguments::ArgString>("batch", "Path to a manifest file with simulation cases (one '<input> <output> [options]' per line), all cases are simulated in forked workers.", false);
+    args.getArg("batch").conflictsWith("save").conflictsWith("fork-scenarios");
+    args.registerArg<bpp::ProgramArguments::ArgInt>("workers", "Number of worker processes that simulate batch cases (or fuzz seeds) concurrently.", false, 1, 1, 1024);
+    args.registerArg<bpp::ProgramArguments::ArgInt>("fuzz", "Number of random button inputs (seeds) simulated from the post-setup state instead of an input file, only failing seeds are reported (0 = disabled).", false, 0, 0);
+    args.getArg("fuzz").conflictsWith("save").conflictsWith("fork-scenarios").conflictsWith("batch")
+        .conflictsWith("record-trace").conflictsWith("replay-trace");
+    args.registerArg<bpp::ProgramArguments::ArgInt>("fuzz-seed", "Seed of the first random input (subsequent seeds are used for the other inputs).", false, 1, 0);
+    args.registerArg<bpp::ProgramArguments::ArgInt>("fuzz-max-gap", "Maximal delay between the beginnings of two subsequent random button patterns [ms].", false, 500, 1);
+    args.registerArg<bpp::ProgramArguments::ArgInt>("fuzz-bouncing", "Delay between two bounces of bouncing button patterns [us] (0 = no bouncing).", false, 1000, 0, 3000);
+#endif
+}
+
+
+/**
+ * Verify constraints of the processed arguments that cannot be expressed by the argument processor.
+ */
+void checkArguments(bpp::ProgramArguments& args)
+{
+    bool batch = false;
+    bool forkScenarios = false;
+    bool fuzz = false;
+#ifdef FORK_SUPPORTED
+    forkScenarios = args.getArgBool("fork-scenarios").getValue();
+    batch = args.getArgString("batch").isPresent();
+    fuzz = args.getArgInt("fuzz").getValue() > 0;
+#endif
+    if (!forkScenarios && args.namelessCount() > 1) {
+        throw bpp::ArgumentException("Only one input file may be given (unless --fork-scenarios is used).");
+    }
+    if (forkScenarios) {
+        if (args.namelessCount() == 0) {
+            throw bpp::ArgumentException("At least one input file is required when --fork-scenarios is used.");
+        }
+        for (std::size_t i = 0; i < args.namelessCount(); ++i) {
+            if (args[i] == "-") {
+                throw bpp::ArgumentException("Input scenarios cannot be loaded from stdin when --fork-scenarios is used.");
+            }
+        }
+    }
+    if (args.getArgString("replay-trace").isPresent() && args.namelessCount() > 0) {
+        throw bpp::ArgumentException("No input file is used when --replay-trace is given (the inputs are recorded in the trace).");
+    }
+    if (fuzz && (args.namelessCount() > 0 || !args.getArgInt("simulation-length").isPresent())) {
+        throw bpp::ArgumentException("The fuzz mode requires --simulation-length and no input file.");
+    }
+    if (batch && args.namelessCount() > 0) {
+        throw bpp::ArgumentException("Input files are listed in the manifest when --batch is used.");
+    }
+#ifndef MOCCARDUINO_STATS
+    if (args.getArgString("stats").isPresent()) {
+        throw bpp::ArgumentException("Profiling statistics are not compiled in (build the tester with STATS=1).");
     }
+#endif
+}
 
-    output_events_t outputEvents;
 
+/**
+ * Run the whole simulation as configured by the arguments.
+ * @return exit code of the application
+ */
+int runSimulation(bpp::ProgramArguments& args)
+{
     // initialize simulation
     ArduinoSimulationController arduino(get_arduino_emulator_instance());
     FunshieldSimulationController funshield(arduino);
@@ -153,103 +654,269 @@ int main(int argc, char* argv[])
         arduino.disableMethod("delay");
         arduino.disableMethod("delayMicroseconds");
     }
+    setupWatchdog(args, arduino);
+
+    return runGuarded([&]() {
+        // the log is streamed into the file during the simulation, stdout gets the whole log at the end
+        // (so an error message may be printed instead)
+        auto format = args.getArgString("save-format").getValue() == "binary" ? LogWriter::Format::BINARY : LogWriter::Format::CSV;
+        std::unique_ptr<LogWriter> log = args.getArgString("save").isPresent()
+            ? std::make_unique<LogWriter>(args.getArgString("save").getValue(), format)
+            : std::make_unique<LogWriter>(std::cout);
+
+        // LEDs and 7-seg display (each display state is broadcast to all requested logs)
+        BroadcastConsumer<leds_state_t> ledsBroadcast;
+        std::deque<Smoothing<4>> ledsSmoothings;
+        setupDisplayLogs(args, "leds", *log, funshield.getLeds(), ledsBroadcast, ledsSmoothings,
+            &funshield.getLeds().getBrightness()); // LEDs dimmed by analogWrite()
+
+        BroadcastConsumer<display_state_t> segBroadcast;
+        std::deque<Smoothing<32>> segSmoothings;
+        setupDisplayLogs(args, "7seg", *log, funshield.getSegDisplay(), segBroadcast, segSmoothings);
+
+        // serial output (all data written in one loop form one event)
+        if (args.getArgBool("log-serial-out").getValue()) {
+            arduino.enableMethod("serial");
+            arduino.attachSerialOutputConsumer(&log->addSink<std::string>("serial-out"));
+        }
 
-    try {
-        logtime_t simulationTime = processInput(args, funshield, outputEvents);
-
-        // LEDs
-        LedsEventsDemultiplexer<4> ledDemuxer(args.getArgInt("leds-demuxer-window").getValue() * 1000);
-        LedsEventsAggregator<4> ledAggregator(args.getArgInt("leds-aggregator-window").getValue() * 1000);
-        auto ledEvents = std::make_shared<TimeSeries<leds_state_t>>();
-        if (args.getArgBool("log-leds").getValue()) {
-            if (args.getArgBool("raw-leds").getValue()) {
-                // collecting raw LED events
-                funshield.getLeds().attachSproutConsumer(*ledEvents);
-            }
-            else {
-                // LED events smoothing using demuxer and aggregator
-                funshield.getLeds().attachSproutConsumer(ledDemuxer);
-                ledDemuxer.attachNextConsumer(ledAggregator);
-                ledAggregator.attachNextConsumer(*ledEvents);
-            }
-            outputEvents["leds"] = ledEvents;
+        if (args.getArgString("replay-trace").isPresent()) {
+            return replayTrace(args, arduino, *log);
         }
 
-        // 7-seg display
-        LedsEventsDemultiplexer<32> segDemuxer(args.getArgInt("7seg-demuxer-window").getValue() * 1000);
-        LedsEventsAggregator<32> segAggregator(args.getArgInt("7seg-aggregator-window").getValue() * 1000);
-        auto segEvents = std::make_shared<TimeSeries<display_state_t>>();
-        if (args.getArgBool("log-7seg").getValue()) {
-            if (args.getArgBool("raw-7seg").getValue()) {
-                // collecting raw LED events
-                funshield.getSegDisplay().attachSproutConsumer(*segEvents);
-            }
-            else {
-                // LED events smoothing using demuxer and aggregator
-                funshield.getSegDisplay().attachSproutConsumer(segDemuxer);
-                segDemuxer.attachNextConsumer(segAggregator);
-                segAggregator.attachNextConsumer(*segEvents);
+        auto warpEvents = setupTimeWarp(args, arduino, *log);
+
+#ifdef FORK_SUPPORTED
+        if (args.getArgBool("fork-scenarios").getValue()) {
+            // the setup is done only once, scenarios are forked from this checkpoint
+            arduino.runSetup();
+            return runForkedScenarios(args, arduino, funshield, *log, warpEvents);
+        }
+        if (args.getArgInt("fuzz").getValue() > 0) {
+            arduino.runSetup();
+            return runFuzz(args, arduino, funshield, *log, warpEvents);
+        }
+#endif
+
+        std::string inputFile = args.namelessCount() > 0 ? args[0] : std::string();
+        auto loader = processInput(args, inputFile, funshield, *log);
+
+        // all events delivered to the displays may be recorded, so the logs can be recomputed by replaying the trace
+        std::ofstream traceFile;
+        std::unique_ptr<EmulatorTraceWriter> trace;
+        if (args.getArgString("record-trace").isPresent()) {
+            traceFile.open(args.getArgString("record-trace").getValue(), std::ios::binary);
+            if (!traceFile.is_open()) {
+                throw std::runtime_error("Unable to write emulator trace " + args.getArgString("record-trace").getValue());
             }
-            outputEvents["7seg"] = segEvents;
+            trace = std::make_unique<EmulatorTraceWriter>(traceFile);
+            arduino.attachTraceRecorder(trace.get());
         }
 
         // run simulation
         arduino.runSetup();
+        int res = runLoops(args, arduino, funshield, *log, loader.get(), warpEvents);
+        if (trace) {
+            trace->finish(arduino.getCurrentTime());
+        }
+        return res;
+    });
+}
 
-        // This analysis is performed to ensure that in one loop is only one display change (latch activation)
-        std::size_t loopsCount = 0;
-        std::size_t violatedLoopsCount = 0;
-        std::size_t lastLoopLatchActivations = 0;
-        bool lastLatchState = true;
-        EventAnalyzer<ArduinoPinState> displayLatchAnalyzer([&](logtime_t time, ArduinoPinState state)
-            {
-                if (state.pin == latch_pin) {
-                    bool pinValue = state.value == HIGH ? true : false;
-                    if (!lastLatchState && pinValue) { // LOW -> HIGH edge
-                        ++lastLoopLatchActivations;
-                    }
-                    lastLatchState = pinValue;
-                }
+
+#ifdef FORK_SUPPORTED
+/**
+ * One simulation case loaded from the batch manifest.
+ */
+struct BatchCase
+{
+    std::string input;
+    std::string output;
+    std::vector<std::string> argv;  ///< complete command line of the simulation
+    std::string error;              ///< message explaining why the case could not be started
+    int result = 0;                 ///< exit code of the simulation
+};
+
+
+/**
+ * Load the batch manifest. Each line holds '<input> <output> [options]' (empty lines and lines starting with # are skipped).
+ * @param fileName path to the manifest
+ * @param commonArgv command line arguments shared by all cases (the case options are appended, so they take precedence)
+ */
+std::vector<BatchCase> loadBatchManifest(const std::string& fileName, const std::vector<std::string>& commonArgv)
+{
+    std::ifstream sin(fileName, std::ios::binary);
+    if (!sin.is_open()) {
+        throw std::runtime_error("Failed to open batch manifest " + fileName);
+    }
+
+    std::vector<BatchCase> cases;
+    std::string line;
+    std::size_t lineCount = 0;
+    while (std::getline(sin, line)) {
+        ++lineCount;
+        std::stringstream ss(line);
+        std::vector<std::string> tokens;
+        std::string token;
+        while (ss >> token) {
+            tokens.push_back(token);
+        }
+
+        if (tokens.empty() || tokens[0][0] == '#') continue;
+        if (tokens.size() < 2) {
+            throw std::runtime_error("Line " + std::to_string(lineCount) + " of batch manifest " + fileName + " does not specify both input and output.");
+        }
+
+        BatchCase batchCase;
+        batchCase.input = tokens[0];
+        batchCase.output = tokens[1];
+        batchCase.argv = commonArgv;
+        batchCase.argv.insert(batchCase.argv.end(), tokens.begin() + 2, tokens.end());
+        batchCase.argv.insert(batchCase.argv.end(), { "--save", batchCase.output, batchCase.input });
+        cases.push_back(std::move(batchCase));
+    }
+    return cases;
+}
+
+
+/**
+ * Process arguments of one batch case.
+ */
+void processCaseArguments(bpp::ProgramArguments& caseArgs, const BatchCase& batchCase)
+{
+    std::vector<const char*> argv;
+    for (auto&& arg : batchCase.argv) {
+        argv.push_back(arg.c_str());
+    }
+
+    registerArguments(caseArgs);
+    caseArgs.process((int)argv.size(), argv.data());
+    checkArguments(caseArgs);
+    if (caseArgs.getArgString("batch").isPresent() || caseArgs.getArgBool("fork-scenarios").getValue()
+        || caseArgs.getArgInt("fuzz").getValue() > 0) {
+        throw bpp::ArgumentException("Batch cases cannot use --batch, --fork-scenarios, or --fuzz.");
+    }
+}
+
+
+/**
+ * Run all cases of the batch manifest in a pool of forked worker processes and print a summary.
+ * Processes are used instead of threads, since global variables of the tested code cannot be duplicated.
+ * @return exit code of the application (the worst code of all cases)
+ */
+int runBatch(bpp::ProgramArguments& args, int argc, char* argv[])
+{
+    // all command line options (except for the batch ones) are shared by all cases
+    std::vector<std::string> commonArgv{ argv[0] };
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg == "--batch" || arg == "--workers") {
+            ++i; // skip the value as well
+            continue;
+        }
+        commonArgv.push_back(arg);
+    }
+
+    auto cases = loadBatchManifest(args.getArgString("batch").getValue(), commonArgv);
+    std::size_t workers = args.getArgInt("workers").getAsSize();
+
+    std::map<pid_t, std::size_t> running; // pid -> case index
+    std::size_t next = 0;
+    while (next < cases.size() || !running.empty()) {
+        if (next < cases.size() && running.size() < workers) {
+            auto& batchCase = cases[next++];
+            bpp::ProgramArguments caseArgs;
+            try {
+                processCaseArguments(caseArgs, batchCase);
+            }
+            catch (bpp::ArgumentException& e) {
+                batchCase.error = std::string("invalid arguments: ") + e.what();
+                batchCase.result = 100;
+                continue;
             }
-        );
-        funshield.getSegDisplay().attachNextConsumer(displayLatchAnalyzer);
 
-        logtime_t loopDelay = args.getArgInt("loop-delay").getValue();
-        arduino.runLoopsForPeriod(simulationTime, loopDelay, [&](logtime_t)
-            {
-                if (lastLoopLatchActivations > 1) {
-                    ++violatedLoopsCount;
-                }
-                lastLoopLatchActivations = 0; // reset for the next loop
-                ++loopsCount;
-                return true;
+            std::cout.flush();
+            CERR.flush();
+            pid_t pid = fork();
+            if (pid < 0) {
+                throw std::runtime_error("Unable to fork a worker for input file " + batchCase.input);
+            }
+
+            if (pid == 0) {
+                int res = runSimulation(caseArgs);
+                std::cout.flush();
+                CERR.flush();
+                _exit(res);
             }
-        );
 
-        if (args.getArgBool("one-latch-loop").getValue() && violatedLoopsCount > 0) {
-            PRINT_ERROR_HEADER
-            CERR << "The single-latch-activation rule was violated in " << violatedLoopsCount << " loop() invocations." << std::endl;
-            return error_res;
+            running[pid] = next - 1;
+            continue;
         }
 
-        // make sure 
-        if (outputEvents.empty()) {
-            std::cout << "Simulation ended successfully, but no event logging was selected." << std::endl;
+        // all workers are busy (or there is nothing more to start), wait for one of them
+        int status = 0;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            throw std::runtime_error("Waiting for batch workers failed.");
+        }
+
+        auto it = running.find(pid);
+        if (it == running.end()) continue;
+        auto& batchCase = cases[it->second];
+        running.erase(it);
+
+        if (WIFEXITED(status)) {
+            batchCase.result = WEXITSTATUS(status);
         }
         else {
-            processOutput(args, outputEvents);
+            batchCase.error = "terminated abnormally";
+            batchCase.result = error_internal;
         }
     }
-    catch (ArduinoEmulatorException& e) {
-        PRINT_ERROR_HEADER
-        CERR << "Arduino Emulator Exception: " << e.what() << std::endl;
-        return error_res;
+
+    // summary
+    int res = 0;
+    std::size_t succeeded = 0;
+    for (auto&& batchCase : cases) {
+        std::cout << batchCase.input << " -> " << batchCase.output << ": ";
+        if (batchCase.result == 0 && batchCase.error.empty()) {
+            std::cout << "OK" << std::endl;
+            ++succeeded;
+        }
+        else {
+            std::cout << "FAILED (" << (batchCase.error.empty() ? "exit code " + std::to_string(batchCase.result) : batchCase.error) << ")" << std::endl;
+        }
+        res = std::max(res, batchCase.result);
     }
-    catch (std::exception& e) {
-        PRINT_INTERNAL_ERROR_HEAD
-        CERR << "Exception: " << e.what() << std::endl;
-        return error_internal;
+    std::cout << "Total " << succeeded << " / " << cases.size() << " cases succeeded." << std::endl;
+
+    return res;
+}
+#endif
+
+
+int main(int argc, char* argv[])
+{
+    bpp::ProgramArguments args;
+
+    try {
+        registerArguments(args);
+
+        // Process the arguments ...
+        args.process(argc, argv);
+        checkArguments(args);
+    }
+    catch (bpp::ArgumentException& e) {
+        std::cout << "Invalid arguments: " << e.what() << std::endl << std::endl;
+        args.printUsage(std::cout);
+        return 100;
     }
 
-    return 0;
+#ifdef FORK_SUPPORTED
+    if (args.getArgString("batch").isPresent()) {
+        return runGuarded([&]() { return runBatch(args, argc, argv); });
+    }
+#endif
+
+    return runSimulation(args);
 }
@@ -0,0 +1,129 @@
+#include "args.hpp"
+
+#include "simulation_log.hpp"
+#include "judge.hpp"
+
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+/**
+ * Get the judged series of the log. Plain event lists have only one column, so they are used regardless the name.
+ */
+const SimulationLog::series_t& selectColumn(const SimulationLog& log, const std::string& name)
+{
+    if (!name.empty() && !log.hasColumn(name) && log.hasColumn(SimulationLog::EVENTS_COLUMN)) {
+        return log.column(SimulationLog::EVENTS_COLUMN);
+    }
+    return log.column(name);
+}
+
+/**
+ * Pair expected events (first file) with the actual events (second file) and print the mapping.
+ * Each line holds the index of the expected and the actual event, '-' stands for an unpaired event.
+ */
+void runPairing(bpp::ProgramArguments& args, const std::vector<std::unique_ptr<SimulationLog>>& logs)
+{
+    const std::string& column = args.getArgString("column").getValue();
+    auto mapping = EventsJudge::pairEvents(selectColumn(*logs[0], column), selectColumn(*logs[1], column),
+        (logtime_t)args.getArgInt("window").getValue());
+
+    for (auto const& pair : mapping) {
+        if (pair.expected == EventsJudge::NONE) {
+            std::cout << '-';
+        }
+        else {
+            std::cout << pair.expected;
+        }
+        std::cout << ' ';
+        if (pair.actual == EventsJudge::NONE) {
+            std::cout << '-';
+        }
+        else {
+            std::cout << pair.actual;
+        }
+        std::cout << "\n";
+    }
+}
+
+/**
+ * Compare all files with the first one and print the durations (one line per file) when their values differ.
+ */
+void runComparison(bpp::ProgramArguments& args, const std::vector<std::unique_ptr<SimulationLog>>& logs)
+{
+    const std::string& column = args.getArgString("column").getValue();
+    std::vector<const SimulationLog::series_t*> series;
+    logtime_t end = 0;
+    for (auto const& log : logs) {
+        series.push_back(&selectColumn(*log, column));
+        if (!series.back()->empty()) {
+            end = std::max(end, series.back()->back().time + 1);
+        }
+    }
+
+    logtime_t start = (logtime_t)args.getArgInt("from").getValue();
+    if (args.getArgInt("to").isPresent()) {
+        end = (logtime_t)args.getArgInt("to").getValue();
+    }
+
+    auto durations = EventsJudge::compareSeries(series, start, end, args.getArgString("initial").getValue());
+    for (std::size_t i = 1; i < durations.size(); ++i) {
+        std::cout << args[i] << "\t" << durations[i] << "\n";
+    }
+}
+
+void registerArguments(bpp::ProgramArguments& args)
+{
+    args.setNamelessCaption(0, "Reference log (or expected events in pairing mode).");
+    args.setNamelessCaption(1, "Compared log(s) (the actual events in pairing mode).");
+
+    args.registerArg<bpp::ProgramArguments::ArgString>("column", "Name of the judged column of the simulation logs (may be omitted if the logs have only one column).", false, "");
+    args.registerArg<bpp::ProgramArguments::ArgBool>("pair", "Pair expected and actual events instead of comparing the logs.");
+    args.registerArg<bpp::ProgramArguments::ArgInt>("window", "Maximal delay of an actual event after the expected one when pairing [us].", false, 0, 0);
+    args.getArg("window").requiresAlso("pair");
+    args.registerArg<bpp::ProgramArguments::ArgInt>("from", "Beginning of the compared time range [us].", false, 0, 0);
+    args.registerArg<bpp::ProgramArguments::ArgInt>("to", "End of the compared time range [us] (the last event of the logs by default).", false, 0, 0);
+    args.registerArg<bpp::ProgramArguments::ArgString>("initial", "Value of all logs before their first event when comparing.", false, "");
+    args.getArg("pair").conflictsWith("from").conflictsWith("to").conflictsWith("initial");
+}
+
+int main(int argc, char* argv[])
+{
+    bpp::ProgramArguments args(2);
+
+    try {
+        registerArguments(args);
+        args.process(argc, argv);
+        if (args.getArgBool("pair").getValue() && args.namelessCount() != 2) {
+            throw bpp::ArgumentException("Exactly two files (expected and actual events) are required for pairing.");
+        }
+    }
+    catch (bpp::ArgumentException& e) {
+        std::cout << "Invalid arguments: " << e.what() << std::endl << std::endl;
+        args.printUsage(std::cout);
+        return 100;
+    }
+
+    try {
+        std::vector<std::unique_ptr<SimulationLog>> logs;
+        for (std::size_t i = 0; i < args.namelessCount(); ++i) {
+            logs.push_back(std::make_unique<SimulationLog>(args[i]));
+        }
+
+        if (args.getArgBool("pair").getValue()) {
+            runPairing(args, logs);
+        }
+        else {
+            runComparison(args, logs);
+        }
+    }
+    catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
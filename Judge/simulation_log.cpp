@@ -0,0 +1,278 @@
+#include "simulation_log.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <cctype>
+
+
+namespace {
+    constexpr char BINARY_MAGIC[] = "MOCCBLOG";
+    constexpr std::size_t BINARY_MAGIC_LENGTH = 8;
+
+    std::uint64_t readLittleEndian(std::string_view data, std::uint64_t offset, std::size_t bytes)
+    {
+        if (offset + bytes > data.size()) {
+            throw std::runtime_error("Binary log is truncated.");
+        }
+        std::uint64_t res = 0;
+        for (std::size_t i = bytes; i > 0; --i) {
+            res = (res << 8) | (unsigned char)data[offset + i - 1];
+        }
+        return res;
+    }
+
+    logtime_t parseTimestamp(std::string_view str, std::size_t line)
+    {
+        logtime_t res = 0;
+        auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), res);
+        if (ec != std::errc() || ptr != str.data() + str.size()) {
+            throw std::runtime_error("Invalid timestamp '" + std::string(str) + "' on line " + std::to_string(line) + ".");
+        }
+        return res;
+    }
+
+    std::string_view trim(std::string_view str)
+    {
+        while (!str.empty() && std::isspace((unsigned char)str.front())) str.remove_prefix(1);
+        while (!str.empty() && std::isspace((unsigned char)str.back())) str.remove_suffix(1);
+        return str;
+    }
+
+    void addEvent(SimulationLog::series_t& series, logtime_t time, std::string value, const std::string& name)
+    {
+        if (!series.empty() && series.back().time > time) {
+            throw std::runtime_error("Events of column " + name + " are not ordered by their timestamps.");
+        }
+        series.addEvent(time, std::move(value));
+    }
+}
+
+
+SimulationLog::SimulationLog(const std::string& fileName)
+{
+    std::string data;
+    if (fileName == "-") {
+        data.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    }
+    else {
+        std::ifstream file(fileName, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Failed to open file " + fileName);
+        }
+        std::ostringstream buffer;
+        buffer << file.rdbuf();
+        data = std::move(buffer).str();
+    }
+
+    std::string_view view(data);
+    if (view.substr(0, BINARY_MAGIC_LENGTH) == std::string_view(BINARY_MAGIC, BINARY_MAGIC_LENGTH)) {
+        loadBinary(view);
+    }
+    else if (view.substr(0, 9) == "timestamp") {
+        loadCsv(view);
+    }
+    else if (view.substr(0, 5) == "ERROR" || view.substr(0, 14) == "INTERNAL ERROR") {
+        throw std::runtime_error("File " + fileName + " holds an error report instead of the simulation log.");
+    }
+    else {
+        loadEvents(view);
+    }
+}
+
+void SimulationLog::loadCsv(std::string_view data)
+{
+    // the header is never quoted, the delimiter follows the timestamp column
+    std::size_t headerEnd = std::min(data.find('\n'), data.size());
+    std::string_view header = data.substr(0, headerEnd);
+    if (!header.empty() && header.back() == '\r') header.remove_suffix(1);
+    if (header.size() <= 9) {
+        return; // no columns besides timestamps
+    }
+    char delimiter = header[9];
+
+    std::vector<series_t*> columns;
+    std::vector<std::string> names;
+    std::size_t pos = 10;
+    while (pos <= header.size()) {
+        std::size_t next = std::min(header.find(delimiter, pos), header.size());
+        names.emplace_back(header.substr(pos, next - pos));
+        columns.push_back(&mColumns[names.back()]);
+        pos = next + 1;
+    }
+
+    // rows (quoted values may contain delimiters and line breaks)
+    std::size_t line = 1;
+    pos = headerEnd + 1;
+    std::string value;
+    while (pos < data.size()) {
+        ++line;
+        if (data[pos] == '\n' || data[pos] == '\r') {
+            ++pos; // empty line
+            continue;
+        }
+
+        std::size_t tsEnd = pos;
+        while (tsEnd < data.size() && data[tsEnd] != delimiter && data[tsEnd] != '\n' && data[tsEnd] != '\r') ++tsEnd;
+        logtime_t time = parseTimestamp(data.substr(pos, tsEnd - pos), line);
+        pos = tsEnd;
+
+        for (std::size_t c = 0; c < columns.size() && pos < data.size() && data[pos] == delimiter; ++c) {
+            ++pos;
+            value.clear();
+            bool present = false;
+            if (pos < data.size() && data[pos] == '"') {
+                present = true;
+                ++pos;
+                while (true) {
+                    if (pos >= data.size()) {
+                        throw std::runtime_error("Unterminated quoted value in the CSV log.");
+                    }
+                    if (data[pos] == '"') {
+                        if (pos + 1 < data.size() && data[pos + 1] == '"') {
+                            value.push_back('"');
+                            pos += 2;
+                            continue;
+                        }
+                        ++pos;
+                        break;
+                    }
+                    if (data[pos] == '\n') ++line;
+                    value.push_back(data[pos++]);
+                }
+            }
+            else {
+                std::size_t end = pos;
+                while (end < data.size() && data[end] != delimiter && data[end] != '\n' && data[end] != '\r') ++end;
+                value.assign(data.substr(pos, end - pos));
+                present = !value.empty();
+                pos = end;
+            }
+
+            if (present) {
+                addEvent(*columns[c], time, value, names[c]);
+            }
+        }
+
+        while (pos < data.size() && data[pos] != '\n') ++pos;
+        ++pos;
+    }
+}
+
+void SimulationLog::loadBinary(std::string_view data)
+{
+    constexpr std::size_t nameLength = 16;
+    constexpr std::uint64_t headerSize = 16;
+    constexpr std::uint64_t descriptorSize = nameLength + 32;
+    constexpr char digits[] = "0123456789abcdef";
+
+    if (readLittleEndian(data, 8, 4) != 1) {
+        throw std::runtime_error("Unsupported version of the binary log.");
+    }
+    std::uint64_t count = readLittleEndian(data, 12, 4);
+
+    for (std::uint64_t i = 0; i < count; ++i) {
+        std::uint64_t descriptor = headerSize + i * descriptorSize;
+        if (descriptor + descriptorSize > data.size()) {
+            throw std::runtime_error("Binary log is truncated.");
+        }
+        std::string_view rawName = data.substr(descriptor, nameLength);
+        std::string name(rawName.substr(0, std::min(rawName.find('\0'), nameLength)));
+        auto type = readLittleEndian(data, descriptor + nameLength, 4);
+        auto valueSize = readLittleEndian(data, descriptor + nameLength + 4, 4);
+        auto bits = readLittleEndian(data, descriptor + nameLength + 8, 4);
+        auto events = readLittleEndian(data, descriptor + nameLength + 16, 8);
+        auto offset = readLittleEndian(data, descriptor + nameLength + 24, 8);
+
+        series_t& series = mColumns[name];
+        std::uint64_t values = offset + 8 * events;
+        std::uint64_t blob = values + valueSize * events;
+        if (blob > data.size()) {
+            throw std::runtime_error("Binary log is truncated.");
+        }
+
+        std::uint64_t stringStart = 0;
+        for (std::uint64_t e = 0; e < events; ++e) {
+            logtime_t time = readLittleEndian(data, offset + 8 * e, 8);
+            std::uint64_t valueOffset = values + valueSize * e;
+            std::string value;
+            switch (type) {
+            case 1: // bool
+                value = data[valueOffset] ? "1" : "0";
+                break;
+            case 2: // bits (same hex encoding as BitArray::writeHex)
+                if (bits <= 4) {
+                    value.push_back(digits[data[valueOffset] & 0x0f]);
+                }
+                else {
+                    for (std::uint64_t b = 0; b < (bits + 7) / 8; ++b) {
+                        unsigned char byte = data[valueOffset + b];
+                        value.push_back(digits[byte >> 4]);
+                        value.push_back(digits[byte & 0x0f]);
+                    }
+                }
+                break;
+            case 3: // string
+            {
+                std::uint64_t stringEnd = readLittleEndian(data, valueOffset, 8);
+                if (stringEnd < stringStart || blob + stringEnd > data.size()) {
+                    throw std::runtime_error("Invalid string offset in column " + name + " of the binary log.");
+                }
+                value.assign(data.substr(blob + stringStart, stringEnd - stringStart));
+                stringStart = stringEnd;
+                break;
+            }
+            default:
+                throw std::runtime_error("Unknown type of column " + name + " in the binary log.");
+            }
+            addEvent(series, time, std::move(value), name);
+        }
+    }
+}
+
+void SimulationLog::loadEvents(std::string_view data)
+{
+    series_t& series = mColumns[EVENTS_COLUMN];
+    std::size_t line = 0;
+    while (!data.empty()) {
+        ++line;
+        std::size_t end = std::min(data.find('\n'), data.size());
+        std::string_view row = trim(data.substr(0, end));
+        data.remove_prefix(std::min(end + 1, data.size()));
+        if (row.empty()) continue;
+
+        std::size_t tsEnd = 0;
+        while (tsEnd < row.size() && !std::isspace((unsigned char)row[tsEnd])) ++tsEnd;
+        logtime_t time = parseTimestamp(row.substr(0, tsEnd), line);
+        addEvent(series, time, std::string(trim(row.substr(tsEnd))), EVENTS_COLUMN);
+    }
+}
+
+const SimulationLog::series_t& SimulationLog::column(const std::string& name) const
+{
+    if (name.empty()) {
+        if (mColumns.size() != 1) {
+            throw std::runtime_error("The log has " + std::to_string(mColumns.size()) + " columns, the column name must be specified.");
+        }
+        return mColumns.begin()->second;
+    }
+
+    auto it = mColumns.find(name);
+    if (it == mColumns.end()) {
+        throw std::runtime_error("The log has no column " + name + ".");
+    }
+    return it->second;
+}
+
+std::vector<std::string> SimulationLog::columnNames() const
+{
+    std::vector<std::string> res;
+    for (auto const& it : mColumns) {
+        res.push_back(it.first);
+    }
+    return res;
+}
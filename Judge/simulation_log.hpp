@@ -0,0 +1,56 @@
+#ifndef MOCCARDUINO_JUDGE_SIMULATION_LOG_HPP
+#define MOCCARDUINO_JUDGE_SIMULATION_LOG_HPP
+
+#include "time_series.hpp"
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Simulation log loaded directly into time series (one for each column), so the judge does not need
+ * to merge and split the CSV rows. Both formats written by the generic tester (CSV and columnar binary)
+ * are accepted, and also a plain list of events ('<timestamp> <value>' on each line).
+ * All values are kept in their CSV representation (bools are "0"/"1", bit arrays are hex strings,
+ * strings are unquoted), so that values of expected and actual events may be compared without any decoding.
+ */
+class SimulationLog
+{
+public:
+	using series_t = TimeSeries<std::string>;
+
+	/**
+	 * Name of the only column of plain event lists.
+	 */
+	static constexpr const char* EVENTS_COLUMN = "events";
+
+private:
+	std::map<std::string, series_t> mColumns;
+
+	void loadCsv(std::string_view data);
+	void loadBinary(std::string_view data);
+	void loadEvents(std::string_view data);
+
+public:
+	/**
+	 * Load the file, its format is detected automatically.
+	 * @param fileName path to the file, "-" for stdin
+	 */
+	explicit SimulationLog(const std::string& fileName);
+
+	bool hasColumn(const std::string& name) const
+	{
+		return mColumns.find(name) != mColumns.end();
+	}
+
+	/**
+	 * Return the series of given column. If the name is empty, the log must have exactly one column.
+	 */
+	const series_t& column(const std::string& name) const;
+
+	std::vector<std::string> columnNames() const;
+};
+
+#endif
@@ -117,11 +117,16 @@ protected:
 	 */
 	std::string mName;
 
+	/**
+	 * Host time budget of the test in milliseconds (0 = the time limit of the runner applies).
+	 */
+	std::size_t mTimeBudget;
+
 public:
 	/**
 	 * Constructor names and registers the object within the global naming registry.
 	 */
-	MoccarduinoTest(const std::string& name) : mName(name)
+	MoccarduinoTest(const std::string& name, std::size_t timeBudget = 0) : mName(name), mTimeBudget(timeBudget)
 	{
 		registry_t& tests = _getTests();
 		if (tests.find(mName) != tests.end())
@@ -148,6 +153,16 @@ public:
 	virtual void run() const = 0;
 
 
+	/**
+	 * Host time budget of the test in milliseconds, the test fails if it runs longer (0 = no own budget).
+	 * Tests are executed concurrently by the parallel runner, so they must not share any mutable state.
+	 */
+	std::size_t getTimeBudget() const
+	{
+		return mTimeBudget;
+	}
+
+
 	/**
 	 * A way to access (read-only) the list of registered tests.
 	 */
@@ -54,3 +54,111 @@ public:
 };
 
 ShiftRegisterTest _shiftRegisterTest;
+
+
+class BitArrayWordsTest : public MoccarduinoTest
+{
+public:
+	BitArrayWordsTest() : MoccarduinoTest("helpers/bit-array-words") {}
+
+	virtual void run() const
+	{
+		BitArray<70> ba(true);
+		ASSERT_EQ(ba.count(), 70, "all bits should be set");
+		ASSERT_EQ(ba.count(false), 0, "no bits should be cleared");
+		ASSERT_TRUE(ba == ~BitArray<70>(false), "negation of empty array should be full array");
+
+		ba.set<std::uint32_t>(0, 60, 8); // crosses the boundary of 64-bit words
+		ASSERT_EQ(ba.get<std::uint32_t>(56, 16), 0x300f, "bits across word boundary (cropped at the end)");
+		ASSERT_EQ(ba.count(false), 8, "cleared bits count");
+		ASSERT_EQ(ba.findFirst(false), 60, "first cleared bit");
+		ASSERT_EQ(ba.findFirst(false, 64), 64, "first cleared bit in second word");
+		ASSERT_EQ(ba.findFirst(false, 68), 70, "no cleared bit after the range");
+
+		std::vector<std::size_t> indices;
+		ba.forEach(false, [&](std::size_t idx) { indices.push_back(idx); });
+		ASSERT_EQ(indices.size(), 8, "number of iterated bits");
+		for (std::size_t i = 0; i < indices.size(); ++i) {
+			ASSERT_EQ(indices[i], 60 + i, "iterated bit index");
+		}
+
+		BitArray<12> a, b;
+		a.set<unsigned>(0xf0f);
+		b.set<unsigned>(0x0ff);
+		ASSERT_EQ((a & b).get<unsigned>(), 0x00f, "bitwise and");
+		ASSERT_EQ((a | b).get<unsigned>(), 0xfff, "bitwise or");
+		ASSERT_EQ((a ^ b).get<unsigned>(), 0xff0, "bitwise xor");
+		ASSERT_EQ((~a).get<unsigned>(), 0x0f0, "negation must not overflow the size");
+	}
+};
+
+BitArrayWordsTest _bitArrayWordsTest;
+
+
+class ShiftRegisterBitsTest : public MoccarduinoTest
+{
+public:
+	ShiftRegisterBitsTest() : MoccarduinoTest("helpers/shift-register-bits") {}
+
+	virtual void run() const
+	{
+		ShiftRegister reg(70), reg2(70);
+		std::uint64_t magic = 0xdeadbeefcafe1234ull;
+		reg.pushBits(magic);
+		reg.pushBits<std::uint8_t>(0xa5);
+		for (std::size_t i = 0; i < 64; ++i) {
+			reg2.push(((magic >> (63 - i)) & 1) != 0);
+		}
+		for (std::size_t i = 0; i < 8; ++i) {
+			reg2.push(((0xa5 >> (7 - i)) & 1) != 0);
+		}
+
+		for (std::size_t i = 0; i < reg.size(); ++i) {
+			ASSERT_EQ(reg[i], reg2[i], "bulk push differs from individual pushes at bit " + std::to_string(i));
+		}
+		ASSERT_EQ((int)reg.get<std::uint8_t>(0), 0xa5, "last pushed byte");
+		ASSERT_EQ(reg.get<std::uint32_t>(0) >> 8, (std::uint32_t)(magic & 0xffffff), "bits pushed before");
+		bool carry = reg.push(false);
+		ASSERT_EQ(carry, ((magic >> 61) & 1) != 0, "carry bit");
+	}
+};
+
+ShiftRegisterBitsTest _shiftRegisterBitsTest;
+
+
+class RingBufferTest : public MoccarduinoTest
+{
+public:
+	RingBufferTest() : MoccarduinoTest("helpers/ring-buffer") {}
+
+	virtual void run() const
+	{
+		RingBuffer<char> buffer(8);
+		std::string data("abcdef");
+		std::size_t count = buffer.push(data.data(), data.size());
+		ASSERT_EQ(count, 6, "all items should fit in");
+
+		char out[8];
+		count = buffer.pop(out, 4);
+		ASSERT_EQ(count, 4, "items should be popped");
+		ASSERT_EQ(std::string(out, 4), "abcd", "wrong popped items");
+
+		// the tail wraps around and the rest is dropped
+		data = "ghijklmn";
+		count = buffer.push(data.data(), data.size());
+		ASSERT_EQ(count, 6, "only free space should be filled");
+		ASSERT_TRUE(buffer.full(), "buffer should be full");
+		ASSERT_EQ(buffer[0], 'e', "wrong first item");
+		ASSERT_EQ(buffer[7], 'l', "wrong last item");
+		ASSERT_EQ(buffer.find('f'), 1, "item before wrap-around not found");
+		ASSERT_EQ(buffer.find('k'), 6, "item after wrap-around not found");
+		ASSERT_EQ(buffer.find('z'), RingBuffer<char>::npos, "missing item found");
+
+		count = buffer.pop(out, 100);
+		ASSERT_EQ(count, 8, "all items should be popped");
+		ASSERT_EQ(std::string(out, 8), "efghijkl", "wrong items popped over wrap-around");
+		ASSERT_TRUE(buffer.empty(), "buffer should be empty");
+	}
+};
+
+RingBufferTest _ringBufferTest;
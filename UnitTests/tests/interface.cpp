@@ -0,0 +1,149 @@
+#include "interface.hpp"
+#include "simulation.hpp"
+
+#include "../test.hpp"
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <cstdint>
+
+/**
+ * The unit tests link the Arduino interface, so they provide the sketch functions as well.
+ * The body of loop() is set by the tests that invoke it (the loop is empty otherwise).
+ */
+thread_local std::function<void()> testLoopBody;
+
+void setup() {}
+
+void loop()
+{
+	if (testLoopBody) {
+		testLoopBody();
+	}
+}
+
+
+class ThreadBindingTest : public MoccarduinoTest
+{
+private:
+	struct Sketch
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation;
+		std::uint8_t value;
+		unsigned long delayMs;
+		unsigned long millisAfterDelay = 0;
+		ArduinoEmulator* previous = nullptr;
+		std::exception_ptr error;
+
+		Sketch(std::uint8_t value, unsigned long delayMs) : simulation(emulator), value(value), delayMs(delayMs)
+		{
+			simulation.registerPin(led1_pin, OUTPUT);
+		}
+
+		/**
+		 * Invoke the Arduino functions as the tested code would (they are forwarded to the emulator bound to the thread).
+		 */
+		void run(std::atomic<int>& bound)
+		{
+			try {
+				previous = bind_arduino_emulator(&emulator);
+
+				// wait for the other thread, so both simulations run at the same time
+				++bound;
+				while (bound < 2) {
+					std::this_thread::yield();
+				}
+
+				pinMode(led1_pin, OUTPUT);
+				digitalWrite(led1_pin, value);
+				delay(delayMs);
+				millisAfterDelay = millis();
+				bind_arduino_emulator(nullptr);
+			}
+			catch (...) {
+				error = std::current_exception();
+			}
+		}
+	};
+
+public:
+	ThreadBindingTest() : MoccarduinoTest("interface/thread-binding") {}
+
+	virtual void run() const
+	{
+		Sketch sketch1(HIGH, 10), sketch2(LOW, 500);
+		std::atomic<int> bound(0);
+		std::thread thread1([&]() { sketch1.run(bound); });
+		std::thread thread2([&]() { sketch2.run(bound); });
+		thread1.join();
+		thread2.join();
+
+		if (sketch1.error) std::rethrow_exception(sketch1.error);
+		if (sketch2.error) std::rethrow_exception(sketch2.error);
+
+		ASSERT_TRUE(sketch1.previous == nullptr, "a new thread should start with the default emulator");
+		ASSERT_TRUE(sketch2.previous == nullptr, "a new thread should start with the default emulator");
+
+		ASSERT_EQ(sketch1.simulation.getPinValue(led1_pin), HIGH, "pin of the first emulator was changed");
+		ASSERT_EQ(sketch2.simulation.getPinValue(led1_pin), LOW, "pin of the second emulator was changed");
+		ASSERT_EQ(sketch1.millisAfterDelay, 10, "wrong time of the first emulator");
+		ASSERT_EQ(sketch2.millisAfterDelay, 500, "wrong time of the second emulator");
+		ASSERT_LT(sketch1.simulation.getCurrentTime(), 20000, "the first emulator advanced by the other thread");
+		ASSERT_GE(sketch2.simulation.getCurrentTime(), 500000, "wrong time of the second emulator");
+
+		// the binding is private to each thread
+		ArduinoEmulator emulator;
+		ASSERT_TRUE(bind_arduino_emulator(&emulator) == nullptr, "the main thread should not see the bindings of other threads");
+		ASSERT_TRUE(bind_arduino_emulator(nullptr) == &emulator, "the binding of the main thread was not kept");
+	}
+};
+
+
+ThreadBindingTest _threadBindingTest;
+
+
+class LoopExceptionTest : public MoccarduinoTest
+{
+public:
+	LoopExceptionTest() : MoccarduinoTest("interface/loop-exception") {}
+
+	virtual void run() const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		TimeSeries<std::string> serial;
+		simulation.attachSerialOutputConsumer(&serial);
+		simulation.enableMethod("serial");
+		simulation.setWatchdogLoopLimit(1000);
+
+		// the loop writes some output and then it is terminated by the watchdog
+		auto previous = bind_arduino_emulator(&emulator);
+		testLoopBody = []() {
+			Serial.print("abc");
+			delay(2);
+		};
+		bool terminated = false;
+		try {
+			simulation.runSingleLoop();
+		}
+		catch (ArduinoWatchdogException&) {
+			terminated = true;
+		}
+		testLoopBody = nullptr;
+		bind_arduino_emulator(previous);
+
+		ASSERT_TRUE(terminated, "the loop should be terminated by the watchdog");
+		ASSERT_EQ(serial.size(), 1, "serial output written before the exception should be flushed");
+		ASSERT_EQ(serial[0].value, "abc", "wrong serial output of the terminated loop");
+
+		// the watchdog of the terminated loop is no longer armed, so the controller can be used further
+		emulator.delay(5);
+		simulation.runSingleLoop();
+		ASSERT_GE(simulation.getCurrentTime(), 7000, "time did not advance after the terminated loop");
+	}
+};
+
+LoopExceptionTest _loopExceptionTest;
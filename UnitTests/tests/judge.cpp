@@ -0,0 +1,89 @@
+#include "judge.hpp"
+#include "time_series.hpp"
+
+#include "../test.hpp"
+
+#include <vector>
+#include <random>
+#include <cstdint>
+
+class JudgePairEventsTest : public MoccarduinoTest
+{
+private:
+	using pair_t = EventsJudge::EventsPair;
+	static constexpr std::size_t NONE = EventsJudge::NONE;
+
+	static TimeSeries<int> makeTs(const std::vector<std::pair<logtime_t, int>>& events)
+	{
+		TimeSeries<int> ts;
+		for (auto&& [time, value] : events) {
+			ts.addEvent(time, value);
+		}
+		return ts;
+	}
+
+public:
+	JudgePairEventsTest() : MoccarduinoTest("judge/pair-events") {}
+
+	virtual void run() const
+	{
+		auto expected = makeTs({ { 100, 1 }, { 200, 2 }, { 300, 3 }, { 400, 4 } });
+
+		auto exact = EventsJudge::pairEvents(expected, makeTs({ { 110, 1 }, { 210, 2 }, { 310, 3 }, { 410, 4 } }), (logtime_t)20);
+		ASSERT_EQ(exact.size(), 4, "all events paired");
+		for (std::size_t i = 0; i < exact.size(); ++i) {
+			ASSERT_TRUE(exact[i] == pair_t(i, i), "events paired one to one");
+		}
+
+		// early event, a glitch before the matching value, a wrong value, and a missing event
+		auto actual = makeTs({ { 50, 9 }, { 100, 7 }, { 105, 1 }, { 250, 5 }, { 500, 4 } });
+		auto mapping = EventsJudge::pairEvents(expected, actual, (logtime_t)60);
+		std::vector<pair_t> correct{ { NONE, 0 }, { NONE, 1 }, { 0, 2 }, { 1, 3 }, { 2, NONE }, { 3, NONE } };
+		ASSERT_EQ(mapping.size(), correct.size(), "mapping size");
+		for (std::size_t i = 0; i < mapping.size(); ++i) {
+			ASSERT_TRUE(mapping[i] == correct[i], "mapping item");
+		}
+
+		ASSERT_EQ(EventsJudge::pairEvents(TimeSeries<int>(), actual, (logtime_t)10).size(), 0, "trailing actual events are not in the mapping");
+	}
+};
+
+
+class JudgeCompareSeriesTest : public MoccarduinoTest
+{
+public:
+	JudgeCompareSeriesTest() : MoccarduinoTest("judge/compare-series") {}
+
+	virtual void run() const
+	{
+		std::mt19937 gen(42);
+		std::vector<TimeSeries<int>> series(5);
+		for (auto& ts : series) {
+			logtime_t time = 0;
+			for (std::size_t i = 0; i < 200; ++i) {
+				time += gen() % 50; // duplicate timestamps are allowed
+				ts.addEvent(time, (int)(gen() % 3));
+			}
+		}
+
+		std::vector<const TimeSeries<int>*> ptrs;
+		for (auto const& ts : series) {
+			ptrs.push_back(&ts);
+		}
+
+		for (logtime_t start : { 0, 10, 1000, 3000 }) {
+			for (logtime_t end : { 500, 2000, 5000, 20000 }) {
+				auto res = EventsJudge::compareSeries(ptrs, start, end, 0);
+				ASSERT_EQ(res.size(), series.size(), "one result per series");
+				ASSERT_EQ(res[0], 0, "reference does not differ from itself");
+				for (std::size_t i = 1; i < series.size(); ++i) {
+					ASSERT_EQ(res[i], series[0].compare(series[i], TimeSeries<int>::Range(start, end), 0), "same as pairwise compare");
+				}
+			}
+		}
+	}
+};
+
+
+JudgePairEventsTest _judgePairEventsTest;
+JudgeCompareSeriesTest _judgeCompareSeriesTest;
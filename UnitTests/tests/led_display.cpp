@@ -202,3 +202,308 @@ public:
 };
 
 DemultiplexingTest2 _demultiplexingTest2;
+
+
+
+class SerialDisplayShiftOutTest : public MoccarduinoTest
+{
+private:
+	using display_t = SerialSegLedDisplay<4>;
+
+	/**
+	 * Show given glyphs on the display either using shiftOut() or by writing the data and clock pins directly.
+	 */
+	static void show(ArduinoEmulator& emulator, const std::vector<std::uint8_t>& glyphs, bool useShiftOut, std::uint8_t bitOrder)
+	{
+		for (std::size_t i = 0; i < glyphs.size(); ++i) {
+			std::uint8_t bytes[]{ glyphs[i], (std::uint8_t)(1 << i) };
+			emulator.digitalWrite(latch_pin, LOW);
+			for (auto byte : bytes) {
+				if (useShiftOut) {
+					emulator.shiftOut(data_pin, clock_pin, bitOrder, byte);
+				}
+				else {
+					for (std::size_t b = 0; b < 8; ++b) {
+						std::size_t bit = bitOrder == LSBFIRST ? b : 7 - b;
+						emulator.digitalWrite(data_pin, (byte >> bit) & 1);
+						emulator.digitalWrite(clock_pin, HIGH);
+						emulator.digitalWrite(clock_pin, LOW);
+					}
+				}
+			}
+			emulator.digitalWrite(latch_pin, HIGH);
+		}
+	}
+
+	static void run(bool useShiftOut, std::uint8_t bitOrder, TimeSeries<display_t::state_t>& states, TimeSeries<ArduinoPinState>& pins)
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		display_t display;
+		for (pin_t pin : { latch_pin, clock_pin, data_pin }) {
+			simulation.registerPin(pin, OUTPUT);
+			emulator.pinMode(pin, OUTPUT);
+		}
+		display.attachToSimulation(simulation);
+		display.attachSproutConsumer(states);
+		display.attachNextConsumer(pins);
+
+		show(emulator, { LED_7SEG_DIGITS_MAP[1], LED_7SEG_DIGITS_MAP[2], LED_7SEG_DIGITS_MAP[3], LED_7SEG_DIGITS_MAP[4] }, useShiftOut, bitOrder);
+		show(emulator, { LED_7SEG_DASH, LED_7SEG_EMPTY_SPACE, LED_7SEG_DIGITS_MAP[7], LED_7SEG_DECIMAL_DOT }, useShiftOut, bitOrder);
+	}
+
+	void test(std::uint8_t bitOrder) const
+	{
+		TimeSeries<display_t::state_t> bulkStates, bitStates;
+		TimeSeries<ArduinoPinState> bulkPins, bitPins;
+		run(true, bitOrder, bulkStates, bulkPins);
+		run(false, bitOrder, bitStates, bitPins);
+
+		ASSERT_EQ(bulkStates.size(), bitStates.size(), "number of display states differ");
+		for (std::size_t i = 0; i < bulkStates.size(); ++i) {
+			ASSERT_TRUE(bulkStates[i] == bitStates[i], "display state #" + std::to_string(i) + " differs");
+		}
+
+		ASSERT_EQ(bulkPins.size(), bitPins.size(), "number of pin events differ");
+		for (std::size_t i = 0; i < bulkPins.size(); ++i) {
+			ASSERT_TRUE(bulkPins[i] == bitPins[i], "pin event #" + std::to_string(i) + " differs");
+		}
+	}
+
+public:
+	SerialDisplayShiftOutTest() : MoccarduinoTest("led_display/serial-display-shift-out") {}
+
+	virtual void run() const
+	{
+		test(MSBFIRST);
+		test(LSBFIRST);
+	}
+};
+
+SerialDisplayShiftOutTest _serialDisplayShiftOutTest;
+
+
+
+class DemultiplexingBitSlicedTest : public MoccarduinoTest
+{
+public:
+	using leds_t = BitArray<32>;
+
+	DemultiplexingBitSlicedTest() : MoccarduinoTest("led_display/demultiplexing-bit-sliced") {}
+
+	virtual void run() const
+	{
+		FutureTimeSeries<leds_t> perLedInput, bitSlicedInput;
+		LedsEventsDemultiplexer<32> perLedDemuxer(10000, 1000, false);
+		LedsEventsDemultiplexer<32> bitSlicedDemuxer(10000, 1000, true);
+		TimeSeries<leds_t> perLedOutput, bitSlicedOutput;
+
+		perLedInput.attachNextConsumer(perLedDemuxer);
+		bitSlicedInput.attachNextConsumer(bitSlicedDemuxer);
+		perLedDemuxer.attachNextConsumer(perLedOutput);
+		bitSlicedDemuxer.attachNextConsumer(bitSlicedOutput);
+
+		// pseudo-random multiplexed input (simple LCG, so the test is deterministic)
+		std::uint32_t seed = 42;
+		logtime_t ts = 1000;
+		for (std::size_t i = 0; i < 20000; ++i) {
+			seed = seed * 1664525u + 1013904223u;
+			leds_t leds;
+			leds.set(~((seed & 0xffu) << ((seed >> 30) * 8))); // random segments of one random digit are ON
+			perLedInput.addFutureEvent(ts, leds);
+			bitSlicedInput.addFutureEvent(ts, leds);
+			ts += 10 + (seed >> 23); // up to ~500us per step
+		}
+
+		perLedInput.advanceTime(ts + 100000);
+		bitSlicedInput.advanceTime(ts + 100000);
+
+		ASSERT_LT((std::size_t)100, perLedOutput.size(), "too few demuxed events");
+		ASSERT_EQ(perLedOutput.size(), bitSlicedOutput.size(), "");
+		for (std::size_t i = 0; i < perLedOutput.size(); ++i) {
+			ASSERT_EQ(perLedOutput[i].time, bitSlicedOutput[i].time, "");
+			ASSERT_EQ(perLedOutput[i].value.get<std::uint32_t>(0), bitSlicedOutput[i].value.get<std::uint32_t>(0), "");
+		}
+	}
+};
+
+DemultiplexingBitSlicedTest _demultiplexingBitSlicedTest;
+
+
+
+class Led7SegDecodeSeriesTest : public MoccarduinoTest
+{
+public:
+	using interpreter_t = Led7SegInterpreter<4>;
+
+	Led7SegDecodeSeriesTest() : MoccarduinoTest("led_display/7seg-decode-series") {}
+
+	virtual void run() const
+	{
+		static_assert(LED_7SEG_DECODE_TABLE.decode(LED_7SEG_DIGITS_MAP[8]) == '8', "decode table is built at compile time");
+		static_assert(LED_7SEG_DECODE_TABLE.decode(LED_7SEG_DIGITS_MAP[1] & LED_7SEG_DECIMAL_DOT, true) == '1', "");
+		static_assert(LED_7SEG_DECODE_TABLE.decode(LED_7SEG_DIGITS_MAP[1]) == 'i', "");
+
+		// mixture of valid glyphs and random garbage
+		std::vector<std::uint8_t> glyphs{ LED_7SEG_EMPTY_SPACE, LED_7SEG_DASH };
+		glyphs.insert(glyphs.end(), std::begin(LED_7SEG_DIGITS_MAP), std::end(LED_7SEG_DIGITS_MAP));
+		glyphs.insert(glyphs.end(), std::begin(LED_7SEG_LETTERS_MAP), std::end(LED_7SEG_LETTERS_MAP));
+
+		TimeSeries<interpreter_t::state_t> series;
+		std::uint32_t seed = 7;
+		for (logtime_t ts = 0; ts < 5000; ++ts) {
+			interpreter_t::state_t state;
+			for (std::size_t idx = 0; idx < 4; ++idx) {
+				seed = seed * 1664525u + 1013904223u;
+				std::uint8_t glyph = (seed >> 28) == 0 ? (std::uint8_t)(seed >> 8) : glyphs[(seed >> 8) % glyphs.size()];
+				if ((seed >> 27) & 1) {
+					glyph &= LED_7SEG_DECIMAL_DOT;
+				}
+				state.set(glyph, idx * 8);
+			}
+			series.addEvent(ts, state);
+		}
+
+		for (char replacement : { '\0', '?' }) {
+			TimeSeries<std::string> texts;
+			TimeSeries<int> numbers;
+			interpreter_t::decodeSeries(series, texts, numbers, replacement);
+
+			ASSERT_EQ(texts.size(), series.size(), "");
+			ASSERT_EQ(numbers.size(), series.size(), "");
+			for (std::size_t i = 0; i < series.size(); ++i) {
+				interpreter_t interpreter(series[i].value);
+				ASSERT_EQ(texts[i].time, series[i].time, "");
+				ASSERT_EQ(texts[i].value, interpreter.getText(replacement), "");
+				ASSERT_EQ(numbers[i].value, interpreter.getNumber(), "");
+			}
+		}
+	}
+};
+
+Led7SegDecodeSeriesTest _led7SegDecodeSeriesTest;
+
+
+
+class LedsPipelineTest : public MoccarduinoTest
+{
+public:
+	using leds_t = BitArray<4>;
+	using pipeline_t = Pipeline<LedDisplay<4>, LedsEventsDemultiplexer<4>, LedsEventsAggregator<4>, TimeSeries<leds_t>>;
+
+	LedsPipelineTest() : MoccarduinoTest("led_display/pipeline") {}
+
+	/**
+	 * Multiplex LEDs 1+2 and then LEDs 3+4 in given emulator.
+	 */
+	void simulate(ArduinoSimulationController& simulation, ArduinoEmulator& emulator, LedDisplay<4>& display) const
+	{
+		std::vector<pin_t> pins = { 1, 2, 3, 4 };
+		for (auto pin : pins) {
+			simulation.registerPin(pin, OUTPUT);
+			emulator.pinMode(pin, OUTPUT);
+		}
+		display.attachToSimulation(simulation, pins);
+
+		for (std::size_t i = 0; i < 4000; ++i) {
+			pin_t pin = pins[(i % 2) + (i < 2000 ? 0 : 2)];
+			emulator.digitalWrite(pin, ON);
+			emulator.delayMicroseconds(50);
+			emulator.digitalWrite(pin, OFF);
+		}
+		emulator.delay(100);
+	}
+
+	virtual void run() const
+	{
+		// statically composed chain (display sprout is linked to the demuxer automatically)
+		ArduinoEmulator pipelineEmulator;
+		ArduinoSimulationController pipelineSimulation(pipelineEmulator);
+		pipeline_t pipeline(LedDisplay<4>(), LedsEventsDemultiplexer<4>(20000), LedsEventsAggregator<4>(20000), TimeSeries<leds_t>());
+		simulate(pipelineSimulation, pipelineEmulator, pipeline.front());
+
+		// equivalent dynamic chain
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		LedDisplay<4> display;
+		LedsEventsDemultiplexer<4> demuxer(20000);
+		LedsEventsAggregator<4> aggregator(20000);
+		TimeSeries<leds_t> output;
+		display.attachSproutConsumer(demuxer);
+		demuxer.attachNextConsumer(aggregator);
+		aggregator.attachNextConsumer(output);
+		simulate(simulation, emulator, display);
+
+		auto& pipelineOutput = pipeline.back();
+		ASSERT_LT((std::size_t)0, output.size(), "no events passed through the chain");
+		ASSERT_EQ(pipelineOutput.size(), output.size(), "pipeline and dynamic chain outputs differ");
+		for (std::size_t i = 0; i < output.size(); ++i) {
+			ASSERT_EQ(pipelineOutput[i].time, output[i].time, "");
+			ASSERT_EQ(pipelineOutput[i].value.get<unsigned>(0), output[i].value.get<unsigned>(0), "");
+		}
+	}
+};
+
+LedsPipelineTest _ledsPipelineTest;
+
+
+
+class PwmBrightnessTest : public MoccarduinoTest
+{
+public:
+	using leds_t = BitArray<4>;
+
+	PwmBrightnessTest() : MoccarduinoTest("led_display/pwm-brightness") {}
+
+	/**
+	 * Dim LEDs by analogWrite() and return the demuxed states.
+	 */
+	static void simulate(bool useBrightness, bool bitSliced, TimeSeries<leds_t>& output, TimeSeries<ArduinoPinState>& pins)
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		LedDisplay<4> display;
+		LedsEventsDemultiplexer<4> demuxer(20000, 2000, bitSliced);
+		std::vector<pin_t> wiring = { 3, 5, 6, 9 }; // pins with PWM
+		for (auto pin : wiring) {
+			simulation.registerPin(pin, OUTPUT);
+		}
+		display.attachToSimulation(simulation, wiring);
+		display.attachSproutConsumer(demuxer);
+		display.attachNextConsumer(pins);
+		demuxer.attachNextConsumer(output);
+		if (useBrightness) {
+			demuxer.setBrightnessSource(&display.getBrightness());
+		}
+
+		emulator.analogWrite(3, 127);	// bright enough (ON is LOW)
+		emulator.analogWrite(5, 250);	// too dim (about 2%)
+		emulator.pinMode(6, OUTPUT);
+		emulator.digitalWrite(6, ON);	// fully lit
+		emulator.analogWrite(9, 255);	// constantly HIGH (OFF)
+		emulator.delay(100);
+	}
+
+	virtual void run() const
+	{
+		TimeSeries<leds_t> output, bitSlicedOutput, unweightedOutput;
+		TimeSeries<ArduinoPinState> pins, bitSlicedPins, unweightedPins;
+		simulate(true, false, output, pins);
+		simulate(true, true, bitSlicedOutput, bitSlicedPins);
+		simulate(false, false, unweightedOutput, unweightedPins);
+
+		ASSERT_EQ(pins.size(), 4, "one pin event per duty change");
+		ASSERT_TRUE(pins[0].value.isPwm(), "PWM event");
+		ASSERT_EQ((int)pins[1].value.duty, 250, "duty cycle of the event");
+		ASSERT_FALSE(pins[3].value.isPwm(), "full duty cycle is a constant level");
+		ASSERT_EQ(pins[3].value.value, HIGH, "full duty cycle is HIGH");
+
+		ASSERT_EQ(output.size(), 1, "demuxed state");
+		ASSERT_EQ(output.back().value.get<unsigned>(0), 0b1010u, "dim LED is OFF");
+		ASSERT_EQ(bitSlicedOutput.size(), 1, "bit-sliced demuxed state");
+		ASSERT_EQ(bitSlicedOutput.back().value.get<unsigned>(0), 0b1010u, "bit-sliced dim LED is OFF");
+		ASSERT_EQ(unweightedOutput.back().value.get<unsigned>(0), 0b1000u, "without brightness the dim LED is ON");
+	}
+};
+
+PwmBrightnessTest _pwmBrightnessTest;
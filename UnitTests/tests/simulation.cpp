@@ -1,8 +1,13 @@
 #include "simulation.hpp"
+#include "led_display.hpp"
+#include "stats.hpp"
 
 #include "../test.hpp"
 
 #include <functional>
+#include <sstream>
+#include <thread>
+#include <chrono>
 #include <cstdint>
 
 class DisableFunctionsTest : public MoccarduinoTest
@@ -33,19 +38,21 @@ public:
 		emulator.pinMode(1, INPUT);
 		simulation.registerPin(2, OUTPUT);
 		emulator.pinMode(2, OUTPUT);
+		simulation.registerPin(3, OUTPUT);
+		emulator.pinMode(3, OUTPUT);
 
 		testDisableFunction(simulation, "pinMode", [&]() { emulator.pinMode(1, INPUT); });
 		testDisableFunction(simulation, "digitalWrite", [&]() { emulator.digitalWrite(2, 0); });
 		testDisableFunction(simulation, "digitalRead", [&]() { emulator.digitalRead(1); });
 		testDisableFunction(simulation, "analogRead", [&]() { emulator.analogRead(1); });
 		//testDisableFunction(simulation, "analogReference", [&]() { emulator.analogReference(); }); NOT IMPLEMENTED YET
-		//testDisableFunction(simulation, "analogWrite", [&]() { emulator.analogWrite(); }); NOT IMPLEMENTED YET
+		testDisableFunction(simulation, "analogWrite", [&]() { emulator.analogWrite(3, 128); });
 		testDisableFunction(simulation, "millis", [&]() { emulator.millis(); });
 		testDisableFunction(simulation, "micros", [&]() { emulator.micros(); });
 		testDisableFunction(simulation, "delay", [&]() { emulator.delay(1); });
 		testDisableFunction(simulation, "delayMicroseconds", [&]() { emulator.delayMicroseconds(1); });
-		//testDisableFunction(simulation, "pulseIn", [&]() { emulator.pulseIn(); }); NOT IMPLEMENTED YET
-		//testDisableFunction(simulation, "pulseInLong", [&]() { emulator.delay(1); }); NOT IMPLEMENTED YET
+		testDisableFunction(simulation, "pulseIn", [&]() { emulator.pulseIn(1, HIGH, 10); });
+		testDisableFunction(simulation, "pulseInLong", [&]() { emulator.pulseInLong(1, HIGH, 10); });
 		testDisableFunction(simulation, "shiftOut", [&]() { emulator.shiftOut(2, 2, LSBFIRST, 0); });
 		testDisableFunction(simulation, "shiftIn", [&]() { emulator.shiftIn(1, 2, LSBFIRST); });
 		//testDisableFunction(simulation, "tone", [&]() { emulator.tone(); }); NOT IMPLEMENTED YET
@@ -56,3 +63,436 @@ public:
 
 
 DisableFunctionsTest _disableFunctionsTest;
+
+
+class InputDeadlinesTest : public MoccarduinoTest
+{
+public:
+	InputDeadlinesTest() : MoccarduinoTest("simulation/input-deadlines") {}
+
+	virtual void run() const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		simulation.registerPin(1, INPUT);
+		simulation.registerPin(2, OUTPUT);
+		emulator.pinMode(1, INPUT);
+		emulator.pinMode(2, OUTPUT);
+
+		TimeSeries<ArduinoPinState> outputs;
+		simulation.attachPinEventsConsumer(2, outputs);
+
+		simulation.enqueuePinValueChange(1, LOW, 1000);
+		simulation.enqueuePinValueChange(1, HIGH, 5000);
+		logtime_t start = simulation.getCurrentTime();
+
+		while (simulation.getCurrentTime() < start + 10000) {
+			logtime_t time = simulation.getCurrentTime();
+			int expected = (time >= start + 1000 && time < start + 5000) ? LOW : HIGH;
+			int value = emulator.digitalRead(1);
+			ASSERT_EQ(value, expected, "input event has not been delivered in time at " + std::to_string(time));
+			emulator.delayMicroseconds(100);
+		}
+
+		emulator.digitalWrite(2, HIGH);
+		emulator.delayMicroseconds(100);
+		emulator.digitalWrite(2, LOW);
+		ASSERT_EQ(outputs.size(), 2, "output events has not been recorded");
+		ASSERT_EQ(outputs[1].time - outputs[0].time, 100 + 20, "output events timestamps differ");
+	}
+};
+
+
+InputDeadlinesTest _inputDeadlinesTest;
+
+
+class PulseInTest : public MoccarduinoTest
+{
+public:
+	PulseInTest() : MoccarduinoTest("simulation/pulse-in") {}
+
+	virtual void run() const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		simulation.registerPin(1, INPUT);
+		emulator.pinMode(1, INPUT);
+
+		logtime_t start = simulation.getCurrentTime();
+		simulation.enqueuePinValueChange(1, HIGH, 0);
+		simulation.enqueuePinValueChange(1, LOW, 1000);
+		simulation.enqueuePinValueChange(1, HIGH, 3000);
+		simulation.enqueuePinValueChange(1, LOW, 10000);
+		simulation.enqueuePinValueChange(1, HIGH, 10500);
+
+		auto width = emulator.pulseIn(1, LOW, 5000);
+		ASSERT_EQ(width, 2000, "wrong width of LOW pulse");
+		ASSERT_EQ(simulation.getCurrentTime(), start + 3000, "time has not jumped to the end of the pulse");
+		int value = emulator.digitalRead(1);
+		ASSERT_EQ(value, HIGH, "events of the pulse has not been delivered");
+
+		// the pin is HIGH already, so the pulse starts at 10500 (after LOW at 10000) and it never ends
+		logtime_t time = simulation.getCurrentTime();
+		width = emulator.pulseInLong(1, HIGH, 20000);
+		ASSERT_EQ(width, 0, "unfinished pulse has been measured");
+		ASSERT_EQ(simulation.getCurrentTime(), time + 20000, "time has not jumped to the timeout");
+
+		width = emulator.pulseIn(1, LOW, 1000);
+		ASSERT_EQ(width, 0, "pulse without any input events has been measured");
+		ASSERT_EQ(simulation.getCurrentTime(), time + 21000, "time has not jumped to the timeout");
+	}
+};
+
+
+PulseInTest _pulseInTest;
+
+
+class SerialTest : public MoccarduinoTest
+{
+public:
+	SerialTest() : MoccarduinoTest("simulation/serial") {}
+
+	virtual void run() const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		TimeSeries<std::string> output;
+		simulation.attachSerialOutputConsumer(&output);
+
+		emulator.addSerialData("hello world");
+		ASSERT_EQ(emulator.serialDataAvailable(), 12, "wrong number of bytes received");
+
+		char buffer[16];
+		std::size_t length = emulator.readSerialBytesUntil(' ', buffer, sizeof(buffer));
+		ASSERT_EQ(std::string(buffer, length), "hello", "wrong bytes read until terminator");
+		length = emulator.readSerialBytes(buffer, 3);
+		ASSERT_EQ(std::string(buffer, length), "wor", "wrong bytes read");
+		length = emulator.readSerialBytesUntil(' ', buffer, sizeof(buffer));
+		ASSERT_EQ(std::string(buffer, length), "ld\n", "terminator not found, all available bytes should be read");
+
+		// writes are coalesced until flushed
+		logtime_t start = simulation.getCurrentTime();
+		emulator.writeSerial("a");
+		emulator.delayMicroseconds(100);
+		emulator.writeSerial("b\r\n");
+		emulator.flushSerialOutput();
+		emulator.flushSerialOutput();
+		emulator.writeSerial("c");
+		emulator.flushSerialOutput();
+
+		ASSERT_EQ(output.size(), 2, "writes are not coalesced");
+		ASSERT_EQ(output[0].time, start, "event should have the time of the first write");
+		ASSERT_EQ(output[0].value, "ab\r\n", "wrong coalesced output");
+		ASSERT_EQ(output[1].value, "c", "wrong output");
+
+		std::string longData(ArduinoEmulator::SERIAL_BUFFER_CAPACITY, 'x');
+		emulator.addSerialData(longData);
+		ASSERT_EQ(emulator.serialDataAvailable(), ArduinoEmulator::SERIAL_BUFFER_CAPACITY, "buffer should be full");
+		ASSERT_EQ(emulator.getSerialOverflow(), 1, "the newline should be dropped");
+	}
+};
+
+
+SerialTest _serialTest;
+
+
+class LazyInputSourceTest : public MoccarduinoTest
+{
+private:
+	/**
+	 * Toggles the input pin every millisecond, events are enqueued only when requested.
+	 */
+	class ToggleSource : public InputEventsSource
+	{
+	private:
+		ArduinoSimulationController& mSimulation;
+		logtime_t mStart;
+		logtime_t mNext;
+		logtime_t mEnd;
+
+	public:
+		ToggleSource(ArduinoSimulationController& simulation, logtime_t start, logtime_t end)
+			: mSimulation(simulation), mStart(start), mNext(start), mEnd(end) {}
+
+		logtime_t nextEventTime() const override
+		{
+			return mNext < mEnd ? mNext : EventConsumer<ArduinoPinState>::NO_DEADLINE;
+		}
+
+		void loadEventsUntil(logtime_t time) override
+		{
+			while (mNext < mEnd && mNext <= time) {
+				mSimulation.enqueuePinValueChangeAt(1, ((mNext - mStart) / 1000) % 2 ? HIGH : LOW, mNext);
+				mNext += 1000;
+			}
+		}
+	};
+
+public:
+	LazyInputSourceTest() : MoccarduinoTest("simulation/lazy-input-source") {}
+
+	virtual void run() const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		simulation.registerPin(1, INPUT);
+		emulator.pinMode(1, INPUT);
+
+		logtime_t start = simulation.getCurrentTime() + 1000;
+		ToggleSource source(simulation, start, start + 10000);
+		simulation.attachInputSource(&source);
+
+		while (simulation.getCurrentTime() < start + 12000) {
+			logtime_t time = simulation.getCurrentTime();
+			int expected = time >= start && time < start + 10000 && ((time - start) / 1000) % 2 == 0 ? LOW : HIGH;
+			int value = emulator.digitalRead(1);
+			ASSERT_EQ(value, expected, "lazily loaded event has not been delivered in time at " + std::to_string(time));
+			emulator.delayMicroseconds(150);
+			ASSERT_GT(source.nextEventTime(), simulation.getCurrentTime(), "due events were not loaded at " + std::to_string(time));
+		}
+
+		ASSERT_EQ(source.nextEventTime(), EventConsumer<ArduinoPinState>::NO_DEADLINE, "not all events were loaded");
+		simulation.attachInputSource(nullptr);
+	}
+};
+
+
+class EmulatorStatsTest : public MoccarduinoTest
+{
+public:
+	EmulatorStatsTest() : MoccarduinoTest("simulation/stats") {}
+
+	virtual void run() const
+	{
+		EmulatorStats stats;
+		logtime_t currentTime = 100;
+		{
+			EmulatorStats::LoopScope loop(stats, currentTime);
+			for (int i = 0; i < 3; ++i) {
+				EmulatorStats::CallScope call(stats, EmulatorStats::Api::DIGITAL_WRITE, currentTime);
+				stats.recordPinWrites(13);
+				currentTime += 20;
+			}
+			EmulatorStats::CallScope call(stats, EmulatorStats::Api::DELAY, currentTime);
+			currentTime += 1000;
+		}
+		stats.recordPinRead(15);
+
+		ASSERT_EQ(stats.api(EmulatorStats::Api::DIGITAL_WRITE).calls, 3, "digitalWrite calls");
+		ASSERT_EQ(stats.api(EmulatorStats::Api::DIGITAL_WRITE).emulatedTime, 60, "digitalWrite emulated time");
+		ASSERT_EQ(stats.api(EmulatorStats::Api::DELAY).emulatedTime, 1000, "delay emulated time");
+		ASSERT_EQ(stats.api(EmulatorStats::Api::MILLIS).calls, 0, "millis calls");
+		ASSERT_EQ(stats.pins().at(13).writes, 3, "pin writes");
+		ASSERT_EQ(stats.pins().at(15).reads, 1, "pin reads");
+		ASSERT_EQ(stats.loopEmulatedTime().count(), 1, "loops count");
+		ASSERT_EQ(stats.loopEmulatedTime().max(), 1060, "loop emulated time");
+
+		// host times are bucketed by powers of two
+		stats.recordLoop(0, 0);
+		stats.recordLoop(600000, 0);
+		stats.recordLoop(1048575, 0);
+		ASSERT_EQ(stats.histogramBucket(0), 1, "zero bucket");
+		ASSERT_EQ(stats.histogramBucket(20), 2, "[2^19, 2^20) bucket");
+
+		std::stringstream json;
+		stats.writeJson(json);
+		ASSERT_TRUE(json.str().find("\"digitalWrite\":{\"calls\":3,\"emulated_us\":60}") != std::string::npos, "api calls in json");
+		ASSERT_TRUE(json.str().find("\"13\":{\"writes\":3,\"reads\":0}") != std::string::npos, "pins in json");
+
+		// calls emulated in bulk (e.g., by shiftOut()) are counted as regular calls
+		stats.recordApiCalls(EmulatorStats::Api::DIGITAL_WRITE, 24, 480);
+		ASSERT_EQ(stats.api(EmulatorStats::Api::DIGITAL_WRITE).calls, 27, "digitalWrite calls emulated in bulk");
+		ASSERT_EQ(stats.api(EmulatorStats::Api::DIGITAL_WRITE).emulatedTime, 540, "digitalWrite time emulated in bulk");
+
+		stats.clear();
+		ASSERT_EQ(stats.loopHostTime().count(), 0, "cleared loops");
+		ASSERT_TRUE(stats.pins().empty(), "cleared pins");
+	}
+};
+
+
+class WatchdogTest : public MoccarduinoTest
+{
+public:
+	WatchdogTest() : MoccarduinoTest("simulation/watchdog") {}
+
+	virtual void run() const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		simulation.registerPin(2, OUTPUT);
+		emulator.pinMode(2, OUTPUT);
+
+		// the watchdog is disabled by default
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		for (int i = 0; i < 1000; ++i) {
+			emulator.digitalWrite(2, i & 1);
+		}
+
+		simulation.setWatchdogHostBudget(std::chrono::milliseconds(1));
+		emulator.millis(); // within the budget
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		ASSERT_EXCEPTION(ArduinoWatchdogException, [&]() {
+			while (true) {
+				emulator.millis(); // busy polling of time is interrupted as well
+			}
+		}, "host time budget exceeded");
+
+		simulation.setWatchdogHostBudget(std::chrono::steady_clock::duration::zero());
+		emulator.digitalWrite(2, LOW);
+		for (int i = 0; i < 1000; ++i) {
+			emulator.millis();
+		}
+	}
+};
+
+
+class TraceReplayTest : public MoccarduinoTest
+{
+private:
+	/**
+	 * Register the same pins in the recorded and in the replayed simulation (1 input, 2 output, 4-6 serial display).
+	 */
+	static void registerPins(ArduinoSimulationController& simulation)
+	{
+		simulation.registerPin(1, INPUT);
+		for (pin_t pin = 2; pin <= 6; ++pin) {
+			simulation.registerPin(pin, OUTPUT);
+		}
+	}
+
+public:
+	TraceReplayTest() : MoccarduinoTest("simulation/trace-replay") {}
+
+	virtual void run() const
+	{
+		std::stringstream traceData;
+		TimeSeries<ArduinoPinState> recorded;
+		TimeSeries<BitArray<32>> recordedDisplay;
+		logtime_t endTime = 0;
+		{
+			ArduinoEmulator emulator;
+			ArduinoSimulationController simulation(emulator);
+			registerPins(simulation);
+			simulation.attachPinEventsConsumer(2, recorded);
+			SerialSegLedDisplay<4> display;
+			display.attachToSimulation(simulation, 4, 5, 6);
+			display.attachSproutConsumer(recordedDisplay);
+
+			EmulatorTraceWriter trace(traceData);
+			simulation.attachTraceRecorder(&trace);
+			simulation.enqueuePinValueChange(1, LOW, 300);
+
+			emulator.pinMode(1, INPUT);
+			for (pin_t pin = 2; pin <= 6; ++pin) {
+				emulator.pinMode(pin, OUTPUT);
+			}
+			emulator.digitalWrite(2, HIGH);
+			emulator.delayMicroseconds(200);
+			emulator.digitalWrite(2, LOW);
+			emulator.digitalWrite(6, LOW);
+			emulator.shiftOut(4, 5, MSBFIRST, 0x42);
+			emulator.shiftOut(4, 5, LSBFIRST, 0x80);
+			emulator.digitalWrite(6, HIGH);
+			emulator.addSerialData("ab");
+
+			endTime = simulation.getCurrentTime();
+			trace.finish(endTime);
+			ASSERT_EQ(simulation.getPinValue(1), LOW, "input event should be delivered");
+		}
+
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		registerPins(simulation);
+		TimeSeries<ArduinoPinState> replayed;
+		simulation.attachPinEventsConsumer(2, replayed);
+		SerialSegLedDisplay<4> display;
+		display.attachToSimulation(simulation, 4, 5, 6);
+		TimeSeries<BitArray<32>> replayedDisplay;
+		display.attachSproutConsumer(replayedDisplay);
+		TimeSeries<std::string> serial;
+
+		EmulatorTraceReader trace(traceData);
+		logtime_t replayEnd = simulation.replayTrace(trace, &serial);
+		ASSERT_EQ(replayEnd, endTime, "wrong end time of the replay");
+		ASSERT_EQ(simulation.getPinValue(1), LOW, "input event should be replayed");
+
+		ASSERT_EQ(replayed.size(), recorded.size(), "wrong number of replayed pin events");
+		for (std::size_t i = 0; i < recorded.size(); ++i) {
+			ASSERT_EQ(replayed[i].time, recorded[i].time, "wrong time of replayed pin event");
+			ASSERT_TRUE(replayed[i].value == recorded[i].value, "wrong replayed pin event");
+		}
+
+		ASSERT_GT(recordedDisplay.size(), 0, "the display should be updated by the latch");
+		ASSERT_EQ(replayedDisplay.size(), recordedDisplay.size(), "wrong number of replayed display states");
+		for (std::size_t i = 0; i < recordedDisplay.size(); ++i) {
+			ASSERT_EQ(replayedDisplay[i].time, recordedDisplay[i].time, "wrong time of replayed display state");
+			ASSERT_EQ(replayedDisplay[i].value, recordedDisplay[i].value, "wrong replayed display state");
+		}
+
+		ASSERT_EQ(serial.size(), 1, "serial input should be replayed");
+		ASSERT_EQ(serial[0].value, "ab", "wrong replayed serial input");
+
+		// the trace without the end record is refused
+		std::string data = traceData.str();
+		std::stringstream truncated(data.substr(0, data.size() - TraceRecord::SIZE));
+		EmulatorTraceReader truncatedTrace(truncated);
+		ArduinoEmulator emulator2;
+		ArduinoSimulationController simulation2(emulator2);
+		registerPins(simulation2);
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { simulation2.replayTrace(truncatedTrace); }, "unfinished trace should be refused");
+	}
+};
+
+
+class PinTableTest : public MoccarduinoTest
+{
+public:
+	PinTableTest() : MoccarduinoTest("simulation/pin-table") {}
+
+	virtual void run() const
+	{
+		PinTable<int> table(UNO_FUNSHIELD_BOARD);
+		for (std::size_t i = 0; i < UNO_FUNSHIELD_BOARD.layoutSize; ++i) {
+			auto pin = UNO_FUNSHIELD_BOARD.layout[i].pin;
+			table.emplace(pin, (int)pin * 10);
+		}
+		int& led = table.emplace(200, 2000); // beyond the board
+		table.set(A1, 42);
+
+		ASSERT_EQ(table.size(), UNO_FUNSHIELD_BOARD.layoutSize + 1, "wrong number of pins in the table");
+		ASSERT_TRUE(table.find(0) == nullptr, "pin 0 should not be present");
+		ASSERT_TRUE(table.find(201) == nullptr, "pin 201 should not be present");
+		ASSERT_EQ(*table.find(A1), 42, "value of the pin was not updated");
+		ASSERT_EQ(*table.find(led1_pin), led1_pin * 10, "wrong value of the pin");
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { table.emplace(200, 0); }, "a pin cannot be inserted twice");
+		ASSERT_EQ(table.size(), UNO_FUNSHIELD_BOARD.layoutSize + 1, "failed insert changed the table");
+
+		// pins are iterated in ascending order
+		int lastPin = -1;
+		for (auto& [pin, value] : table) {
+			ASSERT_LT(lastPin, (int)pin, "pins are not iterated in ascending order");
+			lastPin = pin;
+		}
+		ASSERT_EQ(lastPin, 200, "the last pin is not iterated");
+
+		// values do not move when the table is modified
+		table.erase(data_pin);
+		table.erase(data_pin);
+		table.emplace(1, 10);
+		ASSERT_TRUE(table.find(200) == &led, "value of the pin has moved");
+		ASSERT_FALSE(table.contains(data_pin), "erased pin is still present");
+		ASSERT_EQ(table.size(), UNO_FUNSHIELD_BOARD.layoutSize + 1, "wrong number of pins after the erase");
+
+		table.clear();
+		ASSERT_TRUE(table.empty(), "table is not empty after clear");
+		ASSERT_FALSE(table.contains(200), "cleared pin is still present");
+	}
+};
+
+
+LazyInputSourceTest _lazyInputSourceTest;
+EmulatorStatsTest _emulatorStatsTest;
+WatchdogTest _watchdogTest;
+TraceReplayTest _traceReplayTest;
+PinTableTest _pinTableTest;
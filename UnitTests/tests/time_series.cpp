@@ -3,6 +3,10 @@
 #include "../test.hpp"
 
 #include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include <cstdint>
 
 class EventAnalyzerTest : public MoccarduinoTest
@@ -32,6 +36,47 @@ public:
 EventAnalyzerTest   _eventAnalyzerTest;
 
 
+class BroadcastConsumerTest : public MoccarduinoTest
+{
+public:
+	BroadcastConsumerTest() : MoccarduinoTest("broadcast-consumer") {}
+
+	virtual void run() const
+	{
+		BroadcastConsumer<int> broadcast;
+		TimeSeries<int> next, first, second;
+		broadcast.attachNextConsumer(next);
+		broadcast.subscribe(first);
+		broadcast.subscribe(second);
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { broadcast.subscribe(first); }, "double subscription");
+
+		int advances = 0;
+		EventAnalyzer<int> analyzer([&](logtime_t, int) { ++advances; });
+		broadcast.subscribe(analyzer);
+		ASSERT_EQ(broadcast.getDeadline(), 0, "analyzer deadline should be propagated");
+
+		broadcast.addEvent(10, 1);
+		broadcast.addEvent(20, 2);
+		broadcast.advanceTime(30);
+		ASSERT_EQ(next.size(), 2, "next consumer should get all events");
+		ASSERT_EQ(first.size(), 2, "first subscriber should get all events");
+		ASSERT_EQ(second.size(), 2, "second subscriber should get all events");
+		ASSERT_EQ(second[1].time, 20, "wrong event time");
+		ASSERT_EQ(second[1].value, 2, "wrong event value");
+		ASSERT_EQ(advances, 3, "analyzer should get events and time advance");
+
+		broadcast.unsubscribe(second);
+		broadcast.addEvent(40, 3);
+		ASSERT_EQ(first.size(), 3, "subscriber should still get events");
+		ASSERT_EQ(second.size(), 2, "unsubscribed consumer should not get events");
+		ASSERT_EQ(broadcast.subscribersCount(), 2, "wrong number of subscribers");
+	}
+};
+
+
+BroadcastConsumerTest _broadcastConsumerTest;
+
+
 class TimeSeriesFindSelectedSubseqTest : public MoccarduinoTest
 {
 private:
@@ -78,6 +123,86 @@ public:
 TimeSeriesFindSelectedSubseqTest   _timeSeriesFindSelectedSubseqTest;
 
 
+class TimeSeriesFindSubsequenceTest : public MoccarduinoTest
+{
+private:
+	TimeSeries<int> makeTs(const std::vector<int> values) const
+	{
+		TimeSeries<int> ts;
+		logtime_t time = 0;
+		for (auto val : values) {
+			ts.addEvent(time += 100, val);
+		}
+		return ts;
+	}
+
+	void test(const std::vector<int> haystack, const std::vector<int> needle, std::size_t start, std::size_t end) const
+	{
+		auto res = makeTs(haystack).findSubsequence(needle);
+		ASSERT_EQ(res.start(), start, "start of the found range");
+		ASSERT_EQ(res.end(), end, "end of the found range");
+	}
+
+	void testRepetitive(const std::vector<int> haystack, const std::vector<int> needle, std::size_t start, std::size_t end) const
+	{
+		auto res = makeTs(haystack).findRepetitiveSubsequence(needle);
+		ASSERT_EQ(res.start(), start, "start of the found repetition");
+		ASSERT_EQ(res.end(), end, "end of the found repetition");
+	}
+
+public:
+	TimeSeriesFindSubsequenceTest() : MoccarduinoTest("time-series/findSubsequence") {}
+
+	virtual void run() const
+	{
+		test({ 1, 2, 3, 4 }, { 2, 3 }, 1, 3);
+		test({ 1, 2, 1, 2, 1, 2, 3 }, { 1, 2, 1, 2, 3 }, 2, 7); // the automaton has to fall back
+		test({ 1, 2, 5, 1, 2, 3, 7 }, { 1, 2, 3, 4 }, 3, 6); // longest prefix
+		test({ 5, 1, 2 }, { 1, 2, 3 }, 1, 3); // prefix truncated by the end of the series
+		test({ 5, 6 }, { 1 }, 0, 0);
+		ASSERT_EQ(makeTs({ 1, 2, 3, 1, 2, 3 }).findSubsequence({ 1, 2 }, TimeSeries<int>::Range(1, 6)).start(), 3, "search within a range");
+
+		testRepetitive({ 1, 2, 1, 2, 7, 1, 2, 1, 2, 1, 2 }, { 1, 2 }, 5, 11);
+		testRepetitive({ 3, 3, 3, 3, 3 }, { 3, 3 }, 0, 4);
+		testRepetitive({ 1, 2, 1, 2, 7, 1, 2, 1, 2 }, { 1, 2 }, 0, 4); // the first of the longest
+		testRepetitive({ 1, 2, 3 }, { 4 }, 0, 0);
+	}
+};
+
+
+TimeSeriesFindSubsequenceTest _timeSeriesFindSubsequenceTest;
+
+
+class TimeSeriesTimeLookupTest : public MoccarduinoTest
+{
+public:
+	TimeSeriesTimeLookupTest() : MoccarduinoTest("time-series/time-lookup") {}
+
+	virtual void run() const
+	{
+		TimeSeries<int> ts;
+		for (int i = 0; i < 10; ++i) {
+			ts.addEvent((logtime_t)i * 100 + 100, i);
+			ts.addEvent((logtime_t)i * 100 + 100, -i); // two events with the same time
+		}
+
+		ASSERT_EQ(ts.lowerBoundByTime(0), 0, "before the first event");
+		ASSERT_EQ(ts.lowerBoundByTime(300), 4, "first event at the time");
+		ASSERT_EQ(ts.upperBoundByTime(300), 6, "first event after the time");
+		ASSERT_EQ(ts.lowerBoundByTime(350), 6, "between events");
+		ASSERT_EQ(ts.lowerBoundByTime(5000), ts.size(), "after the last event");
+
+		auto range = ts.rangeByTime(200, 500);
+		ASSERT_EQ(range.start(), 2, "range start");
+		ASSERT_EQ(range.end(), 8, "range end (exclusive)");
+		ASSERT_EQ(ts.getDeltasMean(range), 40.0, "analytics over the time range");
+		ASSERT_TRUE(ts.rangeByTime(500, 200).empty(), "inverted interval is empty");
+	}
+};
+
+
+TimeSeriesTimeLookupTest _timeSeriesTimeLookupTest;
+
 class TimeSeriesCompareTest : public MoccarduinoTest
 {
 private:
@@ -119,3 +244,339 @@ public:
 
 
 TimeSeriesCompareTest  _timeSeriesCompareTest;
+
+
+class FutureTimeSeriesDeadlineTest : public MoccarduinoTest
+{
+public:
+	FutureTimeSeriesDeadlineTest() : MoccarduinoTest("time-series/future-deadline") {}
+
+	virtual void run() const
+	{
+		FutureTimeSeries<int> input;
+		TimeSeries<int> output;
+		input.attachNextConsumer(output);
+		ASSERT_EQ(input.getDeadline(), FutureTimeSeries<int>::NO_DEADLINE, "empty series has no deadline");
+
+		input.addFutureEvent(300, 2);
+		input.addFutureEvent(100, 1);
+		ASSERT_EQ(input.getDeadline(), 100, "deadline is the first future event");
+
+		input.advanceTime(200);
+		ASSERT_EQ(output.size(), 1, "only one event should be emitted");
+		ASSERT_EQ(input.getDeadline(), 300, "deadline moves to the next future event");
+
+		input.advanceTime(1000);
+		ASSERT_EQ(output.size(), 2, "all events should be emitted");
+		ASSERT_EQ(input.getDeadline(), FutureTimeSeries<int>::NO_DEADLINE, "all events consumed");
+	}
+};
+
+
+FutureTimeSeriesDeadlineTest  _futureTimeSeriesDeadlineTest;
+
+
+class FutureEventsQueueTest : public MoccarduinoTest
+{
+public:
+	FutureEventsQueueTest() : MoccarduinoTest("time-series/future-events-queue") {}
+
+	virtual void run() const
+	{
+		FutureEventsQueue<int> input;
+		TimeSeries<int> output;
+		input.attachNextConsumer(output);
+
+		// in-order and out-of-order events with colliding timestamps (like button bouncing)
+		input.addFutureEvent(100, 1);
+		input.addFutureEvent(400, 2);
+		input.addFutureEvent(200, 3);
+		input.addFutureEvent(400, 4);
+		input.addFutureEvent(200, 5);
+		input.addFutureEvent(300, 6);
+		ASSERT_EQ(input.size(), 6, "all events are pending");
+		ASSERT_EQ(input.getDeadline(), 100, "deadline is the first future event");
+
+		input.advanceTime(250);
+		ASSERT_EQ(output.size(), 3, "events up to the time should be emitted");
+		ASSERT_EQ(input.getDeadline(), 300, "deadline moves to the next future event");
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { input.addFutureEvent(240, 7); }, "event older than last time advance");
+
+		input.addFutureEvent(250, 8);
+		input.advanceTime(1000);
+		ASSERT_TRUE(input.empty(), "delivered events are released");
+		ASSERT_EQ(input.getDeadline(), FutureEventsQueue<int>::NO_DEADLINE, "all events consumed");
+
+		std::vector<int> expected = { 1, 3, 5, 8, 6, 2, 4 };
+		ASSERT_EQ(output.size(), expected.size(), "all events emitted");
+		for (std::size_t i = 0; i < expected.size(); ++i) {
+			ASSERT_EQ(output[i].value, expected[i], "events are emitted by time, events with the same time in insertion order");
+		}
+	}
+};
+
+
+FutureEventsQueueTest  _futureEventsQueueTest;
+
+
+class FutureEventsPeekTest : public MoccarduinoTest
+{
+public:
+	FutureEventsPeekTest() : MoccarduinoTest("time-series/future-events-peek") {}
+
+	virtual void run() const
+	{
+		FutureEventsQueue<int> input;
+		TimeSeries<int> output;
+		input.attachNextConsumer(output);
+
+		// many out-of-order events (with colliding timestamps) interleaved with the ordered ones
+		std::uint32_t rnd = 42;
+		for (int i = 0; i < 200; ++i) {
+			rnd = rnd * 1103515245 + 12345;
+			input.addFutureEvent(i % 3 == 0 ? (logtime_t)(i * 10) : (logtime_t)((rnd >> 16) % 2000), i);
+		}
+
+		std::vector<std::pair<logtime_t, int>> peeked;
+		input.peekEvents(500, [&](logtime_t time, int value) {
+			peeked.emplace_back(time, value);
+			return true;
+		});
+
+		std::size_t stopped = 0;
+		input.peekEvents(500, [&](logtime_t, int) {
+			return ++stopped < 5;
+		});
+		ASSERT_EQ(stopped, 5, "the lookahead should stop when the visitor returns false");
+
+		input.advanceTime(499);
+		std::size_t before = output.size();
+		input.advanceTime(10000);
+		ASSERT_EQ(peeked.size(), output.size() - before, "all pending events from the time should be peeked");
+		for (std::size_t i = 0; i < peeked.size(); ++i) {
+			ASSERT_EQ(peeked[i].first, output[before + i].time, "events are peeked in the order of emission");
+			ASSERT_EQ(peeked[i].second, output[before + i].value, "events are peeked in the order of emission");
+		}
+	}
+};
+
+
+FutureEventsPeekTest _futureEventsPeekTest;
+
+
+class ChunkedStorageTest : public MoccarduinoTest
+{
+public:
+	ChunkedStorageTest() : MoccarduinoTest("time-series/chunked-storage") {}
+
+	virtual void run() const
+	{
+		// small chunks, so the events span several of them
+		TimeSeries<int, logtime_t, ChunkedEventStorage<int, logtime_t, false, 4>> series;
+		series.reserve(6);
+		ASSERT_EQ(series.capacity(), 8, "capacity should be rounded up to whole chunks");
+		series.addEvent(10, 0);
+		const auto* first = &series[0];
+		for (int i = 1; i < 10; ++i) {
+			series.addEvent((logtime_t)i * 10 + 10, i);
+		}
+		ASSERT_TRUE(first == &series[0], "events should not be moved when the storage grows");
+		ASSERT_EQ(series.size(), 10, "wrong number of events");
+		ASSERT_EQ(series[9].value, 9, "wrong value in the last chunk");
+		ASSERT_EQ(series.lowerBoundByTime(55), 5, "binary search over chunks");
+		ASSERT_TRUE(series.memoryUsage() >= 12 * sizeof(TimeSeriesEvent<int>), "memory usage of three chunks");
+
+		// split storage in a future series (out of order insertion and compaction of the consumed prefix)
+		FutureTimeSeries<int, logtime_t, ChunkedEventStorage<int, logtime_t, true, 4>> input;
+		TimeSeries<int> output;
+		input.attachNextConsumer(output);
+		for (int i = 0; i < 10; ++i) {
+			input.addFutureEvent((logtime_t)(10 - i) * 10, i);
+		}
+		ASSERT_EQ(input.timeAt(0), 10, "events should be sorted");
+		ASSERT_EQ(input[9].value, 0, "events should be sorted");
+
+		input.advanceTime(65);
+		input.compact();
+		ASSERT_EQ(output.size(), 6, "events up to the time should be emitted");
+		ASSERT_EQ(input.size(), 4, "consumed events should be dropped");
+		ASSERT_EQ(input.valueAt(0), 3, "wrong first event after compaction");
+
+		input.addFutureEvent(75, 42);
+		input.advanceTime(1000);
+		std::vector<int> expected = { 9, 8, 7, 6, 5, 4, 3, 42, 2, 1, 0 };
+		ASSERT_EQ(output.size(), expected.size(), "all events emitted");
+		for (std::size_t i = 0; i < expected.size(); ++i) {
+			ASSERT_EQ(output[i].value, expected[i], "events are emitted by time");
+		}
+	}
+};
+
+
+ChunkedStorageTest  _chunkedStorageTest;
+
+
+class FutureTimeSeriesCompactionTest : public MoccarduinoTest
+{
+public:
+	FutureTimeSeriesCompactionTest() : MoccarduinoTest("time-series/future-compaction") {}
+
+	virtual void run() const
+	{
+		FutureTimeSeries<int> input(false);
+		TimeSeries<int> output;
+		input.attachNextConsumer(output);
+
+		for (int i = 0; i < 10000; ++i) {
+			input.addFutureEvent((logtime_t)i * 10 + 10, i);
+			input.addFutureEvent((logtime_t)i * 10 + 5, -i); // out of order
+			input.advanceTime((logtime_t)i * 10);
+		}
+		ASSERT_LE(input.size(), 2 * 1024 + 2, "consumed events are compacted");
+		ASSERT_EQ(input.pendingCount(), 2, "only the events from the last iteration are pending");
+
+		input.advanceTime(1000000);
+		ASSERT_EQ(output.size(), 20000, "all events emitted");
+		for (std::size_t i = 1; i < output.size(); ++i) {
+			ASSERT_LT(output[i - 1].time, output[i].time, "events are emitted in order");
+		}
+	}
+};
+
+
+FutureTimeSeriesCompactionTest  _futureTimeSeriesCompactionTest;
+
+
+class TimeSeriesDeltaStatsTest : public MoccarduinoTest
+{
+public:
+	TimeSeriesDeltaStatsTest() : MoccarduinoTest("time-series/delta-stats") {}
+
+	virtual void run() const
+	{
+		TimeSeries<int> tracked, plain;
+		tracked.addEvent(0, 0);
+		tracked.trackDeltaStats(); // existing events are accounted for when tracking starts
+
+		// pseudo-random gaps, some of them large enough to overflow squared integer deltas
+		std::uint32_t seed = 7;
+		logtime_t time = 0;
+		plain.addEvent(0, 0);
+		for (int i = 1; i < 5000; ++i) {
+			seed = seed * 1664525u + 1013904223u;
+			time += (i % 1000 == 0) ? ((logtime_t)1 << 40) : (seed >> 20);
+			tracked.addEvent(time, i);
+			plain.addEvent(time, i);
+		}
+
+		auto stats = tracked.getDeltasStats();
+		auto reference = plain.getDeltasStats();
+		ASSERT_EQ(stats.count(), 4999, "number of deltas");
+		ASSERT_LT(std::abs(stats.mean() - reference.mean()), 1e-3 * reference.mean(), "running mean");
+		ASSERT_LT(std::abs(stats.deviation() - reference.deviation()), 1e-3 * reference.deviation(), "running deviation");
+		ASSERT_EQ(stats.min(), reference.min(), "minimal delta");
+		ASSERT_EQ(stats.max(), (logtime_t)1 << 40, "maximal delta");
+		ASSERT_TRUE(std::isfinite(tracked.getDeltasDeviation()), "deviation must not overflow");
+
+		// sliding windows must match separately computed statistics
+		std::size_t windows = 0;
+		tracked.forEachDeltasWindow(50, TimeSeries<int>::Range(100, 3000), [&](const TimeSeries<int>::Range& window, const TimeSeries<int>::DeltaStats& ws) {
+			auto expected = plain.getDeltasStats(window);
+			ASSERT_EQ(window.length(), 50, "window size");
+			ASSERT_EQ(ws.count(), expected.count(), "window deltas count");
+			ASSERT_LT(std::abs(ws.mean() - expected.mean()), 1e-6 * expected.mean() + 1e-6, "window mean");
+			ASSERT_LT(std::abs(ws.deviation() - expected.deviation()), 1e-3 * expected.deviation() + 1e-3, "window deviation");
+			ASSERT_EQ(ws.min(), expected.min(), "window min");
+			ASSERT_EQ(ws.max(), expected.max(), "window max");
+			++windows;
+		});
+		ASSERT_EQ(windows, 2900 - 50 + 1, "number of windows");
+
+		tracked.clear();
+		ASSERT_EQ(tracked.getDeltasStats().count(), 0, "cleared statistics");
+	}
+};
+
+
+TimeSeriesDeltaStatsTest _timeSeriesDeltaStatsTest;
+
+
+class PipelineStaticHopsTest : public MoccarduinoTest
+{
+public:
+	/**
+	 * Stage that increments values and counts events emitted to a statically typed following stage.
+	 */
+	class Incrementer : public EventConsumer<int>
+	{
+	private:
+		std::size_t mStaticHops = 0;
+
+	protected:
+		template<typename NEXT>
+		void addEventTo(NEXT* next, logtime_t time, int value)
+		{
+			if (!std::is_same_v<NEXT, EventConsumer<int>>) {
+				++mStaticHops;
+			}
+			if (next != nullptr) {
+				next->addEvent(time, value + 1);
+			}
+		}
+
+		void doAddEvent(logtime_t time, int value) override
+		{
+			addEventTo(this->nextConsumer(), time, value);
+		}
+
+	public:
+		std::size_t getStaticHops() const
+		{
+			return mStaticHops;
+		}
+	};
+
+	using pipeline_t = Pipeline<Incrementer, Incrementer, TimeSeries<int>>;
+
+	PipelineStaticHopsTest() : MoccarduinoTest("time-series/pipeline-static-hops") {}
+
+	virtual void run() const
+	{
+		static_assert(std::is_same_v<pipeline_t::stage_t<0>, PipelineStage<Incrementer, pipeline_t::stage_t<1>>>,
+			"stage is not wrapped with the type of the following stage");
+		static_assert(std::is_same_v<pipeline_t::stage_t<2>, PipelineStage<TimeSeries<int>>>,
+			"last stage has no following stage");
+
+		pipeline_t pipeline;
+		for (int i = 0; i < 10; ++i) {
+			pipeline.addEvent((logtime_t)i * 10, i);
+		}
+
+		// events entering through the dynamic API take the static hops as well
+		EventConsumer<int>& front = pipeline.front();
+		front.addEvent(100, 10);
+
+		ASSERT_EQ(pipeline.stage<0>().getStaticHops(), 11, "events should pass to the second stage statically");
+		ASSERT_EQ(pipeline.stage<1>().getStaticHops(), 11, "events should pass to the last stage statically");
+		auto& output = pipeline.back();
+		ASSERT_EQ(output.size(), 11, "events were lost in the pipeline");
+		for (std::size_t i = 0; i < output.size(); ++i) {
+			ASSERT_EQ(output[i].time, (logtime_t)i * 10, "wrong time of the output event");
+			ASSERT_EQ(output[i].value, (int)i + 2, "both stages should process the event");
+		}
+
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { pipeline.addEvent((logtime_t)50, 0); },
+			"causality should be checked by the first stage");
+
+		// the same stage in a dynamic chain emits through the consumer interface
+		Incrementer incrementer;
+		TimeSeries<int> series;
+		incrementer.attachNextConsumer(series);
+		incrementer.addEvent(0, 1);
+		ASSERT_EQ(incrementer.getStaticHops(), 0, "dynamic chain does not know the type of the next consumer");
+		ASSERT_EQ(series[0].value, 2, "event was not passed along the dynamic chain");
+	}
+};
+
+
+PipelineStaticHopsTest _pipelineStaticHopsTest;
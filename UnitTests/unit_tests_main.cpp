@@ -1,52 +1,215 @@
 #include "test.hpp"
+#include "args.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <iomanip>
+#include <iostream>
 #include <map>
+#include <mutex>
 #include <string>
-#include <iostream>
+#include <thread>
+#include <vector>
 
 using tests_t = const std::map<std::string, const MoccarduinoTest*>;
 
+/**
+ * Outcome of one executed test.
+ */
+struct TestResult
+{
+	bool done = false;
+	bool passed = false;
+	std::string message;					///< error message of a failed test
+	std::exception_ptr internalError;		///< exception other than TestException (halts the testing)
+	std::chrono::steady_clock::duration duration = std::chrono::steady_clock::duration::zero();
+};
+
 /**
  * Check that given test name is on the argument list.
- * More precisely, whether one of the given keywords (in arguments) is a substring of the name.
+ * More precisely, whether one of the given keywords (nameless arguments) is a substring of the name.
+ */
+bool on_list(const std::string& name, const bpp::ProgramArguments& args)
+{
+	if (args.namelessCount() == 0) return true;	// list is empty, let's accept everything ...
+	for (std::size_t i = 0; i < args.namelessCount(); ++i) {
+		if (name.find(args[i]) != std::string::npos) return true;
+	}
+	return false;
+}
+
+/**
+ * Run one test and measure its host time. The test fails if it exceeds its own time budget,
+ * or the time limit of the runner if the test has no budget (0 = no limit) [ms].
+ */
+void run_test(const MoccarduinoTest& test, std::size_t timeLimit, TestResult& result)
+{
+	auto start = std::chrono::steady_clock::now();
+	try {
+		test.run();
+		result.passed = true;
+	}
+	catch (TestException& e) {
+		result.message = e.what();
+	}
+	catch (...) {
+		result.internalError = std::current_exception();
+	}
+	result.duration = std::chrono::steady_clock::now() - start;
+
+	std::size_t budget = test.getTimeBudget() > 0 ? test.getTimeBudget() : timeLimit;
+	if (result.passed && budget > 0 && result.duration > std::chrono::milliseconds(budget)) {
+		result.passed = false;
+		result.message = "Time budget exceeded (the limit is " + std::to_string(budget) + " ms).";
+	}
+}
+
+/**
+ * Print the outcome of a test (the "TEST: name ... " prefix is printed by the caller).
+ * @return true if the test passed
+ */
+bool print_result(const TestResult& result)
+{
+	if (result.internalError) {
+		std::cout << "ERROR!" << std::endl;
+		std::rethrow_exception(result.internalError);
+	}
+
+	auto ms = std::chrono::duration<double, std::milli>(result.duration).count();
+	std::cout << (result.passed ? "passed" : "FAILED!") << " (" << std::fixed << std::setprecision(1) << ms << " ms)" << std::endl;
+	if (!result.passed) {
+		std::cout << result.message << std::endl;
+	}
+	return result.passed;
+}
+
+/**
+ * Run the tests one by one in the main thread (the name is printed before the test starts).
+ * @return number of failed tests
  */
-bool on_list(const std::string& name, char* argv[])
+std::size_t run_serial(const std::vector<const MoccarduinoTest*>& tests, const std::vector<std::string>& names, std::size_t timeLimit)
 {
-	if (*argv == nullptr) return true;	// list is empty, let's accept everything ...
-	while (*argv != nullptr && name.find(*argv) == std::string::npos) {
-		++argv;
+	std::size_t errors = 0;
+	for (std::size_t i = 0; i < tests.size(); ++i) {
+		std::cout << "TEST: " << names[i] << " ... ";
+		std::cout.flush();
+		TestResult result;
+		run_test(*tests[i], timeLimit, result);
+		if (!print_result(result)) {
+			++errors;
+		}
 	}
-	return (*argv != nullptr);	// not null => match was found
+	return errors;
+}
+
+/**
+ * Run the tests concurrently in a pool of threads. The results are printed in the order of the tests
+ * as soon as they are available (so the output is the same as the serial one, except for the durations).
+ * @return number of failed tests
+ */
+std::size_t run_parallel(const std::vector<const MoccarduinoTest*>& tests, const std::vector<std::string>& names,
+	std::size_t timeLimit, std::size_t threads)
+{
+	std::vector<TestResult> results(tests.size());
+	std::atomic<std::size_t> nextTest(0);
+	std::mutex mutex;
+	std::condition_variable resultReady;
+
+	std::vector<std::thread> workers;
+	for (std::size_t t = 0; t < std::min(threads, tests.size()); ++t) {
+		workers.emplace_back([&]() {
+			std::size_t i;
+			while ((i = nextTest++) < tests.size()) {
+				TestResult result;
+				run_test(*tests[i], timeLimit, result);
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					results[i] = std::move(result);
+					results[i].done = true;
+				}
+				resultReady.notify_all();
+			}
+		});
+	}
+
+	std::size_t errors = 0;
+	std::exception_ptr internalError;
+	for (std::size_t i = 0; i < tests.size(); ++i) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			resultReady.wait(lock, [&]() { return results[i].done; });
+		}
+
+		std::cout << "TEST: " << names[i] << " ... ";
+		try {
+			if (!print_result(results[i])) {
+				++errors;
+			}
+		}
+		catch (...) {
+			internalError = std::current_exception();
+			nextTest = tests.size(); // no more tests are started
+			break;
+		}
+	}
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	if (internalError) {
+		std::rethrow_exception(internalError);
+	}
+	return errors;
 }
 
 
 int main(int argc, char* argv[])
 {
+	bpp::ProgramArguments args;
+
 	try {
+		args.setNamelessCaption(0, "Filters, only tests whose names contain one of the given substrings are executed.");
+		args.registerArg<bpp::ProgramArguments::ArgInt>("threads", "Number of threads which execute the tests concurrently (0 = number of CPU cores).", false, 1, 0);
+		args.registerArg<bpp::ProgramArguments::ArgInt>("time-limit", "Host time limit of one test [ms], tests running longer fail (0 = no limit). Tests with their own time budget use that budget instead.", false, 0, 0);
+		args.process(argc, argv);
+	}
+	catch (bpp::ArgumentException& e) {
+		std::cout << "Invalid arguments: " << e.what() << std::endl << std::endl;
+		args.printUsage(std::cout);
+		return 100;
+	}
+
+	try {
+		std::vector<const MoccarduinoTest*> selected;
+		std::vector<std::string> names;
 		tests_t& tests = MoccarduinoTest::getTests();
-		std::size_t errors = 0, executed = 0;
 		for (tests_t::const_iterator it = tests.begin(); it != tests.end(); ++it) {
-			if (!on_list(it->first, argv + 1)) continue;	// argv + 1 ... skip the application name
-
-			++executed;
-			std::cout << "TEST: " << it->first << " ... ";
-			std::cout.flush();
-			try {
-				it->second->run();
-				std::cout << "passed" << std::endl;
-			}
-			catch (TestException &e) {
-				std::cout << "FAILED!" << std::endl;
-				++errors;
-				std::cout << e.what() << std::endl;
-			}
+			if (!on_list(it->first, args)) continue;
+			selected.push_back(it->second);
+			names.push_back(it->first);
 		}
 
+		auto threads = (std::size_t)args.getArgInt("threads").getValue();
+		if (threads == 0) {
+			threads = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+		}
+		auto timeLimit = (std::size_t)args.getArgInt("time-limit").getValue();
+
+		auto start = std::chrono::steady_clock::now();
+		std::size_t errors = threads > 1
+			? run_parallel(selected, names, timeLimit, threads)
+			: run_serial(selected, names, timeLimit);
+		auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::size_t executed = selected.size();
+
 		std::cout << std::endl << "Total " << (executed-errors) << " / " << executed << " tests passed";
 		if (errors > 0) {
 			std::cout << ", but " << errors << " tests FAILED!";
 		}
-		std::cout << std::endl;
+		std::cout << std::endl << "Total time " << std::fixed << std::setprecision(1) << ms << " ms ("
+			<< threads << (threads > 1 ? " threads)" : " thread)") << std::endl;
 
 		return errors == 0 ? 0 : 1;
 	}
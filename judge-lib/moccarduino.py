@@ -2,6 +2,11 @@ import sys
 import csv
 import os
 import math
+import mmap
+import struct
+import heapq
+import subprocess
+import tempfile
 
 ON = 0
 OFF = 1
@@ -380,6 +385,134 @@ class DisplayState:
         return ''.join(res)
 
 
+class BinaryLogColumn:
+    '''
+    One column (series of events) of the binary simulation log.
+    Timestamps and values are zero-copy views into the memory-mapped file.
+    '''
+
+    BOOL = 1
+    BITS = 2
+    STRING = 3
+
+    _formats = {1: 'B', 2: 'H', 4: 'I', 8: 'Q'}
+
+    def __init__(self, buffer, name, type, value_size, bits, count, offset):
+        self.name = name
+        self.type = type
+        self.value_size = value_size
+        self.bits = bits
+        values_offset = offset + 8 * count
+        self.timestamps = buffer[offset:values_offset].cast('Q')
+        values = buffer[values_offset:values_offset + value_size * count]
+        if type == self.STRING:
+            self.values = values.cast('Q')  # end offsets in the blob
+            self._blob = buffer[values_offset + value_size * count:]
+        elif value_size in self._formats:
+            self.values = values.cast(self._formats[value_size])
+        else:
+            self.values = values.cast('Q')  # multiple 64-bit words per value
+        self._words = max(1, value_size // 8) if type == self.BITS else 1
+
+    def __len__(self):
+        return len(self.timestamps)
+
+    def get_value(self, idx):
+        '''
+        Return decoded value of given event (bool, int of raw bits where
+        bit 0 is the first LED/segment, or str).
+        '''
+        if self.type == self.BOOL:
+            return bool(self.values[idx])
+        if self.type == self.STRING:
+            start = self.values[idx - 1] if idx > 0 else 0
+            return bytes(self._blob[start:self.values[idx]]).decode('utf8')
+        if self._words == 1 or self.value_size < 8:
+            return self.values[idx]
+        res = 0
+        for w in range(self._words - 1, -1, -1):
+            res = (res << 64) | self.values[idx * self._words + w]
+        return res
+
+    def get_csv_value(self, idx):
+        '''
+        Return the value as it would be parsed from the CSV log (bit arrays
+        are hex-encoded there with the first byte as the most significant).
+        '''
+        value = self.get_value(idx)
+        if self.type == self.BITS and self.bits > 4:
+            length = (self.bits + 7) // 8
+            value = int.from_bytes(value.to_bytes(length, 'little'), 'big')
+        return value
+
+
+class BinarySimulationLog:
+    '''
+    Memory-mapped binary (columnar) simulation log produced by Moccarduino
+    generic tester with `--save-format binary`.
+    '''
+
+    MAGIC = b'MOCCBLOG'
+
+    def __init__(self, file_name):
+        if sys.byteorder != 'little':
+            raise Exception("Binary logs can be mapped on little-endian hosts only.")
+        self._fp = open(file_name, 'rb')
+        self._mmap = mmap.mmap(self._fp.fileno(), 0, access=mmap.ACCESS_READ)
+        buffer = memoryview(self._mmap)
+
+        magic, version, count = struct.unpack_from('<8sII', buffer, 0)
+        if magic != self.MAGIC or version != 1:
+            raise Exception("File {} is not a binary simulation log.".format(file_name))
+
+        self.columns = {}
+        for i in range(count):
+            name, type, value_size, bits, _, events, offset = struct.unpack_from(
+                '<16sIIIIQQ', buffer, 16 + i * 48)
+            name = name.rstrip(b'\0').decode('utf8')
+            self.columns[name] = BinaryLogColumn(
+                buffer, name, type, value_size, bits, events, offset)
+
+    @staticmethod
+    def is_binary(file_name):
+        with open(file_name, 'rb') as fp:
+            return fp.read(8) == BinarySimulationLog.MAGIC
+
+    def has_column(self, name):
+        return name in self.columns
+
+    def column(self, name):
+        return self.columns[name]
+
+    def to_events(self):
+        '''
+        Merge the columns into a list of events (rows) in the same form as
+        SimulationLog loads them from CSV.
+        '''
+        names = sorted(self.columns.keys())
+        heads = []
+        for name in names:
+            if len(self.columns[name]) > 0:
+                heads.append((self.columns[name].timestamps[0], name, 0))
+        heapq.heapify(heads)
+
+        events = []
+        while heads:
+            ts = heads[0][0]
+            row = {'timestamp': ts}
+            for name in names:
+                row[name] = None
+            while heads and heads[0][0] == ts:
+                _, name, idx = heapq.heappop(heads)
+                column = self.columns[name]
+                row[name] = column.get_csv_value(idx)
+                if idx + 1 < len(column):
+                    heapq.heappush(
+                        heads, (column.timestamps[idx + 1], name, idx + 1))
+            events.append(row)
+        return events
+
+
 class SimulationLog:
     '''
     Loads and holds all simulation log events.
@@ -432,6 +565,10 @@ class SimulationLog:
         if not os.path.isfile(csv_file):
             raise Exception("CSV file {} does not exist.".format(csv_file))
 
+        if BinarySimulationLog.is_binary(csv_file):
+            self.load_binary(csv_file)
+            return
+
         self.events = []
         with open(csv_file, 'r', encoding='utf8') as fp:
             # handle errors (when the log is not a CSV)
@@ -462,6 +599,26 @@ class SimulationLog:
                     line["serial"] = None
                 self.events.append(line)
 
+    def load_binary(self, file_name):
+        '''
+        Load the log from a binary file produced by Moccarduino generic tester
+        (with `--save-format binary`).
+        '''
+        log = BinarySimulationLog(file_name)
+        self.buttons = log.has_column("b1")
+        self.leds = log.has_column("leds")
+        self.display = log.has_column("7seg")
+        self.serial = log.has_column("serial")
+
+        self.events = log.to_events()
+        for line in self.events:
+            if self.leds and line["leds"] is not None:
+                line["leds"] = LedState(line["leds"])
+            if self.display and line["7seg"] is not None:
+                line["7seg"] = DisplayState(line["7seg"])
+            if self.serial and not line["serial"]:
+                line["serial"] = None
+
     def count(self):
         return len(self.events)
 
@@ -521,7 +678,49 @@ def _find_best_match(events, value, max_time):
     return 0
 
 
-def pair_events(expected, actual, time_window):
+def _write_native_events(fp, events, value_ids):
+    for e in events:
+        value = e[1].get_raw() if hasattr(e[1], 'get_raw') else e[1]
+        key = (type(value), value)
+        if key not in value_ids:
+            value_ids[key] = len(value_ids)
+        fp.write('{} {}\n'.format(e[0], value_ids[key]))
+
+
+def pair_events_native(expected, actual, time_window, judge):
+    '''
+    Same as `pair_events`, but the pairing is computed by the native judge
+    (executable built in the Judge directory of Moccarduino). Values are
+    passed to the judge as identifiers, so any comparable values may be used.
+    '''
+    value_ids = {}
+    files = []
+    try:
+        for events in [expected, actual]:
+            fp = tempfile.NamedTemporaryFile('w', suffix='.txt', delete=False)
+            files.append(fp.name)
+            with fp:
+                _write_native_events(fp, events, value_ids)
+
+        res = subprocess.run(
+            [judge, '--pair', '--window', str(time_window)] + files,
+            stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+        if res.returncode != 0:
+            raise Exception("Native judge failed: {}".format(
+                res.stderr.strip() or res.stdout.strip()))
+    finally:
+        for name in files:
+            os.unlink(name)
+
+    mapping = []
+    for line in res.stdout.splitlines():
+        e, a = line.split()
+        mapping.append((None if e == '-' else expected[int(e)],
+                        None if a == '-' else actual[int(a)]))
+    return mapping
+
+
+def pair_events(expected, actual, time_window, judge=None):
     '''
     Create mapping between two lists of events. An event is a tuple/list,
     where first item is timestamp, second item is the state/value.
@@ -530,7 +729,13 @@ def pair_events(expected, actual, time_window):
     Returns a list of tuples where first item is from expected, second from
     actual. None may be used on either side for unpaired events.
     Time window defines maximal timestamp difference between paired events.
+    If `judge` (path to the native judge executable) is given or set in
+    MOCCARDUINO_JUDGE environment variable, the pairing is computed natively.
     '''
+    judge = judge or os.environ.get('MOCCARDUINO_JUDGE')
+    if judge:
+        return pair_events_native(expected, actual, time_window, judge)
+
     mapping = []
     actual = actual[:]  # make a copy, so we can pop events
     for e in expected:
@@ -0,0 +1,255 @@
+#ifndef MOCCARDUINO_SHARED_BOARD_HPP
+#define MOCCARDUINO_SHARED_BOARD_HPP
+
+#include "constants.hpp"
+#include "funshield.h"
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+using pin_t = std::uint8_t; // same as in emulator.hpp (which includes this header)
+
+
+/**
+ * Number of distinct pin numbers (all values of pin_t), flat pin-indexed tables never need more slots.
+ */
+constexpr std::size_t PIN_SLOTS = (std::size_t)1 << (8 * sizeof(pin_t));
+
+
+/**
+ * One pin of a fixed board layout (e.g., a pin used by a shield).
+ */
+struct BoardPin
+{
+	pin_t pin;
+	int wiring;
+};
+
+
+/**
+ * Static description of the emulated board. The number of pins sizes the pin tables of the emulator,
+ * the layout lists pins the board (or its shield) wires up when the simulation is created.
+ */
+struct BoardDescriptor
+{
+	const char* name;
+	std::size_t pinsCount;		///< pins are numbered 0 .. pinsCount-1 (digital and analog pins)
+	const BoardPin* layout;
+	std::size_t layoutSize;
+};
+
+
+/**
+ * Pins of the Funshield (buttons, LEDs, and the serial interface of the 7-seg display).
+ */
+constexpr BoardPin FUNSHIELD_LAYOUT[] = {
+	{ button1_pin, INPUT },
+	{ button2_pin, INPUT },
+	{ button3_pin, INPUT },
+	{ led1_pin, OUTPUT },
+	{ led2_pin, OUTPUT },
+	{ led3_pin, OUTPUT },
+	{ led4_pin, OUTPUT },
+	{ latch_pin, OUTPUT },
+	{ clock_pin, OUTPUT },
+	{ data_pin, OUTPUT },
+};
+
+/**
+ * Plain Arduino Uno (no pins are wired up in advance).
+ */
+constexpr BoardDescriptor UNO_BOARD = { "Arduino Uno", NUM_DIGITAL_PINS, nullptr, 0 };
+
+/**
+ * Arduino Uno with the Funshield attached.
+ */
+constexpr BoardDescriptor UNO_FUNSHIELD_BOARD = { "Arduino Uno + Funshield", NUM_DIGITAL_PINS,
+	FUNSHIELD_LAYOUT, std::size(FUNSHIELD_LAYOUT) };
+
+
+/**
+ * Replacement of std::map<pin_t, T> with O(1) lookup. The values are held in a flat array indexed directly
+ * by pin numbers, the registered pins are also kept in a dense list sorted by pin numbers (so the iteration
+ * is contiguous and visits the pins in the same order as the map did).
+ * Each value is allocated separately, so its address remains stable (consumer chains refer to the pins).
+ * The table is presized for a board, but any pin number can be inserted.
+ */
+template<typename T>
+class PinTable
+{
+public:
+	using value_type = std::pair<const pin_t, T>;
+
+	/**
+	 * Iterator over the dense list that dereferences the values (so structured bindings work as with the map).
+	 */
+	template<typename V, typename IT>
+	class Iterator
+	{
+	private:
+		IT mIt;
+
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = V;
+		using difference_type = std::ptrdiff_t;
+		using pointer = V*;
+		using reference = V&;
+
+		Iterator(IT it) : mIt(it) {}
+
+		V& operator*() const
+		{
+			return **mIt;
+		}
+
+		V* operator->() const
+		{
+			return *mIt;
+		}
+
+		Iterator& operator++()
+		{
+			++mIt;
+			return *this;
+		}
+
+		bool operator==(const Iterator& it) const
+		{
+			return mIt == it.mIt;
+		}
+
+		bool operator!=(const Iterator& it) const
+		{
+			return mIt != it.mIt;
+		}
+	};
+
+	using iterator = Iterator<value_type, typename std::vector<value_type*>::const_iterator>;
+	using const_iterator = Iterator<const value_type, typename std::vector<value_type*>::const_iterator>;
+
+private:
+	/**
+	 * Values indexed by pin numbers (null if the pin is not present).
+	 */
+	std::vector<std::unique_ptr<value_type>> mSlots;
+
+	/**
+	 * Present values sorted by their pin numbers.
+	 */
+	std::vector<value_type*> mDense;
+
+public:
+	PinTable(std::size_t pinsCount = NUM_DIGITAL_PINS) : mSlots(std::min(pinsCount, PIN_SLOTS)) {}
+
+	PinTable(const BoardDescriptor& board) : PinTable(board.pinsCount) {}
+
+	/**
+	 * Get the value associated with given pin, null if the pin is not present.
+	 */
+	T* find(pin_t pin)
+	{
+		return pin < mSlots.size() && mSlots[pin] ? &mSlots[pin]->second : nullptr;
+	}
+
+	const T* find(pin_t pin) const
+	{
+		return pin < mSlots.size() && mSlots[pin] ? &mSlots[pin]->second : nullptr;
+	}
+
+	bool contains(pin_t pin) const
+	{
+		return find(pin) != nullptr;
+	}
+
+	/**
+	 * Insert a new value for given pin (throws if the pin is already present).
+	 * @return reference to the inserted value
+	 */
+	template<typename... ARGS>
+	T& emplace(pin_t pin, ARGS&&... args)
+	{
+		if (pin >= mSlots.size()) {
+			mSlots.resize((std::size_t)pin + 1); // pins beyond the board (custom tests)
+		}
+		if (mSlots[pin]) {
+			throw std::runtime_error("Pin " + std::to_string(pin) + " is already present in the table.");
+		}
+
+		mSlots[pin] = std::make_unique<value_type>(std::piecewise_construct, std::forward_as_tuple(pin),
+			std::forward_as_tuple(std::forward<ARGS>(args)...));
+		auto it = std::lower_bound(mDense.begin(), mDense.end(), pin, [](const value_type* v, pin_t p) { return v->first < p; });
+		mDense.insert(it, mSlots[pin].get());
+		return mSlots[pin]->second;
+	}
+
+	/**
+	 * Set the value of given pin (insert it if the pin is not present).
+	 */
+	void set(pin_t pin, const T& value)
+	{
+		auto existing = find(pin);
+		if (existing != nullptr) {
+			*existing = value;
+		}
+		else {
+			emplace(pin, value);
+		}
+	}
+
+	/**
+	 * Remove given pin (if present).
+	 */
+	void erase(pin_t pin)
+	{
+		if (!contains(pin)) return;
+		mDense.erase(std::find(mDense.begin(), mDense.end(), mSlots[pin].get()));
+		mSlots[pin].reset();
+	}
+
+	void clear()
+	{
+		for (auto value : mDense) {
+			mSlots[value->first].reset();
+		}
+		mDense.clear();
+	}
+
+	std::size_t size() const
+	{
+		return mDense.size();
+	}
+
+	bool empty() const
+	{
+		return mDense.empty();
+	}
+
+	iterator begin()
+	{
+		return iterator(mDense.cbegin());
+	}
+
+	iterator end()
+	{
+		return iterator(mDense.cend());
+	}
+
+	const_iterator begin() const
+	{
+		return const_iterator(mDense.cbegin());
+	}
+
+	const_iterator end() const
+	{
+		return const_iterator(mDense.cend());
+	}
+};
+
+#endif
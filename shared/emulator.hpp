@@ -3,15 +3,18 @@
 
 #include "time_series.hpp"
 #include "constants.hpp"
+#include "stats.hpp"
+#include "helpers.hpp"
+#include "board.hpp"
 
 #include <deque>
-#include <map>
 #include <memory>
 #include <string>
 #include <sstream>
 #include <stdexcept>
 #include <cctype>
 #include <random>
+#include <chrono>
 
 using pin_t = std::uint8_t;
 
@@ -35,25 +38,61 @@ public:
 };
 
 
+/**
+ * Exception thrown by the watchdog when the tested code exceeds its host time budget
+ * or a single loop() advances the logical time too much (e.g., the code got stuck in an endless loop).
+ */
+class ArduinoWatchdogException : public ArduinoEmulatorException
+{
+public:
+	ArduinoWatchdogException(const char* msg) : ArduinoEmulatorException(msg) {}
+	ArduinoWatchdogException(const std::string& msg) : ArduinoEmulatorException(msg) {}
+	virtual ~ArduinoWatchdogException() noexcept {}
+};
+
+
 /**
  * Records one change of the value of the pin.
  */
 struct ArduinoPinState {
 public:
+	/**
+	 * Duty cycle of PWM signal (analogWrite) that denotes constant HIGH level.
+	 */
+	static constexpr std::uint8_t DUTY_HIGH = 255;
+
 	pin_t pin;		///< pin identifier
-	int value;		///< new value (either written or received as input)
+	int value;		///< new value (either written or received as input), the dominant level of PWM signal
+	std::uint8_t duty;	///< fraction of time the pin is HIGH (0 = constantly LOW, DUTY_HIGH = constantly HIGH)
+
+	ArduinoPinState() : pin(~(pin_t)0), value(-1), duty(0) {}
+	ArduinoPinState(pin_t p, int v) : pin(p), value(v), duty(v == HIGH ? DUTY_HIGH : 0) {}
+	ArduinoPinState(pin_t p, int v, std::uint8_t d) : pin(p), value(v), duty(d) {}
 
-	ArduinoPinState() : pin(~(pin_t)0), value(-1) {}
-	ArduinoPinState(pin_t p, int v) : pin(p), value(v) {}
+	/**
+	 * Create the state of a pin driven by PWM signal with given duty cycle.
+	 */
+	static ArduinoPinState pwm(pin_t p, std::uint8_t d)
+	{
+		return ArduinoPinState(p, d >= DUTY_HIGH / 2 + 1 ? HIGH : LOW, d);
+	}
+
+	/**
+	 * True if the pin is toggled by PWM signal (neither constantly LOW, nor constantly HIGH).
+	 */
+	bool isPwm() const
+	{
+		return duty > 0 && duty < DUTY_HIGH;
+	}
 
 	inline bool operator<(const ArduinoPinState& ps) const
 	{
-		return pin < ps.pin || (pin == ps.pin && value < ps.value);
+		return pin < ps.pin || (pin == ps.pin && (value < ps.value || (value == ps.value && duty < ps.duty)));
 	}
 
 	inline bool operator==(const ArduinoPinState& ps) const
 	{
-		return pin == ps.pin && value == ps.value;
+		return pin == ps.pin && value == ps.value && duty == ps.duty;
 	}
 
 	/**
@@ -69,12 +108,93 @@ public:
 	{
 		std::stringstream sstr;
 		sstr << pin << ":" << value;
+		if (isPwm()) {
+			sstr << "~" << (int)duty;
+		}
 		return sstr.str();
 
 	}
 };
 
 
+/**
+ * Interface of pin events consumers that can process a whole byte sent by shiftOut() at once
+ * (instead of the individual data and clock pin events).
+ */
+class ShiftOutConsumer
+{
+public:
+	virtual ~ShiftOutConsumer() = default;
+
+	/**
+	 * Consume one byte shifted out over given data and clock pins. The result must be the same as if
+	 * the pin events were received one by one (data write, clock HIGH, clock LOW for every bit).
+	 * @param time timestamp of the first pin event (write of the first data bit)
+	 * @param writeDelay delay between two subsequent pin events (used to compute their timestamps)
+	 * @param dataPin pin used for data bits
+	 * @param clockPin pin used for clock signal
+	 * @param bitOrder MSBFIRST or LSBFIRST
+	 * @param value byte being shifted out
+	 * @return false if the consumer cannot process the byte in bulk (individual pin events are emitted instead)
+	 */
+	virtual bool addShiftedByte(logtime_t time, logtime_t writeDelay, pin_t dataPin, pin_t clockPin,
+		std::uint8_t bitOrder, std::uint8_t value) = 0;
+};
+
+
+/**
+ * Source of input events that are loaded lazily (when the simulation time reaches them),
+ * so the whole input does not have to be enqueued in advance.
+ */
+class InputEventsSource
+{
+public:
+	virtual ~InputEventsSource() = default;
+
+	/**
+	 * Get the timestamp of the next event that has not been loaded yet (NO_DEADLINE if there is none).
+	 */
+	virtual logtime_t nextEventTime() const = 0;
+
+	/**
+	 * Enqueue all remaining events with timestamps up to given time (inclusive) into the simulation.
+	 */
+	virtual void loadEventsUntil(logtime_t time) = 0;
+};
+
+
+/**
+ * Recorder of everything the emulator delivers into the pin consumer chains (see EmulatorTraceWriter).
+ * The recorded calls are sufficient to replay the chains (e.g., LED displays) without running the tested code.
+ */
+class EmulatorTraceRecorder
+{
+public:
+	virtual ~EmulatorTraceRecorder() = default;
+
+	/**
+	 * An event of a pin (written by the tested code or delivered from an input).
+	 */
+	virtual void recordPinEvent(logtime_t time, const ArduinoPinState& state) = 0;
+
+	/**
+	 * A byte of shiftOut() accepted in bulk by a ShiftOutConsumer (see ShiftOutConsumer::addShiftedByte()).
+	 */
+	virtual void recordShiftedByte(logtime_t time, logtime_t writeDelay, pin_t dataPin, pin_t clockPin,
+		std::uint8_t bitOrder, std::uint8_t value) = 0;
+
+	/**
+	 * Time advance propagated into the pin consumer chains (only pins with passed deadlines are advanced).
+	 */
+	virtual void recordTimeAdvance(logtime_t time) = 0;
+
+	/**
+	 * Data received by the serial interface.
+	 */
+	virtual void recordSerialInput(logtime_t time, const std::string& data) = 0;
+};
+
+
 class ArduinoEmulator;
 
 /**
@@ -96,6 +216,23 @@ private:
 	int mWiring;	///< how the pin is actually wired (INPUT/OUTPUT)
 	int mMode;		///< current operating mode (INPUT/OUTPUT)
 
+	/**
+	 * Counter of the emulator incremented whenever the value of the pin changes (may be null).
+	 */
+	std::uint64_t* mActivity;
+
+	/**
+	 * Recorder of the emulator that gets all events of the pin (may be null).
+	 */
+	EmulatorTraceRecorder* mTraceRecorder;
+
+	void markActivity()
+	{
+		if (mActivity != nullptr) {
+			++*mActivity;
+		}
+	}
+
 	/*
 	 * Interface for the simulator.
 	 */
@@ -103,21 +240,39 @@ private:
 	void reset()
 	{
 		mMode = UNDEFINED;
-		mState.value = UNDEFINED;
+		mState = ArduinoPinState(mState.pin, UNDEFINED);
+	}
+
+	/**
+	 * Record a value written to the pin without emitting the event
+	 * (used when the events were delivered to the consumer in bulk).
+	 */
+	void setWrittenValue(int value, logtime_t time)
+	{
+		markActivity(); // the bulk of events has been delivered
+		mState = ArduinoPinState(mState.pin, value);
+		mLastTime = time;
 	}
 
 protected:
 	void doAddEvent(logtime_t time, ArduinoPinState state) override
 	{
+		if (mTraceRecorder != nullptr) {
+			mTraceRecorder->recordPinEvent(time, state);
+		}
 		if (mState.pin == state.pin) {
-			mState.value = state.value;
+			if (!(mState == state)) {
+				markActivity();
+			}
+			mState = state;
 		}
 		EventConsumer<ArduinoPinState>::doAddEvent(time, state);
 	}
 
 
 public:
-	ArduinoPin(pin_t pin, int wiring = UNDEFINED) : mState(pin, UNDEFINED), mWiring(wiring), mMode(UNDEFINED) {}
+	ArduinoPin(pin_t pin, int wiring = UNDEFINED, std::uint64_t* activity = nullptr)
+		: mState(pin, UNDEFINED), mWiring(wiring), mMode(UNDEFINED), mActivity(activity), mTraceRecorder(nullptr) {}
 
 	/**
 	 * Change the mode of the pin. This can be done only once (typically in setup).
@@ -176,7 +331,33 @@ public:
 			throw ArduinoEmulatorException("Unable to write data to an input pin (" + std::to_string(mState.pin) + ").");
 		}
 
-		mState.value = value;
+		ArduinoPinState state(mState.pin, value);
+		if (!(mState == state)) {
+			markActivity();
+		}
+		mState = state;
+		addEvent(time, mState);
+	}
+
+	/**
+	 * Drive the pin by PWM signal (the pin is switched to output mode if the mode was not set yet).
+	 * A single event is emitted for the change of the duty cycle (not for the individual toggles).
+	 */
+	void writePwm(std::uint8_t duty, logtime_t time)
+	{
+		if (mMode == UNDEFINED) {
+			setMode(OUTPUT); // as analogWrite() does on Arduino
+		}
+
+		if (mMode != OUTPUT) {
+			throw ArduinoEmulatorException("Unable to write data to an input pin (" + std::to_string(mState.pin) + ").");
+		}
+
+		auto state = ArduinoPinState::pwm(mState.pin, duty);
+		if (!(mState == state)) {
+			markActivity();
+		}
+		mState = state;
 		addEvent(time, mState);
 	}
 };
@@ -190,6 +371,12 @@ public:
 class ArduinoEmulator
 {
 friend class ArduinoSimulationController;
+public:
+	/**
+	 * Capacity of the serial input buffer (much larger than on real Arduino, since whole lines are received at once).
+	 */
+	static constexpr std::size_t SERIAL_BUFFER_CAPACITY = 4096;
+
 private:
 	/**
 	 * Current timestamp in microseconds (time elapsed from the start).
@@ -198,15 +385,43 @@ private:
 	logtime_t mCurrentTime;
 
 	/**
-	 * Pins of the arduino and their state.
+	 * Pins of the arduino and their state (flat table indexed by pin numbers).
 	 */
-	std::map<pin_t, ArduinoPin> mPins;
+	PinTable<ArduinoPin> mPins;
 
 	/**
 	 * Cache for future time series that feed the input pins.
 	 * These series need to be attached to emulator, so it can properly advance their time.
 	 */
-	std::map<pin_t, EventConsumer<ArduinoPinState>*> mInputs;
+	PinTable<EventConsumer<ArduinoPinState>*> mInputs;
+
+	/**
+	 * Inputs that are future event queues (their pending events can be looked ahead by pulseIn()).
+	 */
+	PinTable<const FutureEventsQueue<ArduinoPinState>*> mInputQueues;
+
+	/**
+	 * Optional source of input events loaded on demand (before the inputs are advanced).
+	 */
+	InputEventsSource* mInputSource;
+
+	/**
+	 * Optional recorder of all events delivered into the pin consumer chains.
+	 */
+	EmulatorTraceRecorder* mTraceRecorder;
+
+	/**
+	 * The earliest deadline of all consumer chains attached to pins and inputs.
+	 * Until the current time reaches this deadline, time advances are not propagated into the chains,
+	 * since no consumer would produce any event.
+	 */
+	logtime_t mNextDeadline;
+
+	/**
+	 * Counter of changes observable by the tested code or by the pin consumers (pin value changes, serial transfers).
+	 * If it does not change during a loop, the loop was idle (used by the time warp of the simulation controller).
+	 */
+	std::uint64_t mActivity;
 
 	// Guards that prevent certain function from being called.
 	bool mEnablePinMode;
@@ -227,6 +442,16 @@ private:
 	bool mEnableNoTone;
 	bool mEnableSerial;
 
+	// Watchdog (both limits are disabled by default)
+	bool mWatchdogHostEnabled;
+	std::chrono::steady_clock::duration mWatchdogHostBudget;
+	std::chrono::steady_clock::time_point mWatchdogHostDeadline;
+	unsigned mWatchdogTicks;			///< host clock is checked only once in a while (when this counter wraps)
+	logtime_t mWatchdogLoopLimit;		///< max. logical time advance within one loop() (0 = unlimited)
+	logtime_t mWatchdogLoopDeadline;	///< logical time at which the current loop() is terminated
+
+	static constexpr unsigned WATCHDOG_CHECK_PERIOD = 64;
+
 	// Timing parameters
 	logtime_t mPinReadDelay;
 	logtime_t mPinWriteDelay;
@@ -235,11 +460,40 @@ private:
 	/**
 	 * Buffer of currently available serial data (which can be read by Arduino).
 	 */
-	std::deque<char> mSerialData;
+	RingBuffer<char> mSerialData;
+
+	/**
+	 * Number of received bytes that were dropped since the serial buffer was full.
+	 */
+	std::size_t mSerialOverflow;
+
+	/**
+	 * Consumer of the serial output (data sent by Arduino), the output is discarded if null.
+	 */
+	EventConsumer<std::string>* mSerialOutputConsumer;
+
+	/**
+	 * Serial output written since the last flush (one event per loop is emitted) and the time of its first write.
+	 */
+	std::string mSerialOutput;
+	logtime_t mSerialOutputTime;
+
+	/**
+	 * Random generator used by random() functions (each emulator instance has its own sequence).
+	 */
+	std::default_random_engine mRandomEngine;
+
+#ifdef MOCCARDUINO_STATS
+	/**
+	 * Profiling data (collected only if the instrumentation is compiled in).
+	 */
+	mutable EmulatorStats mStats;
+#endif
 	
 	void reset()
 	{
 		mCurrentTime = 0;
+		invalidateDeadline();
 
 		for (auto& [_, input] : mInputs) {
 			input->clear();
@@ -250,6 +504,11 @@ private:
 		}
 
 		mSerialData.clear();
+		mSerialOverflow = 0;
+		mSerialOutput.clear();
+#ifdef MOCCARDUINO_STATS
+		mStats.clear();
+#endif
 	}
 
 	/**
@@ -260,15 +519,113 @@ private:
 	logtime_t advanceCurrentTimeBy(logtime_t us)
 	{
 		mCurrentTime += us;
+		watchdogTick();
+		if (mCurrentTime >= mNextDeadline) {
+			advanceChains();
+		}
+		return mCurrentTime;
+	}
+
+	/**
+	 * Verify the watchdog limits. The host clock is read only at every WATCHDOG_CHECK_PERIOD-th tick,
+	 * so the check is cheap enough to be made by every API function that may be polled in a busy loop.
+	 */
+	void watchdogTick()
+	{
+		if (mCurrentTime > mWatchdogLoopDeadline) {
+			throw ArduinoWatchdogException("The loop() function advanced the logical time by more than "
+				+ std::to_string(mWatchdogLoopLimit) + " us.");
+		}
+
+		if (mWatchdogHostEnabled && ++mWatchdogTicks >= WATCHDOG_CHECK_PERIOD) {
+			mWatchdogTicks = 0;
+			checkHostBudget();
+		}
+	}
 
+	void checkHostBudget()
+	{
+		if (mWatchdogHostEnabled && std::chrono::steady_clock::now() > mWatchdogHostDeadline) {
+			auto budget = std::chrono::duration_cast<std::chrono::milliseconds>(mWatchdogHostBudget);
+			throw ArduinoWatchdogException("The simulation exceeded its host time budget ("
+				+ std::to_string(budget.count()) + " ms).");
+		}
+	}
+
+	/**
+	 * Called by the simulation controller before each loop() invocation.
+	 */
+	void watchdogLoopStarted()
+	{
+		checkHostBudget();
+		mWatchdogLoopDeadline = mWatchdogLoopLimit > 0
+			? mCurrentTime + mWatchdogLoopLimit : EventConsumer<ArduinoPinState>::NO_DEADLINE;
+	}
+
+	/**
+	 * Called by the simulation controller after each loop() invocation.
+	 */
+	void watchdogLoopFinished()
+	{
+		mWatchdogLoopDeadline = EventConsumer<ArduinoPinState>::NO_DEADLINE;
+	}
+
+	/**
+	 * Propagate current time into all consumer chains whose deadline has passed and find the next deadline.
+	 */
+	void advanceChains()
+	{
+		// lazily loaded events are enqueued first, they are delivered as if they were scheduled in advance
+		if (mInputSource != nullptr && mInputSource->nextEventTime() <= mCurrentTime) {
+			mInputSource->loadEventsUntil(mCurrentTime);
+		}
+
+		// inputs go first, so the pins see the input events before their own time advances
 		for (auto& [_, input] : mInputs) {
-			input->advanceTime(mCurrentTime);
+			if (input->getDeadline() <= mCurrentTime) {
+				input->advanceTime(mCurrentTime);
+			}
+		}
+
+		if (mTraceRecorder != nullptr) {
+			mTraceRecorder->recordTimeAdvance(mCurrentTime);
 		}
 
 		for (auto& [_, arduinoPin] : mPins) {
-			arduinoPin.advanceTime(mCurrentTime);
+			if (arduinoPin.getDeadline() <= mCurrentTime) {
+				arduinoPin.advanceTime(mCurrentTime);
+			}
 		}
-		return mCurrentTime;
+
+		// chains may share consumers, so the deadlines are collected after all the advances are done
+		mNextDeadline = EventConsumer<ArduinoPinState>::NO_DEADLINE;
+		if (mInputSource != nullptr) {
+			scheduleDeadline(mInputSource->nextEventTime());
+		}
+		for (auto& [_, input] : mInputs) {
+			scheduleDeadline(input->getDeadline());
+		}
+
+		for (auto& [_, arduinoPin] : mPins) {
+			scheduleDeadline(arduinoPin.getDeadline());
+		}
+	}
+
+	/**
+	 * Register a deadline of a consumer chain (time when the chain needs to be notified about time advance).
+	 */
+	void scheduleDeadline(logtime_t deadline)
+	{
+		mNextDeadline = std::min(mNextDeadline, deadline);
+	}
+
+	/**
+	 * Make sure the next time advance is propagated into all the chains that require it.
+	 * Used when chains are modified, so their deadlines are unknown.
+	 */
+	void invalidateDeadline()
+	{
+		mNextDeadline = 0;
 	}
 
 	/**
@@ -276,13 +633,13 @@ private:
 	 */
 	ArduinoPin& getPin(pin_t pin)
 	{
-		auto it = mPins.find(pin);
-		if (it == mPins.end()) {
+		auto arduinoPin = mPins.find(pin);
+		if (arduinoPin == nullptr) {
 			throw ArduinoEmulatorException("Trying to reach pin (" + std::to_string(pin)
 				+ ") which is not defined in the emulator.");
 		}
 
-		return it->second;
+		return *arduinoPin;
 	}
 
 	/**
@@ -291,7 +648,9 @@ private:
 	void removeAllPins()
 	{
 		mInputs.clear();
+		mInputQueues.clear();
 		mPins.clear();
+		invalidateDeadline();
 	}
 
 	/**
@@ -299,11 +658,22 @@ private:
 	 */
 	void registerPin(pin_t pin, int wiring = ArduinoPin::UNDEFINED)
 	{
-		auto it = mPins.find(pin);
-		if (it != mPins.end()) {
+		if (mPins.contains(pin)) {
 			throw ArduinoEmulatorException("Given pin (" + std::to_string(pin) + ") already exists.");
 		}
-		mPins.emplace(pin, ArduinoPin(pin, wiring));
+		auto& arduinoPin = mPins.emplace(pin, pin, wiring, &mActivity);
+		arduinoPin.mTraceRecorder = mTraceRecorder;
+	}
+
+	/**
+	 * Attach a recorder of the pin events (null detaches it), the recorder is used by all pins.
+	 */
+	void setTraceRecorder(EmulatorTraceRecorder* recorder)
+	{
+		mTraceRecorder = recorder;
+		for (auto& [_, arduinoPin] : mPins) {
+			arduinoPin.mTraceRecorder = recorder;
+		}
 	}
 
 	/**
@@ -320,14 +690,139 @@ private:
 		}
 
 		// detach old input chain first (if exists)
-		auto it = mInputs.find(pin);
-		if (it != mInputs.end()) {
-			it->second->lastConsumer()->detachNextConsumer();
+		auto oldInput = mInputs.find(pin);
+		if (oldInput != nullptr) {
+			(*oldInput)->lastConsumer()->detachNextConsumer();
 		}
 
 		// attach the corresponding input pin at the end of consumer chain
 		input.lastConsumer()->attachNextConsumer(arduinoPin);
-		mInputs[pin] = &input;
+		mInputs.set(pin, &input);
+		mInputQueues.erase(pin);
+		invalidateDeadline();
+	}
+
+	/**
+	 * Register a queue of future events as an input for particular pin (pending events are used for lookahead).
+	 */
+	void registerPinInput(pin_t pin, FutureEventsQueue<ArduinoPinState>& input)
+	{
+		registerPinInput(pin, static_cast<EventConsumer<ArduinoPinState>&>(input));
+		mInputQueues.set(pin, &input);
+	}
+
+	/**
+	 * Measure a pulse on an input pin as pulseIn() does (wait for the end of a pulse in progress,
+	 * then for the beginning of the pulse and its end). The edges are found by looking ahead in the input queue,
+	 * so the time jumps directly to the end of the pulse (or the timeout) instead of polling the pin.
+	 * @return length of the pulse in microseconds, 0 if no complete pulse was found within the timeout
+	 */
+	unsigned long measurePulse(pin_t pin, std::uint8_t state, unsigned long timeout)
+	{
+		advanceCurrentTimeBy(0); // deliver events which are already due
+		auto& arduinoPin = getPin(pin);
+		bool level = arduinoPin.read() == HIGH;
+		bool pulseLevel = state == HIGH;
+
+		logtime_t start = mCurrentTime;
+		logtime_t deadline = mCurrentTime + timeout;
+		if (mInputSource != nullptr) {
+			mInputSource->loadEventsUntil(deadline); // lazily loaded events have to be enqueued for the lookahead
+		}
+
+		// 0 = waiting for the end of a pulse in progress, 1 = waiting for the pulse, 2 = measuring the pulse
+		int phase = level == pulseLevel ? 0 : 1;
+		logtime_t pulseStart = 0, pulseEnd = 0;
+		auto queue = mInputQueues.find(pin);
+		if (queue != nullptr) {
+			(*queue)->peekEvents(mCurrentTime, [&](logtime_t time, const ArduinoPinState& pinState) {
+				if (time > deadline) {
+					return false;
+				}
+
+				bool newLevel = pinState.value == HIGH;
+				if (phase == 0 && newLevel != pulseLevel) {
+					phase = 1;
+				}
+				else if (phase == 1 && newLevel == pulseLevel) {
+					phase = 2;
+					pulseStart = time;
+				}
+				else if (phase == 2 && newLevel != pulseLevel) {
+					pulseEnd = time;
+					phase = 3;
+					return false;
+				}
+				return true;
+			});
+		}
+
+		if (phase != 3) {
+			advanceCurrentTimeBy(deadline - mCurrentTime);
+			return 0;
+		}
+
+		advanceCurrentTimeBy(pulseEnd - start);
+		return (unsigned long)(pulseEnd - pulseStart);
+	}
+
+	/**
+	 * Update the pins after a byte of shiftOut() was delivered in bulk, so they end up in the same state
+	 * as if the writes were performed (last bit on the data pin, clock LOW).
+	 */
+	static void setShiftedByteWritten(ArduinoPin& data, ArduinoPin& clock, logtime_t time, logtime_t writeDelay,
+		std::uint8_t bitOrder, std::uint8_t val)
+	{
+		int lastBit = bitOrder == LSBFIRST ? (val >> 7) & 1 : val & 1;
+		data.setWrittenValue(lastBit, time + 21 * writeDelay);
+		clock.setWrittenValue(LOW, time + 23 * writeDelay);
+	}
+
+	/**
+	 * Try to deliver a byte of shiftOut() to the pins consumer at once. That is possible only if both pins are
+	 * connected directly to the same ShiftOutConsumer which accepts the byte. Otherwise, regular writes are used.
+	 * @return true if the byte was delivered (including the pin updates and time advancement)
+	 */
+	bool shiftOutBulk(pin_t dataPin, pin_t clockPin, std::uint8_t bitOrder, std::uint8_t val)
+	{
+		if (!mEnableDigitalWrite || dataPin == clockPin) {
+			return false; // let the regular writes handle the errors
+		}
+
+		auto dataPtr = mPins.find(dataPin);
+		auto clockPtr = mPins.find(clockPin);
+		if (dataPtr == nullptr || clockPtr == nullptr) {
+			return false;
+		}
+
+		auto& data = *dataPtr;
+		auto& clock = *clockPtr;
+		if (data.mMode != OUTPUT || clock.mMode != OUTPUT
+			|| data.nextConsumer() == nullptr || data.nextConsumer() != clock.nextConsumer()) {
+			return false;
+		}
+
+		auto consumer = dynamic_cast<ShiftOutConsumer*>(data.nextConsumer());
+		if (consumer == nullptr || !consumer->addShiftedByte(mCurrentTime, mPinWriteDelay, dataPin, clockPin, bitOrder, val)) {
+			return false;
+		}
+
+		if (mTraceRecorder != nullptr) {
+			mTraceRecorder->recordShiftedByte(mCurrentTime, mPinWriteDelay, dataPin, clockPin, bitOrder, val);
+		}
+		setShiftedByteWritten(data, clock, mCurrentTime, mPinWriteDelay, bitOrder, val);
+		scheduleDeadline(data.getDeadline());
+		// the statistics are the same as if the 24 nested digitalWrite() calls were made (so profiles of the same
+		// sketch do not depend on whether the bulk delivery was possible)
+		MOCCARDUINO_STATS_API_CALLS(DIGITAL_WRITE, 24, 24 * mPinWriteDelay);
+		MOCCARDUINO_STATS_PIN_WRITES(dataPin, 8);
+		MOCCARDUINO_STATS_PIN_WRITES(clockPin, 16);
+
+		// time advances exactly the same way as with 24 individual writes
+		for (std::size_t i = 0; i < 24; ++i) {
+			advanceCurrentTimeBy(mPinWriteDelay);
+		}
+		return true;
 	}
 
 	/**
@@ -347,8 +842,18 @@ private:
 	}
 
 public:
-	ArduinoEmulator() :
+	/**
+	 * @param board descriptor used to size the pin tables (the pins themselves are registered separately)
+	 */
+	ArduinoEmulator(const BoardDescriptor& board = UNO_BOARD) :
 		mCurrentTime(0),
+		mPins(board),
+		mInputs(board),
+		mInputQueues(board),
+		mInputSource(nullptr),
+		mTraceRecorder(nullptr),
+		mNextDeadline(0),
+		mActivity(0),
 		mEnablePinMode(true),
 		mEnableDigitalWrite(true),
 		mEnableDigitalRead(true),
@@ -366,9 +871,18 @@ public:
 		mEnableTone(true),
 		mEnableNoTone(true),
 		mEnableSerial(false),
+		mWatchdogHostEnabled(false),
+		mWatchdogHostBudget(0),
+		mWatchdogTicks(0),
+		mWatchdogLoopLimit(0),
+		mWatchdogLoopDeadline(EventConsumer<ArduinoPinState>::NO_DEADLINE),
 		mPinReadDelay(20),
 		mPinWriteDelay(20),
-		mPinSetModeDelay(100)
+		mPinSetModeDelay(100),
+		mSerialData(SERIAL_BUFFER_CAPACITY),
+		mSerialOverflow(0),
+		mSerialOutputConsumer(nullptr),
+		mSerialOutputTime(0)
 	{}
 
 	/*
@@ -384,6 +898,7 @@ public:
 	 */
 	void pinMode(pin_t pin, std::uint8_t mode)
 	{
+		MOCCARDUINO_STATS_API(PIN_MODE);
 		if (!mEnablePinMode) {
 			throw ArduinoEmulatorException("The pinMode() function is disabled in the emulator.");
 		}
@@ -399,12 +914,15 @@ public:
 	 */
 	void digitalWrite(pin_t pin, std::uint8_t val)
 	{
+		MOCCARDUINO_STATS_API(DIGITAL_WRITE);
 		if (!mEnableDigitalWrite) {
 			throw ArduinoEmulatorException("The digitalWrite() function is disabled in the emulator.");
 		}
 
 		auto& arduinoPin = getPin(pin);
 		arduinoPin.write(val, mCurrentTime);
+		MOCCARDUINO_STATS_PIN_WRITES(pin, 1);
+		scheduleDeadline(arduinoPin.getDeadline()); // the new event may have opened a window somewhere in the chain
 		advanceCurrentTimeBy(mPinWriteDelay);
 	}
 
@@ -414,12 +932,14 @@ public:
 	 */
 	int digitalRead(pin_t pin)
 	{
+		MOCCARDUINO_STATS_API(DIGITAL_READ);
 		if (!mEnableDigitalRead) {
 			throw ArduinoEmulatorException("The digitalRead() function is disabled in the emulator.");
 		}
 
 		auto& arduinoPin = getPin(pin);
 		auto val = arduinoPin.read();
+		MOCCARDUINO_STATS_PIN_READ(pin);
 		advanceCurrentTimeBy(mPinReadDelay);
 		return val;
 	}
@@ -430,12 +950,14 @@ public:
 	 */
 	int analogRead(pin_t pin)
 	{
+		MOCCARDUINO_STATS_API(ANALOG_READ);
 		if (!mEnableAnalogRead) {
 			throw ArduinoEmulatorException("The analogRead() function is disabled in the emulator.");
 		}
 
 		auto& arduinoPin = getPin(pin);
 		auto val = arduinoPin.read();
+		MOCCARDUINO_STATS_PIN_READ(pin);
 		advanceCurrentTimeBy(mPinReadDelay); // delay taken from documentation
 		return val * 1023;
 	}
@@ -446,6 +968,7 @@ public:
 	 */
 	void analogReference(std::uint8_t mode)
 	{
+		MOCCARDUINO_STATS_API(ANALOG_REFERENCE);
 		if (!mEnableAnalogReference) {
 			throw ArduinoEmulatorException("The analogReference() function is disabled in the emulator.");
 		}
@@ -454,11 +977,13 @@ public:
 	}
 
 	/**
-	 * Writes an analog value (PWM wave) to a pin. 
+	 * Writes an analog value (PWM wave) to a pin. The wave is not emulated by individual toggles,
+	 * the pin emits one event that holds the duty cycle (0 = always LOW, 255 = always HIGH).
 	 * https://www.arduino.cc/reference/en/language/functions/analog-io/analogwrite/
 	 */
 	void analogWrite(pin_t pin, int val)
 	{
+		MOCCARDUINO_STATS_API(ANALOG_WRITE);
 		if (!mEnableAnalogWrite) {
 			throw ArduinoEmulatorException("The analogWrite() function is disabled in the emulator.");
 		}
@@ -467,7 +992,15 @@ public:
 			throw ArduinoEmulatorException("Only pins that support PWM can be used in analogWrite() function.");
 		}
 
-		throw ArduinoEmulatorException("The analogWrite() function is not implemented in the emulator yet.");
+		if (val < 0 || val > ArduinoPinState::DUTY_HIGH) {
+			throw ArduinoEmulatorException("Value " + std::to_string(val) + " given to analogWrite() is out of range (0-255).");
+		}
+
+		auto& arduinoPin = getPin(pin);
+		arduinoPin.writePwm((std::uint8_t)val, mCurrentTime);
+		MOCCARDUINO_STATS_PIN_WRITES(pin, 1);
+		scheduleDeadline(arduinoPin.getDeadline());
+		advanceCurrentTimeBy(mPinWriteDelay);
 	}
 
 	// Timing
@@ -478,9 +1011,11 @@ public:
 	 */
 	unsigned long millis(void)
 	{
+		MOCCARDUINO_STATS_API(MILLIS);
 		if (!mEnableMillis) {
 			throw ArduinoEmulatorException("The millis() function is disabled in the emulator.");
 		}
+		watchdogTick(); // the code may be polling the time in a busy loop
 
 		return (unsigned long)(mCurrentTime / 1000);
 	}
@@ -491,9 +1026,11 @@ public:
 	 */
 	unsigned long micros(void)
 	{
+		MOCCARDUINO_STATS_API(MICROS);
 		if (!mEnableMicros) {
 			throw ArduinoEmulatorException("The micros() function is disabled in the emulator.");
 		}
+		watchdogTick(); // the code may be polling the time in a busy loop
 
 		return (unsigned long)mCurrentTime;
 	}
@@ -504,6 +1041,7 @@ public:
 	 */
 	void delay(unsigned long ms)
 	{
+		MOCCARDUINO_STATS_API(DELAY);
 		if (!mEnableDelay) {
 			throw ArduinoEmulatorException("The delay() function is disabled in the emulator.");
 		}
@@ -518,6 +1056,7 @@ public:
 	 */
 	void delayMicroseconds(unsigned int us)
 	{
+		MOCCARDUINO_STATS_API(DELAY_MICROSECONDS);
 		if (!mEnableDelayMicroseconds) {
 			throw ArduinoEmulatorException("The delayMicroseconds() function is disabled in the emulator.");
 		}
@@ -533,11 +1072,12 @@ public:
 	 */
 	unsigned long pulseIn(pin_t pin, std::uint8_t state, unsigned long timeout = 1000000L)
 	{
+		MOCCARDUINO_STATS_API(PULSE_IN);
 		if (!mEnablePulseIn) {
 			throw ArduinoEmulatorException("The pulseIn() function is disabled in the emulator.");
 		}
 
-		throw ArduinoEmulatorException("The pulseIn() function is not implemented in the emulator yet.");
+		return measurePulse(pin, state, timeout);
 	}
 
 	/**
@@ -546,11 +1086,12 @@ public:
 	 */
 	unsigned long pulseInLong(pin_t pin, std::uint8_t state, unsigned long timeout = 1000000L)
 	{
+		MOCCARDUINO_STATS_API(PULSE_IN_LONG);
 		if (!mEnablePulseInLong) {
 			throw ArduinoEmulatorException("The pulseInLong() function is disabled in the emulator.");
 		}
 
-		throw ArduinoEmulatorException("The pulseInLong() function is not implemented in the emulator yet.");
+		return measurePulse(pin, state, timeout);
 	}
 
 	/**
@@ -559,9 +1100,14 @@ public:
 	 */
 	void shiftOut(pin_t dataPin, pin_t clockPin, std::uint8_t bitOrder, std::uint8_t val)
 	{
+		MOCCARDUINO_STATS_API(SHIFT_OUT);
 		if (!mEnableShiftOut) {
 			throw ArduinoEmulatorException("The shiftOut() function is disabled in the emulator.");
 		}
+
+		if (shiftOutBulk(dataPin, clockPin, bitOrder, val)) {
+			return;
+		}
 		
 		// Taken from Arduino codebase (wiring_shift.c)
 		for (std::uint8_t i = 0; i < 8; i++) {
@@ -585,6 +1131,7 @@ public:
 	 */
 	std::uint8_t shiftIn(pin_t dataPin, pin_t clockPin, std::uint8_t bitOrder)
 	{
+		MOCCARDUINO_STATS_API(SHIFT_IN);
 		if (!mEnableShiftIn) {
 			throw ArduinoEmulatorException("The shiftIn() function is disabled in the emulator.");
 		}
@@ -608,6 +1155,7 @@ public:
 	 */
 	void tone(pin_t pin, unsigned int frequency, unsigned long duration = 0)
 	{
+		MOCCARDUINO_STATS_API(TONE);
 		if (!mEnableTone) {
 			throw ArduinoEmulatorException("The tone() function is disabled in the emulator.");
 		}
@@ -621,6 +1169,7 @@ public:
 	 */
 	void noTone(pin_t pin)
 	{
+		MOCCARDUINO_STATS_API(NO_TONE);
 		if (!mEnableNoTone) {
 			throw ArduinoEmulatorException("The noTone() function is disabled in the emulator.");
 		}
@@ -628,6 +1177,39 @@ public:
 		throw ArduinoEmulatorException("The noTone() function is not implemented in the emulator yet.");
 	}
 
+	// Random numbers
+
+	/**
+	 * Generate a pseudo-random number from given range.
+	 * https://www.arduino.cc/reference/en/language/functions/random-numbers/random/
+	 */
+	long random(long min, long max)
+	{
+		MOCCARDUINO_STATS_API(RANDOM);
+		std::uniform_int_distribution<long> distribution(min, max);
+		return distribution(mRandomEngine);
+	}
+
+	/**
+	 * Initialize the pseudo-random number generator.
+	 * https://www.arduino.cc/reference/en/language/functions/random-numbers/randomseed/
+	 */
+	void randomSeed(unsigned long seed)
+	{
+		MOCCARDUINO_STATS_API(RANDOM_SEED);
+		mRandomEngine.seed(seed);
+	}
+
+#ifdef MOCCARDUINO_STATS
+	/**
+	 * Return profiling data collected so far.
+	 */
+	const EmulatorStats& getStats() const
+	{
+		return mStats;
+	}
+#endif
+
 	bool isSerialEnabled() const
 	{
 		return mEnableSerial;
@@ -638,10 +1220,22 @@ public:
 	 */
 	void addSerialData(const std::string& str)
 	{
-		for (char c : str) {
-			mSerialData.push_back(c);
+		if (mTraceRecorder != nullptr) {
+			mTraceRecorder->recordSerialInput(mCurrentTime, str);
 		}
-		mSerialData.push_back('\n');
+		mSerialOverflow += str.size() - mSerialData.push(str.data(), str.size());
+		if (!mSerialData.push('\n')) {
+			++mSerialOverflow;
+		}
+		++mActivity;
+	}
+
+	/**
+	 * Return number of received bytes that were dropped since the serial buffer was full.
+	 */
+	std::size_t getSerialOverflow() const
+	{
+		return mSerialOverflow;
 	}
 
 	/**
@@ -649,6 +1243,7 @@ public:
 	 */
 	std::size_t serialDataAvailable() const
 	{
+		MOCCARDUINO_STATS_API(SERIAL_IO);
 		return mSerialData.size();
 	}
 
@@ -657,11 +1252,12 @@ public:
 	 */
 	char peekSerial() const
 	{
+		MOCCARDUINO_STATS_API(SERIAL_IO);
 		if (mSerialData.empty()) {
 			return '\0';
 		}
 
-		return mSerialData.front();
+		return mSerialData[0];
 	}
 
 	/**
@@ -669,14 +1265,80 @@ public:
 	 */
 	char readSerial()
 	{
+		MOCCARDUINO_STATS_API(SERIAL_IO);
 		if (mSerialData.empty()) {
 			return '\0';
 		}
 
-		char res = mSerialData.front();
-		mSerialData.pop_front();
+		char res;
+		mSerialData.pop(&res, 1);
+		++mActivity;
 		return res;
 	}
+
+	/**
+	 * Pop multiple chars from the serial data buffer.
+	 * @return number of chars actually read
+	 */
+	std::size_t readSerialBytes(char* buffer, std::size_t length)
+	{
+		MOCCARDUINO_STATS_API(SERIAL_IO);
+		length = mSerialData.pop(buffer, length);
+		if (length > 0) {
+			++mActivity;
+		}
+		return length;
+	}
+
+	/**
+	 * Pop chars from the serial data buffer until the terminator is found (it is removed, but not stored).
+	 * @return number of chars stored in the buffer
+	 */
+	std::size_t readSerialBytesUntil(char terminator, char* buffer, std::size_t length)
+	{
+		MOCCARDUINO_STATS_API(SERIAL_IO);
+		std::size_t pos = mSerialData.find(terminator);
+		bool terminated = pos < length;
+		length = mSerialData.pop(buffer, terminated ? pos : length);
+		if (terminated) {
+			mSerialData.pop(nullptr, 1);
+		}
+		if (length > 0 || terminated) {
+			++mActivity;
+		}
+		return length;
+	}
+
+	/**
+	 * Append data sent by Arduino to the serial output (the output of one loop is emitted as one event).
+	 */
+	void writeSerial(const std::string& data)
+	{
+		MOCCARDUINO_STATS_API(SERIAL_IO);
+		if (mSerialOutputConsumer == nullptr) {
+			return; // nobody observes the output (e.g., debugging prints)
+		}
+		if (mSerialOutput.empty()) {
+			mSerialOutputTime = mCurrentTime;
+		}
+		mSerialOutput.append(data);
+		++mActivity;
+	}
+
+	/**
+	 * Emit the serial output written since the last flush as one event (invoked after each loop).
+	 * The time of the consumer is advanced, so it can process the events immediately.
+	 */
+	void flushSerialOutput()
+	{
+		if (mSerialOutputConsumer != nullptr) {
+			if (!mSerialOutput.empty()) {
+				mSerialOutputConsumer->addEvent(mSerialOutputTime, mSerialOutput);
+			}
+			mSerialOutputConsumer->advanceTime(mCurrentTime);
+		}
+		mSerialOutput.clear();
+	}
 };
 
 #endif
@@ -1,7 +1,7 @@
 #ifndef MOCCARDUINO_SHARED_HELPERS_HPP
 #define MOCCARDUINO_SHARED_HELPERS_HPP
 
-#include <deque>
+#include <vector>
 #include <array>
 #include <algorithm>
 #include <stdexcept>
@@ -9,32 +9,86 @@
 #include <sstream>
 #include <iomanip>
 #include <string>
+#include <type_traits>
 #include <cstdint>
 
 
+/**
+ * Return the number of bits set in given word.
+ */
+inline std::size_t popCount(std::uint64_t word)
+{
+#ifdef __GNUC__
+	return (std::size_t)__builtin_popcountll(word);
+#else
+	word = word - ((word >> 1) & 0x5555555555555555ull);
+	word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+	word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0full;
+	return (std::size_t)((word * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+/**
+ * Return the index of the lowest bit set in given word (the word must not be zero).
+ */
+inline std::size_t lowestBitIndex(std::uint64_t word)
+{
+#ifdef __GNUC__
+	return (std::size_t)__builtin_ctzll(word);
+#else
+	return popCount((word & (~word + 1)) - 1); // isolate the lowest bit and count the zeros below it
+#endif
+}
+
+/**
+ * Return a mask with given number of lowest bits set.
+ */
+inline std::uint64_t lowBitsMask(std::size_t count)
+{
+	return count >= 64 ? ~(std::uint64_t)0 : (((std::uint64_t)1 << count) - 1);
+}
+
+
 /**
  * Represents an array of bits of fixed size and offers some special functions.
  * Useful for LED bars, matrices, and 7-seg displays to represent intermediate state.
+ * The bits are packed in machine words (the smallest unsigned type that holds all the bits or 64-bit words),
+ * the unused bits of the last word are always kept at zero, so the words can be compared directly.
  */
 template<int N>
 class BitArray
 {
+public:
+	/**
+	 * Type of the internal words.
+	 */
+	using word_t = std::conditional_t<(N <= 8), std::uint8_t,
+		std::conditional_t<(N <= 16), std::uint16_t,
+		std::conditional_t<(N <= 32), std::uint32_t, std::uint64_t>>>;
+
+	static constexpr std::size_t WORD_BITS = sizeof(word_t) * 8;
+	static constexpr std::size_t WORDS = (N + WORD_BITS - 1) / WORD_BITS;
+
+	/**
+	 * Number of chars of the hex representation (one digit for tiny arrays, two digits for every byte otherwise).
+	 */
+	static constexpr std::size_t HEX_DIGITS = (N <= 4) ? 1 : ((N + 7) / 8) * 2;
+
 private:
 	template<int NN>
 	friend std::ostream& operator<<(std::ostream& os, const BitArray<NN>& ba);
 
 	/**
-	 * Internal data are stored in fixed-sized array of bytes (the most compact way).
+	 * Internal data are stored in fixed-sized array of words.
 	 */
-	std::array<std::uint8_t, (N + 7) / 8> mData;
+	std::array<word_t, WORDS> mData;
 
 	/**
-	 * Internal writer.
+	 * Mask of the valid bits in the last word.
 	 */
-	void setBit(bool value, std::size_t idx)
+	static constexpr word_t lastWordMask()
 	{
-		std::uint8_t mask = 1 << (idx % 8);
-		mData[idx / 8] = value ? (mData[idx / 8] | mask) : (mData[idx / 8] & (~mask));
+		return (N % WORD_BITS) == 0 ? (word_t)~(word_t)0 : (word_t)(((word_t)1 << (N % WORD_BITS)) - 1);
 	}
 
 	/**
@@ -42,7 +96,16 @@ private:
 	 */
 	bool getBit(std::size_t idx) const
 	{
-		return (mData[idx / 8] >> (idx % 8)) & 0x01;
+		return (mData[idx / WORD_BITS] >> (idx % WORD_BITS)) & 0x01;
+	}
+
+	/**
+	 * Return given word of the array, all bits inverted if value is false (so the bits equal to value are set).
+	 */
+	word_t matchingWord(std::size_t w, bool value) const
+	{
+		word_t word = value ? mData[w] : (word_t)~mData[w];
+		return w + 1 == WORDS ? (word_t)(word & lastWordMask()) : word;
 	}
 
 public:
@@ -59,7 +122,8 @@ public:
 	 */
 	void fill(bool value)
 	{
-		mData.fill(value ? 0xff : 0x00);
+		mData.fill(value ? (word_t)~(word_t)0 : (word_t)0);
+		mData[WORDS - 1] &= lastWordMask();
 	}
 
 	/**
@@ -76,22 +140,114 @@ public:
 
 	bool operator==(const BitArray<N>& ba) const
 	{
-		// lets make sure == operator compares only relevant bits
-		if (N >= 8) {
-			for (std::size_t i = 0; i < N / 8; ++i) {
-				if (mData[i] != ba.mData[i]) return false;
-			}
+		// unused bits are always zero, so whole words can be compared
+		return mData == ba.mData;
+	}
+
+	bool operator!=(const BitArray<N>& ba) const
+	{
+		return !operator==(ba);
+	}
+
+	BitArray<N> operator~() const
+	{
+		BitArray<N> res;
+		for (std::size_t w = 0; w < WORDS; ++w) {
+			res.mData[w] = (word_t)~mData[w];
 		}
+		res.mData[WORDS - 1] &= lastWordMask();
+		return res;
+	}
 
-		for (std::size_t i = (N/8) * 8; i < N; ++i) {
-			if ((*this)[i] != ba[i]) return false;
+	BitArray<N> operator&(const BitArray<N>& ba) const
+	{
+		BitArray<N> res;
+		for (std::size_t w = 0; w < WORDS; ++w) {
+			res.mData[w] = mData[w] & ba.mData[w];
 		}
-		return true;
+		return res;
 	}
 
-	bool operator!=(const BitArray<N>& ba) const
+	BitArray<N> operator|(const BitArray<N>& ba) const
 	{
-		return !operator==(ba);
+		BitArray<N> res;
+		for (std::size_t w = 0; w < WORDS; ++w) {
+			res.mData[w] = mData[w] | ba.mData[w];
+		}
+		return res;
+	}
+
+	BitArray<N> operator^(const BitArray<N>& ba) const
+	{
+		BitArray<N> res;
+		for (std::size_t w = 0; w < WORDS; ++w) {
+			res.mData[w] = mData[w] ^ ba.mData[w];
+		}
+		return res;
+	}
+
+	/**
+	 * Direct access to the internal words (bit 0 of word 0 is the bit at index 0).
+	 */
+	word_t getWord(std::size_t w) const
+	{
+		return mData[w];
+	}
+
+	/**
+	 * Direct modification of the internal words (bits beyond the size of the array are ignored).
+	 */
+	void setWord(std::size_t w, word_t word)
+	{
+		mData[w] = w + 1 == WORDS ? (word_t)(word & lastWordMask()) : word;
+	}
+
+	/**
+	 * Return the number of bits that are equal to given value.
+	 */
+	std::size_t count(bool value = true) const
+	{
+		std::size_t res = 0;
+		for (std::size_t w = 0; w < WORDS; ++w) {
+			res += popCount(matchingWord(w, value));
+		}
+		return res;
+	}
+
+	/**
+	 * Find the first bit (at or after given index) that is equal to given value.
+	 * @return index of the bit or N if no such bit exists
+	 */
+	std::size_t findFirst(bool value = true, std::size_t from = 0) const
+	{
+		if (from >= N) {
+			return N;
+		}
+
+		std::size_t w = from / WORD_BITS;
+		std::uint64_t word = matchingWord(w, value) & ~lowBitsMask(from % WORD_BITS);
+		while (word == 0) {
+			if (++w >= WORDS) {
+				return N;
+			}
+			word = matchingWord(w, value);
+		}
+		return w * WORD_BITS + lowestBitIndex(word);
+	}
+
+	/**
+	 * Invoke given function for indices of all bits that are equal to given value (in ascending order).
+	 */
+	template<typename F>
+	void forEach(bool value, F&& fnc) const
+	{
+		for (std::size_t w = 0; w < WORDS; ++w) {
+			std::uint64_t word = matchingWord(w, value);
+			while (word != 0) {
+				fnc(w * WORD_BITS + lowestBitIndex(word));
+				word &= word - 1; // clear the lowest bit
+			}
+		}
 	}
 
 	/**
@@ -105,20 +261,23 @@ public:
 	template<typename T>
 	T get(std::size_t offset = 0, std::size_t count = sizeof(T) * 8) const
 	{
-		T res = 0;
 		if (offset >= N) {
-			return res;
+			return 0;
 		}
 
 		count = std::min(count, sizeof(T) * 8);
 		count = std::min(count, N - offset);
-	
-		while (count > 0) {
-			--count;
-			res = res << 1;
-			res |= (*this)[offset + count] ? 1 : 0;
+
+		std::uint64_t res = 0;
+		std::size_t done = 0;
+		while (done < count) {
+			std::size_t idx = offset + done;
+			std::size_t shift = idx % WORD_BITS;
+			std::size_t len = std::min(WORD_BITS - shift, count - done);
+			res |= (((std::uint64_t)mData[idx / WORD_BITS] >> shift) & lowBitsMask(len)) << done;
+			done += len;
 		}
-		return res;
+		return (T)res;
 	}
 
 	/**
@@ -137,32 +296,48 @@ public:
 		}
 
 		count = std::min(count, sizeof(T) * 8);
-		std::size_t end = std::min(offset + count, (std::size_t)N);
-		while (offset < end) {
-			setBit(input & (T)1, offset);
-			input = input >> 1;
-			++offset;
+		count = std::min(count, N - offset);
+
+		std::uint64_t bits = (std::uint64_t)input;
+		std::size_t done = 0;
+		while (done < count) {
+			std::size_t idx = offset + done;
+			std::size_t shift = idx % WORD_BITS;
+			std::size_t len = std::min(WORD_BITS - shift, count - done);
+			std::uint64_t mask = lowBitsMask(len) << shift;
+			auto& word = mData[idx / WORD_BITS];
+			word = (word_t)((word & ~mask) | (((bits >> done) << shift) & mask));
+			done += len;
 		}
 	}
 
 	/**
-	 * Returns the bit array encoded in hex-based string.
+	 * Write the hex representation of the bit array into given buffer (exactly HEX_DIGITS chars, no terminator).
+	 * Bytes are written from the first one, each of them as two digits (high nibble first).
 	 */
-	operator std::string() const
+	void writeHex(char* buffer) const
 	{
-		std::stringstream sstr;
-		sstr << std::hex << std::setfill('0');
+		constexpr char digits[] = "0123456789abcdef";
 		if constexpr (N <= 4) {
-			int val = get<int>(0, 4);
-			sstr << std::setw(1) << val;
+			buffer[0] = digits[get<int>(0, 4) & 0x0f];
 		}
 		else {
-			for (int i = 0; i < ((N + 7) / 8); ++i) {
+			for (std::size_t i = 0; i < ((N + 7) / 8); ++i) {
 				int val = get<int>(i * 8, 8);
-				sstr << std::setw(2) << val;
+				*buffer++ = digits[(val >> 4) & 0x0f];
+				*buffer++ = digits[val & 0x0f];
 			}
 		}
-		return sstr.str();
+	}
+
+	/**
+	 * Returns the bit array encoded in hex-based string.
+	 */
+	operator std::string() const
+	{
+		std::string res(HEX_DIGITS, '0');
+		writeHex(res.data());
+		return res;
 	}
 };
 
@@ -176,15 +351,44 @@ std::ostream& operator<<(std::ostream& os, const BitArray<N>& ba)
 }
 
 /**
- * Shift register simulator of fixed size.
+ * Shift register simulator of fixed size. The bits are packed in 64-bit words,
+ * bit 0 (the last one pushed in) is the lowest bit of the first word.
  */
 class ShiftRegister
 {
 private:
-	std::deque<bool> mRegister;
+	static constexpr std::size_t WORD_BITS = 64;
+
+	std::vector<std::uint64_t> mRegister;
+	std::size_t mSize;
+
+	/**
+	 * Shift the whole register by given number of bits (at most 64) and fill the gap with given bits.
+	 * The bits of the top word beyond the size of the register are cleared.
+	 */
+	void shift(std::uint64_t bits, std::size_t count)
+	{
+		std::uint64_t carry = bits & lowBitsMask(count);
+		for (auto&& word : mRegister) {
+			std::uint64_t nextCarry = count >= WORD_BITS ? word : (count == 0 ? 0 : word >> (WORD_BITS - count));
+			word = (count >= WORD_BITS ? 0 : word << count) | carry;
+			carry = nextCarry;
+		}
+		if (!mRegister.empty()) {
+			mRegister.back() &= lowBitsMask(mSize - (mRegister.size() - 1) * WORD_BITS);
+		}
+	}
+
+	/**
+	 * Internal reader that does not check the range.
+	 */
+	bool getBit(std::size_t idx) const
+	{
+		return (mRegister[idx / WORD_BITS] >> (idx % WORD_BITS)) & 1;
+	}
 
 public:
-	ShiftRegister(std::size_t size) : mRegister(size) {}
+	ShiftRegister(std::size_t size) : mRegister((size + WORD_BITS - 1) / WORD_BITS), mSize(size) {}
 
 	/**
 	 * Push another bit and shif the register.
@@ -192,18 +396,37 @@ public:
 	 */
 	bool push(bool bit)
 	{
-		mRegister.push_front(bit);
-		bool res = mRegister.back();
-		mRegister.pop_back();
+		if (mSize == 0) {
+			return bit;
+		}
+		bool res = getBit(mSize - 1);
+		shift(bit ? 1 : 0, 1);
 		return res;
 	}
 
+	/**
+	 * Push multiple bits at once (as if they were pushed one by one).
+	 * The most significant of the bits goes first, so the value ends up in the lowest bits of the register.
+	 * @param bits value holding the bits in its lowest positions
+	 * @param count number of bits pushed (full size of T by default)
+	 */
+	template<typename T>
+	void pushBits(T bits, std::size_t count = sizeof(T) * 8)
+	{
+		while (count > WORD_BITS) {
+			// only the lowest 64 bits can be held by T anyway, so the first bits are zeros
+			count -= WORD_BITS;
+			shift(0, WORD_BITS);
+		}
+		shift((std::uint64_t)bits, count);
+	}
+
 	/**
 	 * Size of the register (number of bits)
 	 */
 	std::size_t size() const
 	{
-		return mRegister.size();
+		return mSize;
 	}
 
 	/**
@@ -211,12 +434,13 @@ public:
 	 */
 	bool operator[](std::size_t idx) const
 	{
-		return mRegister[idx];
+		return getBit(idx);
 	}
 
 	/**
 	 * Retrieve a sequence of bits as unsigned integral type.
 	 * Size of the result type determines also alignment of the index.
+	 * If the register ends within the requested sequence, available bits are aligned to the top of the result.
 	 * @param idx index in multiples of T
 	 * @return value as T (filled with consecutive bits at index location)
 	 */
@@ -224,16 +448,148 @@ public:
 	T get(std::size_t idx) const
 	{
 		std::size_t len = sizeof(T) * 8;
-		T mask = (T)1 << (len - 1);
-		idx *= len; // word index to index of first bit
-		T res = 0;
-		std::size_t endIdx = std::min(idx + len, mRegister.size());
-		while (idx < endIdx) {
-			res = res >> 1;
-			res |= mRegister[idx] ? mask : 0;
-			++idx;
+		std::size_t start = idx * len; // word index to index of first bit
+		if (start >= mSize) {
+			return 0;
 		}
-		return res;
+
+		std::size_t count = std::min(len, mSize - start);
+		std::uint64_t res = 0;
+		std::size_t done = 0;
+		while (done < count) {
+			std::size_t bit = start + done;
+			std::size_t shift = bit % WORD_BITS;
+			std::size_t chunk = std::min(WORD_BITS - shift, count - done);
+			res |= ((mRegister[bit / WORD_BITS] >> shift) & lowBitsMask(chunk)) << done;
+			done += chunk;
+		}
+		return (T)(res << (len - count));
+	}
+};
+
+
+/**
+ * Queue of fixed capacity stored in a circular buffer (items that do not fit are dropped).
+ * Items are pushed and popped in bulks, so the wrap-around is handled at most twice per operation.
+ */
+template<typename T>
+class RingBuffer
+{
+private:
+	std::vector<T> mBuffer;
+	std::size_t mHead; ///< index of the first item
+	std::size_t mSize;
+
+public:
+	static constexpr std::size_t npos = (std::size_t)-1;
+
+	RingBuffer(std::size_t capacity) : mBuffer(capacity), mHead(0), mSize(0) {}
+
+	std::size_t capacity() const
+	{
+		return mBuffer.size();
+	}
+
+	std::size_t size() const
+	{
+		return mSize;
+	}
+
+	bool empty() const
+	{
+		return mSize == 0;
+	}
+
+	bool full() const
+	{
+		return mSize == mBuffer.size();
+	}
+
+	void clear()
+	{
+		mHead = mSize = 0;
+	}
+
+	/**
+	 * Change the capacity (the buffer is cleared).
+	 */
+	void reset(std::size_t capacity)
+	{
+		mBuffer.assign(capacity, T());
+		clear();
+	}
+
+	/**
+	 * Retrieve an item by its index (0 is the first item in the queue).
+	 */
+	const T& operator[](std::size_t idx) const
+	{
+		std::size_t pos = mHead + idx;
+		return mBuffer[pos >= mBuffer.size() ? pos - mBuffer.size() : pos];
+	}
+
+	/**
+	 * Append items at the end of the queue.
+	 * @return number of items actually stored (the rest did not fit in)
+	 */
+	std::size_t push(const T* items, std::size_t count)
+	{
+		count = std::min(count, mBuffer.size() - mSize);
+		std::size_t tail = mHead + mSize;
+		if (tail >= mBuffer.size()) {
+			tail -= mBuffer.size();
+		}
+
+		std::size_t first = std::min(count, mBuffer.size() - tail);
+		std::copy(items, items + first, mBuffer.begin() + tail);
+		std::copy(items + first, items + count, mBuffer.begin());
+		mSize += count;
+		return count;
+	}
+
+	bool push(const T& item)
+	{
+		return push(&item, 1) == 1;
+	}
+
+	/**
+	 * Remove items from the front of the queue and copy them into a buffer.
+	 * @param items output buffer (if null, the items are only discarded)
+	 * @param count maximal number of items
+	 * @return number of items actually removed
+	 */
+	std::size_t pop(T* items, std::size_t count)
+	{
+		count = std::min(count, mSize);
+		if (items != nullptr) {
+			std::size_t first = std::min(count, mBuffer.size() - mHead);
+			std::copy(mBuffer.begin() + mHead, mBuffer.begin() + mHead + first, items);
+			std::copy(mBuffer.begin(), mBuffer.begin() + (count - first), items + first);
+		}
+
+		mHead += count;
+		if (mHead >= mBuffer.size()) {
+			mHead -= mBuffer.size();
+		}
+		mSize -= count;
+		return count;
+	}
+
+	/**
+	 * Find the first occurrence of an item in the queue.
+	 * @return index of the item or npos
+	 */
+	std::size_t find(const T& item) const
+	{
+		std::size_t first = std::min(mSize, mBuffer.size() - mHead);
+		auto it = std::find(mBuffer.begin() + mHead, mBuffer.begin() + mHead + first, item);
+		if (it != mBuffer.begin() + mHead + first) {
+			return (std::size_t)(it - mBuffer.begin()) - mHead;
+		}
+
+		auto end = mBuffer.begin() + (mSize - first);
+		it = std::find(mBuffer.begin(), end, item);
+		return it != end ? first + (std::size_t)(it - mBuffer.begin()) : npos;
 	}
 };
 
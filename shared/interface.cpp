@@ -2,11 +2,34 @@
 #include "emulator.hpp"
 
 #include <stdexcept>
-#include <random>
+#include <string>
+#include <type_traits>
 #include <cctype>
+#include <cstdio>
 
+/**
+ * The default emulator instance used by all threads that have no emulator bound explicitly.
+ */
 ArduinoEmulator emulator;
 
+/**
+ * Emulator bound to the current thread (null = default emulator is used).
+ * Each thread may run its own simulation, the interface functions below are forwarded to the bound instance.
+ */
+thread_local ArduinoEmulator* threadEmulator = nullptr;
+
+inline ArduinoEmulator& current_emulator()
+{
+	return threadEmulator != nullptr ? *threadEmulator : emulator;
+}
+
+ArduinoEmulator* bind_arduino_emulator(ArduinoEmulator* instance)
+{
+	ArduinoEmulator* previous = threadEmulator;
+	threadEmulator = instance;
+	return previous;
+}
+
 ArduinoEmulator& get_arduino_emulator_instance()
 {
 	// a safeguard that ensures this method is called only once (by our main).
@@ -23,96 +46,93 @@ ArduinoEmulator& get_arduino_emulator_instance()
 
 void pinMode(std::uint8_t pin, std::uint8_t mode)
 {
-	emulator.pinMode(pin, mode);
+	current_emulator().pinMode(pin, mode);
 }
 
 void digitalWrite(std::uint8_t pin, std::uint8_t val)
 {
-	emulator.digitalWrite(pin, val);
+	current_emulator().digitalWrite(pin, val);
 }
 
 int digitalRead(std::uint8_t pin)
 {
-	return emulator.digitalRead(pin);
+	return current_emulator().digitalRead(pin);
 }
 
 int analogRead(std::uint8_t pin)
 {
-	return emulator.analogRead(pin);
+	return current_emulator().analogRead(pin);
 }
 
 void analogReference(std::uint8_t mode)
 {
-	emulator.analogReference(mode);
+	current_emulator().analogReference(mode);
 }
 
 void analogWrite(std::uint8_t pin, int val)
 {
-	emulator.analogWrite(pin, val);
+	current_emulator().analogWrite(pin, val);
 }
 
 // Timing
 
 unsigned long millis(void)
 {
-	return emulator.millis();
+	return current_emulator().millis();
 }
 
 unsigned long micros(void)
 {
-	return emulator.micros();
+	return current_emulator().micros();
 }
 
 void delay(unsigned long ms)
 {
-	emulator.delay(ms);
+	current_emulator().delay(ms);
 }
 
 void delayMicroseconds(unsigned int us)
 {
-	emulator.delayMicroseconds(us);
+	current_emulator().delayMicroseconds(us);
 }
 
 // Advanced I/O
 
 unsigned long pulseIn(std::uint8_t pin, std::uint8_t state, unsigned long timeout)
 {
-	return emulator.pulseIn(pin, state, timeout);
+	return current_emulator().pulseIn(pin, state, timeout);
 }
 
 unsigned long pulseInLong(std::uint8_t pin, std::uint8_t state, unsigned long timeout)
 {
-	return emulator.pulseInLong(pin, state, timeout);
+	return current_emulator().pulseInLong(pin, state, timeout);
 }
 
 void shiftOut(std::uint8_t dataPin, std::uint8_t clockPin, std::uint8_t bitOrder, std::uint8_t val)
 {
-	emulator.shiftOut(dataPin, clockPin, bitOrder, val);
+	current_emulator().shiftOut(dataPin, clockPin, bitOrder, val);
 }
 
 std::uint8_t shiftIn(std::uint8_t dataPin, std::uint8_t clockPin, std::uint8_t bitOrder)
 {
-	return emulator.shiftIn(dataPin, clockPin, bitOrder);
+	return current_emulator().shiftIn(dataPin, clockPin, bitOrder);
 }
 
 void tone(std::uint8_t pin, unsigned int frequency, unsigned long duration)
 {
-	emulator.tone(pin, frequency, duration);
+	current_emulator().tone(pin, frequency, duration);
 }
 
 void noTone(std::uint8_t pin)
 {
-	emulator.noTone(pin);
+	current_emulator().noTone(pin);
 }
 
 // Random numbers
 
-std::default_random_engine random_engine;
-
 long random(long min, long max)
 {
-	std::uniform_int_distribution<long> distribution(min, max);
-	return distribution(random_engine);
+	return current_emulator().random(min, max);
 }
 
 long random(long max)
@@ -122,7 +142,7 @@ long random(long max)
 
 void randomSeed(unsigned long seed)
 {
-	random_engine.seed(seed);
+	current_emulator().randomSeed(seed);
 }
 
 // Math
@@ -204,33 +224,78 @@ bool isWhitespace(int c)
 
 SerialMock::operator bool() const
 {
-	return emulator.isSerialEnabled();
+	return current_emulator().isSerialEnabled();
 }
 
 void SerialMock::begin(long speed, SerialConfig config)
 {
-	if (!emulator.isSerialEnabled()) {
+	if (!current_emulator().isSerialEnabled()) {
+		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
+	}
+}
+
+
+/**
+ * Format an integral value as Serial.print() does (negative numbers have sign only in decimal format,
+ * other formats print the two's complement representation).
+ */
+template<typename T>
+std::string serial_format_number(T val, SerialPrintFormat format)
+{
+	using unsigned_t = std::make_unsigned_t<T>;
+	unsigned base = format == BIN ? 2 : (format == OCT ? 8 : (format == HEX ? 16 : 10));
+	bool negative = base == 10 && val < 0;
+	unsigned_t uval = negative ? (unsigned_t)0 - (unsigned_t)val : (unsigned_t)val;
+
+	char digits[sizeof(T) * 8 + 1];
+	char* end = digits + sizeof(digits);
+	char* it = end;
+	do {
+		*--it = "0123456789ABCDEF"[uval % base];
+		uval /= base;
+	} while (uval > 0);
+
+	std::string res = negative ? "-" : "";
+	return res.append(it, end);
+}
+
+static std::string serial_format_double(double val)
+{
+	char buf[64];
+	std::snprintf(buf, sizeof(buf), "%.2f", val); // Arduino prints 2 decimal places by default
+	return buf;
+}
+
+static void serial_write(const std::string& data)
+{
+	if (!current_emulator().isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
+	current_emulator().writeSerial(data);
+}
+
+
+void SerialMock::print(char val, SerialPrintFormat)
+{
+	serial_write(std::string(1, val)); // chars are printed as they are
 }
 
+void SerialMock::println(char val, SerialPrintFormat)
+{
+	serial_write(std::string(1, val) + "\r\n");
+}
 
 #define SERIAL_MOCK_PRINT_GEN(TYPE)\
 void SerialMock::print(TYPE val, SerialPrintFormat format)\
 {\
-	if (!emulator.isSerialEnabled()) {\
-		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");\
-	}\
+	serial_write(serial_format_number(val, format));\
 }\
 \
 void SerialMock::println(TYPE val, SerialPrintFormat format)\
 {\
-	if (!emulator.isSerialEnabled()) {\
-		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");\
-	}\
+	serial_write(serial_format_number(val, format) + "\r\n");\
 }
 
-SERIAL_MOCK_PRINT_GEN(char)
 SERIAL_MOCK_PRINT_GEN(int)
 SERIAL_MOCK_PRINT_GEN(long)
 SERIAL_MOCK_PRINT_GEN(long long)
@@ -242,73 +307,69 @@ SERIAL_MOCK_PRINT_GEN(unsigned long long)
 
 void SerialMock::print(double val)
 {
-	if (!emulator.isSerialEnabled()) {
-		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
-	}
+	serial_write(serial_format_double(val));
 }
 
 void SerialMock::print(const char* val)
 {
-	if (!emulator.isSerialEnabled()) {
-		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
-	}
+	serial_write(val);
 }
 
 void SerialMock::println(double val)
 {
-	if (!emulator.isSerialEnabled()) {
-		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
-	}
+	serial_write(serial_format_double(val) + "\r\n");
 }
 
 void SerialMock::println(const char* val)
 {
-	if (!emulator.isSerialEnabled()) {
-		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
-	}
+	serial_write(std::string(val) + "\r\n");
 }
 
 std::size_t SerialMock::available() const
 {
-	if (!emulator.isSerialEnabled()) {
+	if (!current_emulator().isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
-	return emulator.serialDataAvailable();
+	return current_emulator().serialDataAvailable();
 }
 
 int SerialMock::peek() const
 {
-	if (!emulator.isSerialEnabled()) {
+	if (!current_emulator().isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
-	if (emulator.serialDataAvailable() == 0) {
+	if (current_emulator().serialDataAvailable() == 0) {
 		return -1;
 	}
-	return emulator.peekSerial();
+	return current_emulator().peekSerial();
 }
 
 int SerialMock::read()
 {
-	if (!emulator.isSerialEnabled()) {
+	if (!current_emulator().isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
-	if (emulator.serialDataAvailable() == 0) {
+	if (current_emulator().serialDataAvailable() == 0) {
 		return -1;
 	}
-	return emulator.readSerial();
+	return current_emulator().readSerial();
 
 }
 
 std::size_t SerialMock::readBytes(char* buffer, std::size_t length)
 {
-	if (!emulator.isSerialEnabled()) {
+	if (!current_emulator().isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
-	length = std::min(length, emulator.serialDataAvailable());
-	for (std::size_t i = 0; i < length; ++i) {
-		buffer[i] = emulator.readSerial();
+	return current_emulator().readSerialBytes(buffer, length);
+}
+
+std::size_t SerialMock::readBytesUntil(char terminator, char* buffer, std::size_t length)
+{
+	if (!current_emulator().isSerialEnabled()) {
+		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
-	return length;
+	return current_emulator().readSerialBytesUntil(terminator, buffer, length);
 }
 
 
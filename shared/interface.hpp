@@ -227,8 +227,29 @@ public:
 	int peek() const;
 	int read();
 	std::size_t readBytes(char* buffer, std::size_t length);
+	std::size_t readBytesUntil(char terminator, char* buffer, std::size_t length);
 };
 
 extern SerialMock Serial;
 
+
+// Emulator instances (used by the testing framework, not by the tested code)
+
+class ArduinoEmulator;
+
+/**
+ * Get the default emulator instance (used by all threads that have no emulator bound explicitly).
+ * It may be called only once (by the main of the tester).
+ */
+ArduinoEmulator& get_arduino_emulator_instance();
+
+/**
+ * Bind an emulator instance to the calling thread, so all Arduino functions invoked from this thread
+ * (by the tested code) are forwarded to it. This way multiple simulations may run in parallel threads.
+ * Note that the global variables of the tested code are still shared by the whole process.
+ * @param instance emulator to be bound (null restores the default emulator)
+ * @return previously bound emulator (null if the default one was used)
+ */
+ArduinoEmulator* bind_arduino_emulator(ArduinoEmulator* instance);
+
 #endif
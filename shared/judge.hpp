@@ -0,0 +1,175 @@
+#ifndef MOCCARDUINO_SHARED_JUDGE_HPP
+#define MOCCARDUINO_SHARED_JUDGE_HPP
+
+#include "time_series.hpp"
+
+#include <vector>
+#include <queue>
+#include <limits>
+#include <utility>
+#include <functional>
+
+
+/**
+ * Algorithms used by judges to evaluate simulation logs (expected vs. actual events).
+ * This is a native counterpart of `pair_events` from the Python judge library.
+ */
+class EventsJudge
+{
+public:
+	/**
+	 * Index used in pairs for events that have no counterpart.
+	 */
+	static constexpr std::size_t NONE = ~(std::size_t)0;
+
+	/**
+	 * One item of the mapping between expected and actual events (indices into the series).
+	 */
+	struct EventsPair
+	{
+		std::size_t expected;	///< index of expected event (NONE if an actual event was not expected)
+		std::size_t actual;		///< index of actual event (NONE if an expected event is missing)
+
+		EventsPair(std::size_t e = NONE, std::size_t a = NONE) : expected(e), actual(a) {}
+
+		bool operator==(const EventsPair& p) const
+		{
+			return expected == p.expected && actual == p.actual;
+		}
+	};
+
+	/**
+	 * Create mapping between expected and actual events. The pairing assumes that an actual event never precedes
+	 * the expected one. For each expected event, the first actual event with the same value within the time window
+	 * is selected (the actual events skipped over are unpaired). If there is no such event but there is at least
+	 * one actual event in the window, the first one is paired (with differing value).
+	 * Actual events after the last expected one are not included in the mapping.
+	 * @param expected series of expected events
+	 * @param actual series of actual events (e.g., loaded from the simulation log)
+	 * @param timeWindow maximal delay of an actual event after the expected one
+	 * @return list of pairs ordered by time
+	 */
+	template<typename VALUE, typename TIME>
+	static std::vector<EventsPair> pairEvents(const TimeSeries<VALUE, TIME>& expected, const TimeSeries<VALUE, TIME>& actual,
+		TIME timeWindow)
+	{
+		std::vector<EventsPair> mapping;
+		mapping.reserve(expected.size() + actual.size());
+
+		std::size_t next = 0; // first actual event not yet in the mapping
+		for (std::size_t e = 0; e < expected.size(); ++e) {
+			TIME time = expected[e].time;
+			while (next < actual.size() && actual[next].time < time) {
+				mapping.emplace_back(NONE, next++);
+			}
+
+			TIME maxTime = time + timeWindow;
+			if (next >= actual.size() || actual[next].time > maxTime) {
+				mapping.emplace_back(e, NONE); // no candidates within the window
+				continue;
+			}
+
+			// the first candidate with matching value, or the very first candidate if none matches
+			std::size_t best = next;
+			for (std::size_t a = next; a < actual.size() && actual[a].time <= maxTime; ++a) {
+				if (actual[a].value == expected[e].value) {
+					best = a;
+					break;
+				}
+			}
+
+			while (next < best) {
+				mapping.emplace_back(NONE, next++);
+			}
+			mapping.emplace_back(e, next++);
+		}
+
+		return mapping;
+	}
+
+	/**
+	 * Generalization of TimeSeries::compare to multiple series processed in one sweep.
+	 * Each series is compared with the reference (the first one) and the total time their values differ
+	 * within the time range is computed.
+	 * @param series list of series, the first one is the reference
+	 * @param start beginning of the time range (events up to this time set initial values)
+	 * @param end end of the time range (exclusive), the bounds are swapped if end precedes start (as in Range)
+	 * @param initialValue the value expected (for all series) before the first event
+	 * @return differing durations (one for each series, the first one is always zero)
+	 */
+	template<typename VALUE, typename TIME>
+	static std::vector<TIME> compareSeries(const std::vector<const TimeSeries<VALUE, TIME>*>& series,
+		TIME start, TIME end, const VALUE& initialValue)
+	{
+		constexpr TIME NO_TIME = std::numeric_limits<TIME>::max();
+		std::vector<TIME> result(series.size(), 0);
+		if (start > end) {
+			std::swap(start, end);
+		}
+		if (series.empty() || start == end) {
+			return result;
+		}
+
+		std::vector<VALUE> lastValue(series.size(), initialValue);
+		std::vector<std::size_t> idx(series.size());
+		std::vector<TIME> differSince(series.size(), NO_TIME);
+
+		// heap of upcoming events (time, series index)
+		using head_t = std::pair<TIME, std::size_t>;
+		std::priority_queue<head_t, std::vector<head_t>, std::greater<head_t>> heads;
+		for (std::size_t s = 0; s < series.size(); ++s) {
+			idx[s] = series[s]->upperBoundByTime(start);
+			if (idx[s] > 0) {
+				lastValue[s] = (*series[s])[idx[s] - 1].value;
+			}
+			if (idx[s] < series[s]->size()) {
+				heads.emplace((*series[s])[idx[s]].time, s);
+			}
+		}
+
+		auto updateState = [&](std::size_t s, TIME time) {
+			bool differ = lastValue[s] != lastValue[0];
+			if (differ && differSince[s] == NO_TIME) {
+				differSince[s] = time;
+			}
+			else if (!differ && differSince[s] != NO_TIME) {
+				result[s] += time - differSince[s];
+				differSince[s] = NO_TIME;
+			}
+		};
+
+		for (std::size_t s = 1; s < series.size(); ++s) {
+			updateState(s, start);
+		}
+
+		while (!heads.empty() && heads.top().first < end) {
+			auto [time, s] = heads.top();
+			heads.pop();
+
+			lastValue[s] = (*series[s])[idx[s]].value;
+			if (++idx[s] < series[s]->size()) {
+				heads.emplace((*series[s])[idx[s]].time, s);
+			}
+
+			// a change of the reference may affect all series
+			if (s == 0) {
+				for (std::size_t i = 1; i < series.size(); ++i) {
+					updateState(i, time);
+				}
+			}
+			else {
+				updateState(s, time);
+			}
+		}
+
+		for (std::size_t s = 1; s < series.size(); ++s) {
+			if (differSince[s] != NO_TIME) {
+				result[s] += end - differSince[s];
+			}
+		}
+
+		return result;
+	}
+};
+
+#endif
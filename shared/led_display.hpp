@@ -2,15 +2,20 @@
 #define MOCCARDUINO_SHARED_LED_DISPLAY_HPP
 
 #include "simulation.hpp"
+#include "time_series.hpp"
 #include "emulator.hpp"
+#include "board.hpp"
 #include "helpers.hpp"
 #include "constants.hpp"
 #include "funshield.h"
 
 #include <string>
 #include <deque>
+#include <algorithm>
+#include <vector>
 #include <stdexcept>
 #include <limits>
+#include <array>
 #include <cstdint>
 
 constexpr std::uint8_t LED_7SEG_EMPTY_SPACE = 0b11111111;
@@ -60,6 +65,50 @@ constexpr std::uint8_t LED_7SEG_LETTERS_MAP[]{
 };
 
 
+/**
+ * Reverse lookup table of 7-seg glyphs built at compile time from the glyph constants above.
+ * Each table covers all 256 raw byte values, so decoding a glyph is a single array access.
+ */
+struct Led7SegDecodeTable
+{
+	static constexpr char INVALID_CHAR = 0x7f;
+
+	char preferDigits[256];	///< glyph -> char, digits win when the glyph is also a letter
+	char preferOthers[256];	///< glyph -> char, letters (space, dash) win when the glyph is also a digit
+
+	constexpr Led7SegDecodeTable() : preferDigits(), preferOthers()
+	{
+		for (int i = 0; i < 256; ++i) {
+			preferDigits[i] = preferOthers[i] = INVALID_CHAR;
+		}
+
+		for (int i = 0; i < 26; ++i) {
+			preferDigits[LED_7SEG_LETTERS_MAP[i]] = preferOthers[LED_7SEG_LETTERS_MAP[i]] = 'a' + i;
+		}
+		preferDigits[LED_7SEG_EMPTY_SPACE] = preferOthers[LED_7SEG_EMPTY_SPACE] = ' ';
+		preferDigits[LED_7SEG_DASH] = preferOthers[LED_7SEG_DASH] = '-';
+
+		for (int i = 0; i < 10; ++i) {
+			preferDigits[LED_7SEG_DIGITS_MAP[i]] = '0' + i;
+			if (preferOthers[LED_7SEG_DIGITS_MAP[i]] == INVALID_CHAR) {
+				preferOthers[LED_7SEG_DIGITS_MAP[i]] = '0' + i;
+			}
+		}
+	}
+
+	/**
+	 * Decode one glyph (the decimal dot bit is ignored).
+	 */
+	constexpr char decode(std::uint8_t glyph, bool preferDigitsOverLetters = false) const
+	{
+		glyph = glyph | ~LED_7SEG_DECIMAL_DOT; // mask out
+		return preferDigitsOverLetters ? preferDigits[glyph] : preferOthers[glyph];
+	}
+};
+
+constexpr Led7SegDecodeTable LED_7SEG_DECODE_TABLE{};
+
+
 /**
  * Wrapper class for Leds state (bit array) that interprets digits and symbols on the display.
  */
@@ -69,11 +118,32 @@ class Led7SegInterpreter
 public:
 	using state_t = BitArray<DIGITS * 8>;
 	static const int INVALID_NUMBER = -1;
-	static const char INVALID_CHAR = 0x7f;
+	static const char INVALID_CHAR = Led7SegDecodeTable::INVALID_CHAR;
 
 private:
 	state_t mState;
 
+	/**
+	 * Return a state where only the decimal dot bits are set.
+	 */
+	static state_t decimalDotsMask()
+	{
+		state_t mask(false);
+		for (std::size_t digit = 0; digit < DIGITS; ++digit) {
+			mask.set(~LED_7SEG_DECIMAL_DOT, digit * 8, 8);
+		}
+		return mask;
+	}
+
+	/**
+	 * Return a state where bits of active (lit) decimal dots are set.
+	 */
+	state_t activeDecimalDots() const
+	{
+		static const state_t mask = decimalDotsMask();
+		return ~mState & mask; // 0 ~ LED is active
+	}
+
 public:
 	Led7SegInterpreter(const state_t &state) : mState(state) {}
 
@@ -104,13 +174,7 @@ public:
 	 */
 	bool decimalDotAmbiguous() const
 	{
-		std::size_t count = 0;
-		for (std::size_t digit = 0; digit < DIGITS; ++digit) {
-			if (hasDecimalDot(digit)) {
-				++count;
-			}
-		}
-		return count > 1;
+		return activeDecimalDots().count() > 1;
 	}
 
 	/**
@@ -120,10 +184,9 @@ public:
 	 */
 	std::size_t decimalDotPosition() const
 	{
-		for (std::size_t digit = 0; digit < DIGITS; ++digit) {
-			if (hasDecimalDot(digit)) {
-				return digit;
-			}
+		std::size_t idx = activeDecimalDots().findFirst();
+		if (idx < DIGITS * 8) {
+			return idx / 8;
 		}
 		return DIGITS - 1; // last position is implicit decimal position even if no dot is present
 	}
@@ -156,41 +219,7 @@ public:
 	 */
 	char getCharacter(std::size_t idx, bool preferDigitsOverLetters = false) const
 	{
-		// internal cached reverse lookup table built from constants of glyphs
-		static std::map<std::uint8_t, char> lookupDigits;
-		static std::map<std::uint8_t, char> lookupOthers;
-		if (lookupDigits.empty()) {
-			for (int i = 0; i < 10; ++i) {
-				lookupDigits[LED_7SEG_DIGITS_MAP[i]] = '0' + i;
-			}
-		}
-		if (lookupOthers.empty()) {
-			for (int i = 0; i < 26; ++i) {
-				lookupOthers[LED_7SEG_LETTERS_MAP[i]] = 'a' + i;
-			}
-			lookupOthers[LED_7SEG_EMPTY_SPACE] = ' ';
-			lookupOthers[LED_7SEG_DASH] = '-';
-		}
-
-		auto glyph = getDigitRaw(idx, true); // true = mask out the decimal dot (not interesting here)
-
-		auto itDigit = lookupDigits.find(glyph);
-		auto itOther = lookupOthers.find(glyph);
-		
-		if (itDigit != lookupDigits.end() && itOther != lookupOthers.end()) {
-			// ambiguous situation, glyph matches both number and not-number
-			return preferDigitsOverLetters ? itDigit->second : itOther->second;
-		}
-
-		if (itDigit != lookupDigits.end()) {
-			return itDigit->second;
-		}
-
-		if (itOther != lookupOthers.end()) {
-			return itOther->second;
-		}
-
-		return INVALID_CHAR;
+		return LED_7SEG_DECODE_TABLE.decode(getDigitRaw(idx), preferDigitsOverLetters);
 	}
 
 	/**
@@ -254,9 +283,73 @@ public:
 		}
 		return res;
 	}
+
+	/**
+	 * Decode a whole series of display states into text and number series in one pass.
+	 * The results are equivalent to calling getText() and getNumber() on every event.
+	 * @param series input series of display states
+	 * @param texts output series (events are appended) with the same timestamps as the input
+	 * @param numbers output series (events are appended) with the same timestamps as the input
+	 * @param invalidCharsReplacement same meaning as in getText()
+	 */
+	template<typename TIME>
+	static void decodeSeries(const TimeSeries<state_t, TIME>& series, TimeSeries<std::string, TIME>& texts,
+		TimeSeries<int, TIME>& numbers, char invalidCharsReplacement = '\0')
+	{
+		std::string text;
+		for (std::size_t i = 0; i < series.size(); ++i) {
+			const auto& event = series[i];
+
+			// text (letters are preferred)
+			text.clear();
+			for (std::size_t idx = 0; idx < DIGITS; ++idx) {
+				char ch = LED_7SEG_DECODE_TABLE.decode(event.value.template get<std::uint8_t>(idx * 8));
+				if (ch == INVALID_CHAR) {
+					if (invalidCharsReplacement == '\0') {
+						text.clear(); // we cannot patch it -> report failure
+						break;
+					}
+					ch = invalidCharsReplacement;
+				}
+				text.push_back(ch);
+			}
+			texts.addEvent(event.time, text);
+
+			// number (digits are preferred, leading spaces and dash are skipped)
+			std::size_t idx = 0;
+			char ch = ' ';
+			while (idx < DIGITS && (ch = LED_7SEG_DECODE_TABLE.decode(event.value.template get<std::uint8_t>(idx * 8), true)) == ' ') {
+				++idx;
+			}
+			bool negative = idx < DIGITS && ch == '-';
+			if (negative) {
+				++idx;
+			}
+
+			int res = idx < DIGITS ? 0 : INVALID_NUMBER; // no digits available
+			for (; idx < DIGITS; ++idx) {
+				ch = LED_7SEG_DECODE_TABLE.decode(event.value.template get<std::uint8_t>(idx * 8), true);
+				if (ch < '0' || ch > '9') {
+					res = INVALID_NUMBER; // current glyph is not numerical digit
+					break;
+				}
+				res = (res * 10) + (ch - '0');
+			}
+			numbers.addEvent(event.time, (negative && res != INVALID_NUMBER) ? -res : res);
+		}
+	}
 };
 
 
+/**
+ * Brightness of individual LEDs dimmed by PWM signal (LED_BRIGHTNESS_FULL = fully lit, 0 = off).
+ */
+template<int LEDS>
+using LedsBrightness = std::array<std::uint8_t, LEDS>;
+
+constexpr std::uint8_t LED_BRIGHTNESS_FULL = ArduinoPinState::DUTY_HIGH;
+
+
 /**
  * Demultiplexes state changes by computing the time each LED has been lit
  * in given quantization intervals and 
@@ -266,6 +359,7 @@ class LedsEventsDemultiplexer : public EventConsumer<BitArray<LEDS>>
 {
 public:
 	using state_t = BitArray<LEDS>;
+	using brightness_t = LedsBrightness<LEDS>;
 
 private:
 	/**
@@ -298,31 +392,201 @@ private:
 	 */
 	std::array<logtime_t, LEDS> mActiveTimes;
 
+	/**
+	 * If true, active times are accumulated in bit-sliced planes instead of mActiveTimes.
+	 */
+	bool mBitSliced;
+
+	/**
+	 * Bit-sliced accumulators of active times. Plane j holds j-th bit of the active time of every LED,
+	 * so the time can be added to all lit LEDs at once (by a ripple-carry addition over the planes).
+	 * There are enough planes to hold the length of the time window (the maximal accumulated time).
+	 */
+	std::vector<state_t> mActiveTimePlanes;
+
+	/**
+	 * Brightness of the LEDs if they may be dimmed by PWM (null if all lit LEDs are fully lit).
+	 * The active times are weighted by the brightness, so they are accumulated in 1/LED_BRIGHTNESS_FULL us units.
+	 */
+	const brightness_t* mBrightness;
+
+	/**
+	 * Multiplier of the accumulated times (1 or LED_BRIGHTNESS_FULL if brightness is used).
+	 */
+	logtime_t mWeightScale;
+
+	/**
+	 * LEDs grouped by their (non-zero) brightness for the bit-sliced accumulation, so LEDs of the same brightness
+	 * get their weighted time added at once. Built by setBrightnessSource() and rebuilt only when the brightness changes.
+	 */
+	std::vector<std::pair<std::uint8_t, state_t>> mBrightnessGroups;
+
+	/**
+	 * Snapshot of the brightness from which mBrightnessGroups were built.
+	 */
+	brightness_t mGroupedBrightness;
+
+	/**
+	 * Group the LEDs by the current brightness (in a single pass over the LEDs).
+	 */
+	void buildBrightnessGroups()
+	{
+		mGroupedBrightness = *mBrightness;
+		mBrightnessGroups.clear();
+
+		std::array<std::size_t, (std::size_t)LED_BRIGHTNESS_FULL + 1> groupIndex;
+		groupIndex.fill(LEDS); // no group yet
+		for (std::size_t i = 0; i < LEDS; ++i) {
+			std::uint8_t brightness = mGroupedBrightness[i];
+			if (brightness == 0) continue; // dark LEDs accumulate nothing
+			if (groupIndex[brightness] == LEDS) {
+				groupIndex[brightness] = mBrightnessGroups.size();
+				mBrightnessGroups.emplace_back(brightness, state_t(false));
+			}
+			mBrightnessGroups[groupIndex[brightness]].second.set(true, i, 1);
+		}
+	}
+
+	/**
+	 * Threshold in the units of the accumulated times.
+	 */
+	logtime_t scaledThreshold() const
+	{
+		return mThreshold * mWeightScale;
+	}
+
+	/**
+	 * Reset the accumulators (and allocate the bit-sliced planes).
+	 */
+	void initAccumulators()
+	{
+		mActiveTimes.fill(0);
+		mActiveTimePlanes.clear();
+
+		if (mBitSliced) {
+			// enough planes to hold the whole window length (and the threshold for the comparison)
+			logtime_t maxValue = std::max(mTimeWindow, mThreshold) * mWeightScale;
+			std::size_t planes = 1;
+			while (planes < 64 && (maxValue >> planes) != 0) {
+				++planes;
+			}
+			mActiveTimePlanes.resize(planes, state_t(false));
+		}
+	}
+
+	/**
+	 * Compute new demuxed state from the bit-sliced accumulators and reset them in the process.
+	 */
+	state_t demuxStateBitSliced()
+	{
+		// bit-sliced comparison with the threshold from the most significant plane
+		const logtime_t threshold = scaledThreshold();
+		state_t greater(false), equal(true);
+		for (std::size_t j = mActiveTimePlanes.size(); j > 0; --j) {
+			auto& plane = mActiveTimePlanes[j - 1];
+			if ((threshold >> (j - 1)) & 1) {
+				equal = equal & plane;
+			}
+			else {
+				greater = greater | (equal & plane);
+				equal = equal & ~plane;
+			}
+			plane.fill(false);
+		}
+
+		// LEDs that has been ON for sufficient amount of time are cleared (ON is LOW)
+		return ~(greater | equal);
+	}
+
+	/**
+	 * Add given time to bit-sliced accumulators of all selected LEDs.
+	 */
+	void addBitSliced(const state_t& lit, logtime_t dt)
+	{
+		state_t carry(false);
+		for (std::size_t j = 0; j < mActiveTimePlanes.size(); ++j) {
+			auto& plane = mActiveTimePlanes[j];
+			state_t addend = ((dt >> j) & 1) ? (lit ^ carry) : carry;
+			state_t nextCarry = ((dt >> j) & 1) ? ((plane & lit) | (carry & (plane ^ lit))) : (plane & carry);
+			plane = plane ^ addend;
+			carry = nextCarry;
+
+			if ((dt >> j) <= 1 && carry == state_t(false)) {
+				break; // nothing more to add
+			}
+		}
+	}
+
+	/**
+	 * Add given time to bit-sliced accumulators of all LEDs which are currently ON.
+	 */
+	void accumulateActiveTimesBitSliced(logtime_t dt)
+	{
+		state_t lit = ~mLastState; // ON is LOW
+		if (mBrightness == nullptr) {
+			addBitSliced(lit, dt);
+			return;
+		}
+
+		// LEDs of the same brightness get the same weighted time, so they are added at once
+		if (mGroupedBrightness != *mBrightness) {
+			buildBrightnessGroups();
+		}
+		for (auto& [brightness, group] : mBrightnessGroups) {
+			state_t active = lit & group;
+			if (active != state_t(false)) {
+				addBitSliced(active, dt * brightness);
+			}
+		}
+	}
+
 	/**
 	 * Compute new demuxed state from the accumulated active times and reset active times in the process.
 	 */
 	state_t demuxState()
 	{
+		if (mBitSliced) {
+			return demuxStateBitSliced();
+		}
+
+		const logtime_t threshold = scaledThreshold();
 		state_t newState(OFF);
-		for (std::size_t i = 0; i < LEDS; ++i) {
-			if (mActiveTimes[i] >= mThreshold) {
-				newState.set(ON, i, 1); // the LED has been ON for sufficient amount of time
+		for (std::size_t w = 0; w < state_t::WORDS; ++w) {
+			// assemble the whole word at once, LEDs that has been ON for sufficient amount of time are cleared
+			typename state_t::word_t word = 0;
+			std::size_t end = std::min<std::size_t>(LEDS, (w + 1) * state_t::WORD_BITS);
+			for (std::size_t i = w * state_t::WORD_BITS; i < end; ++i) {
+				if (mActiveTimes[i] < threshold) {
+					word |= (typename state_t::word_t)1 << (i % state_t::WORD_BITS);
+				}
+				mActiveTimes[i] = 0;
 			}
-			mActiveTimes[i] = 0;
+			newState.setWord(w, word);
 		}
 		return newState;
 	}
 
 	/**
 	 * Use last know state and increase time accumulators for all LEDs which are currently ON.
+	 * Dimmed LEDs get the time weighted by their brightness (so PWM is integrated analytically).
 	 * @param dt how much time have passed since the last update
 	 */
 	void accumulateActiveTimes(logtime_t dt)
 	{
-		for (std::size_t i = 0; i < LEDS; ++i) {
-			if (mLastState[i] == ON) {
+		if (mBitSliced) {
+			accumulateActiveTimesBitSliced(dt);
+			return;
+		}
+
+		if (mBrightness == nullptr) {
+			mLastState.forEach(ON, [&](std::size_t i) {
 				mActiveTimes[i] += dt;
-			}
+			});
+		}
+		else {
+			mLastState.forEach(ON, [&](std::size_t i) {
+				mActiveTimes[i] += dt * (*mBrightness)[i];
+			});
 		}
 	}
 
@@ -336,9 +600,11 @@ private:
 
 	/**
 	 * Update or even close currently opened window usign given timestamp.
+	 * @param next consumer that receives the demuxed events
 	 * @param time actual time (given either by advance time or when event is added)
 	 */
-	void updateOpenedWindow(logtime_t time)
+	template<typename NEXT>
+	void updateOpenedWindow(NEXT* next, logtime_t time)
 	{
 		if (!isWindowOpen()) {
 			return;
@@ -357,16 +623,16 @@ private:
 			if (mLastDemuxedState != demuxedState) {
 				// demuxed state has changed
 				mLastDemuxedState = demuxedState;
-				if (this->nextConsumer() != nullptr) {
+				if (next != nullptr) {
 					// emit event for following consumers
-					this->nextConsumer()->addEvent(mNextMarker, demuxedState);
+					next->addEvent(mNextMarker, demuxedState);
 				}
 				mNextMarker += mTimeWindow; // time window shifts one place
 			}
 			else {
-				if (this->nextConsumer() != nullptr) {
+				if (next != nullptr) {
 					// no event -> just advance time for following consumers
-					this->nextConsumer()->advanceTime(mNextMarker);
+					next->advanceTime(mNextMarker);
 				}
 
 				if (mLastDemuxedState != mLastState) {
@@ -388,10 +654,14 @@ private:
 
 
 protected:
-	void doAddEvent(logtime_t time, state_t state) override
+	/**
+	 * Process an event, the demuxed events are emitted to given consumer (a Pipeline passes its following stage).
+	 */
+	template<typename NEXT>
+	void addEventTo(NEXT* next, logtime_t time, state_t state)
 	{
 		do {
-			updateOpenedWindow(time); // update, possibly close current window
+			updateOpenedWindow(next, time); // update, possibly close current window
 		} while (isWindowOpen() && time >= mNextMarker);
 		mLastState = state;
 		if (!isWindowOpen()) {
@@ -400,38 +670,67 @@ protected:
 		}
 	}
 
-	void doAdvanceTime(logtime_t time)
+	/**
+	 * Process a time advance, the demuxed events are emitted to given consumer.
+	 */
+	template<typename NEXT>
+	void advanceTimeTo(NEXT* next, logtime_t time)
 	{
 		do {
-			updateOpenedWindow(time); // update, possibly close current window
+			updateOpenedWindow(next, time); // update, possibly close current window
 		} while (isWindowOpen() && time >= mNextMarker);
-		if (!isWindowOpen() && this->nextConsumer() != nullptr) {
+		if (!isWindowOpen() && next != nullptr) {
 			// if no window is open, we can pass time advances as usual
-			this->nextConsumer()->advanceTime(time);
+			next->advanceTime(time);
 		}
 	}
 
+	void doAddEvent(logtime_t time, state_t state) override
+	{
+		addEventTo(this->nextConsumer(), time, state);
+	}
+
+	void doAdvanceTime(logtime_t time) override
+	{
+		advanceTimeTo(this->nextConsumer(), time);
+	}
+
 	void doClear() override
 	{
 		mNextMarker = this->mLastTime;
 		mLastState.fill(OFF);
 		mLastDemuxedState.fill(OFF);
 		mActiveTimes.fill(0);
+		for (auto&& plane : mActiveTimePlanes) {
+			plane.fill(false);
+		}
 		EventConsumer<BitArray<LEDS>>::doClear();
 	}
 
+	logtime_t doGetDeadline() const override
+	{
+		// while the window is open, the following consumers are advanced only by closing it
+		return isWindowOpen() ? mNextMarker : EventConsumer<BitArray<LEDS>>::doGetDeadline();
+	}
+
 public:
 	/**
 	 * @param timeWindow period in which the changes are merged together and evaluated by thresholding
 	 * @param threshold how long (inside a time window) a LED needs to be on in given period of time to be considered lit
+	 * @param bitSliced if true, active times of all LEDs are accumulated and thresholded at once in bit-sliced planes,
+	 *                  so the cost does not grow with the number of LEDs (default for larger displays)
 	 */
-	LedsEventsDemultiplexer(logtime_t timeWindow, logtime_t threshold) :
+	LedsEventsDemultiplexer(logtime_t timeWindow, logtime_t threshold, bool bitSliced = (LEDS > 8)) :
 		mTimeWindow(timeWindow),
 		mThreshold(threshold),
 		mNextMarker(0),
 		mLastState(OFF),
-		mLastDemuxedState(OFF)
+		mLastDemuxedState(OFF),
+		mBitSliced(bitSliced),
+		mBrightness(nullptr),
+		mWeightScale(1)
 	{
+		mGroupedBrightness.fill(0);
 		if (mTimeWindow == 0) {
 			throw std::runtime_error("Demultiplexing time window must be greater than 0.");
 		}
@@ -440,11 +739,27 @@ public:
 			throw std::runtime_error("Given threshold is out of range of the time window.");
 		}
 
-		mActiveTimes.fill(0);
+		initAccumulators();
 	}
 
 	// Default timeWindow is 50ms and default threshold is 10% of the time window
 	LedsEventsDemultiplexer(logtime_t timeWindow = 50000) : LedsEventsDemultiplexer(timeWindow, timeWindow / 10) {}
+
+	/**
+	 * Weight the active times of the LEDs by their brightness (e.g., LedDisplay::getBrightness()),
+	 * so LEDs dimmed by PWM are considered lit only if they are bright enough. Must be set before the first event.
+	 * @param brightness pointer to the brightness maintained by the display (null disables the weighting)
+	 */
+	void setBrightnessSource(const brightness_t* brightness)
+	{
+		mBrightness = brightness;
+		mWeightScale = brightness != nullptr ? LED_BRIGHTNESS_FULL : 1;
+		mBrightnessGroups.clear();
+		if (mBrightness != nullptr) {
+			buildBrightnessGroups();
+		}
+		initAccumulators();
+	}
 };
 
 
@@ -497,9 +812,11 @@ private:
 
 	/**
 	 * Update or even close currently opened window usign given timestamp.
+	 * @param next consumer that receives the aggregated events
 	 * @param time actual time (given either by advance time or when event is added)
 	 */
-	void updateOpenedWindow(logtime_t time)
+	template<typename NEXT>
+	void updateOpenedWindow(NEXT* next, logtime_t time)
 	{
 		if (isWindowOpen() && time >= mNextMarker) {
 			// time to shut the window, there is a draft here...
@@ -509,23 +826,27 @@ private:
 			// process the last opened window
 			if (mLastState != mLastEmittedState) {
 				mLastEmittedState = mLastState;
-				if (this->nextConsumer() != nullptr) {
+				if (next != nullptr) {
 					// emit event for following consumers
-					this->nextConsumer()->addEvent(mLastStateTime, mLastEmittedState);
+					next->addEvent(mLastStateTime, mLastEmittedState);
 				}
 			}
-			else if (this->nextConsumer() != nullptr) {
+			else if (next != nullptr) {
 				// advance time for the following consumer
-				this->nextConsumer()->advanceTime(mNextMarker);
+				next->advanceTime(mNextMarker);
 			}
 		}
 	}
 
 
 protected:
-	void doAddEvent(logtime_t time, state_t state) override
+	/**
+	 * Process an event, the aggregated events are emitted to given consumer (a Pipeline passes its following stage).
+	 */
+	template<typename NEXT>
+	void addEventTo(NEXT* next, logtime_t time, state_t state)
 	{
-		updateOpenedWindow(time); // update, possibly close current window
+		updateOpenedWindow(next, time); // update, possibly close current window
 		if (mLastState != state) {
 			mLastState = state;
 			mLastStateTime = time; // the state actually changed, record when
@@ -536,15 +857,29 @@ protected:
 		}
 	}
 
-	void doAdvanceTime(logtime_t time)
+	/**
+	 * Process a time advance, the aggregated events are emitted to given consumer.
+	 */
+	template<typename NEXT>
+	void advanceTimeTo(NEXT* next, logtime_t time)
 	{
-		updateOpenedWindow(time); // update, possibly close current window
-		if (!isWindowOpen() && this->nextConsumer() != nullptr) {
+		updateOpenedWindow(next, time); // update, possibly close current window
+		if (!isWindowOpen() && next != nullptr) {
 			// if no window is open, we can pass time advances as usual
-			this->nextConsumer()->advanceTime(time);
+			next->advanceTime(time);
 		}
 	}
 
+	void doAddEvent(logtime_t time, state_t state) override
+	{
+		addEventTo(this->nextConsumer(), time, state);
+	}
+
+	void doAdvanceTime(logtime_t time) override
+	{
+		advanceTimeTo(this->nextConsumer(), time);
+	}
+
 	void doClear() override
 	{
 		mNextMarker = this->mLastTime;
@@ -554,6 +889,12 @@ protected:
 		EventConsumer<BitArray<LEDS>>::doClear();
 	}
 
+	logtime_t doGetDeadline() const override
+	{
+		// while the window is open, the following consumers are advanced only by closing it
+		return isWindowOpen() ? mNextMarker : EventConsumer<BitArray<LEDS>>::doGetDeadline();
+	}
+
 public:
 	/**
 	 * @param timeWindow period in which the changes are merged together and evaluated by thresholding
@@ -581,47 +922,67 @@ class LedDisplay : public ForkedEventConsumer<ArduinoPinState, BitArray<LEDS>>
 {
 public:
 	using state_t = BitArray<LEDS>;
+	using brightness_t = LedsBrightness<LEDS>;
 
 private:
 	/**
-	 * Actual state of the LEDs
+	 * Actual state of the LEDs (LEDs driven by PWM are ON, unless their brightness is zero).
 	 */
 	state_t mState;
 
 	/**
-	 * Information about wiring. Translates pins to LED indices.
+	 * Brightness of the LEDs (updated by PWM duty cycle changes).
 	 */
-	std::map<pin_t, std::size_t> mLedPins;
+	brightness_t mBrightness;
+
+	/**
+	 * Information about wiring. Translates pins to LED indices (flat table indexed by pins, LEDS = not attached).
+	 */
+	std::array<std::size_t, PIN_SLOTS> mLedPins;
 
 protected:
-	void doAddEvent(logtime_t time, ArduinoPinState state) override
+	/**
+	 * Process a pin event, the display states are emitted to given sprout (a Pipeline passes its following stage).
+	 */
+	template<typename SPROUT>
+	void addEventTo(SPROUT* sprout, logtime_t time, ArduinoPinState state)
 	{
-		auto it = mLedPins.find(state.pin);
-		if (it == mLedPins.end()) {
+		auto idx = mLedPins[state.pin];
+		if (idx == LEDS) {
 			// ignore unknown pins, but we can advance time at least
-			EventConsumer<ArduinoPinState>::doAdvanceTime(time);
-			if (this->sproutConsumer() != nullptr) {
-				this->sproutConsumer()->advanceTime(time);
-			}
+			this->advanceTimeTo(sprout, time);
 			return;	
 		}
 
 		// update the state
-		auto idx = it->second;
-		bool value = state.value == ON ? ON : OFF;
-		if (mState[idx] != value) {
-			// the state actually changes
+		std::uint8_t brightness = state.value == ON ? LED_BRIGHTNESS_FULL : 0;
+		if (state.isPwm()) {
+			brightness = ON == HIGH ? state.duty : LED_BRIGHTNESS_FULL - state.duty;
+		}
+		bool value = brightness > 0 ? ON : OFF;
+		if (mState[idx] != value || mBrightness[idx] != brightness) {
+			// the state actually changes (a change of brightness is emitted as well, even if the state remains)
 			mState.set(value, idx, 1);
-			if (this->sproutConsumer() != nullptr) {
-				this->sproutConsumer()->addEvent(time, mState);
+			if (sprout != nullptr) {
+				sprout->addEvent(time, mState);
 			}
+			mBrightness[idx] = brightness; // updated after the event, so the elapsed period is weighted by the old one
 		}
 
 		EventConsumer<ArduinoPinState>::doAddEvent(time, state);
 	}
 
+	void doAddEvent(logtime_t time, ArduinoPinState state) override
+	{
+		addEventTo(this->sproutConsumer(), time, state);
+	}
+
 public:
-	LedDisplay() : mState(OFF) {}
+	LedDisplay() : mState(OFF)
+	{
+		mBrightness.fill(0);
+		mLedPins.fill(LEDS);
+	}
 
 	/**
 	 * Attach the LED display to existing simulation (connect as event consumer to corresponding pins).
@@ -634,7 +995,7 @@ public:
 		}
 
 		for (std::size_t i = 0; i < wiring.size(); ++i) {
-			if (mLedPins.find(wiring[i]) != mLedPins.end()) {
+			if (mLedPins[wiring[i]] != LEDS) {
 				throw std::runtime_error("Pin " + std::to_string(wiring[i]) + " is attached to multiple LEDs.");
 			}
 			mLedPins[wiring[i]] = i;
@@ -646,6 +1007,14 @@ public:
 	{
 		return mState;
 	}
+
+	/**
+	 * Brightness of the LEDs, it may be used to weight active times in the demultiplexer (setBrightnessSource()).
+	 */
+	const brightness_t& getBrightness() const
+	{
+		return mBrightness;
+	}
 };
 
 
@@ -656,7 +1025,7 @@ public:
  * display state events are produced off the sprout.
  */
 template<int DIGITS>
-class SerialSegLedDisplay : public ForkedEventConsumer<ArduinoPinState, BitArray<DIGITS * 8>>
+class SerialSegLedDisplay : public ForkedEventConsumer<ArduinoPinState, BitArray<DIGITS * 8>>, public ShiftOutConsumer
 {
 public:
 	using state_t = BitArray<DIGITS * 8>;
@@ -691,9 +1060,11 @@ private:
 
 	/**
 	 * Update the states of all digits based on the data in the shift register.
+	 * @param sprout consumer that receives the new state
 	 * @param time actual logical time of the event that triggered this update
 	 */
-	void updateState(logtime_t time)
+	template<typename SPROUT>
+	void updateState(SPROUT* sprout, logtime_t time)
 	{
 		auto activeDigits = mShiftRegister.get<std::uint8_t>(0);
 		auto glyph = mShiftRegister.get<std::uint8_t>(1);
@@ -707,14 +1078,18 @@ private:
 
 		if (newState != mState) {
 			mState = newState;
-			if (this->sproutConsumer() != nullptr) {
-				this->sproutConsumer()->addEvent(time, mState);
+			if (sprout != nullptr) {
+				sprout->addEvent(time, mState);
 			}
 		}
 	}
 
 protected:
-	void doAddEvent(logtime_t time, ArduinoPinState state) override
+	/**
+	 * Process a pin event, the display states are emitted to given sprout (a Pipeline passes its following stage).
+	 */
+	template<typename SPROUT>
+	void addEventTo(SPROUT* sprout, logtime_t time, ArduinoPinState state)
 	{
 		bool pinValue = state.value == HIGH ? true : false;
 
@@ -732,7 +1107,7 @@ protected:
 		else if (state.pin == mLatchPin) {
 			if (!mLatch && pinValue) {
 				// latch goes from LOW to HIGH
-				updateState(time);
+				updateState(sprout, time);
 			}
 			mLatch = pinValue;
 		}
@@ -743,11 +1118,16 @@ protected:
 		// pass the event along
 		EventConsumer<ArduinoPinState>::doAddEvent(time, state);
 
-		if (this->sproutConsumer() != nullptr) {
-			this->sproutConsumer()->advanceTime(time); // actual new events are emitted in updateState
+		if (sprout != nullptr) {
+			sprout->advanceTime(time); // actual new events are emitted in updateState
 		}
 	}
 
+	void doAddEvent(logtime_t time, ArduinoPinState state) override
+	{
+		addEventTo(this->sproutConsumer(), time, state);
+	}
+
 public:
 	SerialSegLedDisplay() :
 		mState(OFF), // all LEDS are dimmed
@@ -781,6 +1161,55 @@ public:
 	{
 		return mState;
 	}
+
+	/**
+	 * Consume the whole byte from shiftOut() at once (see ShiftOutConsumer).
+	 */
+	bool addShiftedByte(logtime_t time, logtime_t writeDelay, pin_t dataPin, pin_t clockPin,
+		std::uint8_t bitOrder, std::uint8_t value) override
+	{
+		if (dataPin != mDataInputPin || clockPin != mClockInputPin) {
+			return false;
+		}
+
+		if (this->nextGetDeadline() != EventConsumer<ArduinoPinState>::NO_DEADLINE) {
+			return false; // following consumers observe time advances, so they need to get the events one by one
+		}
+
+		if (time < this->mLastTime) {
+			throw std::runtime_error("Unable to add event that violates causality.");
+		}
+
+		// the register must end up with the byte as is when shifted MSB first, so LSB-first order needs reversing
+		std::uint8_t bits = value;
+		if (bitOrder == LSBFIRST) {
+			bits = 0;
+			for (std::size_t i = 0; i < 8; ++i) {
+				bits |= ((value >> i) & 1) << (7 - i);
+			}
+		}
+		mShiftRegister.pushBits(bits);
+		mDataInput = (bits & 1) != 0;
+		mClockInput = false;
+
+		if (this->nextConsumer() != nullptr) {
+			// pass the individual pin events along (the same sequence shiftOut() would have produced)
+			logtime_t t = time;
+			for (std::size_t i = 0; i < 8; ++i) {
+				int bit = (bits >> (7 - i)) & 1;
+				this->nextAddEvent(t, ArduinoPinState(dataPin, bit));
+				this->nextAddEvent(t + writeDelay, ArduinoPinState(clockPin, HIGH));
+				this->nextAddEvent(t + 2 * writeDelay, ArduinoPinState(clockPin, LOW));
+				t += 3 * writeDelay;
+			}
+		}
+
+		this->mLastTime = time + 23 * writeDelay; // time of the last clock event
+		if (this->sproutConsumer() != nullptr) {
+			this->sproutConsumer()->advanceTime(this->mLastTime);
+		}
+		return true;
+	}
 };
 
 
@@ -2,11 +2,14 @@
 #define MOCCARDUINO_SHARED_SIMULATION_HPP
 
 #include "emulator.hpp"
+#include "trace.hpp"
 
 #include <map>
 #include <string>
 #include <algorithm>
 #include <deque>
+#include <functional>
+#include <chrono>
 
 
 /**
@@ -25,16 +28,26 @@ private:
 	std::map<std::string, bool*> mEnableMethodFlags;
 
 	/**
-	 * Input buffers (future time series) that are used to store input events.
+	 * Input buffers (future event queues) that are used to store input events.
 	 * These buffers are created and attached as event consumers to input pins.
 	 */
-	std::map<pin_t, FutureTimeSeries<ArduinoPinState>> mInputBuffers;
+	std::map<pin_t, FutureEventsQueue<ArduinoPinState>> mInputBuffers;
 
 	/**
 	 * Registered simulation inputs, strings that will be sent as serial data (at given time)
 	 */
 	std::deque<std::pair<logtime_t, std::string>> mSerialInput;
 
+	/**
+	 * Time warp granularity (0 = disabled), idle loops are never skipped over multiples of this value.
+	 */
+	logtime_t mTimeWarpGranularity;
+
+	/**
+	 * Invoked whenever the time warp skips a period (from, to).
+	 */
+	std::function<void(logtime_t, logtime_t)> mTimeWarpCallback;
+
 	void setMethodEnableFlag(const std::string& name, bool enabled)
 	{
 		auto it = mEnableMethodFlags.find(name);
@@ -44,6 +57,55 @@ private:
 		*(it->second) = enabled;
 	}
 
+	/**
+	 * Fast-forward the time after an idle loop to the earliest moment something may happen
+	 * (next input event, deadline of a consumer chain, or next multiple of the warp granularity).
+	 */
+	void timeWarp(logtime_t endTime)
+	{
+		logtime_t now = getCurrentTime();
+		logtime_t target = (now / mTimeWarpGranularity + 1) * mTimeWarpGranularity;
+		target = std::min(target, mEmulator.mNextDeadline);
+		if (mEmulator.mInputSource != nullptr) {
+			target = std::min(target, mEmulator.mInputSource->nextEventTime());
+		}
+		if (!mSerialInput.empty()) {
+			target = std::min(target, mSerialInput.front().first);
+		}
+		target = std::min(target, endTime);
+
+		if (target > now) {
+			advanceCurrentTimeBy(target - now);
+			if (mTimeWarpCallback) {
+				mTimeWarpCallback(now, target);
+			}
+		}
+	}
+
+	/**
+	 * Deliver a recorded byte of shiftOut() into the chains. If the chain does not accept it in bulk
+	 * (e.g., the consumers are attached differently than in the recorded simulation), the pin events are delivered one by one.
+	 */
+	void replayShiftedByte(logtime_t time, logtime_t writeDelay, pin_t dataPin, pin_t clockPin, std::uint8_t bitOrder, std::uint8_t val)
+	{
+		auto& data = mEmulator.getPin(dataPin);
+		auto& clock = mEmulator.getPin(clockPin);
+		auto consumer = dynamic_cast<ShiftOutConsumer*>(data.nextConsumer());
+		if (consumer != nullptr && data.nextConsumer() == clock.nextConsumer()
+			&& consumer->addShiftedByte(time, writeDelay, dataPin, clockPin, bitOrder, val)) {
+			ArduinoEmulator::setShiftedByteWritten(data, clock, time, writeDelay, bitOrder, val);
+			return;
+		}
+
+		for (std::size_t i = 0; i < 8; ++i) {
+			int bit = bitOrder == LSBFIRST ? (val >> i) & 1 : (val >> (7 - i)) & 1;
+			data.addEvent(time, ArduinoPinState(dataPin, bit));
+			clock.addEvent(time + writeDelay, ArduinoPinState(clockPin, HIGH));
+			clock.addEvent(time + 2 * writeDelay, ArduinoPinState(clockPin, LOW));
+			time += 3 * writeDelay;
+		}
+	}
+
 	void advanceCurrentTimeBy(logtime_t time)
 	{
 		logtime_t currentTime = mEmulator.advanceCurrentTimeBy(time);
@@ -54,7 +116,7 @@ private:
 	}
 
 public:
-	ArduinoSimulationController(ArduinoEmulator& emulator) : mEmulator(emulator)
+	ArduinoSimulationController(ArduinoEmulator& emulator) : mEmulator(emulator), mTimeWarpGranularity(0)
 	{
 		removeAllPins();
 		mEmulator.reset();
@@ -91,6 +153,16 @@ public:
 		return mEmulator.mCurrentTime;
 	}
 
+#ifdef MOCCARDUINO_STATS
+	/**
+	 * Returns profiling data collected by the emulator.
+	 */
+	const EmulatorStats& getStats() const
+	{
+		return mEmulator.getStats();
+	}
+#endif
+
 	/**
 	 * Enable given method in emulator. At the beginning, all methods are enabled.
 	 */
@@ -130,6 +202,7 @@ public:
 	{
 		auto& arduinoPin = mEmulator.getPin(pin);
 		arduinoPin.lastConsumer()->attachNextConsumer(consumer);
+		mEmulator.invalidateDeadline();
 	}
 
 	/**
@@ -146,18 +219,35 @@ public:
 	 * The event is scheduled at current time (with optional delay).
 	 */
 	void enqueuePinValueChange(pin_t pin, int value, logtime_t delay = 0)
+	{
+		enqueuePinValueChangeAt(pin, value, mEmulator.mCurrentTime + delay);
+	}
+
+	/**
+	 * Enqueue a change of given pin at an absolute time (works only on input pins).
+	 * The time must not precede the last time advance of the pin's input buffer.
+	 */
+	void enqueuePinValueChangeAt(pin_t pin, int value, logtime_t time)
 	{
 		bool needsRegistration = mInputBuffers.find(pin) == mInputBuffers.end();
-		mInputBuffers[pin].addFutureEvent(mEmulator.mCurrentTime + delay, ArduinoPinState(pin, value));
+		mInputBuffers[pin].addFutureEvent(time, ArduinoPinState(pin, value));
 
 		if (needsRegistration) {
 			mEmulator.registerPinInput(pin, mInputBuffers[pin]);
 		}
+		mEmulator.scheduleDeadline(mInputBuffers[pin].getDeadline());
 	}
 
 	void enqueueSerialInputEvent(const std::string& input, logtime_t delay = 0)
 	{
-		logtime_t time = mEmulator.mCurrentTime + delay;
+		enqueueSerialInputEventAt(input, mEmulator.mCurrentTime + delay);
+	}
+
+	/**
+	 * Enqueue serial input data that become available at an absolute time.
+	 */
+	void enqueueSerialInputEventAt(const std::string& input, logtime_t time)
+	{
 		if (!mSerialInput.empty() && mSerialInput.back().first > time) {
 			throw ArduinoEmulatorException("Adding serial input event at " + std::to_string(time)
 				+ " would violate ordering, since last event is already scheduled at "
@@ -166,6 +256,83 @@ public:
 		mSerialInput.emplace_back(std::make_pair(time, input));
 	}
 
+	/**
+	 * Attach a source of input events that are loaded lazily as the simulation time advances.
+	 * The source has to outlive the simulation (or be detached by attaching nullptr).
+	 */
+	void attachInputSource(InputEventsSource* source)
+	{
+		mEmulator.mInputSource = source;
+		mEmulator.invalidateDeadline();
+	}
+
+	/**
+	 * Return number of serial input bytes that were dropped since the serial buffer of the emulator was full.
+	 */
+	std::size_t getSerialOverflow() const
+	{
+		return mEmulator.getSerialOverflow();
+	}
+
+	/**
+	 * Attach a consumer of the serial output (data sent by Arduino). All output written in one setup() or loop()
+	 * invocation is coalesced into one event (at the time of the first write). Null detaches the consumer.
+	 */
+	void attachSerialOutputConsumer(EventConsumer<std::string>* consumer)
+	{
+		mEmulator.mSerialOutputConsumer = consumer;
+	}
+
+	/**
+	 * Attach a recorder of all events delivered into the pin consumer chains (e.g., EmulatorTraceWriter).
+	 * The recorder has to outlive the simulation (or be detached by attaching nullptr).
+	 */
+	void attachTraceRecorder(EmulatorTraceRecorder* recorder)
+	{
+		mEmulator.setTraceRecorder(recorder);
+	}
+
+	/**
+	 * Replay a recorded trace into the pin consumer chains without running the tested code. The consumers
+	 * (e.g., LED displays) receive the same events and time advances as in the recorded simulation, so they
+	 * produce the same output (only the consumers may be configured differently, e.g., the smoothing windows).
+	 * @param trace reader of the trace
+	 * @param serialInput consumer of the recorded serial input data (may be null)
+	 * @return time at which the recorded simulation ended
+	 */
+	logtime_t replayTrace(EmulatorTraceReader& trace, EventConsumer<std::string>* serialInput = nullptr)
+	{
+		TraceRecord record;
+		while (trace.next(record)) {
+			mEmulator.mCurrentTime = std::max(mEmulator.mCurrentTime, record.time);
+			switch (record.type) {
+			case TraceRecordType::PIN:
+				mEmulator.getPin(record.pin).addEvent(record.time, ArduinoPinState(record.pin, (int)(std::int32_t)record.value, record.aux));
+				break;
+			case TraceRecordType::SHIFT:
+				replayShiftedByte(record.time, record.value >> 8, record.pin, record.aux, record.flags, (std::uint8_t)record.value);
+				break;
+			case TraceRecordType::ADVANCE:
+				for (auto& [_, arduinoPin] : mEmulator.mPins) {
+					if (arduinoPin.getDeadline() <= record.time) {
+						arduinoPin.advanceTime(record.time);
+					}
+				}
+				break;
+			case TraceRecordType::SERIAL_INPUT:
+				if (serialInput != nullptr) {
+					serialInput->addEvent(record.time, std::string(record.data));
+				}
+				break;
+			case TraceRecordType::END:
+				return record.time;
+			default:
+				throw std::runtime_error("Unknown record type " + std::to_string((int)record.type) + " in the emulator trace.");
+			}
+		}
+		throw std::runtime_error("The emulator trace is not finished (the end record is missing).");
+	}
+
 
 	/**
 	 * Clear all events for pin's queue.
@@ -174,6 +341,7 @@ public:
 	{
 		auto& arduinoPin = mEmulator.getPin(pin);
 		arduinoPin.clear();
+		mEmulator.invalidateDeadline();
 	}
 
 	/**
@@ -184,13 +352,58 @@ public:
 		mSerialInput.clear();
 	}
 
+	/**
+	 * Set the host (wall clock) time budget of the simulation (measured from now).
+	 * When exceeded, ArduinoWatchdogException is thrown from the next API call or loop() invocation.
+	 * @param budget the budget, zero disables the watchdog
+	 */
+	void setWatchdogHostBudget(std::chrono::steady_clock::duration budget)
+	{
+		mEmulator.mWatchdogHostEnabled = budget > std::chrono::steady_clock::duration::zero();
+		mEmulator.mWatchdogHostBudget = budget;
+		mEmulator.mWatchdogHostDeadline = std::chrono::steady_clock::now() + budget;
+		mEmulator.mWatchdogTicks = 0;
+	}
+
+	/**
+	 * Limit the logical time that may elapse within one loop() invocation.
+	 * When exceeded, ArduinoWatchdogException is thrown from the API call that advanced the time.
+	 * @param limit max. time advance in microseconds, zero means unlimited
+	 */
+	void setWatchdogLoopLimit(logtime_t limit)
+	{
+		mEmulator.mWatchdogLoopLimit = limit;
+	}
+
+	/**
+	 * Enable time warp in runLoopsForPeriod(). When a loop is idle (no pin has changed its value, including inputs,
+	 * and no serial data were transferred), the time is fast-forwarded to the next scheduled input event,
+	 * the next deadline of pin consumers (e.g., demultiplexer window), or the next multiple of the granularity,
+	 * whichever comes first. The tested code therefore observes every change of millis()/micros() at the granularity,
+	 * but the loops in between are not executed.
+	 * @param granularity maximal skipped period (and alignment of the warp targets) in microseconds, 0 disables the warp
+	 * @param callback invoked with the beginning and the end of every skipped period
+	 */
+	void setTimeWarp(logtime_t granularity, std::function<void(logtime_t, logtime_t)> callback = nullptr)
+	{
+		mTimeWarpGranularity = granularity;
+		mTimeWarpCallback = std::move(callback);
+	}
+
 	/**
 	 * Invoke the setup function.
 	 * @param setupDelay How much is internal clock advanced after the setup.
 	 */
 	void runSetup(logtime_t setupDelay = 1)
 	{
-		mEmulator.invokeSetup();
+		try {
+			mEmulator.invokeSetup();
+		}
+		catch (...) {
+			mEmulator.flushSerialOutput(); // keep the output written before the failure
+			throw;
+		}
+		mEmulator.flushSerialOutput();
 		advanceCurrentTimeBy(setupDelay);
 	}
 
@@ -200,7 +413,21 @@ public:
 	 */
 	void runSingleLoop(logtime_t loopDelay = 1)
 	{
-		mEmulator.invokeLoop();
+		{
+			MOCCARDUINO_STATS_LOOP(mEmulator);
+			mEmulator.watchdogLoopStarted();
+			try {
+				mEmulator.invokeLoop();
+			}
+			catch (...) {
+				// the caller may catch the exception and keep using the controller, so the loop is closed properly
+				mEmulator.watchdogLoopFinished();
+				mEmulator.flushSerialOutput();
+				throw;
+			}
+			mEmulator.watchdogLoopFinished();
+		}
+		mEmulator.flushSerialOutput();
 		advanceCurrentTimeBy(loopDelay);
 	}
 
@@ -224,7 +451,7 @@ public:
 	}
 
 	/**
-	 * Run loops for given time period.
+	 * Run loops for given time period. Idle loops are fast-forwarded if the time warp is enabled (see setTimeWarp()).
 	 * @param period How long whould we loop.
 	 * @param loopDelay How much is internal clock advanced after every loop.
 	 */
@@ -233,11 +460,16 @@ public:
 	{
 		logtime_t endTime = getCurrentTime() + period;
 		while (getCurrentTime() < endTime) {
+			std::uint64_t activity = mEmulator.mActivity;
 			runSingleLoop(loopDelay);
 
 			if (!callback(getCurrentTime())) {
 				break;
 			}
+
+			if (mTimeWarpGranularity > 0 && mEmulator.mActivity == activity && getCurrentTime() < endTime) {
+				timeWarp(endTime);
+			}
 		}
 	}
 };
@@ -3,6 +3,7 @@
 
 #include "simulation.hpp"
 #include "led_display.hpp"
+#include "board.hpp"
 #include "constants.hpp"
 #include "funshield.h"
 
@@ -56,18 +57,11 @@ public:
 		mArduino(arduino),
 		mButtonBouncingDelay(0) // 0 = disabled
 	{
-		// initialize pins
-		for (auto pin : mButtionPins) {
-			mArduino.registerPin(pin, INPUT);
+		// initialize pins (buttons, LEDs, and serial interface for the 7seg LEDs)
+		for (std::size_t i = 0; i < UNO_FUNSHIELD_BOARD.layoutSize; ++i) {
+			auto& boardPin = UNO_FUNSHIELD_BOARD.layout[i];
+			mArduino.registerPin(boardPin.pin, boardPin.wiring);
 		}
-		for (auto pin : mLedPins) {
-			mArduino.registerPin(pin, OUTPUT);
-		}
-
-		// serial interface for the 7seg LEDs
-		mArduino.registerPin(latch_pin, OUTPUT);
-		mArduino.registerPin(clock_pin, OUTPUT);
-		mArduino.registerPin(data_pin, OUTPUT);
 
 		// attach displays (event consumers)
 		mLeds.attachToSimulation(mArduino, mLedPins);
@@ -118,6 +112,28 @@ s	 */
 		return mSegDisplay;
 	}
 
+	/**
+	 * Number of the shield buttons.
+	 */
+	std::size_t getButtonsCount() const
+	{
+		return mButtionPins.size();
+	}
+
+	/**
+	 * Set the delay between two state changes of a bouncing button (0 disables the bouncing).
+	 * The bouncing is applied to button events scheduled afterwards (each edge is followed by 3 bounces).
+	 */
+	void setButtonBouncingDelay(logtime_t delay)
+	{
+		mButtonBouncingDelay = delay;
+	}
+
+	logtime_t getButtonBouncingDelay() const
+	{
+		return mButtonBouncingDelay;
+	}
+
 	/**
 	 * Press button (schedule event).
 	 * @param button zero-based index of the button (0 is button1)
@@ -126,36 +142,56 @@ s	 */
 	 */
 	void buttonDown(std::size_t button, logtime_t afterDelay = 0, bool bouncing = true)
 	{
-		mArduino.enqueuePinValueChange(mButtionPins[button], LOW, afterDelay);
+		buttonDownAt(button, mArduino.getCurrentTime() + afterDelay, bouncing);
+	}
+
+	/**
+	 * Release button (schedule event).
+	 * @param button zero-based index of the button (0 is button1)
+	 * @param afterDelay schedule the button to be pressed after given amount of (logical) time
+	 * @param bouncing flag indicates whether bouncing effect will be applied (also the bouncing delay must be > 0)
+	 */
+	void buttonUp(std::size_t button, logtime_t afterDelay = 0, bool bouncing = true)
+	{
+		buttonUpAt(button, mArduino.getCurrentTime() + afterDelay, bouncing);
+	}
+
+	/**
+	 * Press button at an absolute time (schedule event).
+	 * @param button zero-based index of the button (0 is button1)
+	 * @param time when the button is pressed
+	 * @param bouncing flag indicates whether bouncing effect will be applied (also the bouncing delay must be > 0)
+	 */
+	void buttonDownAt(std::size_t button, logtime_t time, bool bouncing = true)
+	{
+		mArduino.enqueuePinValueChangeAt(mButtionPins[button], LOW, time);
 
 		if (bouncing && mButtonBouncingDelay > 0) {
-			logtime_t delay = afterDelay;
 			for (std::size_t i = 1; i <= 3; ++i) {
-				delay += mButtonBouncingDelay;
-				buttonUp(button, delay, false);
-				delay += mButtonBouncingDelay;
-				buttonDown(button, delay, false);
+				time += mButtonBouncingDelay;
+				buttonUpAt(button, time, false);
+				time += mButtonBouncingDelay;
+				buttonDownAt(button, time, false);
 			}
 		}
 	}
 
 	/**
-	 * Release button (schedule event).
+	 * Release button at an absolute time (schedule event).
 	 * @param button zero-based index of the button (0 is button1)
-	 * @param afterDelay schedule the button to be pressed after given amount of (logical) time
+	 * @param time when the button is released
 	 * @param bouncing flag indicates whether bouncing effect will be applied (also the bouncing delay must be > 0)
 	 */
-	void buttonUp(std::size_t button, logtime_t afterDelay = 0, bool bouncing = true)
+	void buttonUpAt(std::size_t button, logtime_t time, bool bouncing = true)
 	{
-		mArduino.enqueuePinValueChange(mButtionPins[button], HIGH, afterDelay);
+		mArduino.enqueuePinValueChangeAt(mButtionPins[button], HIGH, time);
 
 		if (bouncing && mButtonBouncingDelay > 0) {
-			logtime_t delay = afterDelay;
 			for (std::size_t i = 1; i <= 3; ++i) {
-				delay += mButtonBouncingDelay;
-				buttonDown(button, delay, false);
-				delay += mButtonBouncingDelay;
-				buttonUp(button, delay, false);
+				time += mButtonBouncingDelay;
+				buttonDownAt(button, time, false);
+				time += mButtonBouncingDelay;
+				buttonUpAt(button, time, false);
 			}
 		}
 	}
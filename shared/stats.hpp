@@ -0,0 +1,297 @@
+#ifndef MOCCARDUINO_SHARED_STATS_HPP
+#define MOCCARDUINO_SHARED_STATS_HPP
+
+#include "time_series.hpp"
+
+#include <array>
+#include <chrono>
+#include <map>
+#include <ostream>
+#include <string>
+#include <cstdint>
+
+using pin_t = std::uint8_t; // same as in emulator.hpp (which includes this header)
+
+
+/**
+ * Instrumentation hooks of the emulator. They are active only if MOCCARDUINO_STATS macro is defined,
+ * otherwise they expand to nothing (and the emulator does not even hold the statistics).
+ */
+#ifdef MOCCARDUINO_STATS
+#define MOCCARDUINO_STATS_API(fnc) EmulatorStats::CallScope _moccarduinoStatsScope(mStats, EmulatorStats::Api::fnc, mCurrentTime)
+#define MOCCARDUINO_STATS_API_CALLS(fnc, count, time) mStats.recordApiCalls(EmulatorStats::Api::fnc, (count), (time))
+#define MOCCARDUINO_STATS_PIN_WRITES(pin, count) mStats.recordPinWrites((pin), (count))
+#define MOCCARDUINO_STATS_PIN_READ(pin) mStats.recordPinRead(pin)
+#define MOCCARDUINO_STATS_LOOP(emulator) EmulatorStats::LoopScope _moccarduinoStatsLoopScope((emulator).mStats, (emulator).mCurrentTime)
+#else
+#define MOCCARDUINO_STATS_API(fnc)
+#define MOCCARDUINO_STATS_API_CALLS(fnc, count, time)
+#define MOCCARDUINO_STATS_PIN_WRITES(pin, count)
+#define MOCCARDUINO_STATS_PIN_READ(pin)
+#define MOCCARDUINO_STATS_LOOP(emulator)
+#endif
+
+
+/**
+ * Profiling data collected by the emulator (host time of loop() invocations, API calls, and pin operations).
+ */
+class EmulatorStats
+{
+public:
+	/**
+	 * Instrumented API functions.
+	 */
+	enum class Api : std::size_t {
+		PIN_MODE, DIGITAL_WRITE, DIGITAL_READ, ANALOG_READ, ANALOG_REFERENCE, ANALOG_WRITE, MILLIS, MICROS,
+		DELAY, DELAY_MICROSECONDS, PULSE_IN, PULSE_IN_LONG, SHIFT_OUT, SHIFT_IN, TONE, NO_TONE, RANDOM,
+		RANDOM_SEED, SERIAL_IO,
+		COUNT // must be the last item
+	};
+
+	static constexpr std::size_t API_COUNT = (std::size_t)Api::COUNT;
+
+	/**
+	 * Number of buckets of the loop time histogram (bucket i holds durations in [2^(i-1), 2^i) ns).
+	 */
+	static constexpr std::size_t HISTOGRAM_BUCKETS = 64;
+
+	using DurationStats = TimeSeriesBase<logtime_t>::DeltaStats;
+
+	struct ApiStats
+	{
+		std::uint64_t calls = 0;
+		logtime_t emulatedTime = 0; ///< logical time the calls took (nested calls are counted in both functions)
+	};
+
+	struct PinStats
+	{
+		std::uint64_t writes = 0;
+		std::uint64_t reads = 0;
+	};
+
+	/**
+	 * Records one API call, the emulated time is measured from construction to destruction of the scope.
+	 */
+	class CallScope
+	{
+	private:
+		ApiStats& mStats;
+		const logtime_t& mCurrentTime;
+		logtime_t mStartTime;
+
+	public:
+		CallScope(EmulatorStats& stats, Api fnc, const logtime_t& currentTime)
+			: mStats(stats.mApi[(std::size_t)fnc]), mCurrentTime(currentTime), mStartTime(currentTime)
+		{
+			++mStats.calls;
+		}
+
+		~CallScope()
+		{
+			mStats.emulatedTime += mCurrentTime - mStartTime;
+		}
+	};
+
+	/**
+	 * Records one loop() invocation (both host and emulated time).
+	 */
+	class LoopScope
+	{
+	private:
+		EmulatorStats& mStats;
+		const logtime_t& mCurrentTime;
+		logtime_t mStartTime;
+		std::chrono::steady_clock::time_point mHostStart;
+
+	public:
+		LoopScope(EmulatorStats& stats, const logtime_t& currentTime)
+			: mStats(stats), mCurrentTime(currentTime), mStartTime(currentTime), mHostStart(std::chrono::steady_clock::now())
+		{}
+
+		~LoopScope()
+		{
+			auto hostTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - mHostStart);
+			mStats.recordLoop((logtime_t)hostTime.count(), mCurrentTime - mStartTime);
+		}
+	};
+
+private:
+	std::array<ApiStats, API_COUNT> mApi;
+	std::map<pin_t, PinStats> mPins;
+	DurationStats mLoopHostTime;		///< in ns
+	DurationStats mLoopEmulatedTime;	///< in us
+	std::array<std::uint64_t, HISTOGRAM_BUCKETS> mLoopHistogram;
+	logtime_t mLoopHostTotal;
+	logtime_t mLoopEmulatedTotal;
+
+	static std::size_t bucketOf(logtime_t ns)
+	{
+		std::size_t bucket = 0;
+		while (ns > 0 && bucket + 1 < HISTOGRAM_BUCKETS) {
+			ns >>= 1;
+			++bucket;
+		}
+		return bucket;
+	}
+
+	static void writeJsonDuration(std::ostream& out, const DurationStats& stats, logtime_t total)
+	{
+		out << "{\"total\":" << total << ",\"mean\":" << stats.mean() << ",\"deviation\":" << stats.deviation()
+			<< ",\"min\":" << (stats.count() > 0 ? stats.min() : 0) << ",\"max\":" << stats.max() << "}";
+	}
+
+public:
+	EmulatorStats()
+	{
+		clear();
+	}
+
+	static const char* apiName(Api fnc)
+	{
+		static const char* names[API_COUNT] = {
+			"pinMode", "digitalWrite", "digitalRead", "analogRead", "analogReference", "analogWrite", "millis", "micros",
+			"delay", "delayMicroseconds", "pulseIn", "pulseInLong", "shiftOut", "shiftIn", "tone", "noTone", "random",
+			"randomSeed", "serial"
+		};
+		return names[(std::size_t)fnc];
+	}
+
+	void clear()
+	{
+		mApi.fill(ApiStats());
+		mPins.clear();
+		mLoopHostTime = DurationStats();
+		mLoopEmulatedTime = DurationStats();
+		mLoopHistogram.fill(0);
+		mLoopHostTotal = mLoopEmulatedTotal = 0;
+	}
+
+	/**
+	 * Record API calls that were not actually invoked, but their effect was emulated
+	 * (e.g., digitalWrite() calls of a shiftOut() delivered in bulk).
+	 * @param emulatedTime total logical time of the calls
+	 */
+	void recordApiCalls(Api fnc, std::uint64_t count, logtime_t emulatedTime)
+	{
+		mApi[(std::size_t)fnc].calls += count;
+		mApi[(std::size_t)fnc].emulatedTime += emulatedTime;
+	}
+
+	void recordPinWrites(pin_t pin, std::uint64_t count = 1)
+	{
+		mPins[pin].writes += count;
+	}
+
+	void recordPinRead(pin_t pin)
+	{
+		++mPins[pin].reads;
+	}
+
+	/**
+	 * @param hostTime wall time of the host [ns]
+	 * @param emulatedTime logical time of the emulator [us]
+	 */
+	void recordLoop(logtime_t hostTime, logtime_t emulatedTime)
+	{
+		mLoopHostTime.add(hostTime);
+		mLoopEmulatedTime.add(emulatedTime);
+		mLoopHostTotal += hostTime;
+		mLoopEmulatedTotal += emulatedTime;
+		++mLoopHistogram[bucketOf(hostTime)];
+	}
+
+	const ApiStats& api(Api fnc) const
+	{
+		return mApi[(std::size_t)fnc];
+	}
+
+	const std::map<pin_t, PinStats>& pins() const
+	{
+		return mPins;
+	}
+
+	const DurationStats& loopHostTime() const
+	{
+		return mLoopHostTime;
+	}
+
+	const DurationStats& loopEmulatedTime() const
+	{
+		return mLoopEmulatedTime;
+	}
+
+	std::uint64_t histogramBucket(std::size_t bucket) const
+	{
+		return mLoopHistogram.at(bucket);
+	}
+
+	/**
+	 * Print human readable report with a histogram of loop host times.
+	 */
+	void writeHistogram(std::ostream& out) const
+	{
+		out << "loops: " << mLoopHostTime.count() << ", host time " << mLoopHostTotal << " ns (mean "
+			<< mLoopHostTime.mean() << " ns), emulated time " << mLoopEmulatedTotal << " us (mean "
+			<< mLoopEmulatedTime.mean() << " us)" << std::endl;
+
+		std::uint64_t maxCount = 0;
+		for (auto count : mLoopHistogram) {
+			maxCount = std::max(maxCount, count);
+		}
+		for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+			if (mLoopHistogram[i] == 0) continue;
+			logtime_t from = i == 0 ? 0 : (logtime_t)1 << (i - 1);
+			out << "  [" << from << ", " << ((logtime_t)1 << i) << ") ns: " << mLoopHistogram[i] << " "
+				<< std::string((std::size_t)(mLoopHistogram[i] * 50 / maxCount), '#') << std::endl;
+		}
+
+		out << "api calls:" << std::endl;
+		for (std::size_t i = 0; i < API_COUNT; ++i) {
+			if (mApi[i].calls == 0) continue;
+			out << "  " << apiName((Api)i) << ": " << mApi[i].calls << " calls, " << mApi[i].emulatedTime << " us" << std::endl;
+		}
+
+		out << "pins:" << std::endl;
+		for (auto const& [pin, stats] : mPins) {
+			out << "  " << (int)pin << ": " << stats.writes << " writes, " << stats.reads << " reads" << std::endl;
+		}
+	}
+
+	/**
+	 * Print the statistics as a JSON object.
+	 */
+	void writeJson(std::ostream& out) const
+	{
+		out << "{\"loops\":{\"count\":" << mLoopHostTime.count() << ",\"host_ns\":";
+		writeJsonDuration(out, mLoopHostTime, mLoopHostTotal);
+		out << ",\"emulated_us\":";
+		writeJsonDuration(out, mLoopEmulatedTime, mLoopEmulatedTotal);
+		out << ",\"histogram\":[";
+		bool first = true;
+		for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+			if (mLoopHistogram[i] == 0) continue;
+			out << (first ? "" : ",") << "{\"from_ns\":" << (i == 0 ? 0 : (logtime_t)1 << (i - 1))
+				<< ",\"to_ns\":" << ((logtime_t)1 << i) << ",\"count\":" << mLoopHistogram[i] << "}";
+			first = false;
+		}
+
+		out << "]},\"api\":{";
+		first = true;
+		for (std::size_t i = 0; i < API_COUNT; ++i) {
+			if (mApi[i].calls == 0) continue;
+			out << (first ? "" : ",") << "\"" << apiName((Api)i) << "\":{\"calls\":" << mApi[i].calls
+				<< ",\"emulated_us\":" << mApi[i].emulatedTime << "}";
+			first = false;
+		}
+
+		out << "},\"pins\":{";
+		first = true;
+		for (auto const& [pin, stats] : mPins) {
+			out << (first ? "" : ",") << "\"" << (int)pin << "\":{\"writes\":" << stats.writes << ",\"reads\":" << stats.reads << "}";
+			first = false;
+		}
+		out << "}}" << std::endl;
+	}
+};
+
+#endif
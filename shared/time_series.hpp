@@ -2,6 +2,7 @@
 #define MOCCARDUINO_SHARED_TIME_SERIES_HPP
 
 #include <vector>
+#include <deque>
 #include <algorithm>
 #include <memory>
 #include <stdexcept>
@@ -10,6 +11,8 @@
 #include <string>
 #include <sstream>
 #include <type_traits>
+#include <tuple>
+#include <utility>
 #include <cstdint>
 #include <cmath>
 
@@ -69,6 +72,14 @@ protected:
 		}
 	}
 
+	/**
+	 * Get the deadline of the rest of the chain (NO_DEADLINE if this is the last consumer).
+	 */
+	TIME nextGetDeadline() const
+	{
+		return mNextConsumer != nullptr ? mNextConsumer->getDeadline() : NO_DEADLINE;
+	}
+
 	virtual void doAddEvent(TIME time, VALUE value)
 	{
 		// base class have no implementation, just a transparent throughput
@@ -87,7 +98,21 @@ protected:
 		nextClear();
 	}
 
+	virtual TIME doGetDeadline() const
+	{
+		// base class does not depend on time, so it merely reports the deadline of the rest of the chain
+		return nextGetDeadline();
+	}
+
 public:
+	using value_t = VALUE;
+	using timestamp_t = TIME;
+
+	/**
+	 * Deadline value indicating that the consumer does not need any time advance notifications.
+	 */
+	static constexpr TIME NO_DEADLINE = std::numeric_limits<TIME>::max();
+
 	EventConsumer() : mNextConsumer(nullptr), mLastTime(0) {}
 	virtual ~EventConsumer() = default;  // just to enforce virtual destructor
 
@@ -190,6 +215,16 @@ public:
 	{
 		doClear();
 	}
+
+	/**
+	 * Return the earliest logical time at which this consumer (or any consumer further down the chain)
+	 * needs to be notified by advanceTime(). Time advances below the deadline may be skipped by the producer
+	 * without any observable effect on emitted events. NO_DEADLINE is returned if no notification is required.
+	 */
+	TIME getDeadline() const
+	{
+		return doGetDeadline();
+	}
 };
 
 
@@ -217,14 +252,24 @@ protected:
 		// Emitting events on the sprout must be defined in derived classes...
 	}
 
-	void doAdvanceTime(TIME time) override
+	/**
+	 * Advance the time of the regular chain and of given sprout consumer. The sprout is passed in explicitly,
+	 * so a Pipeline may provide its statically typed following stage (see PipelineStage).
+	 */
+	template<typename SPROUT>
+	void advanceTimeTo(SPROUT* sprout, TIME time)
 	{
 		EventConsumer<VALUE, TIME>::doAdvanceTime(time);
-		if (mSproutConsumer != nullptr) {
-			mSproutConsumer->advanceTime(time);
+		if (sprout != nullptr) {
+			sprout->advanceTime(time);
 		}
 	}
 
+	void doAdvanceTime(TIME time) override
+	{
+		advanceTimeTo(mSproutConsumer, time);
+	}
+
 	void doClear() override
 	{
 		EventConsumer<VALUE, TIME>::doClear();
@@ -233,6 +278,15 @@ protected:
 		}
 	}
 
+	TIME doGetDeadline() const override
+	{
+		TIME deadline = EventConsumer<VALUE, TIME>::doGetDeadline();
+		if (mSproutConsumer != nullptr) {
+			deadline = std::min(deadline, mSproutConsumer->getDeadline());
+		}
+		return deadline;
+	}
+
 public:
 	ForkedEventConsumer() : mSproutConsumer(nullptr) {}
 
@@ -286,6 +340,7 @@ private:
 	VALUE mLastValue;
 	std::function<void(TIME, VALUE)> mEventCallback;
 	std::function<void()> mClearCallback;
+	bool mNotifyTimeAdvances;
 
 
 protected:
@@ -309,13 +364,98 @@ protected:
 		mClearCallback();
 	}
 
+	TIME doGetDeadline() const override
+	{
+		// the callback observes every time advance (if requested), so the deadline is always due
+		return mNotifyTimeAdvances ? this->mLastTime : EventConsumer<VALUE, TIME>::doGetDeadline();
+	}
+
 public:
 	/**
 	 * Constructor gets one or two functions - event processor (mandatory) and clear callback (optional).
 	 * The event processor is called with every new event and with advance time (using last event value).
+	 * @param notifyTimeAdvances if false, the analyzer does not require to be notified about every time advance
+	 *                           (so the producer may skip them), the callback is still invoked on each event
+	 */
+	EventAnalyzer(std::function<void(TIME, VALUE)> eventCallback, std::function<void()> clearCallback = []() {},
+		bool notifyTimeAdvances = true)
+		: mLastValue(), mEventCallback(eventCallback), mClearCallback(clearCallback), mNotifyTimeAdvances(notifyTimeAdvances) {}
+};
+
+
+/**
+ * Fan-out node that passes all events (and time advances) to multiple subscribed chains, so one producer may feed
+ * several independent consumers (e.g., raw log, smoothed logs with different windows, and analyzers).
+ * Subscribers are kept in a flat array and notified in the order of subscription (after the regular next consumer).
+ */
+template<typename VALUE, typename TIME = logtime_t>
+class BroadcastConsumer : public EventConsumer<VALUE, TIME>
+{
+private:
+	std::vector<EventConsumer<VALUE, TIME>*> mSubscribers;
+
+protected:
+	void doAddEvent(TIME time, VALUE value) override
+	{
+		EventConsumer<VALUE, TIME>::doAddEvent(time, value);
+		for (auto subscriber : mSubscribers) {
+			subscriber->addEvent(time, value);
+		}
+	}
+
+	void doAdvanceTime(TIME time) override
+	{
+		EventConsumer<VALUE, TIME>::doAdvanceTime(time);
+		for (auto subscriber : mSubscribers) {
+			subscriber->advanceTime(time);
+		}
+	}
+
+	void doClear() override
+	{
+		EventConsumer<VALUE, TIME>::doClear();
+		for (auto subscriber : mSubscribers) {
+			subscriber->clear();
+		}
+	}
+
+	TIME doGetDeadline() const override
+	{
+		TIME deadline = EventConsumer<VALUE, TIME>::doGetDeadline();
+		for (auto subscriber : mSubscribers) {
+			deadline = std::min(deadline, subscriber->getDeadline());
+		}
+		return deadline;
+	}
+
+public:
+	/**
+	 * Attach another chain which receives all events.
+	 */
+	void subscribe(EventConsumer<VALUE, TIME>& consumer)
+	{
+		if (std::find(mSubscribers.begin(), mSubscribers.end(), &consumer) != mSubscribers.end()) {
+			throw std::runtime_error("Consumer is already subscribed.");
+		}
+		mSubscribers.push_back(&consumer);
+	}
+
+	/**
+	 * Detach previously subscribed chain.
 	 */
-	EventAnalyzer(std::function<void(TIME, VALUE)> eventCallback, std::function<void()> clearCallback = []() {})
-		: mLastValue(), mEventCallback(eventCallback), mClearCallback(clearCallback) {}
+	void unsubscribe(EventConsumer<VALUE, TIME>& consumer)
+	{
+		auto it = std::find(mSubscribers.begin(), mSubscribers.end(), &consumer);
+		if (it == mSubscribers.end()) {
+			throw std::runtime_error("Consumer is not subscribed.");
+		}
+		mSubscribers.erase(it);
+	}
+
+	std::size_t subscribersCount() const
+	{
+		return mSubscribers.size();
+	}
 };
 
 template<typename TIME = logtime_t>
@@ -378,6 +518,101 @@ public:
 		}
 	};
 
+	/**
+	 * Running statistics of delays between subsequent events (Welford's online algorithm,
+	 * so the results are computed in floating point and cannot overflow).
+	 */
+	class DeltaStats {
+	private:
+		std::size_t mCount;	///< number of deltas
+		double mMean;
+		double mM2;			///< sum of squared differences from the mean
+		TIME mMin;
+		TIME mMax;
+
+	public:
+		DeltaStats() : mCount(0), mMean(0.0), mM2(0.0), mMin(std::numeric_limits<TIME>::max()), mMax(0) {}
+
+		/**
+		 * Add another delta into the statistics.
+		 */
+		void add(TIME dt)
+		{
+			++mCount;
+			double delta = (double)dt - mMean;
+			mMean += delta / (double)mCount;
+			mM2 += delta * ((double)dt - mMean);
+			mMin = std::min(mMin, dt);
+			mMax = std::max(mMax, dt);
+		}
+
+		/**
+		 * Remove a delta that was previously added (used for sliding windows).
+		 * Minimum and maximum are not updated (they are maintained separately by the sliding window).
+		 */
+		void remove(TIME dt)
+		{
+			if (mCount <= 1) {
+				mCount = 0;
+				mMean = mM2 = 0.0;
+				return;
+			}
+
+			--mCount;
+			double delta = (double)dt - mMean;
+			mMean -= delta / (double)mCount;
+			mM2 = std::max(0.0, mM2 - delta * ((double)dt - mMean));
+		}
+
+		/**
+		 * Override the extremes (used for sliding windows).
+		 */
+		void setMinMax(TIME min, TIME max)
+		{
+			mMin = min;
+			mMax = max;
+		}
+
+		std::size_t count() const
+		{
+			return mCount;
+		}
+
+		double mean() const
+		{
+			return mMean;
+		}
+
+		/**
+		 * Population variance of the deltas.
+		 */
+		double variance() const
+		{
+			return mCount > 0 ? mM2 / (double)mCount : 0.0;
+		}
+
+		double deviation() const
+		{
+			return std::sqrt(variance());
+		}
+
+		/**
+		 * The smallest delta (max of TIME if there are no deltas).
+		 */
+		TIME min() const
+		{
+			return mMin;
+		}
+
+		/**
+		 * The largest delta (zero if there are no deltas).
+		 */
+		TIME max() const
+		{
+			return mMax;
+		}
+	};
+
 	virtual std::size_t size() const = 0;
 	virtual bool empty() const = 0;
 	virtual TIME getEventTime(std::size_t idx) const = 0;
@@ -417,445 +652,1510 @@ protected:
 };
 
 /**
- * A container of time-marked events. It provides a similar interface like vector
- * (which is also used as internal storage) and additionaly some analytical functions that
- * might help with behavioral assertions.
- * @tparam VALUE the inner value of each event (e.g., a state of a pin)
- * @tparam TIME type used for logical time stamps
+ * One event of a time series (time-marked value).
  */
-template<typename VALUE, typename TIME = logtime_t> 
-class TimeSeries : public TimeSeriesBase<TIME>, public EventConsumer<VALUE, TIME>
-{
+template<typename VALUE, typename TIME = logtime_t>
+struct TimeSeriesEvent {
 public:
-	using Range = typename TimeSeriesBase<TIME>::Range;
-
-	/**
-	 * Internal structure that wraps all time series events.
-	 */
-	struct Event {
-	public:
-		TIME time;		///< when the event happen
-		VALUE value;	///< associated value of the event (new state)
+	TIME time;		///< when the event happen
+	VALUE value;	///< associated value of the event (new state)
 
-		Event(TIME t, VALUE v) : time(t), value(v) {}
+	TimeSeriesEvent(TIME t, VALUE v) : time(t), value(std::move(v)) {}
 
-		// make the sorting algorithm great again!
-		inline bool operator<(const Event& e) const
-		{
-			return time < e.time || (time == e.time && value < e.value);
-		}
-
-		inline bool operator==(const Event& e) const
-		{
-			return time == e.time && value == e.value;
-		}
-	};
-
-protected:
-	/**
-	 * Internal data structure that actually holds the events.
-	 * The events are sorted by their time in ascending order.
-	 * Events with the same time may be in any order.
-	 */
-	std::vector<Event> mEvents;
-
-	void doAddEvent(TIME time, VALUE value) override
+	// make the sorting algorithm great again!
+	inline bool operator<(const TimeSeriesEvent& e) const
 	{
-		if (!this->mEvents.empty() && this->mEvents.back().time > time) {
-			throw std::runtime_error("Unable to add event that violates causality.");
-		}
-
-		mEvents.emplace_back(time, value);
-		EventConsumer<VALUE, TIME>::doAddEvent(time, value);
+		return time < e.time || (time == e.time && value < e.value);
 	}
 
-	void doClear() override
+	inline bool operator==(const TimeSeriesEvent& e) const
 	{
-		mEvents.clear();
-		EventConsumer<VALUE, TIME>::doClear();
+		return time == e.time && value == e.value;
 	}
+};
 
+
+/**
+ * Default storage of time series events (one vector of events).
+ * Storage policies provide indexed access to events (and separately to their times and values),
+ * appending, insertion, removal of a prefix, capacity reservation, and an estimate of their memory usage.
+ */
+template<typename VALUE, typename TIME = logtime_t>
+class VectorEventStorage
+{
 public:
-	// interface that simulates deque
+	using Event = TimeSeriesEvent<VALUE, TIME>;
+	using const_reference = const Event&;
 
-	std::size_t size() const override
+private:
+	std::vector<Event> mEvents;
+
+public:
+	std::size_t size() const
 	{
 		return mEvents.size();
 	}
 
-	bool empty() const override
+	bool empty() const
 	{
 		return mEvents.empty();
 	}
 
-	TIME getEventTime(std::size_t idx) const override
+	const Event& operator[](std::size_t idx) const
 	{
-		return mEvents[idx].time;
+		return mEvents[idx];
 	}
 
-	std::string getEventAsString(std::size_t idx) const override
+	const Event& front() const
 	{
-		return TimeSeriesBase<TIME>::convert(mEvents[idx].value);
+		return mEvents.front();
 	}
 
-	const Event& operator[](std::size_t idx) const
+	const Event& back() const
 	{
-		return mEvents[idx];
+		return mEvents.back();
 	}
 
-	const Event& at(std::size_t idx) const
+	TIME& time(std::size_t idx)
 	{
-		return mEvents[idx];
+		return mEvents[idx].time;
 	}
 
-	const Event& front() const
+	const TIME& time(std::size_t idx) const
 	{
-		if (empty()) {
-			throw std::runtime_error("The time series is empty. Unable to reach first item.");
-		}
-		return mEvents.front();
+		return mEvents[idx].time;
 	}
 
-	const Event& back() const
+	const VALUE& value(std::size_t idx) const
 	{
-		if (empty()) {
-			throw std::runtime_error("The time series is empty. Unable to reach last item.");
-		}
-		return mEvents.back();
+		return mEvents[idx].value;
 	}
 
-
-	/*
-	 * Analytical functions
-	 */
+	void emplace_back(TIME time, VALUE value)
+	{
+		mEvents.emplace_back(time, std::move(value));
+	}
 
 	/**
-	 * Get the difference between first and last event in given range.
+	 * Insert an event before given index (subsequent events are moved).
 	 */
-	TIME getRangeDuration(const Range& range) const
+	void insert(std::size_t idx, TIME time, VALUE value)
 	{
-		if (range.length() < 2) {
-			return 0.0;
-		}
-		else {
-			return mEvents[range.end() - 1] - mEvents[range.start()];
-		}
+		mEvents.emplace(mEvents.begin() + idx, time, std::move(value));
 	}
 
 	/**
-	 * Examine event time stamps in given range and return the mean delay between subsequent events.
+	 * Remove given number of events from the beginning.
 	 */
-	double getDeltasMean(const Range& range) const
+	void eraseFront(std::size_t count)
 	{
-		if (range.length() < 2) {
-			return 0.0;
-		}
-
-		TIME deltas = 0;
-		TIME lastTime = mEvents[range.start()].time;
+		mEvents.erase(mEvents.begin(), mEvents.begin() + std::min(count, mEvents.size()));
+	}
 
-		for (std::size_t i = range.start() + 1; i < range.end(); ++i) {
-			deltas += mEvents[i].time - lastTime;
-			lastTime = mEvents[i].time;
-		}
+	void clear()
+	{
+		mEvents.clear();
+	}
 
-		return (double)deltas / (double)(range.length() - 1);
+	void reserve(std::size_t capacity)
+	{
+		mEvents.reserve(capacity);
 	}
 
-	/**
-	 * Examine event time stamps of the entire series and return the mean delay between subsequent events.
-	 */
-	double getDeltasMean() const
+	std::size_t capacity() const
 	{
-		return getDeltasMean(Range(0, mEvents.size()));
+		return mEvents.capacity();
 	}
 
 	/**
-	 * Examine event time stamps in given range and return the std. deviation
-	 * of delays between subsequent events.
+	 * Bytes allocated for the events (memory owned by the values themselves, e.g., strings, is not included).
 	 */
-	double getDeltasDeviation(const Range& range) const
+	std::size_t memoryUsage() const
 	{
-		if (range.length() < 2) {
-			return 0.0;
-		}
+		return mEvents.capacity() * sizeof(Event);
+	}
+};
 
-		TIME deltas = 0;
-		TIME squareDeltas = 0;
-		TIME lastTime = mEvents[range.start()].time;
 
-		for (std::size_t i = range.start() + 1; i < range.end(); ++i) {
-			auto dt = mEvents[i].time - lastTime;
-			deltas += dt;
-			squareDeltas += dt * dt;
-			lastTime = mEvents[i].time;
-		}
+/**
+ * Storage of time series events in fixed-size chunks. The chunks are never reallocated (the events keep their
+ * addresses and nothing is copied when the storage grows), chunks released by clear() or eraseFront() are kept
+ * in an arena and reused. If SPLIT is set, times and values are stored in separate arrays (no padding between
+ * a 64-bit time and a small value), so the events are not stored as a whole and operator[] returns them by value.
+ * @tparam CHUNK number of events in one chunk (power of 2)
+ */
+template<typename VALUE, typename TIME = logtime_t, bool SPLIT = false, std::size_t CHUNK = 1024>
+class ChunkedEventStorage
+{
+public:
+	using Event = TimeSeriesEvent<VALUE, TIME>;
+	using const_reference = std::conditional_t<SPLIT, Event, const Event&>;
 
-		double count = (double)(range.length() - 1);
-		double mean = (double)deltas / count;
-		return std::sqrt(((double)squareDeltas / count) - (mean * mean));	// E(X^2) - (EX)^2;
-	}
+	static_assert(CHUNK > 0 && (CHUNK & (CHUNK - 1)) == 0, "Chunk size must be a power of 2.");
 
+private:
 	/**
-	 * Examine event time stamps of the entire series and return the std. deviation
-	 * of delays between subsequent events.
+	 * Chunk of split events (plain arrays, since std::vector<bool> cannot provide references to its items).
 	 */
-	double getDeltasDeviation() const
+	struct SplitChunk
 	{
-		return getDeltasDeviation(Range(0, mEvents.size()));
-	}
+		std::unique_ptr<TIME[]> times;
+		std::unique_ptr<VALUE[]> values;
+		std::size_t size = 0;
+	};
+
+	using chunk_t = std::conditional_t<SPLIT, SplitChunk, std::vector<Event>>;
 
 	/**
-	 * Tries to find the first occurence of a continuous sequence in the time series.
-	 * If no such sequence exists, tries to return the longest prefix.
-	 * @param sequence of event values to search for
-	 * @return range of indiced where the occurence was found (empty range if nothing was found)
+	 * Chunks holding the events, only the last one may be partially filled.
+	 */
+	std::vector<std::unique_ptr<chunk_t>> mChunks;
+
+	/**
+	 * Empty chunks ready to be reused.
 	 */
-	Range findSubsequence(const std::vector<VALUE>& sequence) const
+	std::vector<std::unique_ptr<chunk_t>> mArena;
+
+	std::size_t mOffset;	///< index of the first event in the first chunk (events before it were erased)
+	std::size_t mSize;
+
+	static std::unique_ptr<chunk_t> createChunk()
 	{
-		if (sequence.empty()) {
-			throw std::runtime_error("Empty sequence given as needle for search.");
+		auto chunk = std::make_unique<chunk_t>();
+		if constexpr (SPLIT) {
+			chunk->times = std::make_unique<TIME[]>(CHUNK);
+			chunk->values = std::make_unique<VALUE[]>(CHUNK);
 		}
-
-		if (empty()) {
-			return Range(0, 0);
+		else {
+			chunk->reserve(CHUNK);
 		}
+		return chunk;
+	}
+
+	static std::size_t chunkSize(const chunk_t& chunk)
+	{
+		if constexpr (SPLIT) {
+			return chunk.size;
+		}
+		else {
+			return chunk.size();
+		}
+	}
+
+	/**
+	 * Move chunks [0, count) into the arena.
+	 */
+	void releaseChunks(std::size_t count)
+	{
+		for (std::size_t i = 0; i < count; ++i) {
+			if constexpr (SPLIT) {
+				if constexpr (!std::is_trivially_destructible_v<VALUE>) {
+					for (std::size_t j = 0; j < mChunks[i]->size; ++j) {
+						mChunks[i]->values[j] = VALUE(); // release memory held by the values
+					}
+				}
+				mChunks[i]->size = 0;
+			}
+			else {
+				mChunks[i]->clear();
+			}
+			mArena.push_back(std::move(mChunks[i]));
+		}
+		mChunks.erase(mChunks.begin(), mChunks.begin() + count);
+	}
+
+	chunk_t& chunkOf(std::size_t idx) const
+	{
+		return *mChunks[(mOffset + idx) / CHUNK];
+	}
+
+public:
+	ChunkedEventStorage() : mOffset(0), mSize(0) {}
+
+	std::size_t size() const
+	{
+		return mSize;
+	}
+
+	bool empty() const
+	{
+		return mSize == 0;
+	}
+
+	const_reference operator[](std::size_t idx) const
+	{
+		if constexpr (SPLIT) {
+			return Event(time(idx), value(idx));
+		}
+		else {
+			return chunkOf(idx)[(mOffset + idx) % CHUNK];
+		}
+	}
+
+	const_reference front() const
+	{
+		return (*this)[0];
+	}
+
+	const_reference back() const
+	{
+		return (*this)[mSize - 1];
+	}
+
+	TIME& time(std::size_t idx)
+	{
+		if constexpr (SPLIT) {
+			return chunkOf(idx).times[(mOffset + idx) % CHUNK];
+		}
+		else {
+			return chunkOf(idx)[(mOffset + idx) % CHUNK].time;
+		}
+	}
+
+	const TIME& time(std::size_t idx) const
+	{
+		return const_cast<ChunkedEventStorage*>(this)->time(idx);
+	}
+
+	VALUE& value(std::size_t idx)
+	{
+		if constexpr (SPLIT) {
+			return chunkOf(idx).values[(mOffset + idx) % CHUNK];
+		}
+		else {
+			return chunkOf(idx)[(mOffset + idx) % CHUNK].value;
+		}
+	}
+
+	const VALUE& value(std::size_t idx) const
+	{
+		return const_cast<ChunkedEventStorage*>(this)->value(idx);
+	}
+
+	void emplace_back(TIME time, VALUE value)
+	{
+		if (mChunks.empty() || chunkSize(*mChunks.back()) == CHUNK) {
+			if (mArena.empty()) {
+				mChunks.push_back(createChunk());
+			}
+			else {
+				mChunks.push_back(std::move(mArena.back()));
+				mArena.pop_back();
+			}
+		}
+
+		if constexpr (SPLIT) {
+			auto& chunk = *mChunks.back();
+			chunk.times[chunk.size] = time;
+			chunk.values[chunk.size] = std::move(value);
+			++chunk.size;
+		}
+		else {
+			mChunks.back()->emplace_back(time, std::move(value));
+		}
+		++mSize;
+	}
+
+	/**
+	 * Insert an event before given index (subsequent events are moved, so it takes linear time).
+	 */
+	void insert(std::size_t idx, TIME time, VALUE value)
+	{
+		emplace_back(time, value); // makes room at the end
+		for (std::size_t i = mSize - 1; i > idx; --i) {
+			this->time(i) = this->time(i - 1);
+			this->value(i) = std::move(this->value(i - 1));
+		}
+		this->time(idx) = time;
+		this->value(idx) = std::move(value);
+	}
+
+	/**
+	 * Remove given number of events from the beginning (chunks that become empty are returned to the arena).
+	 */
+	void eraseFront(std::size_t count)
+	{
+		count = std::min(count, mSize);
+		mOffset += count;
+		mSize -= count;
+		if (mSize == 0) {
+			clear();
+			return;
+		}
+		releaseChunks(mOffset / CHUNK);
+		mOffset %= CHUNK;
+	}
+
+	void clear()
+	{
+		releaseChunks(mChunks.size());
+		mOffset = mSize = 0;
+	}
+
+	/**
+	 * Make sure that given number of events fits in without allocation (allocates empty chunks into the arena).
+	 */
+	void reserve(std::size_t capacity)
+	{
+		std::size_t chunks = (mOffset + capacity + CHUNK - 1) / CHUNK;
+		while (mChunks.size() + mArena.size() < chunks) {
+			mArena.push_back(createChunk());
+		}
+	}
+
+	/**
+	 * Number of events that fit in without allocation.
+	 */
+	std::size_t capacity() const
+	{
+		return (mChunks.size() + mArena.size()) * CHUNK - mOffset;
+	}
+
+	/**
+	 * Bytes allocated for the events including the arena (memory owned by the values themselves is not included).
+	 */
+	std::size_t memoryUsage() const
+	{
+		std::size_t eventSize = SPLIT ? sizeof(TIME) + sizeof(VALUE) : sizeof(Event);
+		std::size_t chunks = mChunks.size() + mArena.size();
+		return chunks * (CHUNK * eventSize + sizeof(chunk_t))
+			+ (mChunks.capacity() + mArena.capacity()) * sizeof(std::unique_ptr<chunk_t>);
+	}
+};
+
+
+/**
+ * A container of time-marked events. It provides a similar interface like vector
+ * (which is also used as internal storage by default) and additionaly some analytical functions that
+ * might help with behavioral assertions.
+ * @tparam VALUE the inner value of each event (e.g., a state of a pin)
+ * @tparam TIME type used for logical time stamps
+ * @tparam STORAGE policy that stores the events (VectorEventStorage or ChunkedEventStorage)
+ */
+template<typename VALUE, typename TIME = logtime_t, typename STORAGE = VectorEventStorage<VALUE, TIME>>
+class TimeSeries : public TimeSeriesBase<TIME>, public EventConsumer<VALUE, TIME>
+{
+public:
+	using Range = typename TimeSeriesBase<TIME>::Range;
+	using DeltaStats = typename TimeSeriesBase<TIME>::DeltaStats;
+	using Event = TimeSeriesEvent<VALUE, TIME>;
+	using const_reference = typename STORAGE::const_reference;
+
+	static_assert(std::is_same_v<typename STORAGE::Event, Event>, "The storage must hold events of the series.");
+
+protected:
+	/**
+	 * Internal data structure that actually holds the events.
+	 * The events are sorted by their time in ascending order.
+	 * Events with the same time may be in any order.
+	 */
+	STORAGE mEvents;
+
+	/**
+	 * Whether the running statistics of deltas are maintained (see trackDeltaStats()).
+	 */
+	bool mTrackDeltaStats = false;
+
+	/**
+	 * Running statistics of deltas between all subsequent events (valid only if tracked).
+	 */
+	typename TimeSeriesBase<TIME>::DeltaStats mDeltaStats;
+
+	void doAddEvent(TIME time, VALUE value) override
+	{
+		if (!this->mEvents.empty() && this->mEvents.time(mEvents.size() - 1) > time) {
+			throw std::runtime_error("Unable to add event that violates causality.");
+		}
+
+		if (mTrackDeltaStats && !mEvents.empty()) {
+			mDeltaStats.add(time - mEvents.time(mEvents.size() - 1));
+		}
+		mEvents.emplace_back(time, value);
+		EventConsumer<VALUE, TIME>::doAddEvent(time, value);
+	}
+
+	void doClear() override
+	{
+		mEvents.clear();
+		mDeltaStats = typename TimeSeriesBase<TIME>::DeltaStats();
+		EventConsumer<VALUE, TIME>::doClear();
+	}
+
+	/**
+	 * Stop maintaining the running statistics (derived classes call this when they modify the events directly).
+	 */
+	void invalidateDeltaStats()
+	{
+		mTrackDeltaStats = false;
+	}
+
+	/**
+	 * Clamp the range to the events of the series.
+	 */
+	Range clampRange(const Range& range) const
+	{
+		return Range(std::min(range.start(), mEvents.size()), std::min(range.end(), mEvents.size()));
+	}
+
+	/**
+	 * Binary search for the first index in [from, size()) whose event time does not satisfy the predicate
+	 * (the predicate must be true for a prefix of the events).
+	 */
+	template<typename PRED>
+	std::size_t partitionPointByTime(std::size_t from, PRED&& pred) const
+	{
+		std::size_t lo = from, hi = mEvents.size();
+		while (lo < hi) {
+			std::size_t mid = lo + (hi - lo) / 2;
+			if (pred(mEvents.time(mid))) {
+				lo = mid + 1;
+			}
+			else {
+				hi = mid;
+			}
+		}
+		return lo;
+	}
+
+	/**
+	 * Run Knuth-Morris-Pratt automaton over event values in given range of indices.
+	 * @param sequence the needle (must not be empty)
+	 * @param range of indices where the search is performed
+	 * @param callback invoked for every index with the length of the longest prefix of the sequence
+	 *                 that ends at that index (if the length is not zero), returns false to stop the search
+	 */
+	template<typename CALLBACK>
+	void matchSequence(const std::vector<VALUE>& sequence, const Range& range, CALLBACK&& callback) const
+	{
+		// failure function (length of the longest proper prefix which is also a suffix for every prefix)
+		std::vector<std::size_t> failure(sequence.size(), 0);
+		for (std::size_t i = 1, len = 0; i < sequence.size(); ++i) {
+			while (len > 0 && !(sequence[i] == sequence[len])) {
+				len = failure[len - 1];
+			}
+			if (sequence[i] == sequence[len]) {
+				++len;
+			}
+			failure[i] = len;
+		}
+
+		std::size_t end = std::min(range.end(), size());
+		for (std::size_t idx = range.start(), len = 0; idx < end; ++idx) {
+			if (len == sequence.size()) {
+				len = failure[len - 1]; // continue after a complete match (occurences may overlap)
+			}
+			while (len > 0 && !(mEvents.value(idx) == sequence[len])) {
+				len = failure[len - 1];
+			}
+			if (mEvents.value(idx) == sequence[len]) {
+				++len;
+			}
+			if (len > 0 && !callback(idx, len)) {
+				return;
+			}
+		}
+	}
+
+public:
+	// interface that simulates deque
+
+	std::size_t size() const override
+	{
+		return mEvents.size();
+	}
+
+	bool empty() const override
+	{
+		return mEvents.empty();
+	}
+
+	TIME getEventTime(std::size_t idx) const override
+	{
+		return mEvents.time(idx);
+	}
+
+	std::string getEventAsString(std::size_t idx) const override
+	{
+		return TimeSeriesBase<TIME>::convert(mEvents.value(idx));
+	}
+
+	const_reference operator[](std::size_t idx) const
+	{
+		return mEvents[idx];
+	}
+
+	const_reference at(std::size_t idx) const
+	{
+		return mEvents[idx];
+	}
+
+	/**
+	 * Direct access to the time of an event (that works also with split storage).
+	 */
+	TIME timeAt(std::size_t idx) const
+	{
+		return mEvents.time(idx);
+	}
+
+	/**
+	 * Direct access to the value of an event (that works also with split storage).
+	 */
+	const VALUE& valueAt(std::size_t idx) const
+	{
+		return mEvents.value(idx);
+	}
+
+	/**
+	 * Reserve space for given number of events (e.g., a hint derived from the length of the simulation).
+	 */
+	void reserve(std::size_t capacity)
+	{
+		mEvents.reserve(capacity);
+	}
+
+	std::size_t capacity() const
+	{
+		return mEvents.capacity();
+	}
+
+	/**
+	 * Bytes allocated by the storage of the events (memory owned by the values, e.g., strings, is not included).
+	 */
+	std::size_t memoryUsage() const
+	{
+		return mEvents.memoryUsage();
+	}
+
+	const_reference front() const
+	{
+		if (empty()) {
+			throw std::runtime_error("The time series is empty. Unable to reach first item.");
+		}
+		return mEvents.front();
+	}
+
+	const_reference back() const
+	{
+		if (empty()) {
+			throw std::runtime_error("The time series is empty. Unable to reach last item.");
+		}
+		return mEvents.back();
+	}
+
+	/**
+	 * Find the first event which is not older than given time (binary search).
+	 * @return index of the event (size() if all events are older)
+	 */
+	std::size_t lowerBoundByTime(TIME time) const
+	{
+		return partitionPointByTime(0, [&](TIME t) { return t < time; });
+	}
+
+	/**
+	 * Find the first event which is newer than given time (binary search).
+	 * @return index of the event (size() if no event is newer)
+	 */
+	std::size_t upperBoundByTime(TIME time) const
+	{
+		return partitionPointByTime(0, [&](TIME t) { return t <= time; });
+	}
+
+	/**
+	 * Get the range of indices of all events within given time interval [from, to).
+	 * The range may be passed to any analytical function, so it operates only on the selected events.
+	 */
+	Range rangeByTime(TIME from, TIME to) const
+	{
+		std::size_t start = lowerBoundByTime(from);
+		return Range(start, from < to ? lowerBoundByTime(to) : start);
+	}
+
+
+	/*
+	 * Analytical functions
+	 */
+
+	/**
+	 * Get the difference between first and last event in given range.
+	 */
+	TIME getRangeDuration(const Range& range) const
+	{
+		if (range.length() < 2) {
+			return 0.0;
+		}
+		else {
+			return mEvents.time(range.end() - 1) - mEvents.time(range.start());
+		}
+	}
+
+	/**
+	 * Start (or stop) maintaining running statistics of deltas between subsequent events, so the statistics
+	 * of the entire series are available in O(1). The statistics of already recorded events are computed now.
+	 */
+	void trackDeltaStats(bool enable = true)
+	{
+		mTrackDeltaStats = enable;
+		if (enable) {
+			mDeltaStats = getDeltasStats(Range(0, mEvents.size()));
+		}
+	}
+
+	/**
+	 * Compute statistics of delays between subsequent events in given range.
+	 * If the range covers the entire series and the statistics are tracked, no computation is necessary.
+	 */
+	DeltaStats getDeltasStats(const Range& range) const
+	{
+		Range r = clampRange(range);
+		if (mTrackDeltaStats && r.start() == 0 && r.end() == mEvents.size()) {
+			return mDeltaStats;
+		}
+
+		DeltaStats stats;
+		for (std::size_t i = r.start() + 1; i < r.end(); ++i) {
+			stats.add(mEvents.time(i) - mEvents.time(i - 1));
+		}
+		return stats;
+	}
+
+	/**
+	 * Compute statistics of delays between subsequent events of the entire series.
+	 */
+	DeltaStats getDeltasStats() const
+	{
+		return getDeltasStats(Range(0, mEvents.size()));
+	}
+
+	/**
+	 * Compute statistics of deltas in a window sliding over the events of given range. The statistics are updated
+	 * incrementally (each event enters and leaves the window once, unless an outlier leaves the window),
+	 * the extremes are maintained by monotonic queues.
+	 * @param windowEvents number of events in each window (i.e., windowEvents - 1 deltas)
+	 * @param range of events over which the window slides
+	 * @param callback invoked with the range of each window and its statistics
+	 */
+	template<typename CALLBACK>
+	void forEachDeltasWindow(std::size_t windowEvents, const Range& range, CALLBACK&& callback) const
+	{
+		Range r = clampRange(range);
+		if (windowEvents < 2 || r.length() < windowEvents) {
+			return;
+		}
+
+		DeltaStats stats;
+		std::deque<std::size_t> minQueue, maxQueue; // indices of delta end events with monotonic deltas
+		auto delta = [&](std::size_t i) { return mEvents.time(i) - mEvents.time(i - 1); };
+
+		for (std::size_t i = r.start() + 1; i < r.end(); ++i) {
+			stats.add(delta(i));
+			while (!minQueue.empty() && delta(minQueue.back()) >= delta(i)) minQueue.pop_back();
+			minQueue.push_back(i);
+			while (!maxQueue.empty() && delta(maxQueue.back()) <= delta(i)) maxQueue.pop_back();
+			maxQueue.push_back(i);
+
+			if (i + 1 < r.start() + windowEvents) {
+				continue; // the first window is not complete yet
+			}
+			std::size_t windowStart = i + 1 - windowEvents;
+
+			if (windowStart > r.start()) {
+				// the delta that left the window is removed, if it was an outlier, the cancellation would ruin
+				// the precision of the remaining deltas, so the window statistics are recomputed instead
+				double sumSquares = stats.variance() * (double)stats.count();
+				stats.remove(delta(windowStart));
+				if (stats.variance() * (double)stats.count() < sumSquares * 1e-6) {
+					stats = DeltaStats();
+					for (std::size_t j = windowStart + 1; j <= i; ++j) {
+						stats.add(delta(j));
+					}
+				}
+			}
+			while (minQueue.front() <= windowStart) minQueue.pop_front();
+			while (maxQueue.front() <= windowStart) maxQueue.pop_front();
+			stats.setMinMax(delta(minQueue.front()), delta(maxQueue.front()));
+
+			callback(Range(windowStart, i + 1), stats);
+		}
+	}
+
+	/**
+	 * Examine event time stamps in given range and return the mean delay between subsequent events.
+	 */
+	double getDeltasMean(const Range& range) const
+	{
+		return getDeltasStats(range).mean();
+	}
+
+	/**
+	 * Examine event time stamps of the entire series and return the mean delay between subsequent events.
+	 */
+	double getDeltasMean() const
+	{
+		return getDeltasMean(Range(0, mEvents.size()));
+	}
+
+	/**
+	 * Examine event time stamps in given range and return the std. deviation
+	 * of delays between subsequent events.
+	 */
+	double getDeltasDeviation(const Range& range) const
+	{
+		return getDeltasStats(range).deviation();
+	}
+
+	/**
+	 * Examine event time stamps of the entire series and return the std. deviation
+	 * of delays between subsequent events.
+	 */
+	double getDeltasDeviation() const
+	{
+		return getDeltasDeviation(Range(0, mEvents.size()));
+	}
+
+	/**
+	 * Tries to find the first occurence of a continuous sequence in the time series (Knuth-Morris-Pratt, O(N+K)).
+	 * If no such sequence exists, tries to return the longest prefix.
+	 * @param sequence of event values to search for
+	 * @param range of indices where the search is performed (the whole series by default)
+	 * @return range of indiced where the occurence was found (empty range if nothing was found)
+	 */
+	Range findSubsequence(const std::vector<VALUE>& sequence, const Range& range = Range()) const
+	{
+		if (sequence.empty()) {
+			throw std::runtime_error("Empty sequence given as needle for search.");
+		}
+
+		Range bestFit(0, 0);
+		matchSequence(sequence, range, [&](std::size_t idx, std::size_t len) {
+			if (len > bestFit.length()) {
+				bestFit.set(idx + 1 - len, idx + 1);
+			}
+			return len < sequence.size(); // stop at the first complete match
+		});
+
+		return bestFit;
+	}
+
+	/**
+	 * Tries to find the longest repetition of given sequence as a continuous subsequence.
+	 * If no such sequence exists, tries to return the longest prefix.
+	 * @param sequence of event values to search for
+	 * @param range of indices where the search is performed (the whole series by default)
+	 * @return range of indiced where the occurence was found (empty range if nothing was found)
+	 */
+	Range findRepetitiveSubsequence(const std::vector<VALUE>& sequence, const Range& range = Range()) const
+	{
+		if (sequence.empty()) {
+			throw std::runtime_error("Empty sequence given as needle for search.");
+		}
+
+		std::size_t end = std::min(range.end(), size());
+		if (range.start() >= end || sequence.size() > end - range.start()) {
+			return Range(0, 0); // sequence is longer than the searched part of the time series (no possible match)
+		}
+
+		// true for each index where the search sequence starts
+		std::vector<bool> isStartingPoint(end + 1, false);
+		matchSequence(sequence, range, [&](std::size_t idx, std::size_t len) {
+			if (len == sequence.size()) {
+				isStartingPoint[idx + 1 - len] = true;
+			}
+			return true;
+		});
+
+		// lengths of repetitions starting at each index are computed backwards, so each index is visited once
+		std::vector<std::size_t> repetitionLength(end + sequence.size() + 1, 0);
+		Range bestFit(0, 0);
+		for (std::size_t start = end; start-- > range.start(); ) {
+			if (isStartingPoint[start]) {
+				repetitionLength[start] = sequence.size() + repetitionLength[start + sequence.size()];
+				if (repetitionLength[start] >= bestFit.length()) {
+					bestFit.set(start, start + repetitionLength[start]); // the first one of the longest is kept
+				}
+			}
+		}
+
+		return bestFit;
+	}
+
+
+	/**
+	 * Tries to find the first occurence of selected subsequence usign eager algorithm
+	 * (i.e., some of the items in this sequence may be skipped).
+	 * TODO: this method should accept also vector or VALUE (let's fix it in the future)
+	 * @param sequence of event values to search for (a time series, but the times are ignored)
+	 * @param mapping output vector, for each event in sequence, it will hold an index refering to *this
+	 *                partial mapping is stored here even if the whole sequence could not have been matched
+	 * @return true if the whole sequence was matched
+	 */
+	bool findSelectedSubsequence(const TimeSeries& sequence, std::vector<std::size_t> &mapping) const
+	{
+		if (sequence.empty()) {
+			throw std::runtime_error("Empty sequence given as needle for search.");
+		}
+
+		mapping.clear();
+		if (empty()) {
+			return false;
+		}
+
+		std::size_t idx = 0;
+		for (std::size_t si = 0; si < sequence.size(); ++si) {
+			while (idx < size() && sequence.valueAt(si) != mEvents.value(idx)) {
+				++idx;
+			}
+
+			if (idx < size()) {
+				mapping.push_back(idx);
+			}
+			else break;
+		}
+	
+		return mapping.size() == sequence.size();
+	}
+
+
+	/**
+	 * Compare this time series with another one of the same type. Return total amount of discrete time
+	 * (from given range) the values from events differ.
+	 * @param timeSeries another time series object with which this is compared
+	 * @param range time range of interest
+	 * @param initialValue the value expected (for both series) before the first event
+	 */
+	TIME compare(const TimeSeries &timeSeries, const Range &range, const VALUE& initialValue) const
+	{
+		TIME res = 0;
+		
+		const TimeSeries* ts[]{ this, &timeSeries };
+		VALUE lastValue[]{ initialValue, initialValue };
+		std::size_t idx[]{ 0, 0 };
+
+		// skip parts of time series which are before the range (update starting values)
+		for (std::size_t t = 0; t < 2; ++t) {
+			idx[t] = ts[t]->upperBoundByTime((TIME)range.start());
+			if (idx[t] > 0) {
+				lastValue[t] = ts[t]->valueAt(idx[t] - 1);
+			}
+		}
+
+		TIME lastTime = range.start();
+		while (lastTime < range.end() && (idx[0] < ts[0]->size() || idx[1] < ts[1]->size())) {
+			// index of the series which has next event sooner
+			logtime_t nextTs[2];
+			for (std::size_t t = 0; t < 2; ++t) {
+				nextTs[t] = idx[t] < ts[t]->size() ? ts[t]->timeAt(idx[t]) : std::numeric_limits<logtime_t>::max();
+			}
+			std::size_t next = nextTs[0] <= nextTs[1] ? 0 : 1;
+
+			if (lastValue[0] != lastValue[1]) {
+				// during the time period from last time to now the values were different -> add this period to accumulator
+				res += std::min(nextTs[next], range.end()) - lastTime;
+			}
+
+			// update the local states
+			lastTime = nextTs[next];
+			lastValue[next] = ts[next]->valueAt(idx[next]);
+			++idx[next];
+		}
+
+		// if the values differ at the end, tak it also into account
+		if (lastTime < range.end() && lastValue[0] != lastValue[1]) {
+			res += range.end() - lastTime;
+		}
+
+		return res;
+	}
+};
+
+
+/**
+ * Extension of time series so it can hold "future" events. Future events are registered but not emitted
+ * to the next item in the chain until such action is triggered by time advancing or consumig a regular event.
+ */
+template<typename VALUE, typename TIME = logtime_t, typename STORAGE = VectorEventStorage<VALUE, TIME>>
+class FutureTimeSeries : public TimeSeries<VALUE, TIME, STORAGE>
+{
+private:
+	using base_t = TimeSeries<VALUE, TIME, STORAGE>;
+
+	/**
+	 * Index refering just after the last item that was already consumed (emitted to the next consumer in chain).
+	 */
+	std::size_t mLastConsumed;
+
+	/**
+	 * If false, the consumed events are dropped (so only the future events are held in the series).
+	 */
+	bool mKeepHistory;
+
+	/**
+	 * Minimal number of consumed events that triggers the compaction (when the history is not kept).
+	 */
+	static constexpr std::size_t COMPACTION_THRESHOLD = 1024;
+
+	/**
+	 * Emit events which has not yet been emited up to given timestamp (inclusive).
+	 */
+	void consumeEventsUntil(TIME time)
+	{
+		while (mLastConsumed < this->mEvents.size() && this->mEvents.time(mLastConsumed) <= time) {
+			this->nextAddEvent(this->mEvents.time(mLastConsumed), this->mEvents.value(mLastConsumed));
+			++mLastConsumed;
+		}
+
+		// the consumed prefix is removed only when it dominates the series, so the compaction is amortized O(1)
+		if (!mKeepHistory && mLastConsumed >= COMPACTION_THRESHOLD && mLastConsumed * 2 >= this->mEvents.size()) {
+			compact();
+		}
+	}
+
+protected:
+	void doAddEvent(TIME time, VALUE value) override
+	{
+		consumeEventsUntil(time);
+		addFutureEvent(time, value); // this will actually take care of placing the event at the right position
+		EventConsumer<VALUE, TIME>::doAddEvent(time, value);	// yes, we skip the TimeSeries implementation
+	}
+
+
+	void doAdvanceTime(TIME time) override
+	{
+		consumeEventsUntil(time);
+		base_t::doAdvanceTime(time);
+	}
+
+	void doClear() override
+	{
+		mLastConsumed = 0;
+		base_t::doClear();
+	}
+
+	TIME doGetDeadline() const override
+	{
+		// the next event waiting to be emitted is our deadline
+		TIME deadline = base_t::doGetDeadline();
+		if (mLastConsumed < this->mEvents.size()) {
+			deadline = std::min(deadline, this->mEvents.time(mLastConsumed));
+		}
+		return deadline;
+	}
+
+public:
+	/**
+	 * @param keepHistory if false, events already emitted to the next consumer are (eventually) dropped
+	 */
+	FutureTimeSeries(bool keepHistory = true) : mLastConsumed(0), mKeepHistory(keepHistory) {}
+
+	/**
+	 * Add event that is considered to be in the future. It is not passed along through the event consumer chain,
+	 * until the time is advanced enough using advanceTime method. Future events may actually be inserted in random order.
+	 * The only condition is that future event is not older than last real event.
+	 */
+	void addFutureEvent(TIME time, VALUE value)
+	{
+		if (this->mLastTime > time) {
+			throw std::runtime_error("Unable to add event that violates causality.");
+		}
+
+		this->invalidateDeltaStats(); // future events are not tracked
+		if (this->mEvents.empty() || this->mEvents.time(this->mEvents.size() - 1) <= time) {
+			this->mEvents.emplace_back(time, value); // the most common case, events come in order
+			return;
+		}
+
+		// find the right place among the future events (after all events with the same time)
+		std::size_t idx = this->partitionPointByTime(mLastConsumed, [&](TIME t) { return t <= time; });
+		this->mEvents.insert(idx, time, value);
+	}
+
+	/**
+	 * Drop all events that were already emitted to the next consumer in chain.
+	 */
+	void compact()
+	{
+		this->mEvents.eraseFront(mLastConsumed);
+		mLastConsumed = 0;
+	}
+
+	/**
+	 * Number of events that were not emitted to the next consumer yet.
+	 */
+	std::size_t pendingCount() const
+	{
+		return this->mEvents.size() - mLastConsumed;
+	}
+
+	/**
+	 * Add constant timing skew to all event times.
+	 */
+	void addTimingSkew(TIME skew)
+	{
+		for (std::size_t i = 0; i < this->mEvents.size(); ++i) {
+			this->mEvents.time(i) += skew;
+		}
+	}
+};
+
+
+/**
+ * Queue of future events which are emitted to the next consumer in chain when the time advances enough.
+ * Unlike FutureTimeSeries, the events are released as soon as they are emitted, so the memory holds only
+ * pending events. Events inserted in chronological order are kept in a FIFO (O(1) insertion and removal),
+ * out-of-order events are kept in a binary heap (O(log n) insertion and removal).
+ * Events with the same time are emitted in the order of their insertion.
+ */
+template<typename VALUE, typename TIME = logtime_t>
+class FutureEventsQueue : public EventConsumer<VALUE, TIME>
+{
+private:
+	struct Event
+	{
+	public:
+		TIME time;
+		std::uint64_t seq;	///< insertion sequence number (ensures stable ordering of events with the same time)
+		VALUE value;
+
+		Event(TIME t, std::uint64_t s, VALUE v) : time(t), seq(s), value(std::move(v)) {}
+	};
+
+	/**
+	 * Events inserted in chronological order.
+	 */
+	std::deque<Event> mOrdered;
 
-		// simple N x K comparison (may be replaced with Rabin-Karp or Knuth-Morris-Pratt in the future)
-		Range bestFit(0, 0);
-		for (std::size_t start = 0; start < size() - bestFit.length(); ++start) {
-			std::size_t len = 0;
-			while (len < sequence.size() && sequence[len] == mEvents[start + len].value) {
-				++len;
-			}
-			if (len > bestFit.length()) {
-				bestFit.set(start, start + len);
-			}
-		}
+	/**
+	 * Heap of events that were inserted out of order (the earliest one is on the top).
+	 */
+	std::vector<Event> mLate;
 
-		return bestFit;
+	std::uint64_t mNextSeq;
+
+	/**
+	 * Indices of the heap nodes that are candidates for the next late event visited by peekEvents()
+	 * (a member, so the memory is reused by all lookaheads).
+	 */
+	mutable std::vector<std::size_t> mPeekCandidates;
+
+	/**
+	 * Comparator of the heap (the heap keeps the "greatest" element on top, so the ordering is reversed).
+	 */
+	static bool later(const Event& e1, const Event& e2)
+	{
+		return e1.time > e2.time || (e1.time == e2.time && e1.seq > e2.seq);
 	}
 
 	/**
-	 * Tries to find the longest repetition of given sequence as a continuous subsequence.
-	 * If no such sequence exists, tries to return the longest prefix.
-	 * @param sequence of event values to search for
-	 * @return range of indiced where the occurence was found (empty range if nothing was found)
+	 * Get the earliest pending event (the queue must not be empty).
 	 */
-	Range findRepetitiveSubsequence(const std::vector<VALUE>& sequence) const
+	const Event& front() const
 	{
-		if (sequence.empty()) {
-			throw std::runtime_error("Empty sequence given as needle for search.");
+		if (mLate.empty() || (!mOrdered.empty() && !later(mOrdered.front(), mLate.front()))) {
+			return mOrdered.front();
 		}
+		return mLate.front();
+	}
 
-		if (sequence.size() > size()) {
-			return Range(0, 0); // sequence is longer than the current time series (no possible match)
+	/**
+	 * Remove the earliest pending event and return it.
+	 */
+	Event popFront()
+	{
+		if (mLate.empty() || (!mOrdered.empty() && !later(mOrdered.front(), mLate.front()))) {
+			Event e = std::move(mOrdered.front());
+			mOrdered.pop_front();
+			return e;
 		}
 
-		std::vector<bool> isStartingPoint(mEvents.size());	// true for each index where a the search sequence starts
-		std::vector<std::size_t> startingPoints;			// list of all indices (ordered) where a starting point is
-
-		// simple N x K comparison (may be replaced with Rabin-Karp or Knuth-Morris-Pratt in the future)
-		for (std::size_t start = 0; start <= size() - sequence.size(); ++start) {
-			std::size_t len = 0;
-			while (len < sequence.size() && sequence[len] == mEvents[start + len].value) {
-				++len;
-			}
+		std::pop_heap(mLate.begin(), mLate.end(), later);
+		Event e = std::move(mLate.back());
+		mLate.pop_back();
+		return e;
+	}
 
-			bool entireSequenceMatched = (len == sequence.size());
-			isStartingPoint[start] = entireSequenceMatched;
-			if (entireSequenceMatched) {
-				startingPoints.push_back(start);
-			}
+	/**
+	 * Emit events up to given timestamp (inclusive).
+	 */
+	void consumeEventsUntil(TIME time)
+	{
+		while (!empty() && front().time <= time) {
+			Event e = popFront(); // removed before emitting, so the chain may enqueue new events safely
+			this->nextAddEvent(e.time, std::move(e.value));
 		}
+	}
 
-		// assemble the longest repetitive sequence from collected starting points
-		Range bestFit(0, 0);
-		for (auto start : startingPoints) {
-			std::size_t len = 0;
-			while (start + len < size() && isStartingPoint[start + len]) {
-				len += sequence.size();
-			}
-			if (len > bestFit.length()) {
-				bestFit.set(start, start + len);
-			}
-		}
+protected:
+	void doAddEvent(TIME time, VALUE value) override
+	{
+		consumeEventsUntil(time);
+		EventConsumer<VALUE, TIME>::doAddEvent(time, std::move(value));
+	}
 
-		return bestFit;
+	void doAdvanceTime(TIME time) override
+	{
+		consumeEventsUntil(time);
+		EventConsumer<VALUE, TIME>::doAdvanceTime(time);
+	}
+
+	void doClear() override
+	{
+		mOrdered.clear();
+		mLate.clear();
+		EventConsumer<VALUE, TIME>::doClear();
+	}
+
+	TIME doGetDeadline() const override
+	{
+		// the next event waiting to be emitted is our deadline
+		TIME deadline = EventConsumer<VALUE, TIME>::doGetDeadline();
+		if (!empty()) {
+			deadline = std::min(deadline, front().time);
+		}
+		return deadline;
 	}
 
+public:
+	FutureEventsQueue() : mNextSeq(0) {}
 
 	/**
-	 * Tries to find the first occurence of selected subsequence usign eager algorithm
-	 * (i.e., some of the items in this sequence may be skipped).
-	 * TODO: this method should accept also vector or VALUE (let's fix it in the future)
-	 * @param sequence of event values to search for (a time series, but the times are ignored)
-	 * @param mapping output vector, for each event in sequence, it will hold an index refering to *this
-	 *                partial mapping is stored here even if the whole sequence could not have been matched
-	 * @return true if the whole sequence was matched
+	 * Add event that is considered to be in the future. It is not passed along through the event consumer chain,
+	 * until the time is advanced enough. Future events may be inserted in random order, but they must not be older
+	 * than the last time advance.
 	 */
-	bool findSelectedSubsequence(const TimeSeries<VALUE, TIME>& sequence, std::vector<std::size_t> &mapping) const
+	void addFutureEvent(TIME time, VALUE value)
 	{
-		if (sequence.empty()) {
-			throw std::runtime_error("Empty sequence given as needle for search.");
+		if (this->mLastTime > time) {
+			throw std::runtime_error("Unable to add event that violates causality.");
 		}
 
-		mapping.clear();
-		if (empty()) {
-			return false;
+		if (mOrdered.empty() || mOrdered.back().time <= time) {
+			mOrdered.emplace_back(time, mNextSeq++, std::move(value));
+		}
+		else {
+			mLate.emplace_back(time, mNextSeq++, std::move(value));
+			std::push_heap(mLate.begin(), mLate.end(), later);
 		}
+	}
 
-		std::size_t idx = 0;
-		for (std::size_t si = 0; si < sequence.size(); ++si) {
-			while (idx < size() && sequence[si].value != mEvents[idx].value) {
-				++idx;
-			}
+	/**
+	 * Get the next late event in the order of emission by a lazy walk over the heap. The earliest candidate node
+	 * is taken and its children (node i has children 2i+1 and 2i+2 in the heap layout) become candidates.
+	 * @return null if there are no more late events
+	 */
+	const Event* nextPeekedLateEvent() const
+	{
+		auto laterNode = [this](std::size_t i1, std::size_t i2) { return later(mLate[i1], mLate[i2]); };
+		if (mPeekCandidates.empty()) {
+			return nullptr;
+		}
 
-			if (idx < size()) {
-				mapping.push_back(idx);
-			}
-			else break;
+		std::pop_heap(mPeekCandidates.begin(), mPeekCandidates.end(), laterNode);
+		std::size_t node = mPeekCandidates.back();
+		mPeekCandidates.pop_back();
+		for (std::size_t child = 2 * node + 1; child <= 2 * node + 2 && child < mLate.size(); ++child) {
+			mPeekCandidates.push_back(child);
+			std::push_heap(mPeekCandidates.begin(), mPeekCandidates.end(), laterNode);
 		}
-	
-		return mapping.size() == sequence.size();
+		return &mLate[node];
 	}
 
-
 	/**
-	 * Compare this time series with another one of the same type. Return total amount of discrete time
-	 * (from given range) the values from events differ.
-	 * @param timeSeries another time series object with which this is compared
-	 * @param range time range of interest
-	 * @param initialValue the value expected (for both series) before the first event
+	 * Visit pending events (at or after given time) in the order they will be emitted, without emitting them.
+	 * The ordered events are located by binary search and the late ones are taken from their heap lazily,
+	 * so a lookahead that visits n ordered and k late events takes O(log N + n + k log k) time
+	 * (N = number of ordered events) regardless of the total number of late events, and it does not allocate
+	 * memory once the candidates buffer is large enough.
+	 * @param from time of the first visited event
+	 * @param visitor callable (time, value) returning false to stop the lookahead
 	 */
-	TIME compare(const TimeSeries<VALUE, TIME> &timeSeries, const Range &range, const VALUE& initialValue) const
+	template<typename F>
+	void peekEvents(TIME from, F&& visitor) const
 	{
-		TIME res = 0;
-		
-		const TimeSeries<VALUE, TIME>* ts[]{ this, &timeSeries };
-		VALUE lastValue[]{ initialValue, initialValue };
-		std::size_t idx[]{ 0, 0 };
+		auto it = std::lower_bound(mOrdered.begin(), mOrdered.end(), from,
+			[](const Event& e, TIME t) { return e.time < t; });
 
-		// skip parts of time series which are before the range (update starting values)
-		for (std::size_t t = 0; t < 2; ++t) {
-			while (idx[t] < ts[t]->size() && ts[t]->at(idx[t]).time <= range.start()) {
-				lastValue[t] = ts[t]->at(idx[t]).value;
-				++idx[t];
-			}
+		mPeekCandidates.clear();
+		if (!mLate.empty()) {
+			mPeekCandidates.push_back(0); // the root of the heap
 		}
-
-		TIME lastTime = range.start();
-		while (lastTime < range.end() && (idx[0] < ts[0]->size() || idx[1] < ts[1]->size())) {
-			// index of the series which has next event sooner
-			logtime_t nextTs[2];
-			for (std::size_t t = 0; t < 2; ++t) {
-				nextTs[t] = idx[t] < ts[t]->size() ? ts[t]->at(idx[t]).time : std::numeric_limits<logtime_t>::max();
+		auto nextLate = [&]() {
+			const Event* e = nextPeekedLateEvent();
+			while (e != nullptr && e->time < from) {
+				e = nextPeekedLateEvent(); // skip the late events before the lookahead
 			}
-			std::size_t next = nextTs[0] <= nextTs[1] ? 0 : 1;
-
-			if (lastValue[0] != lastValue[1]) {
-				// during the time period from last time to now the values were different -> add this period to accumulator
-				res += std::min(nextTs[next], range.end()) - lastTime;
+			return e;
+		};
+
+		const Event* late = nextLate();
+		while (it != mOrdered.end() || late != nullptr) {
+			const Event* e = nullptr;
+			if (late == nullptr || (it != mOrdered.end() && !later(*it, *late))) {
+				e = &*it++;
+			}
+			else {
+				e = late;
+				late = nextLate();
+			}
+			if (!visitor(e->time, e->value)) {
+				return;
 			}
-
-			// update the local states
-			lastTime = nextTs[next];
-			lastValue[next] = ts[next]->at(idx[next]).value;
-			++idx[next];
 		}
+	}
 
-		// if the values differ at the end, tak it also into account
-		if (lastTime < range.end() && lastValue[0] != lastValue[1]) {
-			res += range.end() - lastTime;
-		}
+	/**
+	 * Number of events waiting to be emitted.
+	 */
+	std::size_t size() const
+	{
+		return mOrdered.size() + mLate.size();
+	}
 
-		return res;
+	bool empty() const
+	{
+		return mOrdered.empty() && mLate.empty();
 	}
 };
 
 
 /**
- * Extension of time series so it can hold "future" events. Future events are registered but not emitted
- * to the next item in the chain until such action is triggered by time advancing or consumig a regular event.
+ * Wrapper of a Pipeline stage that knows the exact (final) type of the following stage.
+ * Stages that implement the emitting hooks (addEventTo() and advanceTimeTo() templated by the consumer they emit to)
+ * get the following stage passed in directly, so the hop between the stages is a static call that may be inlined.
+ * Other stages (and the last one, NEXT = void) are called statically, but they emit through the dynamic chain.
+ * The addEvent() and advanceTime() of the base are hidden, so the previous stage enters this one without virtual
+ * dispatch as well. The links made by the pipeline must not be changed, since the following stage is cast
+ * to its static type.
+ * @tparam STAGE type of the wrapped event consumer
+ * @tparam NEXT type of the following stage (void for the last stage)
  */
-template<typename VALUE, typename TIME = logtime_t>
-class FutureTimeSeries : public TimeSeries<VALUE, TIME>
+template<typename STAGE, typename NEXT = void>
+class PipelineStage final : public STAGE
 {
+public:
+	using value_t = typename STAGE::value_t;
+	using timestamp_t = typename STAGE::timestamp_t;
+
 private:
+	// the following stage is attached to the sprout of forked consumers, to the regular chain otherwise
+	template<typename S>
+	static auto target(S& stage, int) -> decltype(stage.sproutConsumer())
+	{
+		return stage.sproutConsumer();
+	}
+
+	template<typename S>
+	static auto target(S& stage, long) -> decltype(stage.nextConsumer())
+	{
+		return stage.nextConsumer();
+	}
+
+	template<typename N = NEXT>
+	std::enable_if_t<!std::is_void_v<N>, N*> nextStage()
+	{
+		return static_cast<N*>(target(*this, 0));
+	}
+
+	template<typename N = NEXT, typename S = PipelineStage>
+	auto dispatchAddEvent(timestamp_t time, value_t value, int)
+		-> decltype(std::declval<S&>().addEventTo(std::declval<S&>().template nextStage<N>(), time, value), void())
+	{
+		this->addEventTo(nextStage(), time, std::move(value));
+	}
+
+	void dispatchAddEvent(timestamp_t time, value_t value, long)
+	{
+		STAGE::doAddEvent(time, std::move(value));
+	}
+
+	template<typename N = NEXT, typename S = PipelineStage>
+	auto dispatchAdvanceTime(timestamp_t time, int)
+		-> decltype(std::declval<S&>().advanceTimeTo(std::declval<S&>().template nextStage<N>(), time), void())
+	{
+		this->advanceTimeTo(nextStage(), time);
+	}
+
+	void dispatchAdvanceTime(timestamp_t time, long)
+	{
+		STAGE::doAdvanceTime(time);
+	}
+
+protected:
+	void doAddEvent(timestamp_t time, value_t value) override
+	{
+		dispatchAddEvent(time, std::move(value), 0);
+	}
+
+	void doAdvanceTime(timestamp_t time) override
+	{
+		dispatchAdvanceTime(time, 0);
+	}
+
+public:
+	using STAGE::STAGE;
+	PipelineStage() = default;
+	PipelineStage(STAGE&& stage) : STAGE(std::move(stage)) {}
+	PipelineStage(const STAGE& stage) : STAGE(stage) {}
+
 	/**
-	 * Index refering just after the last item that was already consumed (emitted to the next consumer in chain).
+	 * Same as EventConsumer::addEvent(), but the stage is processed without virtual dispatch.
 	 */
-	std::size_t mLastConsumed;
+	void addEvent(timestamp_t time, value_t value)
+	{
+		if (time < this->mLastTime) {
+			throw std::runtime_error("Unable to add event that violates causality.");
+		}
+		dispatchAddEvent(time, std::move(value), 0);
+		this->mLastTime = time;
+	}
 
 	/**
-	 * Emit events which has not yet been emited up to given timestamp (inclusive).
+	 * Same as EventConsumer::advanceTime(), but the stage is processed without virtual dispatch.
 	 */
-	void consumeEventsUntil(TIME time)
+	void advanceTime(timestamp_t time)
 	{
-		while (mLastConsumed < this->mEvents.size() && this->mEvents[mLastConsumed].time <= time) {
-			this->nextAddEvent(this->mEvents[mLastConsumed].time, this->mEvents[mLastConsumed].value);
-			++mLastConsumed;
+		if (time < this->mLastTime) {
+			throw std::runtime_error("Unable to advance time to past, since it violates causality.");
 		}
+		dispatchAdvanceTime(time, 0);
+		this->mLastTime = time;
 	}
+};
 
-protected:
-	void doAddEvent(TIME time, VALUE value) override
+
+/**
+ * Builds the tuple of pipeline stages, each stage is wrapped with the type of its successor.
+ */
+template<typename... STAGES>
+struct PipelineStages;
+
+template<typename LAST>
+struct PipelineStages<LAST>
+{
+	using tuple_t = std::tuple<PipelineStage<LAST>>;
+};
+
+template<typename FIRST, typename... REST>
+struct PipelineStages<FIRST, REST...>
+{
+	using rest_t = typename PipelineStages<REST...>::tuple_t;
+	using tuple_t = decltype(std::tuple_cat(std::declval<std::tuple<PipelineStage<FIRST, std::tuple_element_t<0, rest_t>>>>(),
+		std::declval<rest_t>()));
+};
+
+
+/**
+ * Chain of event consumers composed at compile time. The pipeline owns its stages (stored in one tuple, so they are
+ * close together in memory) and links them when constructed. A stage that is a ForkedEventConsumer passes its
+ * sprout (produced) events to the next stage, other stages pass their regular events.
+ * Each stage is wrapped in a final PipelineStage that knows the type of the following stage, so the hops between
+ * the stages which implement the emitting hooks (LED displays, demultiplexer, aggregator) are static calls.
+ * The dynamic chain API remains available on both ends (front() and back()).
+ * @tparam STAGES types of event consumers in the order of processing
+ */
+template<typename... STAGES>
+class Pipeline
+{
+public:
+	static constexpr std::size_t SIZE = sizeof...(STAGES);
+	static_assert(SIZE > 0, "Pipeline must have at least one stage.");
+
+private:
+	using stages_t = typename PipelineStages<STAGES...>::tuple_t;
+
+public:
+	template<std::size_t I>
+	using stage_t = std::tuple_element_t<I, stages_t>;
+
+private:
+	stages_t mStages;
+
+	template<typename FROM, typename TO>
+	static auto linkStages(FROM& from, TO& to, int) -> decltype(from.attachSproutConsumer(to), void())
 	{
-		consumeEventsUntil(time);
-		addFutureEvent(time, value); // this will actually take care of placing the event at the right position
-		EventConsumer<VALUE, TIME>::doAddEvent(time, value);	// yes, we skip the TimeSeries implementation
+		from.attachSproutConsumer(to);
 	}
 
-
-	void doAdvanceTime(TIME time) override
+	template<typename FROM, typename TO>
+	static void linkStages(FROM& from, TO& to, long)
 	{
-		consumeEventsUntil(time);
-		TimeSeries<VALUE, TIME>::doAdvanceTime(time);
+		from.attachNextConsumer(to);
 	}
 
-	void doClear() override
+	template<std::size_t... I>
+	void link(std::index_sequence<I...>)
 	{
-		mLastConsumed = 0;
-		TimeSeries<VALUE, TIME>::doClear();
+		(linkStages(std::get<I>(mStages), std::get<I + 1>(mStages), 0), ...);
 	}
 
 public:
-	FutureTimeSeries() : mLastConsumed(0) {}
+	/**
+	 * Create the pipeline from default-constructed stages.
+	 */
+	Pipeline()
+	{
+		link(std::make_index_sequence<SIZE - 1>());
+	}
 
 	/**
-	 * Add event that is considered to be in the future. It is not passed along through the event consumer chain,
-	 * until the time is advanced enough using advanceTime method. Future events may actually be inserted in random order.
-	 * The only condition is that future event is not older than last real event.
+	 * Create the pipeline from given (configured) stages, which are moved inside.
 	 */
-	void addFutureEvent(TIME time, VALUE value)
+	explicit Pipeline(STAGES... stages) : mStages(std::move(stages)...)
 	{
-		if (this->mLastTime > time) {
-			throw std::runtime_error("Unable to add event that violates causality.");
-		}
+		link(std::make_index_sequence<SIZE - 1>());
+	}
 
-		// shuffle the event to the right place from the back
-		std::size_t idx = this->mEvents.size();
-		this->mEvents.emplace_back(time, value);
-		while (idx > 0 && this->mEvents[idx-1].time > this->mEvents[idx].time) {
-			std::swap(this->mEvents[idx-1], this->mEvents[idx]);
-			--idx;
-		}
+	// stages hold pointers to each other
+	Pipeline(const Pipeline&) = delete;
+	Pipeline& operator=(const Pipeline&) = delete;
 
-		if (idx < mLastConsumed) {
-			throw std::runtime_error("Invariant breached! Index of last consumed event and last timestamp are not in sync.");
-		}
+	template<std::size_t I>
+	stage_t<I>& stage()
+	{
+		return std::get<I>(mStages);
+	}
+
+	template<std::size_t I>
+	const stage_t<I>& stage() const
+	{
+		return std::get<I>(mStages);
 	}
 
 	/**
-	 * Add constant timing skew to all event times.
+	 * The first stage (where the events enter the pipeline).
 	 */
-	void addTimingSkew(TIME skew)
+	stage_t<0>& front()
 	{
-		for (auto&& e : this->mEvents) {
-			e.time += skew;
-		}
+		return stage<0>();
+	}
+
+	/**
+	 * The last stage (further consumers may be attached to it).
+	 */
+	stage_t<SIZE - 1>& back()
+	{
+		return stage<SIZE - 1>();
+	}
+
+	template<typename VALUE, typename TIME>
+	void addEvent(TIME time, VALUE value)
+	{
+		front().addEvent(time, std::move(value));
+	}
+
+	template<typename TIME>
+	void advanceTime(TIME time)
+	{
+		front().advanceTime(time);
+	}
+
+	void clear()
+	{
+		front().clear();
 	}
-};
 
+	auto getDeadline() const
+	{
+		return stage<0>().getDeadline();
+	}
+};
 
 #endif
@@ -0,0 +1,233 @@
+#ifndef MOCCARDUINO_SHARED_TRACE_HPP
+#define MOCCARDUINO_SHARED_TRACE_HPP
+
+#include "emulator.hpp"
+
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <cstdint>
+
+
+/**
+ * Types of the records of the emulator trace.
+ */
+enum class TraceRecordType : std::uint8_t
+{
+	PIN = 1,		///< event of a pin (pin, duty, value)
+	SHIFT = 2,		///< byte of shiftOut() delivered in bulk (data pin, clock pin, bit order, value and write delay)
+	ADVANCE = 3,	///< time advance of the pin consumer chains
+	SERIAL_INPUT = 4,	///< serial input data (the record is followed by the data)
+	END = 5,		///< end of the simulation (the last record)
+};
+
+
+/**
+ * One record of the emulator trace. All records have the same size in the file (SIZE),
+ * only the serial input data are stored right after their record.
+ */
+struct TraceRecord
+{
+	logtime_t time = 0;
+	TraceRecordType type = TraceRecordType::END;
+	pin_t pin = 0;				///< pin of the event or the data pin of the shifted byte
+	std::uint8_t aux = 0;		///< duty of the pin event or the clock pin of the shifted byte
+	std::uint8_t flags = 0;		///< bit order of the shifted byte
+	std::uint32_t value = 0;	///< value of the pin event, shifted byte with write delay (<< 8), or length of serial data
+	std::string_view data;		///< serial input data (valid as long as the reader)
+
+	static constexpr std::size_t SIZE = 16;
+};
+
+
+/**
+ * Writes a compact binary trace of the emulator (see the description of the format in GenericTester README).
+ * The records are buffered and written in large blocks, so the recording does not slow down the simulation much.
+ */
+class EmulatorTraceWriter : public EmulatorTraceRecorder
+{
+private:
+	static constexpr std::size_t BUFFER_SIZE = 64 * 1024;
+
+	std::ostream& mOutput;
+	std::string mBuffer;
+	bool mFinished;
+
+	void appendLittleEndian(std::uint64_t value, std::size_t bytes)
+	{
+		for (std::size_t i = 0; i < bytes; ++i) {
+			mBuffer.push_back((char)(value & 0xff));
+			value >>= 8;
+		}
+	}
+
+	void appendRecord(logtime_t time, TraceRecordType type, pin_t pin = 0, std::uint8_t aux = 0, std::uint8_t flags = 0,
+		std::uint32_t value = 0)
+	{
+		if (mFinished) {
+			throw std::runtime_error("Unable to record events into a finished trace.");
+		}
+
+		appendLittleEndian(time, 8);
+		mBuffer.push_back((char)type);
+		mBuffer.push_back((char)pin);
+		mBuffer.push_back((char)aux);
+		mBuffer.push_back((char)flags);
+		appendLittleEndian(value, 4);
+	}
+
+	void flushIfFull()
+	{
+		if (mBuffer.size() >= BUFFER_SIZE) {
+			flush();
+		}
+	}
+
+public:
+	/**
+	 * Magic string at the beginning of the trace files.
+	 */
+	static constexpr std::string_view MAGIC = "MOCCTRCE";
+	static constexpr std::uint32_t VERSION = 1;
+
+	EmulatorTraceWriter(std::ostream& output) : mOutput(output), mFinished(false)
+	{
+		mBuffer.reserve(BUFFER_SIZE + TraceRecord::SIZE);
+		mBuffer.append(MAGIC);
+		appendLittleEndian(VERSION, 4);
+		appendLittleEndian(0, 4); // reserved
+	}
+
+	~EmulatorTraceWriter() override
+	{
+		// an unfinished trace is kept (without the end record), so it can be inspected
+		if (!mBuffer.empty()) {
+			mOutput.write(mBuffer.data(), mBuffer.size());
+		}
+	}
+
+	void recordPinEvent(logtime_t time, const ArduinoPinState& state) override
+	{
+		appendRecord(time, TraceRecordType::PIN, state.pin, state.duty, 0, (std::uint32_t)state.value);
+		flushIfFull();
+	}
+
+	void recordShiftedByte(logtime_t time, logtime_t writeDelay, pin_t dataPin, pin_t clockPin,
+		std::uint8_t bitOrder, std::uint8_t value) override
+	{
+		if (writeDelay >= ((logtime_t)1 << 24)) {
+			throw std::runtime_error("Pin write delay " + std::to_string(writeDelay) + " is too large for the trace.");
+		}
+		appendRecord(time, TraceRecordType::SHIFT, dataPin, clockPin, bitOrder, (std::uint32_t)(value | (writeDelay << 8)));
+		flushIfFull();
+	}
+
+	void recordTimeAdvance(logtime_t time) override
+	{
+		appendRecord(time, TraceRecordType::ADVANCE);
+		flushIfFull();
+	}
+
+	void recordSerialInput(logtime_t time, const std::string& data) override
+	{
+		appendRecord(time, TraceRecordType::SERIAL_INPUT, 0, 0, 0, (std::uint32_t)data.size());
+		mBuffer.append(data);
+		flushIfFull();
+	}
+
+	/**
+	 * Write all buffered records into the output.
+	 */
+	void flush()
+	{
+		mOutput.write(mBuffer.data(), mBuffer.size());
+		mBuffer.clear();
+		if (!mOutput) {
+			throw std::runtime_error("Unable to write the emulator trace.");
+		}
+	}
+
+	/**
+	 * Write the end record and flush the trace. No more records may be written afterwards.
+	 * @param time at which the simulation ended
+	 */
+	void finish(logtime_t time)
+	{
+		appendRecord(time, TraceRecordType::END);
+		mFinished = true;
+		flush();
+		mOutput.flush();
+	}
+};
+
+
+/**
+ * Reads the emulator trace written by EmulatorTraceWriter. The whole trace is loaded into memory,
+ * so the records are decoded sequentially without any further I/O.
+ */
+class EmulatorTraceReader
+{
+private:
+	std::string mData;
+	std::size_t mOffset;
+
+	std::uint64_t readLittleEndian(std::size_t offset, std::size_t bytes) const
+	{
+		std::uint64_t res = 0;
+		for (std::size_t i = bytes; i > 0; --i) {
+			res = (res << 8) | (std::uint8_t)mData[offset + i - 1];
+		}
+		return res;
+	}
+
+public:
+	static constexpr std::size_t HEADER_SIZE = 16;
+
+	EmulatorTraceReader(std::istream& input)
+		: mData(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()), mOffset(HEADER_SIZE)
+	{
+		if (mData.size() < HEADER_SIZE || std::string_view(mData).substr(0, 8) != EmulatorTraceWriter::MAGIC) {
+			throw std::runtime_error("Given file is not an emulator trace.");
+		}
+		if (readLittleEndian(8, 4) != EmulatorTraceWriter::VERSION) {
+			throw std::runtime_error("Unsupported version of the emulator trace.");
+		}
+	}
+
+	/**
+	 * Decode the next record of the trace.
+	 * @return false if there are no more records
+	 */
+	bool next(TraceRecord& record)
+	{
+		if (mOffset == mData.size()) {
+			return false;
+		}
+		if (mData.size() - mOffset < TraceRecord::SIZE) {
+			throw std::runtime_error("The emulator trace is truncated.");
+		}
+
+		record.time = readLittleEndian(mOffset, 8);
+		record.type = (TraceRecordType)mData[mOffset + 8];
+		record.pin = (pin_t)mData[mOffset + 9];
+		record.aux = (std::uint8_t)mData[mOffset + 10];
+		record.flags = (std::uint8_t)mData[mOffset + 11];
+		record.value = (std::uint32_t)readLittleEndian(mOffset + 12, 4);
+		mOffset += TraceRecord::SIZE;
+
+		record.data = std::string_view();
+		if (record.type == TraceRecordType::SERIAL_INPUT) {
+			if (mData.size() - mOffset < record.value) {
+				throw std::runtime_error("The emulator trace is truncated.");
+			}
+			record.data = std::string_view(mData).substr(mOffset, record.value);
+			mOffset += record.value;
+		}
+		return true;
+	}
+};
+
+#endif